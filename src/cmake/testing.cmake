@@ -271,7 +271,7 @@ macro (osl_add_all_tests)
     TESTSUITE ( aastep allowconnect-err andor-reg and-or-not-synonyms
                 arithmetic area-reg arithmetic-reg
                 array array-reg array-copy array-copy-reg array-derivs array-range
-                array-aassign array-assign-reg array-length-reg
+                array-aassign array-assign-reg array-length-reg async-jit async-jit-outputs
                 bitwise-and-reg bitwise-or-reg bitwise-shl-reg  bitwise-shr-reg bitwise-xor-reg
                 blackbody blackbody-reg blendmath breakcont breakcont-reg
                 bug-array-heapoffsets bug-locallifetime bug-outputinit
@@ -304,14 +304,15 @@ macro (osl_add_all_tests)
                 initops initops-instance-clash
                 intbits isconnected
                 isconstant
+                jit-cache
                 layers layers-Ciassign layers-entry layers-lazy layers-lazyerror
-                layers-nonlazycopy layers-repeatedoutputs
+                layers-lazyjit layers-nonlazycopy layers-repeatedoutputs
                 lazytrace
                 length-reg linearstep
                 lockgeom
                 logic loop luminance-reg
                 matrix matrix-reg matrix-arithmetic-reg
-                matrix-compref-reg max-reg message message-no-closure message-reg
+                matrix-compref-reg max-reg message message-many message-no-closure message-reg
                 mergeinstances-duplicate-entrylayers
                 mergeinstances-nouserdata mergeinstances-vararray
                 metadata-braces min-reg miscmath missing-shader
@@ -351,15 +352,20 @@ macro (osl_add_all_tests)
                 oslinfo-arrayparams oslinfo-colorctrfloat
                 oslinfo-metadata oslinfo-noparams
                 osl-imageio
+                oso-binary
                 paramval-floatpromotion
                 pragma-nowarn
+                preload-shaders
                 printf-reg
                 printf-whole-array
-                raytype raytype-reg raytype-specialized regex-reg
-                reparam reparam-arrays reparam-string testoptix-reparam
+                profile-layers
+                raytype raytype-reg raytype-specialized regex-reg regex-simple
+                reparam reparam-arrays reparam-auto-interactive
+                reparam-respecialize reparam-string
+                testoptix-reparam
                 render-background render-bumptest
-                render-bunny
-                render-cornell
+                render-bunny render-bvh-small
+                render-cornell render-cornell-dedup render-cornell-sorted
                 render-displacement
                 render-furnace-diffuse
                 render-mx-furnace-burley-diffuse
@@ -372,10 +378,11 @@ macro (osl_add_all_tests)
                 render-mx-layer
                 render-mx-sheen
                 render-microfacet render-oren-nayar
+                render-progressive
                 render-spi-thinlayer
                 render-uv render-veachmis render-ward
                 render-raytypes
-                select select-reg shaderglobals shortcircuit
+                select select-reg shadeimage shaderglobals shortcircuit
                 smoothstep-reg
                 spline spline-reg splineinverse splineinverse-ident
                 splineinverse-knots-ascend-reg splineinverse-knots-descend-reg
@@ -392,6 +399,7 @@ macro (osl_add_all_tests)
                 test-fmt-arrays test-fmt-fileprint
                 test-fmt-cxpf  test-fmt-noise test-fmt-matrixcolor 
                 test-fmt-stpf test-fmt-errorwarning test-fmt-errorwarning-repeats
+                test-fmt-journalstream
                 texture-alpha texture-alpha-derivs
                 texture-blur texture-colorspace texture-connected-options
                 texture-derivs texture-environment texture-errormsg
@@ -400,6 +408,7 @@ macro (osl_add_all_tests)
                 texture-missingalpha texture-missingcolor texture-opts-reg texture-simple
                 texture-smallderivs texture-swirl texture-udim
                 texture-width texture-withderivs texture-wrap
+                tiered-jit
                 trace-reg
                 trailing-commas
                 transcendental-reg
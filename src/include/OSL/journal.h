@@ -7,6 +7,9 @@
 #include <list>
 #ifdef __CUDACC__
 #    include <cuda/atomic>
+#else
+#    include <atomic>
+#    include <thread>
 #endif
 
 #include <OSL/encodedtypes.h>
@@ -34,15 +37,33 @@ OSL_NAMESPACE_BEGIN
 /// For legacy purposes, the default virtual RendererServices will route errors
 /// to ShadingSystem's OSL::ErrorHandler, but intent is for Renderer's to
 /// switch over to using a Journal buffer or their own custom logging.
+///
+/// On the CPU a journal buffer may instead be set up for streaming with
+/// initialize_streaming_buffer, in which case each thread's pages form a
+/// ring that a journal::Drainer empties in the background while shading is
+/// underway. Output is then never dropped for lack of space (a thread that
+/// gets a full ring ahead of the drainer waits for it), and the buffer only
+/// needs to be a few pages per thread regardless of how much is printed.
 
 namespace journal {
 
 namespace pvt {
+#ifdef __CUDACC__
+using AtomicUint32 = cuda::std::atomic<std::uint32_t>;
+#else
+using AtomicUint32 = std::atomic<std::uint32_t>;
+#endif
+
 //Per thread information for its page
 struct alignas(64) PageInfo {
     uint32_t pos;
     uint32_t remaining;
     uint32_t warning_count;
+    // Streaming only: pages filled by the writer, pages decoded by the
+    // reader, and where the reader is to continue from.
+    AtomicUint32 pages_written;
+    mutable AtomicUint32 pages_read;
+    mutable uint32_t read_pos;
 };
 
 struct Organization  //Initial bookkeeping
@@ -50,13 +71,9 @@ struct Organization  //Initial bookkeeping
     int thread_count;
     uint32_t buf_size;
     uint32_t page_size;
+    uint32_t ring_pages;  // pages per thread when streaming, 0 if not
 
 // rename free_pos bytes_used;
-#ifdef __CUDACC__
-    using AtomicUint32 = cuda::std::atomic<std::uint32_t>;
-#else
-    using AtomicUint32 = std::atomic<std::uint32_t>;
-#endif
     alignas(64)
         AtomicUint32 free_pos;  // cache line alignment to avoid false sharing
     alignas(64) AtomicUint32
@@ -70,7 +87,8 @@ struct Organization  //Initial bookkeeping
     }
     uint32_t calc_head_pos(int thread_index) const
     {
-        return calc_end_of_page_infos() + (thread_index * page_size);
+        return calc_end_of_page_infos()
+               + (thread_index * page_size * (ring_pages ? ring_pages : 1));
     }
 
     PageInfo& get_pageinfo(int thread_index)
@@ -101,6 +119,15 @@ OSLEXECPUBLIC bool
 initialize_buffer(uint8_t* const buffer, uint32_t buf_size_,
                   uint32_t page_size_, int thread_count_);
 
+/// Like initialize_buffer, but for streaming: the whole buffer is split
+/// evenly among the threads as rings of pages, to be emptied by a
+/// journal::Drainer while shading.
+/// returns: true for success,
+///          false if buf_size can not accomadate 2 pages per thread
+OSLEXECPUBLIC bool
+initialize_streaming_buffer(uint8_t* const buffer, uint32_t buf_size_,
+                            uint32_t page_size_, int thread_count_);
+
 /// Abstract base class intended for Renders to override and handle messages
 /// decoded from a journal buffer
 class OSLEXECPUBLIC Reporter {
@@ -173,8 +200,15 @@ public:
     Reader(const uint8_t* buffer_, Reporter& reporter);
     void process();
 
+    /// For a streaming buffer, decode just the pages the writers have
+    /// finished with, and hand them back to be reused. Safe to call while
+    /// shading is still writing to the buffer, but only from one thread at
+    /// a time. Call process() after shading is done for the rest.
+    void process_completed_pages();
+
 private:
-    void process_entries_for_thread(int thread_index);
+    void process_entries_for_thread(int thread_index,
+                                    bool completed_pages_only = false);
 
     const uint8_t* const m_buffer;   //Read  from this?
     const pvt::Organization& m_org;  //
@@ -255,16 +289,31 @@ private:
 
         OSL_ASSERT(info.remaining >= requiredForPageTransition());
 
-        // pre check if next_pos >= buf_size to prevent continuing to
-        // increment free_pos once its already past the end of a page
-        if ((m_org.free_pos.load() + m_org.page_size) >= m_org.buf_size)
-            return false;
+        uint32_t next_pos;
+        uint32_t next_page = 0;
+        if (m_org.ring_pages) {
+            // Streaming: move on to the next page of this thread's ring,
+            // once the drainer is done with what was there before.
+            next_page = info.pages_written.load() + 1;
+            while (next_page - info.pages_read.load() >= m_org.ring_pages) {
+#ifndef __CUDACC__
+                std::this_thread::yield();
+#endif
+            }
+            next_pos = m_org.calc_head_pos(thread_index)
+                       + (next_page % m_org.ring_pages) * m_org.page_size;
+        } else {
+            // pre check if next_pos >= buf_size to prevent continuing to
+            // increment free_pos once its already past the end of a page
+            if ((m_org.free_pos.load() + m_org.page_size) >= m_org.buf_size)
+                return false;
 
-        uint32_t next_pos = m_org.free_pos.fetch_add(m_org.page_size);
-        // post check if next_pos >= buf_size because another thread could
-        // have bumped free_pos
-        if (next_pos >= m_org.buf_size)
-            return false;
+            next_pos = m_org.free_pos.fetch_add(m_org.page_size);
+            // post check if next_pos >= buf_size because another thread
+            // could have bumped free_pos
+            if (next_pos >= m_org.buf_size)
+                return false;
+        }
 
         // write page transition
         uint8_t* dest_ptr         = m_buffer + info.pos;
@@ -274,6 +323,10 @@ private:
         // Don't bother update page info for the memory used by the transition
         // because we are about to overwrite it.
 
+        // The page we're leaving is complete, let the drainer have it
+        if (m_org.ring_pages)
+            info.pages_written.store(next_page);
+
         // Update page info to point to newly allocated page
         info.pos           = next_pos;
         info.remaining     = m_org.page_size;
@@ -359,6 +412,25 @@ private:
     pvt::PageInfo* m_pageinfo_by_thread_index;
 };
 
+#ifndef __CUDACC__
+/// Drainer runs a background thread that keeps decoding the completed
+/// pages of a buffer set up by initialize_streaming_buffer, reporting them
+/// through the Reporter, for as long as shading is writing to it. Once
+/// shading is done, call finish() (or let the Drainer go out of scope) to
+/// stop the thread and report everything that is left.
+class OSLEXECPUBLIC Drainer {
+public:
+    Drainer(const uint8_t* buffer_, Reporter& reporter);
+    ~Drainer();
+    void finish();
+
+private:
+    Reader m_reader;
+    std::atomic<bool> m_done { false };
+    std::thread m_thread;
+};
+#endif
+
 }  // namespace journal
 
 OSL_NAMESPACE_END
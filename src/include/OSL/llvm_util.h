@@ -6,6 +6,7 @@
 
 #include <OSL/oslconfig.h>
 
+#include <functional>
 #include <unordered_set>
 #include <vector>
 
@@ -307,9 +308,37 @@ public:
     /// you have already called do_optimize() if you want optimization.
     void* getPointerToFunction(llvm::Function* func);
 
+    /// Retrieve a callable pointer to a function by name, for functions
+    /// that came from object code added with add_object_code() and thus
+    /// have no llvm::Function in the current module. Returns nullptr if
+    /// no such function exists.
+    void* getPointerToFunction(const std::string& name);
+
     /// Wrap ExecutionEngine::InstallLazyFunctionCreator.
     void InstallLazyFunctionCreator(void* (*P)(const std::string&));
 
+    /// Retain a copy of the relocatable object code produced when the
+    /// current ExecutionEngine compiles its module, storing it in `*obj`.
+    /// Must be called after make_jit_execengine() and before the first
+    /// getPointerToFunction(). Passing nullptr stops capturing.
+    void capture_object_code(std::string* obj);
+
+    /// Load previously captured relocatable object code into the current
+    /// ExecutionEngine (generally one made for an empty module), after
+    /// which its functions may be retrieved with getPointerToFunction(name).
+    /// All relocatable pointers it references (see
+    /// constant_relocatable_ptr) must resolve to non-null addresses for
+    /// this process, otherwise nothing is loaded and false is returned.
+    bool add_object_code(string_view obj, std::string* err = nullptr);
+
+    /// Set the function used to resolve the addresses of the named
+    /// pointers made by constant_relocatable_ptr() when the object code
+    /// is loaded. It is passed the name without the internal prefix.
+    void relocatable_ptr_resolver(std::function<void*(string_view)> resolver)
+    {
+        m_relocatable_ptr_resolver = std::move(resolver);
+    }
+
 
     /// Create a new LLVM basic block (for the current function) and return
     /// its handle.
@@ -717,6 +746,17 @@ public:
     /// If the type specified is NULL, it will make a 'void *'.
     llvm::Value* constant_ptr(void* p, llvm::PointerType* type = NULL);
 
+    /// Return a pointer constant that, rather than baking in an address,
+    /// refers to an external symbol derived from `name` whose address is
+    /// supplied by the relocatable_ptr_resolver when the object code is
+    /// linked. This keeps process-specific addresses out of the generated
+    /// code so that it may be cached and reused by another process.
+    llvm::Value* constant_relocatable_ptr(string_view name,
+                                          llvm::PointerType* type = NULL);
+
+    /// Is this the name of a symbol made by constant_relocatable_ptr()?
+    static bool is_relocatable_ptr_name(string_view symname);
+
     /// Return an llvm::Value holding the given string constant (as
     /// determined by the ustring_rep).
     llvm::Value* constant(ustring s);
@@ -842,6 +882,10 @@ public:
     /// arg list.  Return an llvm::Value* corresponding to the return
     /// value of the function, if any.
     llvm::Value* call_function(llvm::Value* func, cspan<llvm::Value*> args);
+    /// Generate code for a call through func, a pointer (of any type) to a
+    /// function of type functype, with the given arg list.
+    llvm::Value* call_function(llvm::FunctionType* functype, llvm::Value* func,
+                               cspan<llvm::Value*> args);
     /// Generate code for a call to the named function with the given arg
     /// list.  Return an llvm::Value* corresponding to the return value of
     /// the function, if any.
@@ -911,6 +955,11 @@ public:
     llvm::Value* op_load(llvm::Type* type, llvm::Value* ptr,
                          const std::string& llname = {});
 
+    /// Atomically load *ptr with acquire ordering, for a value that other
+    /// threads publish with a std::atomic store.
+    llvm::Value* op_load_acquire(llvm::Type* type, llvm::Value* ptr,
+                                 const std::string& llname = {});
+
     llvm::Value* op_gather(llvm::Type* src_type, llvm::Value* src_ptr,
                            llvm::Value* wide_index);
 
@@ -1054,8 +1103,11 @@ public:
 private:
     class MemoryManager;
     class IRBuilder;
+    class ObjectCapture;
     struct NewPassManager;
 
+    void* resolve_relocatable_ptr(string_view symname) const;
+
     void SetupLLVM();
     IRBuilder& builder();
 
@@ -1074,6 +1126,8 @@ private:
     llvm::legacy::FunctionPassManager* m_llvm_func_passes;
     NewPassManager* m_new_pass_manager;
     llvm::ExecutionEngine* m_llvm_exec;
+    ObjectCapture* m_object_capture = nullptr;
+    std::function<void*(string_view)> m_relocatable_ptr_resolver;
     TargetISA m_target_isa = TargetISA::UNKNOWN;
     llvm::TargetMachine* m_nvptx_target_machine;
 
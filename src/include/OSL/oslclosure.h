@@ -146,4 +146,88 @@ typedef ClosureComponent* ClosureComponentPtr;
 typedef ClosureAdd* ClosureAddPtr;
 typedef ClosureMul* ClosureMulPtr;
 
+
+
+/// FlatClosure is one primitive component of a closure, as produced by
+/// flatten_closure(): its ID, its parameters, and its total weight, that
+/// is the product of its own weight with all of the weights applied to it
+/// on its way up the closure tree.
+struct OSLEXECPUBLIC FlatClosure {
+    int id;              ///< Closure ID of the component
+    Color3 weight;       ///< Total weight of the component
+    const void* params;  ///< Parameter data of the component
+
+    /// Handy method for extracting the parameters as a struct
+    template<typename T> OSL_HOSTDEVICE const T* as() const
+    {
+        return reinterpret_cast<const T*>(params);
+    }
+};
+
+/// The number of sums flatten_closure() can put off the left hand side of
+/// at once.
+enum { FlatClosureMaxDepth = 64 };
+
+/// Flatten the closure tree rooted at `closure`, scaled by `w`, into the
+/// list of weighted primitive components it adds up to, in the order a
+/// depth first walk of the tree finds them. The first `capacity` of them
+/// are written to `out`, and the number found is returned, so a caller can
+/// tell whether any were left out. The tree is walked without recursion or
+/// allocation, so renderers can call this after execute() on the CPU or
+/// the GPU, then loop over the result instead of walking the tree again
+/// for every question they have about the closure.
+///
+/// Shaders build `a + b + c + ...` as a tree that leans to the left, so
+/// the walk takes the right hand side of each sum first, and fills `out`
+/// from the back, which keeps its stack shallow however long the sum is.
+/// Only components under more than FlatClosureMaxDepth sums that they are
+/// on the right hand side of, as in `a + (b + (c + ...))`, are dropped, and
+/// those are not counted.
+OSL_HOSTDEVICE inline int
+flatten_closure(const ClosureColor* closure, FlatClosure* out, int capacity,
+                const Color3& w = Color3(1.0f))
+{
+    // The first pass counts the components, so that the second one knows
+    // where in `out` the last of them goes.
+    int n = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        // Non-recursive traversal stack
+        int stack_idx = 0;
+        const ClosureColor* ptr_stack[FlatClosureMaxDepth];
+        Color3 weight_stack[FlatClosureMaxDepth];
+        const ClosureColor* ptr = closure;
+        Color3 weight           = w;
+        int i                   = n;
+
+        while (ptr) {
+            if (ptr->id == ClosureColor::MUL) {
+                if (pass)
+                    weight *= ptr->as_mul()->weight;
+                ptr = ptr->as_mul()->closure;
+            } else if (ptr->id == ClosureColor::ADD) {
+                if (stack_idx < FlatClosureMaxDepth) {
+                    ptr_stack[stack_idx]      = ptr->as_add()->closureA;
+                    weight_stack[stack_idx++] = weight;
+                }
+                ptr = ptr->as_add()->closureB;
+            } else {
+                if (pass == 0) {
+                    n++;
+                } else if (--i < capacity) {
+                    const ClosureComponent* comp = ptr->as_comp();
+                    out[i].id                    = comp->id;
+                    out[i].weight                = weight * comp->w;
+                    out[i].params                = comp->data();
+                }
+                ptr = nullptr;
+            }
+            if (ptr == nullptr && stack_idx > 0) {
+                ptr    = ptr_stack[--stack_idx];
+                weight = weight_stack[stack_idx];
+            }
+        }
+    }
+    return n;
+}
+
 OSL_NAMESPACE_END
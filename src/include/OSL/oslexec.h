@@ -181,6 +181,12 @@ public:
     ///    int statistics:level   Automatically print OSL statistics (0).
     ///    string searchpath:shader  Colon-separated path to search for .oso
     ///                                files ("", meaning test "." only)
+    ///    int oso_binary         Use precompiled binary shaders (.osb
+    ///                              files): 1 = load the .osb beside an
+    ///                              .oso (if made from the .oso as it is
+    ///                              now), or found in its place; 2 = also
+    ///                              write an .osb beside every .oso that
+    ///                              had to be parsed. (0)
     ///    string colorspace      Name of RGB color space ("Rec709")
     ///    int range_checking     Generate extra code for component & array
     ///                              range checking (1)
@@ -236,6 +242,43 @@ public:
     ///                              isconnected()? (0)
     ///    int greedyjit          Optimize and compile all shaders up front,
     ///                              versus only as needed (0).
+    ///    int async_jit          If nonzero, start optimizing and compiling
+    ///                              groups in the background when
+    ///                              start_async_compiles() is called, using
+    ///                              this many threads (<0 means all cores).
+    ///                              Shading a group that isn't ready yet
+    ///                              compiles it on the spot or waits for it,
+    ///                              as usual. (0)
+    ///    int dedup_groups       If nonzero, a group whose layers, instance
+    ///                              values, and connections are identical
+    ///                              to an earlier group's shares that
+    ///                              group's optimized and JITed code rather
+    ///                              than compiling its own. Groups with
+    ///                              interactive params are not shared. (0)
+    ///    int reparam_respecialize  If nonzero, ReParameter may also change
+    ///                              params that were not declared
+    ///                              interactive, for groups declared while
+    ///                              this is set. The first such edit after
+    ///                              the group is compiled rebuilds it with
+    ///                              that param made interactive, and the
+    ///                              group is recompiled once, the next time
+    ///                              it is run; later edits of the param
+    ///                              are as cheap as for any interactive
+    ///                              param. The group must not be executing
+    ///                              during ReParameter, and its symbols
+    ///                              must be found again after a rebuild.
+    ///                              Such groups are not shared by
+    ///                              dedup_groups. Not for OptiX. (0)
+    ///    int auto_interactive   If nonzero, a param edited this many
+    ///                              times, by ReParameter or by redeclaring
+    ///                              a group of the same name with another
+    ///                              value, is made interactive in the
+    ///                              groups declared or rebuilt after that.
+    ///                              Implies reparam_respecialize. (0)
+    ///    float auto_interactive_quiet  Seconds after its last edit when
+    ///                              settle_interactive_params() folds an
+    ///                              automatically promoted param back into
+    ///                              its group's code. (30)
     ///    int llvm_target_host   Target the specific host architecture for
     ///                              LLVM IR generation. (1)
     ///    int llvm_jit_fma       Allow fused mul/add (0). This can increase
@@ -260,6 +303,15 @@ public:
     ///                              interpolated geometric parameters.
     ///                              This option is slated for deprecation.
     ///    int countlayerexecs    Add extra code to count total layers run.
+    ///    int profile_layers     Add extra code to time each layer (1), and
+    ///                              also each run of ops from one source
+    ///                              line (2). The times exclude any layers
+    ///                              run from within a layer. They are
+    ///                              reported by getstats, and written to
+    ///                              profile_layers_file if set. (0)
+    ///    string profile_layers_file  File to write the layer profile to, as
+    ///                              JSON, when the ShadingSystem is
+    ///                              destroyed. ("")
     ///    int allow_shader_replacement Allow shader to be specified more than
     ///                              once, replacing former definition.
     ///    string archive_groupname  Name of a group to pickle and archive.
@@ -285,6 +337,15 @@ public:
     ///         opt_seed_bblock_aliases, opt_groupdata
     ///    int opt_passes         Number of optimization passes per layer (10)
     ///    int llvm_optimize      Which of several LLVM optimize strategies (1)
+    ///    int llvm_tiered_jit    If nonzero, JIT groups with minimal LLVM
+    ///                              optimization first, then re-JIT a group
+    ///                              at full llvm_optimize in the background
+    ///                              after it has been executed this many
+    ///                              times. (0)
+    ///    int llvm_lazy_layers   If nonzero, leave the layers that are only
+    ///                              run on demand out of a group's JIT, and
+    ///                              compile each one the first time it is
+    ///                              called. (0)
     ///    int llvm_debug         Set LLVM extra debug level (0)
     ///    int llvm_debug_layers  Extra printfs upon entering and leaving
     ///                              layer functions.
@@ -568,6 +629,18 @@ public:
     /// shader lookups in the shader search path
     bool LoadMemoryCompiledShader(string_view shadername, string_view buffer);
 
+    /// Load the named shaders now, in parallel using up to nthreads
+    /// threads (0 means use all available HW cores), so that the Shader()
+    /// calls naming them later needn't find and read them one at a time.
+    /// Shaders already loaded are skipped. Return true if all of them
+    /// could be loaded; errors are reported for any that couldn't.
+    bool preload_shaders(cspan<ustring> shadernames, int nthreads = 0);
+
+    /// Preload the shaders named in a manifest file, as with
+    /// preload_shaders(). The manifest lists one shader name per line;
+    /// blank lines and lines starting with '#' are ignored.
+    bool preload_shader_manifest(string_view filename, int nthreads = 0);
+
     // The basic sequence for declaring a shader group looks like this:
     // ShadingSystem *ss = ...;
     // ShaderGroupRef group = ss->ShaderGroupBegin (groupname);
@@ -706,7 +779,7 @@ public:
     /// This is meant to called after the ShaderGroupBegin/End, but will
     /// fail if the shader has already been irrevocably optimized/compiled,
     /// unless the particular parameter is marked as either interpolated=1
-    /// or interactive=1.
+    /// or interactive=1, or the "reparam_respecialize" option is set.
     bool ReParameter(ShaderGroup& group, string_view layername,
                      string_view paramname, TypeDesc type, const void* val);
     // Shortcuts for param passing a single int, float, or string.
@@ -733,6 +806,15 @@ public:
                            (const char**)&val);
     }
 
+    /// For the "auto_interactive" option: start rebuilding, in the
+    /// background, any group whose automatically promoted interactive
+    /// params have gone unedited for "auto_interactive_quiet" seconds, so
+    /// that they are constant folded again, and switch groups over to any
+    /// such rebuilds that are done. Call it when no shading is underway,
+    /// for example between IPR frames. Return the number of groups that
+    /// switched to their rebuilt code.
+    int settle_interactive_params();
+
     // Non-threadsafe versions of Parameter, Shader, ConnectShaders, and
     // ShaderGroupEnd. These depend on some persistent state about which
     // shader group is the "current" one being amended. It's fine to use
@@ -940,6 +1022,11 @@ public:
     /// Returns true if supported, false otherwise
     bool configure_batch_execution_at(int width);
 
+    /// Like configure_batch_execution_at, but only test whether batched
+    /// execution at the specified width is supported, without changing
+    /// llvm_jit_target or llvm_jit_fma.
+    bool supports_batch_execution_at(int width);
+
     template<int WidthT> class OSLEXECPUBLIC BatchedExecutor {
         ShadingSystem& m_shading_system;
 
@@ -956,6 +1043,8 @@ public:
         /// If option "greedyjit" was set, this call will trigger all
         /// shader groups that have not yet been compiled to do so with the
         /// specified number of threads (0 means use all available HW cores).
+        /// The most expensive groups are started first, and the threads
+        /// come from a pool that persists between calls.
         void jit_all_groups(int nthreads = 0);
 
         bool execute(ShadingContext& ctx, ShaderGroup& group, int batch_size,
@@ -1063,8 +1152,16 @@ public:
     /// If option "greedyjit" was set, this call will trigger all
     /// shader groups that have not yet been compiled to do so with the
     /// specified number of threads (0 means use all available HW cores).
+    /// The most expensive groups are started first, and the threads come
+    /// from a pool that persists between calls.
     void optimize_all_groups(int nthreads = 0, bool do_jit = true);
 
+    /// If option "async_jit" was set, start optimizing and compiling in the
+    /// background every group ended since the last call. Call it once the
+    /// groups' renderer outputs, entry layers and symbol locations are set,
+    /// since changing them later means compiling the group all over again.
+    void start_async_compiles();
+
     /// Return a pointer to the TextureSystem being used.
     TextureSystem* texturesys() const;
 
@@ -1159,6 +1256,15 @@ enum ShadeImageLocations {
 /// themselves will either be at "pixel centers" (position (i+0.5)/res), or
 /// as if it were a grid that is shaded at exact endpoints (position
 /// i/(res+1)). In either case, derivatives will be set appropriately.
+///
+/// If OSL was built with batched support, the renderer provides batched
+/// services, the "opt_batched_analysis" option is enabled, and the app has
+/// set up batched execution (see configure_batch_execution_at), the pixels
+/// will be shaded in batches (of 16, 8, or 4, the widest that the hardware
+/// supports) along each scanline rather than one at a time. Only the
+/// uniform fields (renderstate, tracedata, objdata, raytype) and the
+/// fields that batched shading supports are taken from 'defaultsg' in that
+/// case.
 OSLEXECPUBLIC
 bool
 shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
@@ -581,7 +581,9 @@ public:
     };
 
     // Default no-op implementations of the caching api.
-    // Currently used for caching optix ptx before llvm generation.
+    // Currently used for caching optix ptx before llvm generation (cache
+    // "optix_ptx", if supports("optix_ptx_cache")), and the object code of
+    // CPU JITed groups (cache "llvm_jit", if supports("llvm_jit_cache")).
     virtual void cache_insert(string_view cachename, string_view key,
                               string_view value) const
     {
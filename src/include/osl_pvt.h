@@ -183,6 +183,11 @@ public:
     /// If 'add' is true, add the struct if not already found.
     static int structure_id(const char* name, bool add = false);
 
+    /// Give the structure with the given id these field names (of unknown
+    /// type), unless it already has fields. Safe to call from several
+    /// threads loading shaders that use the same struct.
+    static void add_struct_fields(int id, cspan<ustring> fields);
+
     /// Make room for one new structure and return its index.
     ///
     static int new_struct(StructSpec* n);
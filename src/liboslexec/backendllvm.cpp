@@ -30,6 +30,13 @@ BackendLLVM::BackendLLVM(ShadingSystemImpl& shadingsys, ShaderGroup& group,
     m_use_optix      = shadingsys.use_optix();
     m_use_rs_bitcode = !shadingsys.m_rs_bitcode.empty();
     m_name_llvm_syms = shadingsys.m_llvm_output_bitcode;
+    m_llvm_optimize  = shadingsys.llvm_optimize();
+    // The profiling calls are CPU shadeops
+    m_profile_layers = m_use_optix ? 0 : shadingsys.profile_layers();
+    m_profile_range  = -1;
+    // Lazy layers are called through a per-group table of code pointers
+    m_lazy_layers = !m_use_optix && shadingsys.llvm_lazy_layers();
+    m_lazy_layer  = -1;
 
     // Select the appropriate ustring representation
     ll.ustring_rep(LLVM_Util::UstringRep::hash);
@@ -37,6 +44,19 @@ BackendLLVM::BackendLLVM(ShadingSystemImpl& shadingsys, ShaderGroup& group,
     ll.dumpasm(shadingsys.m_llvm_dumpasm);
     ll.jit_fma(shadingsys.m_llvm_jit_fma);
     ll.jit_aggressive(shadingsys.m_llvm_jit_aggressive);
+
+    // Cached object code can't carry debug info or profiling events, and
+    // would hide the IR dumps that llvm_debug and output_bitcode ask for.
+    // The code that calls lazy layers holds the address of their table.
+    m_use_jit_cache = shadingsys.use_jit_cache() && !m_use_optix
+                      && !m_lazy_layers
+                      && !shadingsys.llvm_debugging_symbols()
+                      && !shadingsys.llvm_profiling_events()
+                      && !shadingsys.llvm_output_bitcode()
+                      && !shadingsys.m_llvm_dumpasm && !llvm_debug();
+    if (m_use_jit_cache)
+        ll.relocatable_ptr_resolver(
+            [this](string_view name) { return resolve_relocatable_ptr(name); });
 }
 
 
@@ -45,6 +65,43 @@ BackendLLVM::~BackendLLVM() {}
 
 
 
+llvm::Value*
+BackendLLVM::llvm_relocatable_ptr(void* p, string_view name,
+                                  llvm::PointerType* type)
+{
+    if (!p || !use_jit_cache())
+        return ll.constant_ptr(p, type);
+    return ll.constant_relocatable_ptr(name, type);
+}
+
+
+
+void*
+BackendLLVM::resolve_relocatable_ptr(string_view name)
+{
+    // Names are "renderer" or "<kind>:<key>", as emitted by llvm_gen.cpp.
+    if (name == "renderer")
+        return renderer();
+    size_t colon = name.find(':');
+    if (colon == string_view::npos)
+        return nullptr;
+    string_view kind = name.substr(0, colon);
+    ustring key(name.substr(colon + 1));
+    if (kind == "texture_handle")
+        return renderer()->get_texture_handle(key, shadingcontext(), nullptr);
+    if (kind == "closure_prepare" || kind == "closure_setup") {
+        const ClosureRegistry::ClosureEntry* clentry
+            = shadingsys().find_closure(key);
+        if (!clentry)
+            return nullptr;
+        return kind == "closure_prepare" ? (void*)clentry->prepare
+                                         : (void*)clentry->setup;
+    }
+    return nullptr;
+}
+
+
+
 int
 BackendLLVM::llvm_debug() const
 {
@@ -41,6 +41,14 @@ public:
     /// and store the llvm::Function* handle to it with the ShaderGroup.
     virtual void run();
 
+    /// Option "llvm_lazy_layers": JIT just the given layer, one that run()
+    /// left out, in a module of its own, and return its code.
+    RunLLVMGroupFunc run_lazy_layer(int layer);
+
+    /// Is the layer left out of the group's JIT, to be JITed the first
+    /// time it is called?
+    bool jit_layer_lazily(int layer) const;
+
     /// Set additional Module/Function options for the CUDA/OptiX target.
     void prepare_module_for_cuda_jit();
 
@@ -329,6 +337,12 @@ public:
     /// data that holds all the shader params.
     llvm::Type* llvm_type_groupdata_ptr();
 
+    /// Return the LLVM type of a layer function:
+    ///     void layer (ShaderGlobals*, GroupData*, void* userdata_base_ptr,
+    ///                 void* output_base_ptr, int shadeindex,
+    ///                 void* interactive_params);
+    llvm::FunctionType* llvm_type_layer_func();
+
     /// Return the group data pointer.
     ///
     llvm::Value* groupdata_ptr() const { return m_llvm_groupdata_ptr; }
@@ -529,6 +543,26 @@ public:
     /// Return if we should compile against free function versions of Renderer Service.
     bool use_rs_bitcode() { return m_use_rs_bitcode; }
 
+    /// Override the shading system's llvm_optimize level for this group
+    /// (as tiered JIT does for its quick first compile).
+    void llvm_optimize(int level) { m_llvm_optimize = level; }
+    int llvm_optimize() const { return m_llvm_optimize; }
+
+    /// Return whether the JITed object code for this group will be stored
+    /// in (or retrieved from) the renderer's "llvm_jit" cache.
+    bool use_jit_cache() { return m_use_jit_cache; }
+
+    /// Keep this group's object code out of the JIT cache, because it
+    /// depends on an address that another process can't reconstruct.
+    void disable_jit_cache() { m_use_jit_cache = false; }
+
+    /// Return an llvm::Value holding the process-specific pointer p (the
+    /// renderer, a texture handle, a closure callback). When the JIT cache
+    /// is in use, it is instead emitted as a relocation named `name`, which
+    /// resolve_relocatable_ptr() maps back to an address at load time.
+    llvm::Value* llvm_relocatable_ptr(void* p, string_view name,
+                                      llvm::PointerType* type = nullptr);
+
     /// Return the userdata index for the given Symbol.  Return -1 if the Symbol
     /// is not an input parameter or is constant and therefore doesn't have an
     /// entry in the groupdata struct.
@@ -554,6 +588,27 @@ public:
     }
 
 private:
+    /// Compute m_layer_remap and m_num_used_layers for the group.
+    void setup_layer_remap();
+
+    /// Create the module, with the shadeops in it, and the JIT engine for
+    /// it. Return false if the engine couldn't be made.
+    bool create_llvm_module();
+
+    /// The full key of this group's object code in the renderer's cache.
+    /// Only valid once the JIT engine has picked the target ISA.
+    std::string jit_cache_key() const;
+
+    /// Try to load this group's object code from the renderer's cache,
+    /// returning true (with the group's functions set) if it succeeded.
+    /// Either way, `key` is set to the key a fresh JIT should be stored
+    /// under.
+    bool load_cached_jit(std::string& key);
+
+    /// Map the name of a relocatable pointer to its address in this
+    /// process, or nullptr if it can't be found.
+    void* resolve_relocatable_ptr(string_view name);
+
     std::vector<int> m_layer_remap;      ///< Remapping of layer ordering
     std::set<int> m_layers_already_run;  ///< List of layers run
     int m_num_used_layers;               ///< Number of layers actually used
@@ -596,6 +651,12 @@ private:
 
     bool m_use_optix;  ///< Compile for OptiX?
     bool m_use_rs_bitcode;  /// To use free function versions of Renderer Service functions.
+    bool m_use_jit_cache;   ///< Cache the JITed object code?
+    int m_llvm_optimize;    ///< LLVM optimization level to use
+    int m_profile_layers;   ///< Instrument layers for profiling?
+    int m_profile_range;    ///< Profiling range current in the code so far
+    bool m_lazy_layers;     ///< Leave lazily run layers for first call?
+    int m_lazy_layer;       ///< The one layer being JITed lazily, or -1
 
     friend class ShadingSystemImpl;
 };
@@ -644,6 +705,9 @@ append_constant_arg(BackendLLVM& rop, const TArgVariant& arg,
         args.push_back(rop.ll.constant64(arg.get_double()));
         break;
     case TArgVariant::Type::Pointer:
+        // A renderer-supplied address has no name we could relocate by.
+        if (arg.get_ptr())
+            rop.disable_jit_cache();
         args.push_back(rop.ll.constant_ptr(arg.get_ptr()));
         break;
     case TArgVariant::Type::UString:
@@ -142,6 +142,10 @@ DECL(osl_gen_warningfmt, "xXhiXiX")
 DECL(osl_formatfmt, "hXhiXiX")
 DECL(osl_split, "ihXhii")
 DECL(osl_incr_layers_executed, "xX")
+DECL(osl_profile_layer_begin, "xXi")
+DECL(osl_profile_layer_end, "xX")
+DECL(osl_profile_range, "xXi")
+DECL(osl_jit_lazy_layer, "xXXi")
 
 // For legacy printf support
 DECL(osl_printf, "xXh*")
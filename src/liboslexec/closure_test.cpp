@@ -0,0 +1,116 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <vector>
+
+#include <OSL/oslclosure.h>
+
+#include <OpenImageIO/unittest.h>
+
+using namespace OSL;
+
+
+// A closure component with one float parameter, laid out the way the
+// shading system allocates them.
+struct TestComponent {
+    ClosureComponent comp;
+    float param;
+};
+
+
+
+// Build the tree OSL makes for `Ci = 2 * (c0 + c1 + ... + cN-1)`, where
+// each sum adds one more component to the left-leaning tree of the others.
+static const ClosureColor*
+make_sum(int n, std::vector<TestComponent>& comps,
+         std::vector<ClosureAdd>& adds, ClosureMul& mul)
+{
+    comps.resize(n);
+    adds.resize(n - 1);
+    for (int i = 0; i < n; i++) {
+        comps[i].comp.id = i;
+        comps[i].comp.w  = Vec3(float(i), 1.0f, 0.5f);
+        comps[i].param   = 100.0f + i;
+    }
+    const ClosureColor* sum = &comps[0].comp;
+    for (int i = 1; i < n; i++) {
+        adds[i - 1].id       = ClosureColor::ADD;
+        adds[i - 1].closureA = sum;
+        adds[i - 1].closureB = &comps[i].comp;
+        sum                  = &adds[i - 1];
+    }
+    mul.id      = ClosureColor::MUL;
+    mul.weight  = Color3(2.0f);
+    mul.closure = sum;
+    return &mul;
+}
+
+
+
+static void
+test_flatten()
+{
+    std::vector<TestComponent> comps;
+    std::vector<ClosureAdd> adds;
+    ClosureMul mul;
+    const int n                 = 24;
+    const ClosureColor* closure = make_sum(n, comps, adds, mul);
+
+    // Every component comes out in order, with all of its weights applied
+    FlatClosure flat[n];
+    OIIO_CHECK_EQUAL(flatten_closure(closure, flat, n), n);
+    for (int i = 0; i < n; i++) {
+        OIIO_CHECK_EQUAL(flat[i].id, i);
+        OIIO_CHECK_EQUAL(flat[i].weight, Color3(2.0f * i, 2.0f, 1.0f));
+        OIIO_CHECK_EQUAL(*flat[i].as<float>(), 100.0f + i);
+    }
+
+    // An extra weight scales them all
+    OIIO_CHECK_EQUAL(flatten_closure(closure, flat, n, Color3(0.5f)), n);
+    OIIO_CHECK_EQUAL(flat[3].weight, Color3(3.0f, 1.0f, 0.5f));
+
+    // Too little room keeps the first ones, but still counts them all
+    FlatClosure few[4];
+    OIIO_CHECK_EQUAL(flatten_closure(closure, few, 4), n);
+    OIIO_CHECK_EQUAL(few[3].id, 3);
+
+    // An empty closure has no components
+    OIIO_CHECK_EQUAL(flatten_closure(nullptr, flat, n), 0);
+}
+
+
+
+static void
+test_flatten_long_sum()
+{
+    // A sum of many more components than FlatClosureMaxDepth loses none
+    std::vector<TestComponent> comps;
+    std::vector<ClosureAdd> adds;
+    ClosureMul mul;
+    const int n                 = 16 * FlatClosureMaxDepth;
+    const ClosureColor* closure = make_sum(n, comps, adds, mul);
+
+    std::vector<FlatClosure> flat(n);
+    OIIO_CHECK_EQUAL(flatten_closure(closure, flat.data(), n), n);
+    for (int i = 0; i < n; i++) {
+        OIIO_CHECK_EQUAL(flat[i].id, i);
+        OIIO_CHECK_EQUAL(flat[i].weight, Color3(2.0f * i, 2.0f, 1.0f));
+    }
+
+    FlatClosure few[4];
+    OIIO_CHECK_EQUAL(flatten_closure(closure, few, 4), n);
+    OIIO_CHECK_EQUAL(few[0].id, 0);
+    OIIO_CHECK_EQUAL(few[3].id, 3);
+}
+
+
+
+int
+main(int /*argc*/, char* /*argv*/[])
+{
+    test_flatten();
+    test_flatten_long_sum();
+
+    return unit_test_failures;
+}
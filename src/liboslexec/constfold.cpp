@@ -39,6 +39,7 @@ static ustring u_nop("nop");
 static ustring u_return("return");
 static ustring u_sqrt("sqrt");
 static ustring u_sub("sub");
+static ustring u_transform("transform");
 
 
 OSL_NAMESPACE_BEGIN
@@ -1437,21 +1438,48 @@ DECLFOLDER(constfold_substr)
 
 
 
-DECLFOLDER(constfold_regex_search)
+DECLFOLDER(constfold_regex)
 {
-    // Try to turn R=regex_search(subj,reg) into R=C
+    // Try to turn R=regex_search(subj,reg) or R=regex_match(subj,reg)
+    // into R=C, and for the versions with a results array, also assign
+    // a constant array to the results.
     Opcode& op(rop.inst()->ops()[opnum]);
-    Symbol& Subj(*rop.inst()->argsymbol(op.firstarg() + 1));
-    Symbol& Reg(*rop.inst()->argsymbol(op.firstarg() + 2));
-    if (op.nargs() == 3  // only the 2-arg version without search results
-        && Subj.is_constant() && Reg.is_constant()) {
+    bool has_results = (op.nargs() == 4);
+    Symbol& Subj(*rop.opargsym(op, 1));
+    Symbol& Reg(*rop.opargsym(op, has_results ? 3 : 2));
+    if (Subj.is_constant() && Reg.is_constant()) {
         OSL_DASSERT(Subj.typespec().is_string() && Reg.typespec().is_string());
-        ustring s(Subj.get_string());
-        ustring r(Reg.get_string());
-        std::regex reg(r.string());
-        int result = std::regex_search(s.string(), reg);
-        int cind   = rop.add_constant(result);
-        rop.turn_into_assign(op, cind, "const fold regex_search");
+        bool fullmatch = (op.opname() == "regex_match");
+        std::unique_ptr<CompiledRegex> reg;
+        try {
+            reg.reset(new CompiledRegex(Reg.get_string()));
+        } catch (const std::regex_error&) {
+            return 0;  // Leave bad patterns for the runtime to deal with
+        }
+        int nresults = has_results
+                           ? rop.opargsym(op, 2)->typespec().arraylength()
+                           : 0;
+        if (has_results && nresults < 1)
+            return 0;
+        std::vector<int> results(std::max(nresults, 1));
+        int result = reg->match(Subj.get_string(), fullmatch, results.data(),
+                                nresults);
+        // Temporarily stash the index of the symbol holding results
+        int resultsarg = has_results ? rop.inst()->args()[op.firstarg() + 2]
+                                     : -1;
+        rop.turn_into_assign(op, rop.add_constant(result),
+                             fullmatch ? "const fold regex_match"
+                                       : "const fold regex_search");
+        if (has_results) {
+            // Insert an instruction copying the constant results array to
+            // the user's results array.
+            int cind = rop.add_constant(TypeDesc(TypeDesc::INT, nresults),
+                                        results.data());
+            const int args[] = { resultsarg, cind };
+            rop.insert_code(opnum, u_assign, args,
+                            RuntimeOptimizer::RecomputeRWRanges,
+                            RuntimeOptimizer::GroupWithNext);
+        }
         return 1;
     }
     return 0;
@@ -2213,6 +2241,18 @@ DECLFOLDER(constfold_transformc)
                                  "transformc => constant");
             return 1;
         }
+        // A color config transform that is affine can be done as a matrix
+        // transform, which is inlined and has exact derivatives, instead
+        // of calling into OCIO for every shade.
+        OCIOAffineTransform xform;
+        if (rop.shadingsys().colorsystem().uses_colorconfig(from, to)
+            && rop.shadingsys().ocio_affine_transform(from, to, xform)) {
+            rop.turn_into_new_op(op, u_transform, rop.oparg(op, 0),
+                                 rop.add_constant(xform.matrix()),
+                                 rop.oparg(op, 3),
+                                 "transformc => affine transform");
+            return 1;
+        }
     }
     return 0;
 }
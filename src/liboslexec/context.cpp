@@ -49,11 +49,21 @@ ShadingContext::ShadingContext(ShadingSystemImpl& shadingsys,
     , m_threadinfo(threadinfo)
     , m_group(NULL)
     , m_max_warnings(shadingsys.max_warnings_per_thread())
-    , m_dictionary(NULL)
     , batch_size_executed(0)
 {
     m_shadingsys.m_stat_contexts += 1;
     m_texture_thread_info = NULL;
+    // Start out with as much memory as any context has needed so far, so
+    // that shading rarely has to allocate, and so that the memory is
+    // placed local to the thread creating (and presumably using) us. Only
+    // if nothing has been optimized to shade one point at a time, assume
+    // we'll be running batches.
+    if (size_t size = m_shadingsys.m_max_groupdata_size)
+        reserve_heap(size);
+    else if (size_t size = m_shadingsys.m_max_groupdata_wide_size)
+        reserve_heap(size, true);
+    m_closure_pool.reserve(size_t(m_shadingsys.m_stat_closure_highwater));
+    m_scratch_pool.reserve(size_t(m_shadingsys.m_stat_scratch_highwater));
 }
 
 
@@ -64,8 +74,44 @@ ShadingContext::~ShadingContext()
 #if OSL_USE_BATCHED
     process_file_output();
 #endif
+    record_pool_high_water();
+    flush_layer_profile();
     m_shadingsys.m_stat_contexts -= 1;
-    free_dict_resources();
+}
+
+
+
+void
+ShadingContext::profile_layer_begin(int layer)
+{
+    if (m_profile_group.get() != group()) {
+        // Starting on a different group; hand over what we have so far.
+        // Holding on to it keeps it from being freed (and its address
+        // reused by another group) before then.
+        flush_layer_profile();
+        m_profile_group = group()->weak_from_this().lock();
+        if (!m_profile_group)
+            return;  // Not a group we can hold on to, so not profiled
+        m_profile_layer_ticks.assign(m_profile_group->nlayers(), 0);
+        m_profile_layer_calls.assign(m_profile_group->nlayers(), 0);
+        m_profile_range_ticks.assign(m_profile_group->profile_nranges(), 0);
+    }
+    profile_mark();
+    m_profile_stack.emplace_back(layer, -1);
+    m_profile_layer_calls[layer] += 1;
+}
+
+
+
+void
+ShadingContext::flush_layer_profile()
+{
+    if (m_profile_group)
+        m_profile_group->add_profile(m_profile_layer_ticks.data(),
+                                     m_profile_layer_calls.data(),
+                                     m_profile_range_ticks.data());
+    m_profile_group.reset();
+    m_profile_stack.clear();
 }
 
 
@@ -97,6 +143,8 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
         }
         if (sgroup.does_nothing())
             return false;
+        if (sgroup.count_tierup_execution())
+            shadingsys().tier_up_group_async(sgroup);
     } else {
         // empty shader - nothing to do!
         return false;
@@ -294,7 +342,7 @@ ShadingContext::Batched<WidthT>::execute_init(
 
     // Allocate enough space on the heap
     size_t heap_size_needed = sgroup.llvm_groupdata_wide_size();
-    context().reserve_heap(heap_size_needed);
+    context().reserve_heap(heap_size_needed, true);
     // Zero out the heap memory we will be using
     if (shadingsys().m_clearmemory)
         memset(context().m_heap.get(), 0, heap_size_needed);
@@ -614,17 +662,16 @@ ShadingContext::symbol_data(const Symbol& sym) const
 
 
 
-const std::regex&
+const CompiledRegex&
 ShadingContext::find_regex(ustring r)
 {
     RegexMap::const_iterator found = m_regex_map.find(r);
     if (found != m_regex_map.end())
         return *found->second;
-    // otherwise, it wasn't found, add it
-    m_regex_map[r].reset(new std::regex(r.c_str()));
-    m_shadingsys.m_stat_regexes += 1;
-    // std::cerr << "Made new regex for " << r << "\n";
-    return *m_regex_map[r];
+    // otherwise, it wasn't found, get it from the shared cache
+    const CompiledRegex& regex(m_shadingsys.find_regex(r));
+    m_regex_map[r] = &regex;
+    return regex;
 }
 
 
@@ -670,6 +717,42 @@ osl_incr_layers_executed(ShaderGlobals* sg)
     ctx->incr_layers_executed();
 }
 
+
+
+OSL_SHADEOP void
+osl_profile_layer_begin(ShaderGlobals* sg, int layer)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->profile_layer_begin(layer);
+}
+
+
+
+OSL_SHADEOP void
+osl_profile_layer_end(ShaderGlobals* sg)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->profile_layer_end();
+}
+
+
+
+OSL_SHADEOP void
+osl_profile_range(ShaderGlobals* sg, int range)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->profile_range(range);
+}
+
+
+
+OSL_SHADEOP void
+osl_jit_lazy_layer(ShaderGlobals* sg, void* group, int layer)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->shadingsys().jit_lazy_layer(*(ShaderGroup*)group, layer, ctx);
+}
+
 #if OSL_USE_BATCHED
 // Explicit template instantiation for supported batch sizes
 template class ShadingContext::Batched<16>;
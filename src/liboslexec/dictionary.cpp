@@ -5,6 +5,9 @@
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -45,22 +48,25 @@ namespace pvt {  // OSL::pvt
 // particular query to return a string is a totally different cache
 // entry than asking for it to be converted to a matrix, say.
 //
+// There is one Dictionary per ShadingSystem, shared by all the shading
+// threads, so each document is parsed only once and each query is
+// resolved only once no matter how many contexts ask for it. Node IDs are
+// therefore valid in any context. Once cached, nothing is ever modified,
+// so lookups only take a shared lock, and the expensive parts (parsing a
+// document, searching it) are done without holding the lock at all.
+//
 class Dictionary {
 public:
-    Dictionary(ShadingContext* ctx) : m_context(ctx)
+    Dictionary()
     {
         // Create placeholder element 0 == 'not found'
         m_nodes.emplace_back(0, pugi::xml_node());
     }
-    ~Dictionary()
-    {
-        // Free all the documents.
-        for (auto& doc : m_documents)
-            delete doc;
-    }
 
-    int dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query);
-    int dict_find(ExecContextPtr ec, int nodeID, ustring query);
+    int dict_find(ShadingContext* ctx, ExecContextPtr ec,
+                  ustring dictionaryname, ustring query);
+    int dict_find(ShadingContext* ctx, ExecContextPtr ec, int nodeID,
+                  ustring query);
     int dict_next(int nodeID);
     int dict_value(int nodeID, ustring attribname, TypeDesc type, void* data,
                    bool treat_ustrings_as_hash);
@@ -118,11 +124,19 @@ private:
 
     typedef std::unordered_map<Query, QueryResult, QueryHash> QueryMap;
     typedef std::unordered_map<ustring, int> DocMap;
+    typedef std::shared_lock<std::shared_mutex> read_lock;
+    typedef std::unique_lock<std::shared_mutex> write_lock;
+
+    // Guards everything below except the contents of the documents, which
+    // are never modified once loaded.
+    mutable std::shared_mutex m_mutex;
 
-    ShadingContext* m_context;  // back-pointer to shading context
+    // Serializes document loading, so that threads that all want the same
+    // new document wait for one of them to parse it.
+    std::mutex m_load_mutex;
 
     // List of XML documents we've read in.
-    std::vector<pugi::xml_document*> m_documents;
+    std::vector<std::unique_ptr<pugi::xml_document>> m_documents;
 
     // Map xml strings and/or filename to indices in m_documents.
     DocMap m_document_map;
@@ -140,86 +154,110 @@ private:
     std::vector<ustring> m_stringdata;
 
     // Helper function: return the document index given dictionary name.
-    int get_document_index(ExecContextPtr ec, ustring dictionaryname);
+    int get_document_index(ShadingContext* ctx, ExecContextPtr ec,
+                           ustring dictionaryname);
+
+    // Helper function: return the first node matching query q (whose name
+    // is the xpath query) searching from root, caching the result.
+    int select_nodes(ShadingContext* ctx, ExecContextPtr ec, const Query& q,
+                     const pugi::xml_node& root);
+
+    // Helper function: copy the cached value at offset into data.
+    int copy_value(int offset, TypeDesc type, void* data,
+                   bool treat_ustrings_as_hash) const;
 };
 
 
 
 int
-Dictionary::get_document_index(ExecContextPtr ec, ustring dictionaryname)
+Dictionary::get_document_index(ShadingContext* ctx, ExecContextPtr ec,
+                               ustring dictionaryname)
 {
-    DocMap::iterator dm = m_document_map.find(dictionaryname);
-    int dindex;
-    if (dm == m_document_map.end()) {
-        dindex                         = m_documents.size();
-        m_document_map[dictionaryname] = dindex;
-        pugi::xml_document* doc        = new pugi::xml_document;
-        m_documents.push_back(doc);
-        pugi::xml_parse_result parse_result;
-        if (Strutil::ends_with(dictionaryname, ".xml")) {
-            // xml file -- read it
-            parse_result = doc->load_file(dictionaryname.c_str());
+    {
+        read_lock lock(m_mutex);
+        DocMap::iterator dm = m_document_map.find(dictionaryname);
+        if (dm != m_document_map.end())
+            return dm->second;
+    }
+
+    // Not loaded yet. Only one thread parses it; any others that want it
+    // in the meantime wait here and then find it in the map.
+    std::lock_guard<std::mutex> load_lock(m_load_mutex);
+    {
+        read_lock lock(m_mutex);
+        DocMap::iterator dm = m_document_map.find(dictionaryname);
+        if (dm != m_document_map.end())
+            return dm->second;
+    }
+
+    std::unique_ptr<pugi::xml_document> doc(new pugi::xml_document);
+    pugi::xml_parse_result parse_result;
+    if (Strutil::ends_with(dictionaryname, ".xml")) {
+        // xml file -- read it
+        parse_result = doc->load_file(dictionaryname.c_str());
+    } else {
+        // load xml directly from the string
+        parse_result = doc->load_string(dictionaryname.c_str());
+    }
+    if (!parse_result) {
+        // Batched case doesn't support error customization yet,
+        // so continue to report through the context when ec is null
+        if (ec == nullptr) {
+            ctx->errorfmt("XML parsed with errors: {}, at offset {}",
+                          parse_result.description(), parse_result.offset);
         } else {
-            // load xml directly from the string
-            parse_result = doc->load_string(dictionaryname.c_str());
-        }
-        if (!parse_result) {
-            // Batched case doesn't support error customization yet,
-            // so continue to report through the context when ec is null
-            if (ec == nullptr) {
-                m_context->errorfmt("XML parsed with errors: {}, at offset {}",
-                                    parse_result.description(),
-                                    parse_result.offset);
-            } else {
-                OSL::errorfmt(ec, "XML parsed with errors: {}, at offset {}",
-                              parse_result.description(), parse_result.offset);
-            }
-            m_document_map[dictionaryname] = -1;
-            return -1;
+            OSL::errorfmt(ec, "XML parsed with errors: {}, at offset {}",
+                          parse_result.description(), parse_result.offset);
         }
-    } else {
-        dindex = dm->second;
+        write_lock lock(m_mutex);
+        m_document_map[dictionaryname] = -1;
+        return -1;
     }
 
-    OSL_DASSERT(dindex < (int)m_documents.size());
+    write_lock lock(m_mutex);
+    int dindex                     = (int)m_documents.size();
+    m_document_map[dictionaryname] = dindex;
+    m_documents.push_back(std::move(doc));
     return dindex;
 }
 
 
 
 int
-Dictionary::dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query)
+Dictionary::select_nodes(ShadingContext* ctx, ExecContextPtr ec,
+                         const Query& q, const pugi::xml_node& root)
 {
-    int dindex = get_document_index(ec, dictionaryname);
-    if (dindex < 0)
-        return dindex;
-
-    Query q(dindex, 0, query);
-    QueryMap::iterator qfound = m_cache.find(q);
-    if (qfound != m_cache.end()) {
-        return qfound->second.valueoffset;
+    {
+        read_lock lock(m_mutex);
+        QueryMap::iterator qfound = m_cache.find(q);
+        if (qfound != m_cache.end())
+            return qfound->second.valueoffset;
     }
 
-    pugi::xml_document* doc = m_documents[dindex];
-
-    // Query was not found.  Do the expensive lookup and cache it
+    // Query was not found.  Do the expensive lookup (concurrent searches
+    // of the same document are fine) and cache it
     pugi::xpath_node_set matches;
-
     try {
-        matches = doc->select_nodes(query.c_str());
+        matches = root.select_nodes(q.name.c_str());
     } catch (const pugi::xpath_exception& e) {
         // Batched case doesn't support error customization yet,
         // so continue to report through the context when ec is null
         if (ec == nullptr) {
-            m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                                e.what());
+            ctx->errorfmt("Invalid dict_find query '{}': {}", q.name,
+                          e.what());
         } else {
-            OSL::errorfmt(ec, "Invalid dict_find query '{}': {}", query,
+            OSL::errorfmt(ec, "Invalid dict_find query '{}': {}", q.name,
                           e.what());
         }
         return 0;
     }
 
+    write_lock lock(m_mutex);
+    // Another thread may have cached the same query while we searched.
+    QueryMap::iterator qfound = m_cache.find(q);
+    if (qfound != m_cache.end())
+        return qfound->second.valueoffset;
+
     if (matches.empty()) {
         m_cache[q] = QueryResult(false);  // mark invalid
         return 0;                         // Not found
@@ -227,7 +265,7 @@ Dictionary::dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query)
     int firstmatch = (int)m_nodes.size();
     int last       = -1;
     for (auto&& m : matches) {
-        m_nodes.emplace_back(dindex, m.node());
+        m_nodes.emplace_back(q.document, m.node());
         int nodeid = (int)m_nodes.size() - 1;
         if (last < 0) {
             // If this is the first match, add a cache entry for it
@@ -244,54 +282,37 @@ Dictionary::dict_find(ExecContextPtr ec, ustring dictionaryname, ustring query)
 
 
 int
-Dictionary::dict_find(ExecContextPtr ec, int nodeID, ustring query)
+Dictionary::dict_find(ShadingContext* ctx, ExecContextPtr ec,
+                      ustring dictionaryname, ustring query)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
-        return 0;  // invalid node ID
+    int dindex = get_document_index(ctx, ec, dictionaryname);
+    if (dindex < 0)
+        return dindex;
 
-    int document = m_nodes[nodeID].document;
-    Query q(document, nodeID, query);
-    QueryMap::iterator qfound = m_cache.find(q);
-    if (qfound != m_cache.end()) {
-        return qfound->second.valueoffset;
+    const pugi::xml_document* doc;
+    {
+        read_lock lock(m_mutex);
+        doc = m_documents[dindex].get();
     }
+    return select_nodes(ctx, ec, Query(dindex, 0, query), *doc);
+}
 
-    // Query was not found.  Do the expensive lookup and cache it
-    pugi::xpath_node_set matches;
-    try {
-        matches = m_nodes[nodeID].node.select_nodes(query.c_str());
-    } catch (const pugi::xpath_exception& e) {
-        // Batched case doesn't support error customization yet,
-        // so continue to report through the context when ec is null
-        if (ec == nullptr) {
-            m_context->errorfmt("Invalid dict_find query '{}': {}", query,
-                                e.what());
-        } else {
-            OSL::errorfmt(ec, "Invalid dict_find query '{}': {}", query,
-                          e.what());
-        }
-        return 0;
-    }
 
-    if (matches.empty()) {
-        m_cache[q] = QueryResult(false);  // mark invalid
-        return 0;                         // Not found
-    }
-    int firstmatch = (int)m_nodes.size();
-    int last       = -1;
-    for (auto&& m : matches) {
-        m_nodes.emplace_back(document, m.node());
-        int nodeid = (int)m_nodes.size() - 1;
-        if (last < 0) {
-            // If this is the first match, add a cache entry for it
-            m_cache[q] = QueryResult(true /* it's a node */, nodeid);
-        } else {
-            // If this is a subsequent match, set the last match's 'next'
-            m_nodes[last].next = nodeid;
-        }
-        last = nodeid;
+
+int
+Dictionary::dict_find(ShadingContext* ctx, ExecContextPtr ec, int nodeID,
+                      ustring query)
+{
+    int document;
+    pugi::xml_node node;
+    {
+        read_lock lock(m_mutex);
+        if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+            return 0;  // invalid node ID
+        document = m_nodes[nodeID].document;
+        node     = m_nodes[nodeID].node;
     }
-    return firstmatch;
+    return select_nodes(ctx, ec, Query(document, nodeID, query), node);
 }
 
 
@@ -299,6 +320,7 @@ Dictionary::dict_find(ExecContextPtr ec, int nodeID, ustring query)
 int
 Dictionary::dict_next(int nodeID)
 {
+    read_lock lock(m_mutex);
     if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
         return 0;  // invalid node ID
     return m_nodes[nodeID].next;
@@ -306,50 +328,63 @@ Dictionary::dict_next(int nodeID)
 
 
 
+int
+Dictionary::copy_value(int offset, TypeDesc type, void* data,
+                       bool treat_ustrings_as_hash) const
+{
+    int n = type.numelements() * type.aggregate;
+    if (type.basetype == TypeDesc::STRING) {
+        OSL_DASSERT(n == 1 && "no string arrays in XML");
+        if (treat_ustrings_as_hash == true) {
+            ((ustringhash_pod*)data)[0] = m_stringdata[offset].hash();
+        } else {
+            ((ustring*)data)[0] = m_stringdata[offset];
+        }
+        return 1;
+    }
+    if (type.basetype == TypeDesc::INT) {
+        for (int i = 0; i < n; ++i)
+            ((int*)data)[i] = m_intdata[offset++];
+        return 1;
+    }
+    if (type.basetype == TypeDesc::FLOAT) {
+        for (int i = 0; i < n; ++i)
+            ((float*)data)[i] = m_floatdata[offset++];
+        return 1;
+    }
+    return 0;  // Unknown type
+}
+
+
+
 int
 Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
                        void* data, bool treat_ustrings_as_hash)
 {
-    if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
-        return 0;  // invalid node ID
-
-    const Dictionary::Node& node(m_nodes[nodeID]);
-    Dictionary::Query q(node.document, nodeID, attribname, type);
-    Dictionary::QueryMap::iterator qfound = m_cache.find(q);
-    if (qfound != m_cache.end()) {
-        // previously found
-        int offset = qfound->second.valueoffset;
-        int n      = type.numelements() * type.aggregate;
-        if (type.basetype == TypeDesc::STRING) {
-            OSL_DASSERT(n == 1 && "no string arrays in XML");
-            if (treat_ustrings_as_hash == true) {
-                ((ustringhash_pod*)data)[0] = m_stringdata[offset].hash();
-            } else {
-                ((ustring*)data)[0] = m_stringdata[offset];
-            }
-            return 1;
-        }
-        if (type.basetype == TypeDesc::INT) {
-            for (int i = 0; i < n; ++i)
-                ((int*)data)[i] = m_intdata[offset++];
-            return 1;
-        }
-        if (type.basetype == TypeDesc::FLOAT) {
-            for (int i = 0; i < n; ++i)
-                ((float*)data)[i] = m_floatdata[offset++];
-            return 1;
+    Dictionary::Query q(0, nodeID, attribname, type);
+    pugi::xml_node node;
+    {
+        read_lock lock(m_mutex);
+        if (nodeID <= 0 || nodeID >= (int)m_nodes.size())
+            return 0;  // invalid node ID
+        q.document = m_nodes[nodeID].document;
+        node       = m_nodes[nodeID].node;
+        Dictionary::QueryMap::iterator qfound = m_cache.find(q);
+        if (qfound != m_cache.end()) {
+            // previously found
+            return copy_value(qfound->second.valueoffset, type, data,
+                              treat_ustrings_as_hash);
         }
-        return 0;  // Unknown type
     }
 
     // OK, the entry wasn't in the cache, we need to decode it and cache it.
 
     const char* val = NULL;
     if (attribname.empty()) {
-        val = node.node.value();
+        val = node.value();
     } else {
-        for (pugi::xml_attribute_iterator ait = node.node.attributes_begin();
-             ait != node.node.attributes_end(); ++ait) {
+        for (pugi::xml_attribute_iterator ait = node.attributes_begin();
+             ait != node.attributes_end(); ++ait) {
             if (ait->name() == attribname) {
                 val = ait->value();
                 break;
@@ -359,44 +394,50 @@ Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
     if (val == NULL)
         return 0;  // not found
 
-    Dictionary::QueryResult r(false, 0);
     int n = type.numelements() * type.aggregate;
     if (type.basetype == TypeDesc::STRING && n == 1) {
-        r.valueoffset = (int)m_stringdata.size();
         ustring s(val);
-        m_stringdata.push_back(s);
         if (treat_ustrings_as_hash == true) {
             ((ustringhash_pod*)data)[0] = s.hash();
         } else {
             ((ustring*)data)[0] = s;
         }
-        m_cache[q] = r;
+        write_lock lock(m_mutex);
+        if (m_cache.find(q) == m_cache.end()) {
+            m_cache[q] = QueryResult(false, (int)m_stringdata.size());
+            m_stringdata.push_back(s);
+        }
         return 1;
     }
     if (type.basetype == TypeDesc::INT) {
-        r.valueoffset = (int)m_intdata.size();
         string_view valstr(val);
         for (int i = 0; i < n; ++i) {
             int v;
             OIIO::Strutil::parse_int(valstr, v);
             OIIO::Strutil::parse_char(valstr, ',');
-            m_intdata.push_back(v);
             ((int*)data)[i] = v;
         }
-        m_cache[q] = r;
+        write_lock lock(m_mutex);
+        if (m_cache.find(q) == m_cache.end()) {
+            m_cache[q] = QueryResult(false, (int)m_intdata.size());
+            m_intdata.insert(m_intdata.end(), (int*)data, (int*)data + n);
+        }
         return 1;
     }
     if (type.basetype == TypeDesc::FLOAT) {
-        r.valueoffset = (int)m_floatdata.size();
         string_view valstr(val);
         for (int i = 0; i < n; ++i) {
             float v;
             OIIO::Strutil::parse_float(valstr, v);
             OIIO::Strutil::parse_char(valstr, ',');
-            m_floatdata.push_back(v);
             ((float*)data)[i] = v;
         }
-        m_cache[q] = r;
+        write_lock lock(m_mutex);
+        if (m_cache.find(q) == m_cache.end()) {
+            m_cache[q] = QueryResult(false, (int)m_floatdata.size());
+            m_floatdata.insert(m_floatdata.end(), (float*)data,
+                               (float*)data + n);
+        }
         return 1;
     }
 
@@ -405,6 +446,25 @@ Dictionary::dict_value(int nodeID, ustring attribname, TypeDesc type,
 }
 
 
+
+Dictionary*
+ShadingSystemImpl::dictionary()
+{
+    std::call_once(m_dictionary_once,
+                   [this]() { m_dictionary = new Dictionary; });
+    return m_dictionary;
+}
+
+
+
+void
+ShadingSystemImpl::free_dict_resources()
+{
+    delete m_dictionary;
+    m_dictionary = nullptr;
+}
+
+
 };  // namespace pvt
 
 
@@ -413,10 +473,8 @@ int
 ShadingContext::dict_find(ExecContextPtr ec, ustring dictionaryname,
                           ustring query)
 {
-    if (!m_dictionary) {
-        m_dictionary = new Dictionary(this);
-    }
-    return m_dictionary->dict_find(ec, dictionaryname, query);
+    return shadingsys().dictionary()->dict_find(this, ec, dictionaryname,
+                                                query);
 }
 
 
@@ -424,10 +482,7 @@ ShadingContext::dict_find(ExecContextPtr ec, ustring dictionaryname,
 int
 ShadingContext::dict_find(ExecContextPtr ec, int nodeID, ustring query)
 {
-    if (!m_dictionary) {
-        m_dictionary = new Dictionary(this);
-    }
-    return m_dictionary->dict_find(ec, nodeID, query);
+    return shadingsys().dictionary()->dict_find(this, ec, nodeID, query);
 }
 
 
@@ -435,9 +490,7 @@ ShadingContext::dict_find(ExecContextPtr ec, int nodeID, ustring query)
 int
 ShadingContext::dict_next(int nodeID)
 {
-    if (!m_dictionary)
-        return 0;
-    return m_dictionary->dict_next(nodeID);
+    return shadingsys().dictionary()->dict_next(nodeID);
 }
 
 
@@ -446,18 +499,8 @@ int
 ShadingContext::dict_value(int nodeID, ustring attribname, TypeDesc type,
                            void* data, bool treat_ustrings_as_hash)
 {
-    if (!m_dictionary)
-        return 0;
-    return m_dictionary->dict_value(nodeID, attribname, type, data,
-                                    treat_ustrings_as_hash);
-}
-
-
-
-void
-ShadingContext::free_dict_resources()
-{
-    delete m_dictionary;
+    return shadingsys().dictionary()->dict_value(nodeID, attribname, type,
+                                                 data, treat_ustrings_as_hash);
 }
 
 
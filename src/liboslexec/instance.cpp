@@ -764,6 +764,10 @@ ShaderGroup::~ShaderGroup()
     }
 #endif
 
+    // Keep the layer profile of the group after it is gone
+    if (m_profile.layer_ticks.size())
+        shadingsys().retire_layer_profile(layer_profile());
+
     // Free any GPU memory associated with this group
     if (m_device_interactive_arena)
         shadingsys().renderer()->device_free(
@@ -871,6 +875,53 @@ ShaderGroup::generate_optix_cache_key(string_view code)
 
 
 
+size_t
+ShaderGroup::estimated_compile_cost() const
+{
+    // Only look at the masters, which unlike the instances won't change
+    // under us if another thread is optimizing the group. Even an empty
+    // layer costs something to set up.
+    size_t cost = 0;
+    for (int i = 0, nl = nlayers(); i < nl; ++i)
+        cost += layer(i)->master()->nops() + 1;
+    return cost;
+}
+
+
+
+void
+ShaderGroup::generate_jit_cache_key(string_view code)
+{
+    const uint64_t ir_key = Strutil::strhash(code);
+
+    // The serialized IR doesn't spell out exactly how the layers are
+    // connected, which determines the group data layout, so hash those too.
+    std::string connections;
+    for (int i = 0, nl = nlayers(); i < nl; ++i) {
+        const ShaderInstance* inst = layer(i);
+        for (int c = 0, nc = inst->nconnections(); c < nc; ++c) {
+            const Connection& con(inst->connection(c));
+            connections += fmtformat("{}<{}:{};", i, con.srclayer,
+                                     con.str(*this, inst));
+        }
+    }
+    const uint64_t connection_key = Strutil::strhash(connections);
+
+    std::string safegroup;
+    safegroup = Strutil::replace(name(), "/", "_", true);
+    safegroup = Strutil::replace(safegroup, ":", "_", true);
+
+    ShaderInstance* inst = layer(nlayers() - 1);
+    ustring layername    = inst->layername();
+
+    // As with the OptiX key, the group and layer names are part of the key
+    // because they are baked into the names of the JITed functions.
+    m_jit_cache_key = fmtformat("cache-osl-jit-{}-{}-{:x}-{:x}", safegroup,
+                                layername, ir_key, connection_key);
+}
+
+
+
 std::string
 ShaderGroup::serialize() const
 {
@@ -878,6 +929,15 @@ ShaderGroup::serialize() const
     out.imbue(std::locale::classic());  // force C locale
     out.precision(9);
     lock_guard lock(m_mutex);
+    serialize(out);
+    return out.str();
+}
+
+
+
+void
+ShaderGroup::serialize(std::ostream& out) const
+{
     for (int i = 0, nl = nlayers(); i < nl; ++i) {
         const ShaderInstance* inst = m_layers[i].get();
 
@@ -956,8 +1016,183 @@ ShaderGroup::serialize() const
                 << inst->layername() << '.' << dstparam << " ;\n";
         }
     }
+}
+
+
+
+std::string
+ShaderGroup::dedup_key() const
+{
+    if (m_declaration.size())
+        return {};  // may be respecialized with other values
+    for (int i = 0, nl = nlayers(); i < nl; ++i) {
+        const ShaderInstance* inst = m_layers[i].get();
+        if (inst->symbols().size())
+            return {};  // already optimized on its own
+        for (int p = 0; p < inst->lastparam(); ++p)
+            if (inst->instoverride(p)->interactive())
+                return {};
+    }
+
+    std::ostringstream out;
+    out.imbue(std::locale::classic());  // force C locale
+    out.precision(9);
+    serialize(out);
+    // Besides the network itself, the code depends on these
+    out << "usage " << m_group_use << " ;\nentry";
+    for (int i = 0, nl = nlayers(); i < nl; ++i)
+        out << ' ' << m_layers[i]->entry_layer();
+    out << " ;\noutputs";
+    for (auto&& name : m_renderer_outputs)
+        out << ' ' << name;
+    out << " ;\nexec_repeat " << m_exec_repeat << " raytypes " << m_raytypes_on
+        << ' ' << m_raytypes_off << " ;\n";
+    for (auto&& symloc : m_symlocs)
+        out << "symloc " << symloc.name << ' ' << symloc.type << ' '
+            << symloc.offset << ' ' << symloc.stride << ' '
+            << int(symloc.arena) << ' ' << symloc.derivs << " ;\n";
     return out.str();
 }
 
 
+
+void
+ShaderGroup::share_compiled_state(const ShaderGroup& src)
+{
+    // The layers are shared outright: the symbols of the optimized
+    // instances hold their locations in the group data, which the
+    // renderer may look up through either group.
+    m_layers = src.m_layers;
+
+    if (src.optimized() && !optimized()) {
+        m_unknown_textures_needed   = src.m_unknown_textures_needed;
+        m_textures_needed           = src.m_textures_needed;
+        m_unknown_closures_needed   = src.m_unknown_closures_needed;
+        m_closures_needed           = src.m_closures_needed;
+        m_globals_needed            = src.m_globals_needed;
+        m_globals_read              = src.m_globals_read;
+        m_globals_write             = src.m_globals_write;
+        m_userdata_names            = src.m_userdata_names;
+        m_userdata_types            = src.m_userdata_types;
+        m_userdata_offsets          = src.m_userdata_offsets;
+        m_userdata_derivs           = src.m_userdata_derivs;
+        m_userdata_layers           = src.m_userdata_layers;
+        m_userdata_init_vals        = src.m_userdata_init_vals;
+        m_unknown_attributes_needed = src.m_unknown_attributes_needed;
+        m_attributes_needed         = src.m_attributes_needed;
+        m_attribute_scopes          = src.m_attribute_scopes;
+        m_attribute_types           = src.m_attribute_types;
+        m_attribute_derivs          = src.m_attribute_derivs;
+        m_does_nothing              = src.m_does_nothing;
+        m_optimized                 = src.m_optimized;
+        // Only a respecialized group's source has interactive params
+        m_interactive_params = src.m_interactive_params;
+        setup_interactive_arena(
+            cspan<uint8_t>(src.m_interactive_arena.get(),
+                           src.m_interactive_arena_size));
+    }
+    if (src.jitted() && !jitted()) {
+        // N.B. the userdata offsets are only final once JITed
+        m_userdata_offsets    = src.m_userdata_offsets;
+        m_llvm_groupdata_size = src.m_llvm_groupdata_size;
+        llvm_compiled_version(src.llvm_compiled_version());
+        llvm_compiled_init(src.llvm_compiled_init());
+        for (int i = 0, nl = (int)src.m_llvm_compiled_layers.size(); i < nl;
+             ++i)
+            llvm_compiled_layer(i, src.llvm_compiled_layer(i));
+        m_does_nothing = src.m_does_nothing;
+        m_jitted       = src.m_jitted;
+        // The JITed code refers to the profiling ranges by number
+        spin_lock lock(src.m_profile_mutex);
+        m_profile.ranges    = src.m_profile.ranges;
+        m_profile_op_ranges = src.m_profile_op_ranges;
+    }
+    if (src.batch_jitted() && !batch_jitted()) {
+        m_llvm_groupdata_wide_size   = src.m_llvm_groupdata_wide_size;
+        m_llvm_compiled_wide_version = src.m_llvm_compiled_wide_version;
+        m_llvm_compiled_wide_init    = src.m_llvm_compiled_wide_init;
+        m_llvm_compiled_wide_layers  = src.m_llvm_compiled_wide_layers;
+        m_does_nothing               = src.m_does_nothing;
+        m_batch_jitted               = src.m_batch_jitted;
+    }
+}
+
+
+
+void
+ShaderGroup::setup_profile_ranges()
+{
+    spin_lock lock(m_profile_mutex);
+    if (m_profile_op_ranges.size())
+        return;  // already done
+
+    int nlayers = this->nlayers();
+    m_profile_op_ranges.resize(nlayers);
+    for (int layer = 0; layer < nlayers; ++layer) {
+        const OpcodeVec& ops((*this)[layer]->ops());
+        std::vector<int>& opranges(m_profile_op_ranges[layer]);
+        opranges.resize(ops.size(), -1);
+        // A line's ops needn't be contiguous (loops, inlined functions),
+        // so share one range per line of the layer.
+        std::map<std::pair<ustring, int>, int> lineranges;
+        for (size_t opnum = 0; opnum < ops.size(); ++opnum) {
+            const Opcode& op(ops[opnum]);
+            if (op.opname() == "nop" || op.opname() == Strings::end
+                || op.sourcefile().empty())
+                continue;
+            auto key = std::make_pair(op.sourcefile(), op.sourceline());
+            auto found = lineranges.find(key);
+            if (found == lineranges.end()) {
+                found = lineranges.emplace(key, int(m_profile.ranges.size()))
+                            .first;
+                m_profile.ranges.push_back(
+                    { layer, op.sourcefile(), op.sourceline() });
+            }
+            opranges[opnum] = found->second;
+        }
+    }
+}
+
+
+
+void
+ShaderGroup::add_profile(const long long* layer_ticks,
+                         const long long* layer_calls,
+                         const long long* range_ticks)
+{
+    spin_lock lock(m_profile_mutex);
+    int nlayers = this->nlayers();
+    int nranges = int(m_profile.ranges.size());
+    m_profile.layer_ticks.resize(nlayers, 0);
+    m_profile.layer_calls.resize(nlayers, 0);
+    m_profile.range_ticks.resize(nranges, 0);
+    for (int i = 0; i < nlayers; ++i) {
+        m_profile.layer_ticks[i] += layer_ticks[i];
+        m_profile.layer_calls[i] += layer_calls[i];
+    }
+    for (int i = 0; i < nranges; ++i)
+        m_profile.range_ticks[i] += range_ticks[i];
+}
+
+
+
+pvt::LayerProfile
+ShaderGroup::layer_profile() const
+{
+    pvt::LayerProfile profile;
+    {
+        spin_lock lock(m_profile_mutex);
+        profile = m_profile;
+    }
+    profile.groupname = name();
+    for (int layer = 0, n = nlayers(); layer < n; ++layer) {
+        const ShaderInstance* inst = (*this)[layer];
+        profile.layernames.push_back(inst->layername().size()
+                                         ? inst->layername()
+                                         : ustring(inst->shadername()));
+    }
+    return profile;
+}
+
+
 OSL_NAMESPACE_END
@@ -7,6 +7,7 @@
 #include <OSL/journal.h>
 #include <OSL/oslconfig.h>
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
 
@@ -207,6 +208,7 @@ initialize_buffer(uint8_t* const buffer, uint32_t buf_size, uint32_t page_size,
     org.thread_count = thread_count;
     org.buf_size     = buf_size;
     org.page_size    = page_size;
+    org.ring_pages   = 0;
 
     org.additional_bytes_required = 0;
     org.exceeded_page_size        = 0;
@@ -226,6 +228,46 @@ initialize_buffer(uint8_t* const buffer, uint32_t buf_size, uint32_t page_size,
         info.pos           = org.calc_head_pos(thread_index);
         info.remaining     = org.page_size;
         info.warning_count = 0;
+        info.pages_written = 0;
+        info.pages_read    = 0;
+        info.read_pos      = info.pos;
+    }
+    return true;
+}
+
+
+
+bool
+initialize_streaming_buffer(uint8_t* const buffer, uint32_t buf_size,
+                            uint32_t page_size, int thread_count)
+{
+    using namespace journal::pvt;
+    auto& org        = *(reinterpret_cast<Organization*>(buffer));
+    org.thread_count = thread_count;
+    org.page_size    = page_size;
+    uint32_t end     = org.calc_end_of_page_infos();
+    if (buf_size < end
+        || (buf_size - end) / page_size < 2 * uint32_t(thread_count))
+        return false;
+
+    // With pages reused in a ring, free_pos and additional_bytes_required
+    // never come into play.
+    org.ring_pages = (buf_size - end) / page_size / thread_count;
+    org.buf_size   = end + org.ring_pages * org.page_size * org.thread_count;
+    org.free_pos   = org.buf_size;
+    org.additional_bytes_required = 0;
+    org.exceeded_page_size        = 0;
+
+    for (int thread_index = 0; thread_index < org.thread_count;
+         ++thread_index) {
+        PageInfo& info = org.get_pageinfo(thread_index);
+
+        info.pos           = org.calc_head_pos(thread_index);
+        info.remaining     = org.page_size;
+        info.warning_count = 0;
+        info.pages_written = 0;
+        info.pages_read    = 0;
+        info.read_pos      = info.pos;
     }
     return true;
 }
@@ -328,6 +370,16 @@ Reader::Reader(const uint8_t* buffer_, Reporter& reporter)
 {
 }
 
+void
+Reader::process_completed_pages()
+{
+    OSL_DASSERT(m_org.ring_pages);
+    const int tc = m_org.thread_count;
+    for (int thread_index = 0; thread_index < tc; ++thread_index) {
+        process_entries_for_thread(thread_index, true);
+    }
+}
+
 void
 Reader::process()
 {
@@ -350,12 +402,21 @@ Reader::process()
 }
 
 void
-Reader::process_entries_for_thread(int thread_index)
+Reader::process_entries_for_thread(int thread_index, bool completed_pages_only)
 {
-    uint32_t read_pos = m_org.calc_head_pos(thread_index);
-    const auto& info  = m_pageinfo_by_thread_index[thread_index];
+    const auto& info = m_pageinfo_by_thread_index[thread_index];
+    // When streaming, pick up where the last call left off.
+    const bool streaming = m_org.ring_pages != 0;
+    uint32_t read_pos = streaming ? info.read_pos
+                                  : m_org.calc_head_pos(thread_index);
     // We are done processing entries when our read_pos reaches the end_pos;
-    uint32_t end_pos = info.pos;
+    // unless we only want completed pages, in which case the writer may
+    // still be changing info.pos, and we stop instead at the end of the
+    // last completed page.
+    uint32_t end_pos = completed_pages_only ? ~uint32_t(0) : info.pos;
+    if (completed_pages_only
+        && info.pages_read.load() == info.pages_written.load())
+        return;
 
     using pvt::Content;
 
@@ -399,6 +460,14 @@ Reader::process_entries_for_thread(int thread_index)
             memcpy(&next_pos, src_ptr + sizeof(content), sizeof(next_pos));
 
             read_pos = next_pos;
+            if (streaming) {
+                // Done with that page, the writer may reuse it
+                info.read_pos = read_pos;
+                info.pages_read += 1;
+                if (completed_pages_only
+                    && info.pages_read.load() == info.pages_written.load())
+                    return;
+            }
             break;
         }
 
@@ -432,6 +501,33 @@ Reader::process_entries_for_thread(int thread_index)
         }
         };
     }
+    if (streaming)
+        info.read_pos = read_pos;
+}
+
+Drainer::Drainer(const uint8_t* buffer_, Reporter& reporter)
+    : m_reader(buffer_, reporter)
+{
+    m_thread = std::thread([this]() {
+        while (!m_done) {
+            m_reader.process_completed_pages();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+}
+
+Drainer::~Drainer() { finish(); }
+
+void
+Drainer::finish()
+{
+    if (!m_thread.joinable())
+        return;
+    m_done = true;
+    m_thread.join();
+    // The writers are done, so now the partially filled pages are safe to
+    // read too.
+    m_reader.process();
 }
 
 }  //namespace journal
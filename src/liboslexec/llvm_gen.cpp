@@ -159,11 +159,33 @@ BackendLLVM::llvm_call_layer(int layer, bool unconditional)
         // insert point is now then_block
     }
 
-    // Mark the call as a fast call
-    llvm::Value* funccall
-        = ll.call_function(layer_function_name(group(), *parent).c_str(), args);
-    if (!parent->entry_layer())
-        ll.mark_fast_func_call(funccall);
+    if (jit_layer_lazily(layer) || m_lazy_layer >= 0) {
+        // The layer's code isn't in this module, so call it through its
+        // slot in the group's table, having it JITed if nobody has yet:
+        //     if (! group->lazy_layers[layer])
+        //         osl_jit_lazy_layer (sg, group, layer);
+        //     group->lazy_layers[layer] (sg, groupdata, ...);
+        llvm::Value* slot = ll.constant_ptr(
+            group().llvm_lazy_layer_slot(layer));
+        llvm::Value* func = ll.op_load_acquire(ll.type_void_ptr(), slot);
+        llvm::BasicBlock* jit_block  = ll.new_basic_block("");
+        llvm::BasicBlock* call_block = ll.new_basic_block("");
+        ll.op_branch(ll.op_eq(func, ll.void_ptr_null()), jit_block,
+                     call_block);
+        // insert point is now jit_block
+        llvm::Value* jitargs[] = { sg_void_ptr(), ll.constant_ptr(&group()),
+                                   ll.constant(layer) };
+        ll.call_function("osl_jit_lazy_layer", jitargs);
+        ll.op_branch(call_block);  // also moves insert point
+        func = ll.op_load_acquire(ll.type_void_ptr(), slot);
+        ll.call_function(llvm_type_layer_func(), func, args);
+    } else {
+        // Mark the call as a fast call
+        llvm::Value* funccall = ll.call_function(
+            layer_function_name(group(), *parent).c_str(), args);
+        if (!parent->entry_layer())
+            ll.mark_fast_func_call(funccall);
+    }
 
     if (!unconditional)
         ll.op_branch(after_block);  // also moves insert point
@@ -2843,7 +2865,9 @@ LLVMGEN(llvm_gen_texture)
     llvm::Value* args[] = {
         rop.sg_void_ptr(),
         rop.llvm_load_value(Filename),
-        rop.ll.constant_ptr(texture_handle),
+        rop.llvm_relocatable_ptr(texture_handle,
+                                 fmtformat("texture_handle:{}",
+                                           Filename.get_string())),
         opt,
         rop.llvm_load_value(S),
         rop.llvm_load_value(T),
@@ -2910,7 +2934,9 @@ LLVMGEN(llvm_gen_texture3d)
     llvm::Value* args[] = {
         rop.sg_void_ptr(),
         rop.llvm_load_value(Filename),
-        rop.ll.constant_ptr(texture_handle),
+        rop.llvm_relocatable_ptr(texture_handle,
+                                 fmtformat("texture_handle:{}",
+                                           Filename.get_string())),
         opt,
         rop.llvm_void_ptr(P),
         // Auto derivs of P if !user_derivs
@@ -2975,7 +3001,9 @@ LLVMGEN(llvm_gen_environment)
     llvm::Value* args[] = {
         rop.sg_void_ptr(),
         rop.llvm_load_value(Filename),
-        rop.ll.constant_ptr(texture_handle),
+        rop.llvm_relocatable_ptr(texture_handle,
+                                 fmtformat("texture_handle:{}",
+                                           Filename.get_string())),
         opt,
         rop.llvm_void_ptr(R),
         user_derivs ? rop.llvm_void_ptr(*rop.opargsym(op, 3))
@@ -3504,7 +3532,8 @@ LLVMGEN(llvm_gen_gettextureinfo)
     std::vector<llvm::Value*> args;
     args.push_back(rop.sg_void_ptr());
     args.push_back(rop.llvm_load_value(Filename));
-    args.push_back(rop.ll.constant_ptr(texture_handle));
+    args.push_back(rop.llvm_relocatable_ptr(
+        texture_handle, fmtformat("texture_handle:{}", Filename.get_string())));
     if (use_coords) {
         args.push_back(rop.llvm_load_value(*S));
         args.push_back(rop.llvm_load_value(*T));
@@ -3849,8 +3878,9 @@ LLVMGEN(llvm_gen_closure)
 
     // Call osl_allocate_closure_component(closure, id, size).  It returns
     // the memory for the closure parameter data.
-    llvm::Value* render_ptr = rop.ll.constant_ptr(rop.shadingsys().renderer(),
-                                                  rop.ll.type_void_ptr());
+    llvm::Value* render_ptr
+        = rop.llvm_relocatable_ptr(rop.shadingsys().renderer(), "renderer",
+                                   rop.ll.type_void_ptr());
     llvm::Value* sg_ptr     = rop.sg_void_ptr();
     llvm::Value* id_int     = rop.ll.constant(clentry->id);
     llvm::Value* size_int   = rop.ll.constant(clentry->struct_size);
@@ -3890,8 +3920,10 @@ LLVMGEN(llvm_gen_closure)
     if (clentry->prepare) {
         // Call clentry->prepare(renderservices *, int id, void *mem)
         llvm::Value* funct_ptr
-            = rop.ll.constant_ptr((void*)clentry->prepare,
-                                  rop.llvm_type_prepare_closure_func());
+            = rop.llvm_relocatable_ptr((void*)clentry->prepare,
+                                       fmtformat("closure_prepare:{}",
+                                                 closure_name),
+                                       rop.llvm_type_prepare_closure_func());
         llvm::Value* args[] = { render_ptr, id_int, mem_void_ptr };
         rop.ll.call_function(funct_ptr, args);
     } else {
@@ -3926,8 +3958,10 @@ LLVMGEN(llvm_gen_closure)
     if (clentry->setup) {
         // Call clentry->setup(renderservices *, int id, void *mem)
         llvm::Value* funct_ptr
-            = rop.ll.constant_ptr((void*)clentry->setup,
-                                  rop.llvm_type_setup_closure_func());
+            = rop.llvm_relocatable_ptr((void*)clentry->setup,
+                                       fmtformat("closure_setup:{}",
+                                                 closure_name),
+                                       rop.llvm_type_setup_closure_func());
         llvm::Value* args[] = { render_ptr, id_int, mem_void_ptr };
         rop.ll.call_function(funct_ptr, args);
     }
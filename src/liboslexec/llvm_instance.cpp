@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <bitset>
 #include <cmath>
 #include <iostream>
@@ -423,6 +424,21 @@ BackendLLVM::llvm_type_groupdata_ptr()
 
 
 
+llvm::FunctionType*
+BackendLLVM::llvm_type_layer_func()
+{
+    llvm::Type* params[] = {
+        llvm_type_sg_ptr(), llvm_type_groupdata_ptr(),
+        ll.type_void_ptr(),  // userdata_base_ptr
+        ll.type_void_ptr(),  // output_base_ptr
+        ll.type_int(),       // shadeindex
+        ll.type_void_ptr(),  // interactive_params
+    };
+    return ll.type_function(ll.type_void(), params);
+}
+
+
+
 llvm::Type*
 BackendLLVM::llvm_type_closure_component()
 {
@@ -1246,10 +1262,21 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
     if (bb)
         ll.set_insert_point(bb);
 
+    // We can't know which profiling range is current on entry to a block
+    m_profile_range = -1;
+
     for (int opnum = beginop; opnum < endop; ++opnum) {
         const Opcode& op        = inst()->ops()[opnum];
         const OpDescriptor* opd = shadingsys().op_descriptor(op.opname());
         if (opd && opd->llvmgen) {
+            if (m_profile_layers >= 2) {
+                int range = group().profile_range(layer(), opnum);
+                if (range >= 0 && range != m_profile_range) {
+                    llvm::Value* args[] = { sg_void_ptr(), ll.constant(range) };
+                    ll.call_function("osl_profile_range", args);
+                    m_profile_range = range;
+                }
+            }
             if (shadingsys().debug_uninit() /* debug uninitialized vals */)
                 llvm_generate_debug_uninit(op);
             if (shadingsys().llvm_debug_ops())
@@ -1276,8 +1303,10 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
         // If the op we coded jumps around, skip past its recursive block
         // executions.
         int next = op.farthest_jump();
-        if (next >= 0)
-            opnum = next - 1;
+        if (next >= 0) {
+            opnum           = next - 1;
+            m_profile_range = -1;  // control flow may have left another one
+        }
     }
     return true;
 }
@@ -1551,10 +1580,12 @@ BackendLLVM::build_llvm_instance(bool groupentry)
     // Note that the GroupData* is passed as a void*.
     std::string unique_layer_name = layer_function_name(group(), *inst());
 
+    // Lazily JITed layers are called through a plain function pointer
     bool is_entry_layer = group().is_entry_layer(layer());
     ll.current_function(ll.make_function(
         unique_layer_name,
-        !is_entry_layer,  // fastcall for non-entry layer functions
+        // fastcall for non-entry layer functions
+        !is_entry_layer && !jit_layer_lazily(layer()),
         ll.type_void(),   // return type
         {
             llvm_type_sg_ptr(), llvm_type_groupdata_ptr(),
@@ -1630,6 +1661,10 @@ BackendLLVM::build_llvm_instance(bool groupentry)
         if (shadingsys().countlayerexecs())
             ll.call_function("osl_incr_layers_executed", sg_void_ptr());
     }
+    if (m_profile_layers) {
+        llvm::Value* args[] = { sg_void_ptr(), ll.constant(this->layer()) };
+        ll.call_function("osl_profile_layer_begin", args);
+    }
 
     // Setup the symbols
     m_named_values.clear();
@@ -1852,6 +1887,8 @@ BackendLLVM::build_llvm_instance(bool groupentry)
         llvm_gen_debug_printf(fmtformat("exit layer {} {} {}", this->layer(),
                                         inst()->layername(),
                                         inst()->shadername()));
+    if (m_profile_layers)
+        ll.call_function("osl_profile_layer_end", sg_void_ptr());
     ll.op_return();
 
     if (llvm_debug())
@@ -1883,7 +1920,7 @@ BackendLLVM::initialize_llvm_group()
 
     // Set up optimization passes. Don't target the host if we're building
     // for OptiX.
-    ll.setup_optimization_passes(shadingsys().llvm_optimize(),
+    ll.setup_optimization_passes(llvm_optimize(),
                                  shadingsys().llvm_target_host()
                                      && !use_optix());
 
@@ -2072,243 +2109,408 @@ BackendLLVM::prepare_module_for_cuda_jit()
 
 
 
-static void
-empty_group_func(void*, void*)
+void
+BackendLLVM::setup_layer_remap()
 {
+    // Set up m_num_used_layers to be the number of layers that are
+    // actually used, and m_layer_remap[] to map original layer numbers
+    // to the shorter list of actually-called layers. We also note that
+    // if m_layer_remap[i] is < 0, it's not a layer that's used.
+    int nlayers = group().nlayers();
+    m_layer_remap.resize(nlayers, -1);
+    m_num_used_layers = 0;
+    if (debug() >= 1)
+        std::cout << "\nLayers used: (group " << group().name() << ")\n";
+    for (int layer = 0; layer < nlayers; ++layer) {
+        // Skip unused or empty layers, unless they are callable entry
+        // points.
+        ShaderInstance* inst = group()[layer];
+        bool is_single_entry = (layer == (nlayers - 1)
+                                && group().num_entry_layers() == 0);
+        if (inst->entry_layer() || is_single_entry
+            || (!inst->unused() && !inst->empty_instance())) {
+            if (debug() >= 1)
+                std::cout << "  " << layer << ' ' << inst->layername() << "\n";
+            m_layer_remap[layer] = m_num_used_layers++;
+        }
+    }
+    if (m_lazy_layer < 0)  // counted when the group was JITed
+        shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
 }
 
 
 
-void
-BackendLLVM::run()
+std::string
+BackendLLVM::jit_cache_key() const
 {
-    if (group().does_nothing()) {
-        group().llvm_compiled_init((RunLLVMGroupFunc)empty_group_func);
-        group().llvm_compiled_version((RunLLVMGroupFunc)empty_group_func);
-        return;
+    // Beyond the optimized IR of the group (already in the group's key),
+    // the object code depends on the OSL and LLVM versions, the target, and
+    // every option that steers code generation.
+    const ShadingSystemImpl& ss(shadingsys());
+    std::string options = fmtformat(
+        "{} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {} {}",
+        llvm_optimize(), ss.m_llvm_jit_fma, ss.m_llvm_jit_aggressive,
+        ss.llvm_target_host(), ss.debug_nan(), ss.debug_uninit(),
+        ss.range_checking(), ss.countlayerexecs(), ss.lazy_userdata(),
+        ss.profile(), m_profile_layers, ss.opt_texture_handle(),
+        ss.m_opt_useparam, ss.m_opt_groupdata, ss.llvm_debug_layers(),
+        ss.llvm_debug_ops(), ss.llvm_prune_ir_strategy(),
+        ss.commonspace_synonym(), ss.m_max_local_mem_KB, ss.no_noise(),
+        Strutil::join(ss.m_raytypes, ","));
+    // The inline lists are unordered sets, sort them so the key is stable
+    std::vector<std::string> inlining;
+    for (auto&& f : ss.m_inline_functions)
+        inlining.push_back(fmtformat("+{}", f));
+    for (auto&& f : ss.m_noinline_functions)
+        inlining.push_back(fmtformat("-{}", f));
+    std::sort(inlining.begin(), inlining.end());
+    options += Strutil::join(inlining, " ");
+    if (m_use_rs_bitcode)
+        options += fmtformat(" rs{:x}",
+                             Strutil::strhash(string_view(
+                                 ss.m_rs_bitcode.data(),
+                                 ss.m_rs_bitcode.size())));
+    return fmtformat("{}-{}-{}-{}-{:x}", group().jit_cache_key(),
+                     OSL_LIBRARY_VERSION_CODE, OSL_LLVM_VERSION,
+                     LLVM_Util::target_isa_name(ll.target_isa()),
+                     Strutil::strhash(options));
+}
+
+
+
+bool
+BackendLLVM::load_cached_jit(std::string& key)
+{
+    // MCJIT wants a module to own, even though all the code we'll run is
+    // in the cached object. Making the engine also settles the target ISA,
+    // which is part of the key.
+    std::string err;
+    ll.module(ll.new_module("llvm_jit_cache"));
+    if (!ll.make_jit_execengine(&err,
+                                ll.lookup_isa_by_name(
+                                    shadingsys().m_llvm_jit_target),
+                                false, false)) {
+        ll.module(NULL);
+        return false;
+    }
+    key = jit_cache_key();
+    std::string object_code;
+    if (!renderer()->cache_get("llvm_jit", key, object_code)
+        || object_code.empty()) {
+        ll.execengine(NULL);
+        ll.module(NULL);
+        return false;
     }
+    initialize_llvm_helper_function_map();
+    ll.InstallLazyFunctionCreator(helper_function_lookup);
 
-    // At this point, we already hold the lock for this group, by virtue
-    // of ShadingSystemImpl::optimize_group.
-    OIIO::Timer timer;
+    // Lay out the group data exactly as the original codegen did, which
+    // also records the symbol offsets and heap size the group will need.
+    m_llvm_type_sg                = NULL;
+    m_llvm_type_groupdata         = NULL;
+    m_llvm_type_closure_component = NULL;
+    llvm_type_groupdata();
+
+    bool ok = ll.add_object_code(object_code, &err);
+    RunLLVMGroupFunc init_func = nullptr;
+    std::vector<RunLLVMGroupFunc> funcs(group().nlayers(), nullptr);
+    if (ok) {
+        init_func = (RunLLVMGroupFunc)ll.getPointerToFunction(
+            init_function_name(shadingsys(), group()));
+        ok = init_func != nullptr;
+    }
+    for (int layer = 0; ok && layer < group().nlayers(); ++layer) {
+        if (m_layer_remap[layer] != -1 && group().is_entry_layer(layer)) {
+            funcs[layer] = (RunLLVMGroupFunc)ll.getPointerToFunction(
+                layer_function_name(group(), *group()[layer]));
+            ok = funcs[layer] != nullptr;
+        }
+    }
+    ll.execengine(NULL);
+    ll.module(NULL);
+
+    if (!ok) {
+        // Stale or damaged cache entries are not fatal, we just JIT anew.
+        if (err.size())
+            shadingcontext()->warningfmt(
+                "Ignoring cached JIT of shader group {}: {}", group().name(),
+                err);
+        return false;
+    }
+
+    group().llvm_compiled_init(init_func);
+    for (int layer = 0; layer < group().nlayers(); ++layer)
+        if (funcs[layer])
+            group().llvm_compiled_layer(layer, funcs[layer]);
+    if (group().num_entry_layers())
+        group().llvm_compiled_version(NULL);
+    else
+        group().llvm_compiled_version(
+            group().llvm_compiled_layer(group().nlayers() - 1));
+    return true;
+}
+
+
+
+static void
+empty_group_func(void*, void*)
+{
+}
+
+
+
+bool
+BackendLLVM::create_llvm_module()
+{
     std::string err;
 
-    {
 #ifdef OSL_LLVM_NO_BITCODE
-        // I don't know which exact part has thread safety issues, but it
-        // crashes on windows when we don't lock.
-        // FIXME -- try subsequent LLVM releases on Windows to see if this
-        // is a problem that is eventually fixed on the LLVM side.
-        static spin_mutex mutex;
-        OIIO::spin_lock lock(mutex);
+    // I don't know which exact part has thread safety issues, but it
+    // crashes on windows when we don't lock.
+    // FIXME -- try subsequent LLVM releases on Windows to see if this
+    // is a problem that is eventually fixed on the LLVM side.
+    static spin_mutex mutex;
+    OIIO::spin_lock lock(mutex);
 #endif
 
 #ifdef OSL_LLVM_NO_BITCODE
-        OSL_DASSERT(!use_rs_bitcode());
-        ll.module(ll.new_module("llvm_ops"));
+    OSL_DASSERT(!use_rs_bitcode());
+    ll.module(ll.new_module("llvm_ops"));
 #    if OSL_USE_OPTIX
-        if (use_optix()) {
-            // If the module is created from LLVM bitcode, the target and
-            // data layout is inherited from that, but if creating an empty
-            // module like here, have to manually set those, otherwise
-            // compiling will later fail because the NVPTX target is not found.
-            // The target triple and data layout used here are those specified
-            // for NVPTX (https://www.llvm.org/docs/NVPTXUsage.html#triples).
-            ll.module()->setDataLayout(
-                "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
-            ll.module()->setTargetTriple("nvptx64-nvidia-cuda");
-        }
+    if (use_optix()) {
+        // If the module is created from LLVM bitcode, the target and
+        // data layout is inherited from that, but if creating an empty
+        // module like here, have to manually set those, otherwise
+        // compiling will later fail because the NVPTX target is not found.
+        // The target triple and data layout used here are those specified
+        // for NVPTX (https://www.llvm.org/docs/NVPTXUsage.html#triples).
+        ll.module()->setDataLayout(
+            "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
+        ll.module()->setTargetTriple("nvptx64-nvidia-cuda");
+    }
 #    endif
 #else
-        if (!use_optix()) {
-            if (use_rs_bitcode()) {
-                ll.module(ll.module_from_bitcode(
-                    (char*)osl_llvm_compiled_rs_dependent_ops_block,
-                    osl_llvm_compiled_rs_dependent_ops_size,
-                    "llvm_rs_dependent_ops", &err));
-                if (err.length())
-                    shadingcontext()->errorfmt(
-                        "llvm::parseBitcodeFile returned '{}' for llvm_rs_dependent_ops\n",
-                        err);
+    if (!use_optix()) {
+        if (use_rs_bitcode()) {
+            ll.module(ll.module_from_bitcode(
+                (char*)osl_llvm_compiled_rs_dependent_ops_block,
+                osl_llvm_compiled_rs_dependent_ops_size,
+                "llvm_rs_dependent_ops", &err));
+            if (err.length())
+                shadingcontext()->errorfmt(
+                    "llvm::parseBitcodeFile returned '{}' for llvm_rs_dependent_ops\n",
+                    err);
 
 //Leaving this around for developers to make sure LLVM's shaderglobals and C++'s are binary compatible
 #    if 0
-                std::vector<unsigned int> offset_by_index;
-                build_offsets_of_ShaderGlobals(offset_by_index);
-                ll.validate_struct_data_layout(m_llvm_type_sg, offset_by_index);
+            std::vector<unsigned int> offset_by_index;
+            build_offsets_of_ShaderGlobals(offset_by_index);
+            ll.validate_struct_data_layout(m_llvm_type_sg, offset_by_index);
 #    endif
 
-                std::vector<char>& rs_free_function_bitcode
-                    = shadingsys().m_rs_bitcode;
-                OSL_ASSERT(rs_free_function_bitcode.size()
-                           && "Free Function bitcode is empty");
-
-                llvm::Module* rs_free_functions_module = ll.module_from_bitcode(
-                    static_cast<const char*>(rs_free_function_bitcode.data()),
-                    rs_free_function_bitcode.size(), "rs_free_functions", &err);
-                if (err.length())
-                    shadingcontext()->errorfmt(
-                        "llvm::parseBitcodeFile returned '{}' for rs_free_functions\n",
-                        err);
-                std::unique_ptr<llvm::Module> rs_free_functions_module_ptr(
-                    rs_free_functions_module);
-                bool success = ll.absorb_module(
-                    std::move(rs_free_functions_module_ptr));
-                if (!success)
-                    shadingcontext()->errorfmt(
-                        "LLVM_Util::absorb_module failed'\n");
-            } else {
-                ll.module(
-                    ll.module_from_bitcode((char*)osl_llvm_compiled_ops_block,
-                                           osl_llvm_compiled_ops_size,
-                                           "llvm_ops", &err));
-                if (err.length())
-                    shadingcontext()->errorfmt(
-                        "llvm::parseBitcodeFile returned '{}' for llvm_ops\n",
-                        err);
-            }
+            std::vector<char>& rs_free_function_bitcode
+                = shadingsys().m_rs_bitcode;
+            OSL_ASSERT(rs_free_function_bitcode.size()
+                       && "Free Function bitcode is empty");
 
+            llvm::Module* rs_free_functions_module = ll.module_from_bitcode(
+                static_cast<const char*>(rs_free_function_bitcode.data()),
+                rs_free_function_bitcode.size(), "rs_free_functions", &err);
+            if (err.length())
+                shadingcontext()->errorfmt(
+                    "llvm::parseBitcodeFile returned '{}' for rs_free_functions\n",
+                    err);
+            std::unique_ptr<llvm::Module> rs_free_functions_module_ptr(
+                rs_free_functions_module);
+            bool success = ll.absorb_module(
+                std::move(rs_free_functions_module_ptr));
+            if (!success)
+                shadingcontext()->errorfmt(
+                    "LLVM_Util::absorb_module failed'\n");
         } else {
-#    ifdef OSL_LLVM_CUDA_BITCODE
-            llvm::Module* shadeops_module = ll.module_from_bitcode(
-                (char*)shadeops_cuda_llvm_compiled_ops_block,
-                shadeops_cuda_llvm_compiled_ops_size, "llvm_ops", &err);
-
+            ll.module(
+                ll.module_from_bitcode((char*)osl_llvm_compiled_ops_block,
+                                       osl_llvm_compiled_ops_size,
+                                       "llvm_ops", &err));
             if (err.length())
                 shadingcontext()->errorfmt(
-                    "llvm::parseBitcodeFile returned '{}' for cuda llvm_ops\n",
+                    "llvm::parseBitcodeFile returned '{}' for llvm_ops\n",
                     err);
+        }
 
-            shadeops_module->setDataLayout(
-                "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
-            shadeops_module->setTargetTriple("nvptx64-nvidia-cuda");
+    } else {
+#    ifdef OSL_LLVM_CUDA_BITCODE
+        llvm::Module* shadeops_module = ll.module_from_bitcode(
+            (char*)shadeops_cuda_llvm_compiled_ops_block,
+            shadeops_cuda_llvm_compiled_ops_size, "llvm_ops", &err);
 
-            std::unique_ptr<llvm::Module> shadeops_ptr(shadeops_module);
-            llvm::Linker::linkModules(*ll.module(), std::move(shadeops_ptr),
-                                      llvm::Linker::Flags::None);
+        if (err.length())
+            shadingcontext()->errorfmt(
+                "llvm::parseBitcodeFile returned '{}' for cuda llvm_ops\n",
+                err);
+
+        shadeops_module->setDataLayout(
+            "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
+        shadeops_module->setTargetTriple("nvptx64-nvidia-cuda");
+
+        std::unique_ptr<llvm::Module> shadeops_ptr(shadeops_module);
+        llvm::Linker::linkModules(*ll.module(), std::move(shadeops_ptr),
+                                  llvm::Linker::Flags::None);
+
+        if (err.length())
+            shadingcontext()->errorfmt(
+                "llvm::parseBitcodeFile returned '{}' for cuda rend_lib\n",
+                err);
+
+        // The renderer may provide additional shadeops bitcode for renderer-specific
+        // functionality ("rend_lib" fuctions). Like the built-in shadeops, the rend_lib
+        // functions may or may not be inlined, depending on the optimization options.
+        std::vector<char>& bitcode = shadingsys().m_lib_bitcode;
+        if (bitcode.size()) {
+            llvm::Module* rend_lib_module = ll.module_from_bitcode(
+                static_cast<const char*>(bitcode.data()), bitcode.size(),
+                "cuda_rend_lib", &err);
 
             if (err.length())
                 shadingcontext()->errorfmt(
-                    "llvm::parseBitcodeFile returned '{}' for cuda rend_lib\n",
+                    "llvm::parseBitcodeFile returned '{}' for cuda llvm_ops\n",
                     err);
 
-            // The renderer may provide additional shadeops bitcode for renderer-specific
-            // functionality ("rend_lib" fuctions). Like the built-in shadeops, the rend_lib
-            // functions may or may not be inlined, depending on the optimization options.
-            std::vector<char>& bitcode = shadingsys().m_lib_bitcode;
-            if (bitcode.size()) {
-                llvm::Module* rend_lib_module = ll.module_from_bitcode(
-                    static_cast<const char*>(bitcode.data()), bitcode.size(),
-                    "cuda_rend_lib", &err);
-
-                if (err.length())
-                    shadingcontext()->errorfmt(
-                        "llvm::parseBitcodeFile returned '{}' for cuda llvm_ops\n",
-                        err);
-
-                rend_lib_module->setDataLayout(
-                    "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
-                rend_lib_module->setTargetTriple("nvptx64-nvidia-cuda");
-
-                for (llvm::Function& fn : *rend_lib_module) {
-                    fn.addFnAttr("osl-rend_lib-function", "true");
-                }
+            rend_lib_module->setDataLayout(
+                "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
+            rend_lib_module->setTargetTriple("nvptx64-nvidia-cuda");
 
-                std::unique_ptr<llvm::Module> rend_lib_ptr(rend_lib_module);
-                llvm::Linker::linkModules(*ll.module(), std::move(rend_lib_ptr),
-                                          llvm::Linker::Flags::OverrideFromSrc);
+            for (llvm::Function& fn : *rend_lib_module) {
+                fn.addFnAttr("osl-rend_lib-function", "true");
             }
+
+            std::unique_ptr<llvm::Module> rend_lib_ptr(rend_lib_module);
+            llvm::Linker::linkModules(*ll.module(), std::move(rend_lib_ptr),
+                                      llvm::Linker::Flags::OverrideFromSrc);
+        }
 #    else
-            OSL_ASSERT(0 && "Must generate LLVM CUDA bitcode for OptiX");
+        OSL_ASSERT(0 && "Must generate LLVM CUDA bitcode for OptiX");
 #    endif
-            // Ensure that the correct target triple and data layout are set when targeting NVPTX.
-            // The triple is empty with recent versions of LLVM (e.g., 15) for reasons that aren't
-            // clear. So we must set them to the expected values.
-            // See: https://llvm.org/docs/NVPTXUsage.html
-            ll.module()->setTargetTriple("nvptx64-nvidia-cuda");
-            ll.module()->setDataLayout(
-                "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
-
-            // Tag each function as an OSL library function to help with
-            // inlining and optimization after codegen.
-            for (llvm::Function& fn : *ll.module()) {
-                fn.addFnAttr("osl-lib-function", "true");
-            }
+        // Ensure that the correct target triple and data layout are set when targeting NVPTX.
+        // The triple is empty with recent versions of LLVM (e.g., 15) for reasons that aren't
+        // clear. So we must set them to the expected values.
+        // See: https://llvm.org/docs/NVPTXUsage.html
+        ll.module()->setTargetTriple("nvptx64-nvidia-cuda");
+        ll.module()->setDataLayout(
+            "e-p:64:64:64-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-i128:128:128-f32:32:32-f64:64:64-v16:16:16-v32:32:32-v64:64:64-v128:128:128-n16:32:64");
+
+        // Tag each function as an OSL library function to help with
+        // inlining and optimization after codegen.
+        for (llvm::Function& fn : *ll.module()) {
+            fn.addFnAttr("osl-lib-function", "true");
+        }
 
-            // Mark all global variables extern and discard their initializers.
-            // Global variables are defined in the shadeops PTX file.
-            for (llvm::GlobalVariable& global : ll.module()->globals()) {
-                global.setLinkage(llvm::GlobalValue::ExternalLinkage);
-                global.setExternallyInitialized(true);
-                global.setInitializer(nullptr);
-                // Replace characters not supported in ptx, matching the LLVM
-                // NVPTXAssignValidGlobalNames pass.
-                string_view global_name(global.getName().data(),
-                                        global.getName().size());
-                if (Strutil::contains_any_char(global_name, ".@")) {
-                    std::string valid_name = global_name;
-                    valid_name = Strutil::replace(valid_name, ".", "_$_", true);
-                    valid_name = Strutil::replace(valid_name, "@", "_$_", true);
-                    global.setName(valid_name);
-                }
+        // Mark all global variables extern and discard their initializers.
+        // Global variables are defined in the shadeops PTX file.
+        for (llvm::GlobalVariable& global : ll.module()->globals()) {
+            global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+            global.setExternallyInitialized(true);
+            global.setInitializer(nullptr);
+            // Replace characters not supported in ptx, matching the LLVM
+            // NVPTXAssignValidGlobalNames pass.
+            string_view global_name(global.getName().data(),
+                                    global.getName().size());
+            if (Strutil::contains_any_char(global_name, ".@")) {
+                std::string valid_name = global_name;
+                valid_name = Strutil::replace(valid_name, ".", "_$_", true);
+                valid_name = Strutil::replace(valid_name, "@", "_$_", true);
+                global.setName(valid_name);
             }
         }
-        OSL_ASSERT(ll.module());
+    }
+    OSL_ASSERT(ll.module());
 #endif
 
-        // Create the ExecutionEngine. We don't create an ExecutionEngine in the
-        // OptiX case, because we are using the NVPTX backend and not MCJIT. However,
-        // it's still useful to set the target ISA to facilitate PTX-specific codegen.
-        if (use_optix()) {
-            ll.set_target_isa(TargetISA::NVPTX);
-        } else if (!ll.make_jit_execengine(
-                       &err,
-                       ll.lookup_isa_by_name(shadingsys().m_llvm_jit_target),
-                       shadingsys().llvm_debugging_symbols(),
-                       shadingsys().llvm_profiling_events())) {
-            shadingcontext()->errorfmt("Failed to create engine: {}\n", err);
-            OSL_ASSERT(0);
-            return;
-        }
+    // Create the ExecutionEngine. We don't create an ExecutionEngine in the
+    // OptiX case, because we are using the NVPTX backend and not MCJIT. However,
+    // it's still useful to set the target ISA to facilitate PTX-specific codegen.
+    if (use_optix()) {
+        ll.set_target_isa(TargetISA::NVPTX);
+    } else if (!ll.make_jit_execengine(
+                   &err,
+                   ll.lookup_isa_by_name(shadingsys().m_llvm_jit_target),
+                   shadingsys().llvm_debugging_symbols(),
+                   shadingsys().llvm_profiling_events())) {
+        shadingcontext()->errorfmt("Failed to create engine: {}\n", err);
+        OSL_ASSERT(0);
+        return false;
+    }
 
-        // End of mutex lock, for the OSL_LLVM_NO_BITCODE case
+    return true;
+}
+
+
+
+void
+BackendLLVM::run()
+{
+    if (group().does_nothing()) {
+        group().llvm_compiled_init((RunLLVMGroupFunc)empty_group_func);
+        group().llvm_compiled_version((RunLLVMGroupFunc)empty_group_func);
+        return;
     }
 
-    m_stat_llvm_setup_time += timer.lap();
+    // At this point, we already hold the lock for this group, by virtue
+    // of ShadingSystemImpl::optimize_group.
+    OIIO::Timer timer;
 
-    // Set up m_num_used_layers to be the number of layers that are
-    // actually used, and m_layer_remap[] to map original layer numbers
-    // to the shorter list of actually-called layers. We also note that
-    // if m_layer_remap[i] is < 0, it's not a layer that's used.
+    setup_layer_remap();
     int nlayers = group().nlayers();
-    m_layer_remap.resize(nlayers, -1);
-    m_num_used_layers = 0;
-    if (debug() >= 1)
-        std::cout << "\nLayers used: (group " << group().name() << ")\n";
-    for (int layer = 0; layer < nlayers; ++layer) {
-        // Skip unused or empty layers, unless they are callable entry
-        // points.
-        ShaderInstance* inst = group()[layer];
-        bool is_single_entry = (layer == (nlayers - 1)
-                                && group().num_entry_layers() == 0);
-        if (inst->entry_layer() || is_single_entry
-            || (!inst->unused() && !inst->empty_instance())) {
-            if (debug() >= 1)
-                std::cout << "  " << layer << ' ' << inst->layername() << "\n";
-            m_layer_remap[layer] = m_num_used_layers++;
+
+    // The lazy layers are called through a table that belongs to the group.
+    // It's only made the first time, because code JITed earlier may still
+    // be using it when tiered JIT gets here again.
+    if (m_lazy_layers && group().m_llvm_lazy_layers.empty()) {
+        group().m_llvm_lazy_layers
+            = std::vector<std::atomic<RunLLVMGroupFunc>>(nlayers);
+        int nlazy = 0;
+        for (int layer = 0; layer < nlayers; ++layer)
+            if (jit_layer_lazily(layer))
+                ++nlazy;
+        group().m_llvm_lazy_layers_pending = nlazy;
+        shadingsys().m_stat_lazy_layers += nlazy;
+    }
+
+    // The profiling ranges are needed even if the code comes from the cache
+    if (m_profile_layers)
+        group().setup_profile_ranges();
+
+    // If the renderer has the object code from an earlier identical JIT of
+    // this group (by this or another process), load it and skip codegen.
+    std::string jit_key;
+    if (use_jit_cache()) {
+        if (load_cached_jit(jit_key)) {
+            shadingsys().m_stat_jit_cache_hits += 1;
+            m_stat_llvm_jit_time += timer.lap();
+            m_stat_total_llvm_time = timer();
+            if (shadingsys().m_compile_report)
+                shadingcontext()->infofmt(
+                    "Loaded cached JIT of shader group {} ({:1.2f}s)",
+                    group().name(), m_stat_total_llvm_time);
+            return;
         }
     }
-    shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
+
+    if (!create_llvm_module())
+        return;
+
+    m_stat_llvm_setup_time += timer.lap();
 
     initialize_llvm_group();
 
-    // Generate the LLVM IR for each layer.  Skip unused layers.
+    // Generate the LLVM IR for each layer.  Skip unused layers, and the
+    // ones that will be JITed when first called.
     m_llvm_local_mem          = 0;
     llvm::Function* init_func = build_llvm_init();
     std::vector<llvm::Function*> funcs(nlayers, NULL);
     for (int layer = 0; layer < nlayers; ++layer) {
         set_inst(layer);
-        if (m_layer_remap[layer] != -1) {
+        if (m_layer_remap[layer] != -1 && !jit_layer_lazily(layer)) {
             // If no entry points were specified, the last layer is special,
             // it's the single entry point for the whole group.
             bool is_single_entry = (layer == (nlayers - 1)
@@ -2461,8 +2663,7 @@ BackendLLVM::run()
             safegroup = fmtformat("TRUNC_{}_{}",
                                   safegroup.substr(safegroup.size() - 235),
                                   group().id());
-        std::string name = fmtformat("{}_O{}.ll", safegroup,
-                                     shadingsys().llvm_optimize());
+        std::string name = fmtformat("{}_O{}.ll", safegroup, llvm_optimize());
         OIIO::ofstream out;
         OIIO::Filesystem::open(out, name);
         if (out) {
@@ -2483,21 +2684,34 @@ BackendLLVM::run()
     } else
 #endif
     {
+        // Ask for a copy of the object code before it is generated, so we
+        // can hand it to the renderer's cache below.
+        std::string object_code;
+        if (use_jit_cache())
+            ll.capture_object_code(&object_code);
+
         // Force the JIT to happen now and retrieve the JITed function pointers
         // for the initialization and all public entry points.
         group().llvm_compiled_init(
             (RunLLVMGroupFunc)ll.getPointerToFunction(init_func));
         for (int layer = 0; layer < nlayers; ++layer) {
             llvm::Function* f = funcs[layer];
-            if (f && group().is_entry_layer(layer))
-                group().llvm_compiled_layer(
-                    layer, (RunLLVMGroupFunc)ll.getPointerToFunction(f));
+            if (f && group().is_entry_layer(layer)) {
+                auto func = (RunLLVMGroupFunc)ll.getPointerToFunction(f);
+                group().llvm_compiled_layer(layer, func);
+                // Lazy layers may call entry layers too, by their slots
+                if (m_lazy_layers)
+                    group().llvm_lazy_layer_slot(layer)->store(func);
+            }
         }
         if (group().num_entry_layers())
             group().llvm_compiled_version(NULL);
         else
             group().llvm_compiled_version(
                 group().llvm_compiled_layer(nlayers - 1));
+
+        if (use_jit_cache() && object_code.size() && jit_key.size())
+            renderer()->cache_insert("llvm_jit", jit_key, object_code);
     }
 
     if (shadingsys().use_optix_cache()) {
@@ -2545,5 +2759,61 @@ BackendLLVM::run()
 
 
 
+
+RunLLVMGroupFunc
+BackendLLVM::run_lazy_layer(int layer)
+{
+    // The caller holds the lock for this group. Its ops are still around
+    // because ShadingSystemImpl::group_post_jit_cleanup leaves them until
+    // the last lazy layer has been JITed.
+    OIIO::Timer timer;
+    m_lazy_layer = layer;
+    setup_layer_remap();
+    if (m_profile_layers)
+        group().setup_profile_ranges();
+    if (!create_llvm_module())
+        return nullptr;
+    m_stat_llvm_setup_time += timer.lap();
+
+    // The groupdata layout comes out just as it did for the whole group.
+    initialize_llvm_group();
+    m_llvm_local_mem = 0;
+    set_inst(layer);
+    llvm::Function* func = build_llvm_instance(false);
+    m_stat_llvm_irgen_time += timer.lap();
+
+    if (shadingsys().llvm_prune_ir_strategy() != "none")
+        ll.prune_and_internalize_module({ func });
+    ll.do_optimize();
+    m_stat_llvm_opt_time += timer.lap();
+
+    auto compiled = (RunLLVMGroupFunc)ll.getPointerToFunction(func);
+    ll.execengine(NULL);
+    ll.module(NULL);
+    m_stat_llvm_jit_time += timer.lap();
+    m_stat_total_llvm_time = timer();
+
+    if (shadingsys().m_compile_report)
+        shadingcontext()->infofmt(
+            "JITed lazy layer {} of shader group {} ({:1.2f}s)",
+            inst()->layername(), group().name(), m_stat_total_llvm_time);
+    return compiled;
+}
+
+
+
+bool
+BackendLLVM::jit_layer_lazily(int layer) const
+{
+    // Entry layers, and the ones the group entry runs unconditionally, are
+    // needed every time the group runs. Only the layers that are run on
+    // demand might never be needed at all.
+    return m_lazy_layers && m_layer_remap[layer] != -1
+           && !group().is_entry_layer(layer) && !group().is_last_layer(layer)
+           && group()[layer]->run_lazily();
+}
+
+
+
 };  // namespace pvt
 OSL_NAMESPACE_END
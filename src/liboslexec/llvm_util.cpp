@@ -7,6 +7,7 @@
 #include <memory>
 
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/thread.h>
 
 #include <OSL/llvm_util.h>
@@ -38,6 +39,7 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/ValueSymbolTable.h>
 #include <llvm/Linker/Linker.h>
+#include <llvm/Object/ObjectFile.h>
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/ErrorOr.h>
 #include <llvm/Support/FileSystem.h>
@@ -61,6 +63,7 @@
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Verifier.h>
@@ -190,6 +193,9 @@ static std::unique_ptr<std::vector<std::shared_ptr<LLVMMemoryManager>>>
     jitmm_hold;
 static int jit_mem_hold_users = 0;
 
+// Prefix of the external symbols made by constant_relocatable_ptr().
+static const char relocatable_ptr_prefix[] = "osl_relocptr.";
+
 
 #if OSL_LLVM_VERSION >= 120
 llvm::raw_os_ostream raw_cout(std::cout);
@@ -272,14 +278,35 @@ LLVM_Util::total_jit_memory_held()
 
 
 
+// Strip the constant_relocatable_ptr() prefix (and any leading underscore
+// added by the platform's symbol mangling) from symname, returning an
+// empty string if it isn't one of ours.
+static string_view
+relocatable_ptr_basename(string_view symname)
+{
+    if (OIIO::Strutil::starts_with(symname, "_"))
+        symname.remove_prefix(1);
+    if (!OIIO::Strutil::parse_prefix(symname, relocatable_ptr_prefix))
+        return string_view();
+    return symname;
+}
+
+
+
 /// MemoryManager - Create a shell that passes on requests
 /// to a real LLVMMemoryManager underneath, but can be retained after the
 /// dummy is destroyed.  Also, we don't pass along any deallocations.
+/// Symbols made by constant_relocatable_ptr() are resolved by the owning
+/// LLVM_Util rather than searched for in the process.
 class LLVM_Util::MemoryManager final : public LLVMMemoryManager {
 protected:
     LLVMMemoryManager* mm;  // the real one
+    const LLVM_Util* util;  // who resolves our relocatable pointers
 public:
-    MemoryManager(LLVMMemoryManager* realmm) : mm(realmm) {}
+    MemoryManager(LLVMMemoryManager* realmm, const LLVM_Util* owner)
+        : mm(realmm), util(owner)
+    {
+    }
 
     void notifyObjectLoaded(llvm::ExecutionEngine* EE,
                             const llvm::object::ObjectFile& oi) override
@@ -319,6 +346,11 @@ public:
 
     llvm::JITSymbol findSymbol(const std::string& Name) override
     {
+        if (util && is_relocatable_ptr_name(Name)) {
+            void* addr = util->resolve_relocatable_ptr(Name);
+            return llvm::JITSymbol(uint64_t(addr),
+                                   llvm::JITSymbolFlags::Exported);
+        }
         return mm->findSymbol(Name);
     }
 
@@ -374,6 +406,31 @@ public:
 
 
 
+/// ObjectCapture - An llvm::ObjectCache that never supplies object code,
+/// but retains a copy of whatever the ExecutionEngine compiles so that the
+/// caller may store it and later hand it back to add_object_code().
+class LLVM_Util::ObjectCapture final : public llvm::ObjectCache {
+public:
+    explicit ObjectCapture(std::string* dest) : m_dest(dest) {}
+
+    void notifyObjectCompiled(const llvm::Module* /*M*/,
+                              llvm::MemoryBufferRef obj) override
+    {
+        m_dest->assign(obj.getBufferStart(), obj.getBufferSize());
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer>
+    getObject(const llvm::Module* /*M*/) override
+    {
+        return nullptr;
+    }
+
+private:
+    std::string* m_dest;
+};
+
+
+
 class LLVM_Util::IRBuilder final
     : public llvm::IRBuilder<llvm::ConstantFolder,
                              llvm::IRBuilderDefaultInserter> {
@@ -575,6 +632,7 @@ LLVM_Util::ustring_rep(UstringRep rep)
 LLVM_Util::~LLVM_Util()
 {
     execengine(NULL);
+    delete m_object_capture;
     delete m_llvm_module_passes;
     delete m_llvm_func_passes;
     delete m_new_pass_manager;
@@ -1517,7 +1575,7 @@ LLVM_Util::make_jit_execengine(std::string* err, TargetISA requestedISA,
     // We are actually holding a LLVMMemoryManager
     engine_builder.setMCJITMemoryManager(
         std::unique_ptr<llvm::RTDyldMemoryManager>(
-            new MemoryManager(m_llvm_jitmm)));
+            new MemoryManager(m_llvm_jitmm, this)));
 
 #if OSL_LLVM_VERSION >= 180
     engine_builder.setOptLevel(jit_aggressive()
@@ -1789,6 +1847,8 @@ LLVM_Util::execengine(llvm::ExecutionEngine* exec)
         delete m_llvm_exec;
     }
     m_llvm_exec = exec;
+    // Nothing in a new engine has been finalized yet
+    m_ModuleIsFinalized = false;
 }
 
 
@@ -1873,6 +1933,18 @@ LLVM_Util::add_global_mapping(const char* global_var_name,
     llvm::sys::DynamicLibrary::AddSymbol(global_var_name, global_var_addr);
 }
 
+void*
+LLVM_Util::getPointerToFunction(const std::string& name)
+{
+    llvm::ExecutionEngine* exec = execengine();
+    if (!m_ModuleIsFinalized) {
+        exec->finalizeObject();
+        m_ModuleIsFinalized = true;
+    }
+    return (void*)(uintptr_t)exec->getFunctionAddress(name);
+}
+
+
 void
 LLVM_Util::InstallLazyFunctionCreator(void* (*P)(const std::string&))
 {
@@ -1882,6 +1954,66 @@ LLVM_Util::InstallLazyFunctionCreator(void* (*P)(const std::string&))
 
 
 
+void
+LLVM_Util::capture_object_code(std::string* obj)
+{
+    llvm::ExecutionEngine* exec = execengine();
+    ObjectCapture* capture      = obj ? new ObjectCapture(obj) : nullptr;
+    exec->setObjectCache(capture);
+    delete m_object_capture;
+    m_object_capture = capture;
+}
+
+
+
+bool
+LLVM_Util::add_object_code(string_view obj, std::string* err)
+{
+    std::unique_ptr<llvm::MemoryBuffer> buffer
+        = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(obj.data(),
+                                                               obj.size()),
+                                               "osl_object_code");
+    auto objfile = llvm::object::ObjectFile::createObjectFile(
+        buffer->getMemBufferRef());
+    if (!objfile) {
+        error_string(objfile.takeError(), err);
+        return false;
+    }
+
+    // An unresolved symbol is a fatal error once the object is linked, so
+    // make sure every relocatable pointer can be resolved before we commit
+    // to using this object code.
+    for (const llvm::object::SymbolRef& sym : (*objfile)->symbols()) {
+        llvm::Expected<uint32_t> flags = sym.getFlags();
+        if (!flags) {
+            llvm::consumeError(flags.takeError());
+            continue;
+        }
+        if (!(*flags & llvm::object::SymbolRef::SF_Undefined))
+            continue;
+        llvm::Expected<llvm::StringRef> name = sym.getName();
+        if (!name) {
+            llvm::consumeError(name.takeError());
+            continue;
+        }
+        string_view symname(name->data(), name->size());
+        if (is_relocatable_ptr_name(symname)
+            && !resolve_relocatable_ptr(symname)) {
+            if (err)
+                *err = fmtformat("Could not resolve relocatable pointer {}",
+                                 symname);
+            return false;
+        }
+    }
+
+    execengine()->addObjectFile(
+        llvm::object::OwningBinary<llvm::object::ObjectFile>(
+            std::move(*objfile), std::move(buffer)));
+    return true;
+}
+
+
+
 void
 LLVM_Util::setup_optimization_passes(int optlevel, bool target_host)
 {
@@ -3017,7 +3149,8 @@ LLVM_Util::validate_global_mappings(
     std::vector<std::string>& names_of_unmapped_globals)
 {
     for (llvm::GlobalVariable& global : m_llvm_module->globals()) {
-        if (global.hasExternalLinkage()) {
+        if (global.hasExternalLinkage()
+            && !is_relocatable_ptr_name(global.getName().str())) {
             void* global_addr
                 = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(
                     global.getName().data());
@@ -3548,6 +3681,42 @@ LLVM_Util::constant_ptr(void* p, llvm::PointerType* type)
 
 
 
+llvm::Value*
+LLVM_Util::constant_relocatable_ptr(string_view name, llvm::PointerType* type)
+{
+    if (!type)
+        type = type_void_ptr();
+    std::string symname = fmtformat("{}{}", relocatable_ptr_prefix, name);
+    llvm::GlobalVariable* global = module()->getNamedGlobal(symname);
+    if (!global)
+        global = new llvm::GlobalVariable(*module(), type_int8(),
+                                          true /*isConstant*/,
+                                          llvm::GlobalValue::ExternalLinkage,
+                                          nullptr /*no initializer*/, symname);
+    return ptr_cast(global, type);
+}
+
+
+
+bool
+LLVM_Util::is_relocatable_ptr_name(string_view symname)
+{
+    return !relocatable_ptr_basename(symname).empty();
+}
+
+
+
+void*
+LLVM_Util::resolve_relocatable_ptr(string_view symname) const
+{
+    string_view name = relocatable_ptr_basename(symname);
+    if (name.empty() || !m_relocatable_ptr_resolver)
+        return nullptr;
+    return m_relocatable_ptr_resolver(name);
+}
+
+
+
 llvm::Value*
 LLVM_Util::constant(ustring s)
 {
@@ -4382,6 +4551,20 @@ LLVM_Util::call_function(llvm::Value* func, cspan<llvm::Value*> args)
 
 
 
+llvm::Value*
+LLVM_Util::call_function(llvm::FunctionType* functype, llvm::Value* func,
+                         cspan<llvm::Value*> args)
+{
+    OSL_DASSERT(functype && func);
+    func = builder().CreatePointerCast(func,
+                                       llvm::PointerType::getUnqual(functype));
+    return builder().CreateCall(functype, func,
+                                llvm::ArrayRef<llvm::Value*>(args.data(),
+                                                             args.size()));
+}
+
+
+
 llvm::Value*
 LLVM_Util::call_function(const char* name, cspan<llvm::Value*> args)
 {
@@ -4497,6 +4680,17 @@ LLVM_Util::op_load(llvm::Type* type, llvm::Value* ptr,
 
 
 
+llvm::Value*
+LLVM_Util::op_load_acquire(llvm::Type* type, llvm::Value* ptr,
+                           const std::string& llname)
+{
+    auto load = llvm::cast<llvm::LoadInst>(op_load(type, ptr, llname));
+    load->setAtomic(llvm::AtomicOrdering::Acquire);
+    return load;
+}
+
+
+
 llvm::Value*
 LLVM_Util::op_linearize_16x_indices(llvm::Value* wide_index)
 {
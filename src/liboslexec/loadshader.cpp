@@ -330,16 +330,15 @@ OSOReaderToMaster::hint(string_view hintstring)
     if (Strutil::parse_prefix(h, "%structfields{")
         && m_master->m_symbols.size()) {
         Symbol& sym(m_master->m_symbols.back());
-        StructSpec* structspec = sym.typespec().structspec();
-        if (structspec->numfields() == 0) {
-            while (1) {
-                std::string afield = Strutil::parse_until(h, ",}");
-                Strutil::parse_char(h, ',');  // skip the separator
-                if (!afield.length())
-                    break;
-                structspec->add_field(TypeSpec(), ustring(afield));
-            }
+        std::vector<ustring> fields;
+        while (1) {
+            string_view afield = Strutil::parse_until(h, ",}");
+            Strutil::parse_char(h, ',');  // skip the separator
+            if (!afield.length())
+                break;
+            fields.emplace_back(afield);
         }
+        TypeSpec::add_struct_fields(sym.typespec().structure(), fields);
         return;
     }
     if (Strutil::parse_prefix(h, "%mystructfield{")
@@ -558,7 +557,11 @@ ShadingSystemImpl::loadshader(string_view cname)
     }
     ++m_stat_shaders_requested;
     ustring name(cname);
-    lock_guard guard(m_mutex);  // Thread safety
+    std::unique_lock<mutex> lock(m_mutex);  // Thread safety
+    // If another thread is reading this shader right now, wait for it
+    // rather than reading it a second time.
+    m_shader_loaded_cv.wait(lock,
+                            [&]() { return !m_shaders_loading.count(name); });
     ShaderNameMap::const_iterator found = m_shader_masters.find(name);
     if (found != m_shader_masters.end()) {
         // if (debug())
@@ -567,29 +570,65 @@ ShadingSystemImpl::loadshader(string_view cname)
         return (*found).second;
     }
 
-    // Not found in the map
+    // Not found in the map. Read it without holding the lock, so that
+    // other shaders can be loaded at the same time.
+    m_shaders_loading.insert(name);
+    lock.unlock();
+    ShaderMaster::ref r = read_master(name);
+    lock.lock();
+    // A shader loaded from memory in the meantime takes precedence.
+    r = m_shader_masters.emplace(name, r).first->second;
+    m_shaders_loading.erase(name);
+    lock.unlock();
+    m_shader_loaded_cv.notify_all();
+    return r;
+}
+
+
+
+ShaderMaster::ref
+ShadingSystemImpl::read_master(ustring name)
+{
     OSOReaderToMaster oso(*this);
-    bool testcwd
-        = m_searchpath_dirs.empty();  // test "." if there's no searchpath
-    std::string filename
-        = OIIO::Filesystem::searchpath_find(name.string() + ".oso",
-                                            m_searchpath_dirs, testcwd);
-    if (filename.empty()) {
+    std::string filename = find_shader_file(name.string() + ".oso");
+    // A precompiled .osb next to the .oso is preferred if it was made from
+    // that .oso. Without an .oso, an .osb alone on the searchpath is used.
+    std::string binfilename;
+    if (m_oso_binary && filename.size())
+        binfilename = OIIO::Filesystem::replace_extension(filename, ".osb");
+    else if (m_oso_binary)
+        binfilename = find_shader_file(name.string() + ".osb");
+    if (filename.empty() && binfilename.empty()) {
         errorfmt("No .oso file could be found for shader \"{}\"", name);
         return NULL;
     }
     OIIO::Timer timer;
-    bool ok                = oso.parse_file(filename);
-    ShaderMaster::ref r    = ok ? oso.master() : nullptr;
-    m_shader_masters[name] = r;
-    double loadtime        = timer();
+    ShaderMaster::ref r;
+    if (binfilename.size() && OIIO::Filesystem::exists(binfilename)) {
+        std::string err;
+        r = ShaderMaster::read_binary(*this, binfilename, filename, err);
+        if (!r && filename.empty())
+            errorfmt("Precompiled shader \"{}\" {}", binfilename, err);
+        else if (!r)
+            infofmt("Not using precompiled shader \"{}\": {}", binfilename,
+                    err);
+    }
+    bool binary = r != nullptr;
+    bool ok     = binary;
+    if (!binary && filename.size()) {
+        ok = oso.parse_file(filename);
+        r  = ok ? oso.master() : nullptr;
+    }
+    double loadtime = timer();
     {
         spin_lock lock(m_stat_mutex);
         m_stat_master_load_time += loadtime;
     }
     if (ok) {
         ++m_stat_shaders_loaded;
-        infofmt("Loaded \"{}\" (took {})", filename,
+        if (binary)
+            ++m_stat_shaders_loaded_binary;
+        infofmt("Loaded \"{}\" (took {})", binary ? binfilename : filename,
                 Strutil::timeintervalformat(loadtime, 2));
         OSL_DASSERT(r);
         r->resolve_syms();
@@ -598,7 +637,12 @@ ShadingSystemImpl::loadshader(string_view cname)
         //     if (s.length())
         //         infofmt("{}", s);
         // }
-    } else {
+        std::string err;
+        if (!binary && m_oso_binary >= 2
+            && !r->write_binary(binfilename, filename, err))
+            infofmt("Could not write precompiled shader \"{}\": {}",
+                    binfilename, err);
+    } else if (filename.size()) {
         errorfmt("Unable to read \"{}\"", filename);
     }
 
@@ -607,6 +651,109 @@ ShadingSystemImpl::loadshader(string_view cname)
 
 
 
+std::string
+ShadingSystemImpl::find_shader_file(const std::string& filename)
+{
+    std::vector<std::string> dirs;
+    std::string path;
+    {
+        lock_guard lock(m_searchpath_index_mutex);
+        // The index only knows plain file names.
+        bool indexable = (OIIO::Filesystem::filename(filename) == filename);
+        if (indexable && !m_searchpath_indexed) {
+            // List the searchpath just once, until it's changed. Earlier
+            // directories on the searchpath take precedence.
+            std::vector<std::string> indexdirs = m_searchpath_dirs;
+            if (indexdirs.empty())
+                indexdirs.emplace_back(".");  // test "." if no searchpath
+            for (auto&& dir : indexdirs) {
+                std::vector<std::string> entries;
+                OIIO::Filesystem::get_directory_entries(dir, entries);
+                for (auto&& entry : entries) {
+                    std::string ext = OIIO::Filesystem::extension(entry);
+                    if (ext == ".oso" || ext == ".osb")
+                        m_searchpath_index.emplace(
+                            OIIO::Filesystem::filename(entry), entry);
+                }
+            }
+            m_searchpath_indexed = true;
+        }
+        auto found = indexable ? m_searchpath_index.find(filename)
+                               : m_searchpath_index.end();
+        if (found != m_searchpath_index.end())
+            path = found->second;
+        else
+            dirs = m_searchpath_dirs;
+    }
+    if (path.size() && OIIO::Filesystem::exists(path))
+        return path;
+    // Not in the index (like the .oso of a shader that only comes as an
+    // .osb, or a file added since), or its file has gone since: search
+    // for it the slow way, but don't rebuild the index for it.
+    if (path.size()) {
+        lock_guard lock(m_searchpath_index_mutex);
+        dirs = m_searchpath_dirs;
+    }
+    return OIIO::Filesystem::searchpath_find(filename, dirs, dirs.empty());
+}
+
+
+
+bool
+ShadingSystemImpl::preload_shaders(cspan<ustring> shadernames, int nthreads)
+{
+    if (shadernames.empty())
+        return true;
+    if (nthreads < 1)  // threads <= 0 means use all hardware available
+        nthreads = (int)std::thread::hardware_concurrency();
+    nthreads = std::max(1, std::min(nthreads, (int)shadernames.size()));
+
+    // Each thread loads the next shader on the list until it's exhausted.
+    // Two threads asking for the same shader just share one read of it.
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    int loaded_before = m_stat_shaders_loaded;
+    auto worker = [&](int /*id*/) {
+        for (size_t i; (i = next++) < shadernames.size();)
+            if (!loadshader(shadernames[i]))
+                ok = false;
+    };
+    if (nthreads == 1) {
+        worker(-1);
+    } else {
+        // The calling thread does its share of the work, too.
+        OIIO::thread_pool* pool = compile_pool(nthreads - 1);
+        OIIO::task_set tasks(pool);
+        for (int t = 1; t < nthreads; ++t)
+            tasks.push(pool->push(worker));
+        worker(0);
+        tasks.wait();
+    }
+    m_stat_shaders_preloaded += m_stat_shaders_loaded - loaded_before;
+    return ok;
+}
+
+
+
+bool
+ShadingSystemImpl::preload_shader_manifest(string_view filename, int nthreads)
+{
+    std::string manifest;
+    if (!OIIO::Filesystem::read_text_file(filename, manifest)) {
+        errorfmt("Could not read shader manifest \"{}\"", filename);
+        return false;
+    }
+    std::vector<ustring> shadernames;
+    for (string_view line : Strutil::splitsv(manifest, "\n")) {
+        line = Strutil::strip(line);
+        if (line.size() && line.front() != '#')
+            shadernames.emplace_back(line);
+    }
+    return preload_shaders(shadernames, nthreads);
+}
+
+
+
 bool
 ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
                                             string_view buffer)
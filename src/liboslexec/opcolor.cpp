@@ -319,6 +319,22 @@ ColorSystem::from_rgb(ustringhash tospace, const Color3& C, ShadingContext* ctx,
 
 
 
+OSL_HOSTDEVICE bool
+ColorSystem::uses_colorconfig(ustringhash fromspace, ustringhash tospace) const
+{
+    // NOTE: keep in sync with the spaces handled by transformc below
+    auto builtin = [&](ustringhash space) {
+        return space == Hashes::RGB || space == Hashes::rgb
+               || space == Hashes::linear || space == m_colorspace
+               || space == Hashes::hsv || space == Hashes::hsl
+               || space == Hashes::YIQ || space == Hashes::XYZ
+               || space == Hashes::xyY || space == Hashes::sRGB;
+    };
+    return !builtin(fromspace) || !builtin(tospace);
+}
+
+
+
 template<typename COLOR>
 OSL_HOSTDEVICE COLOR
 ColorSystem::transformc(ustringhash fromspace, ustringhash tospace,
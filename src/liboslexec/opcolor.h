@@ -116,6 +116,11 @@ public:
         return m_colorspace;
     }
 
+    /// Return true if transformc from fromspace to tospace is not one of
+    /// the built-in conversions, and so is done by the color config.
+    OSL_HOSTDEVICE bool uses_colorconfig(ustringhash fromspace,
+                                         ustringhash tospace) const;
+
 private:
     template<typename Color>
     OSL_HOSTDEVICE inline Color
@@ -141,6 +146,30 @@ private:
 };
 
 
+/// A color config transform that turned out to be affine, which can be
+/// applied directly (and differentiated exactly) rather than through the
+/// OCIO processor: Cout = C * linear + offset.
+struct OCIOAffineTransform {
+    Matrix33 linear;
+    Color3 offset;
+
+    template<typename COLOR>
+    OSL_HOSTDEVICE COLOR apply(const COLOR& C) const
+    {
+        return C * linear + offset;
+    }
+
+    /// The same transform as a Matrix44, for the transform op.
+    Matrix44 matrix() const
+    {
+        return Matrix44(linear[0][0], linear[0][1], linear[0][2], 0.0f,
+                        linear[1][0], linear[1][1], linear[1][2], 0.0f,
+                        linear[2][0], linear[2][1], linear[2][2], 0.0f,
+                        offset[0], offset[1], offset[2], 1.0f);
+    }
+};
+
+
 class OCIOColorSystem {
 #ifndef __CUDACC__
 public:
@@ -148,6 +177,12 @@ public:
                                               ustring tospace,
                                               ShadingSystemImpl* shadingsys);
 
+    /// If the transform from fromspace to tospace is affine, store it in
+    /// xform and return true.
+    bool affine_transform(ustring fromspace, ustring tospace,
+                          ShadingSystemImpl* shadingsys,
+                          OCIOAffineTransform& xform);
+
 private:
     const OIIO::ColorConfig& colorconfig(ShadingSystemImpl* shadingsys);
 
@@ -158,9 +193,20 @@ private:
     OIIO::ColorProcessorHandle m_last_colorproc;
     ustring m_last_colorproc_fromspace;
     ustring m_last_colorproc_tospace;
+    bool m_last_colorproc_affine = false;
+    OCIOAffineTransform m_last_colorproc_xform;
 #endif
 };
 
+
+#ifndef __CUDACC__
+/// Decide whether a color processor is an affine transform. If it is,
+/// store it in xform and return true.
+bool
+probe_affine_transform(const OIIO::ColorProcessor& cp,
+                       OCIOAffineTransform& xform);
+#endif
+
 }  // namespace pvt
 
 
@@ -10,7 +10,9 @@
 ///
 /////////////////////////////////////////////////////////////////////////
 
+#include <cctype>
 #include <cstdarg>
+#include <cstring>
 
 #include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/fmath.h>
@@ -132,39 +134,148 @@ osl_substr_ssii(ustringhash_pod s_, int start, int length)
 }
 
 
-OSL_SHADEOP int
-osl_regex_impl(void* sg_, ustringhash_pod subject_, void* results, int nresults,
-               ustringhash_pod pattern_, int fullmatch)
+namespace {
+
+// If pattern is a literal string, possibly with escaped punctuation,
+// store the unescaped text in literal and return true. Return false if
+// it uses any regex constructs beyond that.
+bool
+regex_literal(string_view pattern, std::string& literal)
 {
-    ShaderGlobals* sg        = (ShaderGlobals*)sg_;
-    ShadingContext* ctx      = sg->context;
-    ustringhash subject_hash = ustringhash_from(subject_);
-    ustring subject_ustr     = ustring_from(subject_hash);
-    const std::string& subject(subject_ustr.string());
-    ustringhash pattern_hash = ustringhash_from(pattern_);
-    ustring pattern          = ustring_from(pattern_hash);
-    std::match_results<std::string::const_iterator> mresults;
-    const std::regex& regex(ctx->find_regex(pattern));
-    if (nresults > 0) {
-        std::string::const_iterator start = subject.begin();
-        int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                            : std::regex_search(subject, mresults, regex);
-        int* m  = (int*)results;
+    literal.clear();
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        char c = pattern[i];
+        if (c == '\\') {
+            // "\." etc. stand for the punctuation itself, but "\d", "\b",
+            // "\1" and so on are character classes, assertions, or
+            // backreferences.
+            if (i + 1 == pattern.size()
+                || !ispunct((unsigned char)pattern[i + 1]))
+                return false;
+            literal += pattern[++i];
+        } else if (strchr("^$.|?*+()[]{}", c)) {
+            return false;
+        } else {
+            literal += c;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+
+
+CompiledRegex::CompiledRegex(string_view pattern)
+    : m_kind(General)
+    , m_patternlen(int(pattern.size()))
+{
+    string_view p     = pattern;
+    bool anchor_begin = Strutil::starts_with(p, "^");
+    if (anchor_begin)
+        p.remove_prefix(1);
+    bool anchor_end = p.size() && p.back() == '$'
+                      && (p.size() < 2 || p[p.size() - 2] != '\\');
+    if (anchor_end)
+        p.remove_suffix(1);
+    if (regex_literal(p, m_literal)) {
+        m_kind = anchor_begin ? (anchor_end ? Exact : Prefix)
+                              : (anchor_end ? Suffix : Literal);
+    } else {
+        m_literal.clear();
+        m_regex.reset(new std::regex(pattern.begin(), pattern.end()));
+    }
+}
+
+
+
+bool
+CompiledRegex::match(string_view subject, bool fullmatch, int* results,
+                     int nresults) const
+{
+    if (m_kind == General) {
+        std::cmatch mresults;
+        const char* begin = subject.data();
+        const char* end   = begin + subject.size();
+        bool res = fullmatch ? std::regex_match(begin, end, mresults, *m_regex)
+                             : std::regex_search(begin, end, mresults,
+                                                 *m_regex);
         for (int r = 0; r < nresults; ++r) {
             if (r / 2 < (int)mresults.size()) {
                 if ((r & 1) == 0)
-                    m[r] = mresults[r / 2].first - start;
+                    results[r] = mresults[r / 2].first - begin;
                 else
-                    m[r] = mresults[r / 2].second - start;
+                    results[r] = mresults[r / 2].second - begin;
             } else {
-                m[r] = pattern.length();
+                results[r] = m_patternlen;
             }
         }
         return res;
+    }
+
+    // Simple kinds: there are no subexpressions, so the only result is
+    // the extent of the whole match.
+    size_t len = m_literal.size();
+    size_t pos = string_view::npos;
+    if (fullmatch || m_kind == Exact) {
+        if (subject == m_literal)
+            pos = 0;
+    } else if (m_kind == Prefix) {
+        if (Strutil::starts_with(subject, m_literal))
+            pos = 0;
+    } else if (m_kind == Suffix) {
+        if (Strutil::ends_with(subject, m_literal))
+            pos = subject.size() - len;
     } else {
-        return fullmatch ? std::regex_match(subject, regex)
-                         : std::regex_search(subject, regex);
+        pos = subject.find(m_literal);
+    }
+    bool res = (pos != string_view::npos);
+    for (int r = 0; r < nresults; ++r) {
+        if (res && r < 2)
+            results[r] = int(r == 0 ? pos : pos + len);
+        else
+            results[r] = m_patternlen;
+    }
+    return res;
+}
+
+
+
+const CompiledRegex&
+ShadingSystemImpl::find_regex(ustring pattern)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(m_regex_mutex);
+        auto found = m_regex_map.find(pattern);
+        if (found != m_regex_map.end())
+            return *found->second;
     }
+    // Compile without holding the lock. If another thread got there
+    // first, keep theirs and discard ours.
+    std::unique_ptr<CompiledRegex> regex(new CompiledRegex(pattern));
+    std::unique_lock<std::shared_mutex> lock(m_regex_mutex);
+    auto& entry = m_regex_map[pattern];
+    if (!entry) {
+        entry = std::move(regex);
+        m_stat_regexes += 1;
+    }
+    return *entry;
+}
+
+
+
+OSL_SHADEOP int
+osl_regex_impl(void* sg_, ustringhash_pod subject_, void* results, int nresults,
+               ustringhash_pod pattern_, int fullmatch)
+{
+    ShaderGlobals* sg        = (ShaderGlobals*)sg_;
+    ShadingContext* ctx      = sg->context;
+    ustringhash subject_hash = ustringhash_from(subject_);
+    ustring subject          = ustring_from(subject_hash);
+    ustringhash pattern_hash = ustringhash_from(pattern_);
+    ustring pattern          = ustring_from(pattern_hash);
+    const CompiledRegex& regex(ctx->find_regex(pattern));
+    return regex.match(subject, fullmatch, (int*)results, nresults);
 }
 
 // TODO: transition format to from llvm_gen_printf_legacy
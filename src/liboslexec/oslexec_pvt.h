@@ -4,11 +4,16 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <cstring>
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <regex>
 #include <set>
+#include <shared_mutex>
 #include <stack>
 #include <string>
 #include <unordered_map>
@@ -92,6 +97,7 @@ class ShadingSystemImpl;
 class ShaderInstance;
 typedef std::shared_ptr<ShaderInstance> ShaderInstanceRef;
 class Dictionary;
+class PointCloud;
 class RuntimeOptimizer;
 class BackendLLVM;
 #if OSL_USE_BATCHED
@@ -446,11 +452,31 @@ public:
 
     int num_params() const { return m_lastparam - m_firstparam; }
 
+    /// Number of ops in the master's (unoptimized) code.
+    size_t nops() const { return m_ops.size(); }
+
     int raytype_queries() const { return m_raytype_queries; }
 
     bool range_checking() const { return m_range_checking; }
     void range_checking(bool b) { m_range_checking = b; }
 
+    /// Write the (resolved) master to filename in the precompiled binary
+    /// form that read_binary() loads, recording the size and modification
+    /// time of osofilename, the .oso it was read from. Return true if it
+    /// was written, or false with an explanation in err.
+    bool write_binary(const std::string& filename,
+                      const std::string& osofilename, std::string& err) const;
+
+    /// Load a master from the precompiled binary file written by
+    /// write_binary(), mapping it into memory rather than reading it. If
+    /// osofilename is not empty, the binary is only used if it was made
+    /// from that .oso file as it is now. The master still needs
+    /// resolve_syms(). Return nullptr, with an explanation in err, if the
+    /// file can't be used.
+    static ref read_binary(ShadingSystemImpl& shadingsys,
+                           const std::string& filename,
+                           const std::string& osofilename, std::string& err);
+
 private:
     ShadingSystemImpl& m_shadingsys;  ///< Back-ptr to the shading system
     ShaderType m_shadertype;          ///< Type of shader
@@ -521,6 +547,65 @@ private:
 
 
 
+/// Where the shading time of a group went, as measured when the
+/// "profile_layers" option is on: the time spent in each layer (not
+/// counting layers it ran in turn), and the time spent in each range of
+/// a layer's ops that come from one source line.
+struct LayerProfile {
+    struct Range {
+        int layer;
+        ustring sourcefile;
+        int sourceline;
+    };
+    ustring groupname;
+    std::vector<ustring> layernames;
+    std::vector<Range> ranges;
+    std::vector<long long> layer_ticks;
+    std::vector<long long> layer_calls;
+    std::vector<long long> range_ticks;
+};
+
+
+
+/// A compiled pattern for regex_search and regex_match.  Patterns that are
+/// just a literal string, optionally anchored with '^' and/or '$' (by far
+/// the most common case in name-based shader logic), are matched with
+/// plain string comparisons; anything else falls back to std::regex.
+/// A CompiledRegex is immutable once constructed, so one may be shared by
+/// any number of threads.
+class CompiledRegex {
+public:
+    /// Compile the pattern. Throws std::regex_error if it is malformed.
+    explicit CompiledRegex(string_view pattern);
+
+    /// Return true if the subject matches (fullmatch) or contains a match
+    /// (!fullmatch) of the pattern, with the same semantics as
+    /// std::regex_match/std::regex_search. If nresults > 0, results[] is
+    /// filled with the begin/end offsets of the whole match and of each
+    /// subexpression, and any entries beyond those with the length of the
+    /// pattern.
+    bool match(string_view subject, bool fullmatch, int* results = nullptr,
+               int nresults = 0) const;
+
+    /// Is this pattern matched without resorting to std::regex?
+    bool is_simple() const { return m_kind != General; }
+
+private:
+    enum Kind {
+        Literal,  // "abc"   -- subject contains abc
+        Prefix,   // "^abc"  -- subject starts with abc
+        Suffix,   // "abc$"  -- subject ends with abc
+        Exact,    // "^abc$" -- subject is abc
+        General   // anything else, use std::regex
+    };
+    Kind m_kind;
+    int m_patternlen;                     // length of the original pattern
+    std::string m_literal;                // the literal text, simple kinds
+    std::unique_ptr<std::regex> m_regex;  // for General only
+};
+
+
+
 class ShadingSystemImpl {
 public:
     ShadingSystemImpl(RendererServices* renderer   = NULL,
@@ -567,6 +652,10 @@ public:
                         string_view dstlayer, string_view dstparam);
     ShaderGroupRef ShaderGroupBegin(string_view groupname, string_view usage,
                                     string_view groupspec);
+    // Add the layers, params, and connections of groupspec (in the form
+    // taken by ShaderGroupBegin) to group. Return false on a parse error.
+    bool parse_groupspec(ShaderGroup& group, string_view usage,
+                         string_view groupspec);
     bool ReParameter(ShaderGroup& group, string_view layername,
                      string_view paramname, TypeDesc type, const void* val);
 
@@ -606,6 +695,23 @@ public:
 
     ShaderMaster::ref loadshader(string_view name);
 
+    /// Find and read the master for a shader that isn't loaded yet. This
+    /// is the part of loadshader() done without holding m_mutex.
+    ShaderMaster::ref read_master(ustring name);
+
+    /// Find a shader file (.oso or .osb) on the shader searchpath. The
+    /// contents of the searchpath directories are indexed on first use,
+    /// so that each lookup isn't a stat of every directory; files that
+    /// appear after that are still found by searching the directories.
+    std::string find_shader_file(const std::string& filename);
+
+    /// Load all the named shaders, using up to nthreads threads (0 means
+    /// as many as the hardware has) from the compile pool.
+    bool preload_shaders(cspan<ustring> shadernames, int nthreads = 0);
+
+    /// Preload the shaders named in a manifest file, one per line.
+    bool preload_shader_manifest(string_view filename, int nthreads = 0);
+
     PerThreadInfo* create_thread_info();
 
     void destroy_thread_info(PerThreadInfo* threadinfo);
@@ -639,6 +745,7 @@ public:
 
     bool use_optix() const { return m_use_optix; }
     bool use_optix_cache() const { return m_use_optix_cache; }
+    bool use_jit_cache() const { return m_use_jit_cache; }
     bool debug_nan() const { return m_debugnan; }
     bool debug_uninit() const { return m_debug_uninit; }
     bool lockgeom_default() const { return m_lockgeom_default; }
@@ -678,6 +785,8 @@ public:
     bool lazy_trace() const { return m_lazy_trace; }
     bool userdata_isconnected() const { return m_userdata_isconnected; }
     int profile() const { return m_profile; }
+    int profile_layers() const { return m_profile_layers; }
+    bool llvm_lazy_layers() const { return m_llvm_lazy_layers; }
     bool no_noise() const { return m_no_noise; }
     bool no_pointcloud() const { return m_no_pointcloud; }
     bool force_derivs() const { return m_force_derivs; }
@@ -747,8 +856,113 @@ public:
 
     OSLEXECPUBLIC int raytype_bit(ustring name);
 
-    void optimize_all_groups(int nthreads = 0, int mythread = 0,
-                             int totalthreads = 1, bool do_jit = true);
+    void optimize_all_groups(int nthreads = 0, bool do_jit = true);
+
+    /// Call compile(group, ctx) for every live group for which
+    /// needs_compile(group) is true, using up to nthreads threads (0 means
+    /// as many as the hardware has) from a pool that persists between
+    /// calls. Groups are handed out most expensive first, one at a time,
+    /// so that no thread is left with a long tail of work while the others
+    /// sit idle.
+    void compile_all_groups(
+        int nthreads,
+        const std::function<bool(const ShaderGroup&)>& needs_compile,
+        const std::function<void(ShaderGroup&, ShadingContext*)>& compile);
+
+    /// Queue the group to be optimized and JITed by the background compile
+    /// threads (option "async_jit"). A shading thread that needs it before
+    /// they get to it just compiles it itself, as usual, and one that needs
+    /// it while it's being compiled waits for it to finish.
+    void compile_group_async(ShaderGroup& group);
+
+    /// Queue, with compile_group_async, every group ended since the last
+    /// call that hasn't been compiled by a shading thread in the meantime.
+    void start_async_compiles();
+
+    /// Call after changing a group attribute that the optimizer depends on
+    /// (renderer outputs, entry layers, symbol locations). If the group was
+    /// queued by compile_group_async and its compile has already used the
+    /// old values, rebuild it from its declaration and queue that instead.
+    /// That only happens if the renderer changes them after calling
+    /// start_async_compiles().
+    void recompile_group_async(ShaderGroup& group);
+
+    /// Tiered JIT: queue a hot group, whose current code was JITed with
+    /// minimal LLVM optimization, to be JITed again at the full
+    /// llvm_optimize level in the background and swapped in.
+    void tier_up_group_async(ShaderGroup& group);
+
+    /// Run task on a compile_pool thread (of at least nthreads), unless
+    /// the shading system is shutting down by then. Until it's done, it
+    /// counts in "stat:async_compiles_pending".
+    void push_async_compile(int nthreads, std::function<void()> task);
+
+    /// Option "llvm_lazy_layers": JIT a layer that was left out of its
+    /// group's JIT, and return its code. Threads that call it at the same
+    /// time wait for the one that compiles it, and all share the result.
+    RunLLVMGroupFunc jit_lazy_layer(ShaderGroup& group, int layer,
+                                    ShadingContext* ctx);
+
+    /// Return the persistent pool of compile threads, making sure it has at
+    /// least nthreads threads.
+    OIIO::thread_pool* compile_pool(int nthreads);
+
+    /// Option "dedup_groups": if an identical group (by dedup_key) has
+    /// already been seen, return it so that this group can share its
+    /// compiled code. Otherwise remember this group as the one to share
+    /// with any later duplicates, and return an empty ref.
+    ShaderGroupRef find_dedup_source(ShaderGroup& group);
+
+    /// Option "reparam_respecialize": rebuild the group from its
+    /// declaration, with the given layer param set to val (and, if the
+    /// group was already optimized, made interactive so that the next
+    /// edit needn't do this again). The whole group is re-optimized and
+    /// re-JITed the next time it is run, and shares the result: the group
+    /// data layout and the optimizer's cross-layer folding both depend on
+    /// every layer, so not even lazily JITed layers' code can be kept.
+    bool respecialize_group(ShaderGroup& group, int layer, ustring paramname,
+                            TypeDesc type, const void* val);
+
+    /// Set an interactive layer param of a group that has yet to be
+    /// optimized, as its instance value. Return false if the group has
+    /// been optimized, or the param isn't interactive or of that type.
+    bool set_instance_param(ShaderGroup& group, int layer, ustring paramname,
+                            TypeDesc type, const void* val);
+
+    /// Make a new group from the declaration of group, giving each of
+    /// params (with its hints) to the corresponding entry of layers, after
+    /// the declared values. Return an empty ref on failure.
+    ShaderGroupRef rebuild_group(ShaderGroup& group, cspan<int> layers,
+                                 const ParamValueList& params,
+                                 cspan<ParamHints> hints);
+
+    /// Have group take on the layers of fresh, a rebuild of it, and share
+    /// its compiled code: now if it's compiled, otherwise the next time
+    /// the group is run.
+    void adopt_rebuilt_group(ShaderGroup& group, ShaderGroupRef fresh);
+
+    /// Option "auto_interactive": count an edit of a layer param in the
+    /// named group.
+    void note_param_edit(ustring groupname, ustring layername,
+                         ustring paramname);
+
+    /// Option "auto_interactive": count the params whose values differ
+    /// from the last declaration of a group of the same name as edited,
+    /// then make interactive those that have been edited often enough.
+    /// The group's serialized declaration is passed in.
+    void promote_edited_params(ShaderGroup& group, string_view declaration);
+
+    int settle_interactive_params();
+
+    /// Return the dictionary store shared by all ShadingContexts, which
+    /// holds the parsed documents and cached dict_find/dict_value queries.
+    Dictionary* dictionary();
+    void free_dict_resources();
+
+    /// Return the compiled form of the regex pattern, compiling it only
+    /// the first time any thread asks for it. The result is shared by all
+    /// threads and lives as long as the ShadingSystem.
+    const CompiledRegex& find_regex(ustring pattern);
 
     typedef std::unordered_map<ustring, OpDescriptor> OpDescriptorMap;
 
@@ -788,6 +1002,22 @@ public:
 
     std::shared_ptr<OIIO::ColorConfig> colorconfig();
 
+    /// Find out whether the color config's transform from fromspace to
+    /// tospace is affine, probing it the first time it is asked about. If
+    /// it is, store it in xform and return true.
+    bool ocio_affine_transform(ustring fromspace, ustring tospace,
+                               OCIOAffineTransform& xform);
+
+    /// Hold on to the layer profile of a group that is being destroyed.
+    void retire_layer_profile(LayerProfile&& profile);
+
+    /// Return the layer profiles of all groups, whether or not they still
+    /// exist, that have run with the "profile_layers" option.
+    std::vector<LayerProfile> layer_profiles() const;
+
+    /// Write the layer profiles to a file as JSON.
+    bool write_layer_profiles(string_view filename) const;
+
 #if OSL_USE_BATCHED
     // Group all batched methods behind a templated interface
     // so we can support multiple widths
@@ -801,8 +1031,7 @@ public:
         /// Ensure that the group has been JITed.
         void jit_group(ShaderGroup& group, ShadingContext* ctx);
 
-        void jit_all_groups(int nthreads = 0, int mythread = 0,
-                            int totalthreads = 1);
+        void jit_all_groups(int nthreads = 0);
     };
 
     template<int WidthT> OSL_FORCEINLINE Batched<WidthT> batched()
@@ -873,6 +1102,8 @@ private:
 
     typedef std::map<ustring, ShaderMaster::ref> ShaderNameMap;
     ShaderNameMap m_shader_masters;  ///< name -> shader masters map
+    std::set<ustring> m_shaders_loading;  ///< Masters being read right now
+    std::condition_variable m_shader_loaded_cv;  ///< Signals a master read
 
     ConstantPool<int> m_int_pool;
     ConstantPool<Float> m_float_pool;
@@ -900,14 +1131,23 @@ private:
     bool m_debugnan;              ///< Root out NaN's?
     bool m_debug_uninit;          ///< Find use of uninitialized vars?
     bool m_lockgeom_default;      ///< Default value of lockgeom
+    int m_oso_binary;             ///< Read (1) and write (2) .osb files?
     bool m_strict_messages;       ///< Strict checking of message passing usage?
     bool m_error_repeats;         ///< Allow repeats of identical err/warn?
     bool m_range_checking;        ///< Range check arrays & components?
     bool m_connection_error;      ///< Error for ConnectShaders to fail?
     bool m_greedyjit;             ///< JIT as much as we can?
+    int m_async_jit;              ///< Background compile threads (0 = off)
+    int m_llvm_tiered_jit;        ///< Execs before full LLVM opt (0 = off)
+    bool m_llvm_lazy_layers;      ///< JIT lazy layers on first call?
+    bool m_dedup_groups;          ///< Share code among identical groups?
+    bool m_reparam_respecialize;  ///< ReParameter of non-interactive params?
+    int m_auto_interactive;       ///< Edits to make a param interactive
+    float m_auto_interactive_quiet;  ///< Seconds unedited to undo that
     bool m_countlayerexecs;       ///< Count number of layer execs?
     bool m_relaxed_param_typecheck;  ///< Allow parameters to be set from isomorphic types (same data layout)
     int m_profile;                 ///< Level of profiling of shader execution
+    int m_profile_layers;          ///< Time layers (1) and source lines (2)?
     int m_optimize;                ///< Runtime optimization level
     bool m_opt_simplify_param;     ///< Turn instance params into const?
     bool m_opt_constant_fold;      ///< Allow constant folding?
@@ -953,8 +1193,13 @@ private:
     ustring m_only_groupname;          ///< Name of sole group to compile
     ustring m_archive_groupname;       ///< Name of group to pickle/archive
     ustring m_archive_filename;        ///< Name of filename for group archive
+    ustring m_profile_layers_file;     ///< Where to write the layer profile
     std::string m_searchpath;          ///< Shader search path
     std::vector<std::string> m_searchpath_dirs;  ///< All searchpath dirs
+    std::unordered_map<std::string, std::string>
+        m_searchpath_index;             ///< Shader file name -> full path
+    bool m_searchpath_indexed = false;  ///< Is m_searchpath_index built?
+    mutex m_searchpath_index_mutex;     ///< Guards the index and dirs
     std::string m_library_searchpath;            ///< Library search path
     std::vector<std::string>
         m_library_searchpath_dirs;            ///< All library searchpath dirs
@@ -965,6 +1210,7 @@ private:
     int m_compile_report;    ///< Print compilation report?
     bool m_use_optix;        ///< This is an OptiX-based renderer
     bool m_use_optix_cache;  ///< Renderer-enabled caching for OptiX ptx
+    bool m_use_jit_cache;    ///< Renderer-enabled caching for CPU JIT code
     int m_max_optix_groupdata_alloc;  ///< Maximum OptiX groupdata buffer allocation
     bool m_buffer_printf;             ///< Buffer/batch printf output?
     bool m_no_noise;                  ///< Substitute trivial noise calls
@@ -990,13 +1236,26 @@ private:
 
     std::shared_ptr<OIIO::ColorConfig>
         m_colorconfig;  ///< OIIO/OCIO color configuration
+    // Which color config transforms are affine, see ocio_affine_transform()
+    struct UstringPairHash {
+        size_t operator()(const std::pair<ustring, ustring>& p) const
+        {
+            return p.first.hash() * 31 + p.second.hash();
+        }
+    };
+    std::unordered_map<std::pair<ustring, ustring>,
+                       std::pair<bool, OCIOAffineTransform>, UstringPairHash>
+        m_ocio_affine;
+    std::shared_mutex m_ocio_affine_mutex;
 
     // Thread safety
     mutable mutex m_mutex;
 
     // Stats
     atomic_int m_stat_shaders_loaded;      ///< Stat: shaders loaded
+    atomic_int m_stat_shaders_loaded_binary;  ///< Stat: ...from .osb files
     atomic_int m_stat_shaders_requested;   ///< Stat: shaders requested
+    atomic_int m_stat_shaders_preloaded;   ///< Stat: ...by preload_shaders
     PeakCounter<int> m_stat_instances;     ///< Stat: instances
     PeakCounter<int> m_stat_contexts;      ///< Stat: shading contexts
     atomic_int m_stat_groups;              ///< Stat: shading groups
@@ -1020,6 +1279,15 @@ private:
     atomic_int m_stat_tex_calls_as_handles;  ///< Stat: texture calls with handles
     atomic_int m_stat_useparam_ops;  ///< Stat: pre-optimization useparam ops
     atomic_int m_stat_call_layers_inserted;  ///< Stat: post-opt layer calls
+    atomic_int m_stat_jit_cache_hits;        ///< Stat: groups JIT cache hits
+    atomic_int m_stat_groups_tiered_up;      ///< Stat: hot groups re-JITed
+    atomic_int m_stat_async_compiles_pending;  ///< Stat: queued compiles
+    atomic_int m_stat_lazy_layers;           ///< Stat: layers left unJITed
+    atomic_int m_stat_lazy_layers_jitted;    ///< Stat: ...JITed when called
+    atomic_int m_stat_groups_deduped;        ///< Stat: duplicate groups
+    atomic_int m_stat_groups_respecialized;  ///< Stat: rebuilt for ReParameter
+    atomic_int m_stat_params_promoted;       ///< Stat: made interactive
+    atomic_int m_stat_groups_demoted;        ///< Stat: promoted ones folded
     double m_stat_master_load_time;          ///< Stat: time loading masters
     double m_stat_optimization_time;         ///< Stat: time spent optimizing
     double m_stat_opt_locking_time;          ///<   locking time
@@ -1047,6 +1315,10 @@ private:
     atomic_ll m_stat_reparam_bytes_total;
     atomic_ll m_stat_reparam_calls_changed;
     atomic_ll m_stat_reparam_bytes_changed;
+    atomic_ll m_stat_context_heap_highwater;  ///< Stat: max ctx heap bytes
+    atomic_ll m_stat_closure_highwater;       ///< Stat: max ctx closure bytes
+    atomic_ll m_stat_scratch_highwater;       ///< Stat: max ctx scratch bytes
+    atomic_int m_stat_context_heap_reallocs;  ///< Stat: ctx heap regrowths
 
     int m_stat_max_llvm_local_mem;     ///< Stat: max LLVM local mem
     PeakCounter<off_t> m_stat_memory;  ///< Stat: all shading system memory
@@ -1074,7 +1346,41 @@ private:
 
     atomic_int m_groups_to_compile_count;
     atomic_int m_threads_currently_compiling;
+    std::unique_ptr<OIIO::thread_pool> m_compile_pool;  ///< See compile_pool()
+    std::mutex m_compile_pool_mutex;
+    std::atomic<bool> m_stop_async_compiles { false };  ///< Shutting down
+    std::vector<std::weak_ptr<ShaderGroup>> m_async_ended;  ///< Not yet queued
+    std::mutex m_async_ended_mutex;
+    // Largest scalar and wide groupdata of any group optimized so far,
+    // which is how big a context's heap needs to be to run any of them
+    // one point at a time, or in batches.
+    // N.B. only raised while holding m_stat_mutex.
+    std::atomic<size_t> m_max_groupdata_size { 0 };
+    std::atomic<size_t> m_max_groupdata_wide_size { 0 };
+    Dictionary* m_dictionary = nullptr;  ///< See dictionary()
+    // Option "auto_interactive": for each group name, the edits of each
+    // "layer.param", and hashes of the values its last declaration gave
+    // them, guarded by the mutex. Forgotten once no group has the name.
+    struct ParamEdits {
+        int edits      = 0;
+        long long last = 0;  // Timer::now() of the last edit
+    };
+    struct GroupEdits {
+        std::unordered_map<std::string, ParamEdits> params;
+        std::unordered_map<std::string, uint64_t> declared;
+    };
+    std::unordered_map<ustring, GroupEdits> m_param_edits;
+    std::mutex m_param_edits_mutex;
+    // Groups that others may share code with, by dedup_key
+    std::unordered_map<std::string, std::weak_ptr<ShaderGroup>> m_dedup_map;
+    spin_mutex m_dedup_mutex;
+    std::once_flag m_dictionary_once;
+    // Compiled regex patterns, see find_regex()
+    std::unordered_map<ustring, std::unique_ptr<CompiledRegex>> m_regex_map;
+    mutable std::shared_mutex m_regex_mutex;
     mutable std::map<ustring, long long> m_group_profile_times;
+    std::vector<LayerProfile> m_retired_layer_profiles;
+    // N.B. retired_layer_profiles is protected by m_stat_mutex.
     // N.B. group_profile_times is protected by m_stat_mutex.
 
     LLVM_Util::ScopedJitMemoryUser m_llvm_jit_memory_user;
@@ -1566,8 +1872,9 @@ public:
     {
         // pool must have at least one block available to avoid special cases
         m_blocks.emplace_back(new char[BlockSize]);
-        m_block_offset  = BlockSize;
+        m_block_offset  = 0;
         m_current_block = 0;
+        m_high_water    = 0;
     }
 
     // avoid 'attempting to reference a deleted function' of std::unique_ptr<char>s
@@ -1610,10 +1917,30 @@ public:
 
     void clear()
     {
+        m_high_water    = high_water();
         m_current_block = 0;
         m_block_offset  = 0;
     }
 
+    /// Allocate enough blocks up front that `size` bytes can be handed out
+    /// without allocating any more. The memory is touched here, so its
+    /// pages are placed local to the calling thread.
+    void reserve(size_t size)
+    {
+        while (m_blocks.size() * BlockSize < size) {
+            m_blocks.emplace_back(new char[BlockSize]);
+            memset(m_blocks.back().get(), 0, BlockSize);
+        }
+    }
+
+    /// The most bytes (including any left unused at the ends of blocks)
+    /// that have been in use at once.
+    size_t high_water() const
+    {
+        return std::max(m_high_water,
+                        m_current_block * BlockSize + m_block_offset);
+    }
+
 private:
     static inline size_t alignment_offset_calc(void* ptr, size_t alignment)
     {
@@ -1628,6 +1955,7 @@ private:
         m_blocks;            ///< Hold blocks of BlockSize bytes
     size_t m_current_block;  ///< Index into the m_blocks array
     size_t m_block_offset;   ///< Offset from the start of the current block
+    size_t m_high_water;     ///< Most bytes in use before the last clear
 };
 
 /// Represents a single message for use by getmessage and setmessage opcodes
@@ -1661,7 +1989,10 @@ struct Message {
 
 
 /// Represents the list of messages set by a given shader using setmessage and
-/// getmessage.
+/// getmessage. The messages themselves live in an arena that is reset for
+/// each shade. For fast lookup by name they are also indexed by a small
+/// open-addressed hash table, which is emptied in O(1) by bumping a
+/// generation count rather than by clearing its slots.
 struct MessageList {
     MessageList() : list_head(nullptr), message_data() {}
 
@@ -1669,14 +2000,27 @@ struct MessageList {
     {
         list_head = nullptr;
         message_data.clear();
+        count = 0;
+        if (++generation == 0) {
+            // Wrapped around -- really clear the slots this time
+            for (auto& slot : slots)
+                slot.generation = 0;
+            generation = 1;
+        }
     }
 
     const Message* find(ustringhash name) const
     {
-        for (const Message* m = list_head; m; m = m->next)
-            if (m->name == name)
-                return m;  // name matches
-        return nullptr;    // not found
+        if (!count)
+            return nullptr;
+        size_t mask = slots.size() - 1;
+        for (size_t i = name.hash() & mask;; i = (i + 1) & mask) {
+            const Slot& slot(slots[i]);
+            if (slot.generation != generation)
+                return nullptr;  // empty slot -- not found
+            if (slot.message->name == name)
+                return slot.message;  // name matches
+        }
     }
 
     void add(ustringhash name, void* data, const TypeDesc& type, int layeridx,
@@ -1688,11 +2032,44 @@ struct MessageList {
             list_head->data = message_data.alloc(type.size());
             memcpy(list_head->data, data, type.size());
         }
+        // Keep the table at most half full, so probe sequences stay short
+        // and always end at an empty slot.
+        if (2 * (count + 1) > slots.size())
+            rehash(std::max(size_t(32), 2 * slots.size()));
+        else
+            insert(list_head);
+        ++count;
     }
 
 private:
+    struct Slot {
+        Message* message    = nullptr;
+        uint32_t generation = 0;  ///< Slot is empty unless this is current
+    };
+
+    void insert(Message* m)
+    {
+        size_t mask = slots.size() - 1;
+        size_t i    = m->name.hash() & mask;
+        while (slots[i].generation == generation)
+            i = (i + 1) & mask;
+        slots[i].message    = m;
+        slots[i].generation = generation;
+    }
+
+    // Resize the table (a power of 2) and re-index every message.
+    void rehash(size_t size)
+    {
+        slots.assign(size, Slot());
+        for (Message* m = list_head; m; m = m->next)
+            insert(m);
+    }
+
     Message* list_head;
     SimplePool<1024> message_data;
+    std::vector<Slot> slots;  ///< Hash index of the messages by name
+    size_t count        = 0;  ///< Number of messages
+    uint32_t generation = 1;  ///< Current generation of the slots
 };
 
 
@@ -1722,7 +2099,7 @@ struct BatchedMessageBuffer {
 
 /// A ShaderGroup consists of one or more layers (each of which is a
 /// ShaderInstance), and the connections among them.
-class ShaderGroup {
+class ShaderGroup : public std::enable_shared_from_this<ShaderGroup> {
 public:
     ShaderGroup(string_view name, ShadingSystemImpl& shadingsys);
     ~ShaderGroup();
@@ -1749,6 +2126,10 @@ public:
     ///
     int nlayers() const { return (int)m_layers.size(); }
 
+    /// A rough estimate of how expensive the group is to optimize and JIT,
+    /// based on how many layers and ops it has.
+    size_t estimated_compile_cost() const;
+
     ShaderInstance* layer(int i) const { return m_layers[i].get(); }
 
     /// Array indexing returns the i-th layer of the group
@@ -1778,32 +2159,54 @@ public:
         m_llvm_groupdata_wide_size = size;
     }
 
+    // N.B. The entry points are atomic because tiered JIT replaces them
+    // while other threads may be running the group.
     RunLLVMGroupFunc llvm_compiled_version() const
     {
-        return m_llvm_compiled_version;
+        return m_llvm_compiled_version.load(std::memory_order_acquire);
     }
     void llvm_compiled_version(RunLLVMGroupFunc func)
     {
-        m_llvm_compiled_version = func;
+        m_llvm_compiled_version.store(func, std::memory_order_release);
+    }
+    RunLLVMGroupFunc llvm_compiled_init() const
+    {
+        return m_llvm_compiled_init.load(std::memory_order_acquire);
     }
-    RunLLVMGroupFunc llvm_compiled_init() const { return m_llvm_compiled_init; }
     void llvm_compiled_init(RunLLVMGroupFunc func)
     {
-        m_llvm_compiled_init = func;
+        m_llvm_compiled_init.store(func, std::memory_order_release);
     }
     RunLLVMGroupFunc llvm_compiled_layer(int layer) const
     {
         return layer < (int)m_llvm_compiled_layers.size()
-                   ? m_llvm_compiled_layers[layer]
+                   ? m_llvm_compiled_layers[layer].load(
+                         std::memory_order_acquire)
                    : NULL;
     }
     void llvm_compiled_layer(int layer, RunLLVMGroupFunc func)
     {
-        m_llvm_compiled_layers.resize((size_t)nlayers(), NULL);
+        // Only sized the first time, before any thread can be running it
+        if (m_llvm_compiled_layers.size() != (size_t)nlayers())
+            m_llvm_compiled_layers
+                = std::vector<std::atomic<RunLLVMGroupFunc>>(nlayers());
         if (layer < nlayers())
-            m_llvm_compiled_layers[layer] = func;
+            m_llvm_compiled_layers[layer].store(func,
+                                                std::memory_order_release);
+    }
+
+    /// The slot through which the JITed code calls the given layer when
+    /// the "llvm_lazy_layers" option is on. It is null until the layer has
+    /// been JITed, and the address never changes once the group is JITed.
+    std::atomic<RunLLVMGroupFunc>* llvm_lazy_layer_slot(int layer)
+    {
+        return &m_llvm_lazy_layers[layer];
     }
 
+    /// Number of layers that have been left for jit_lazy_layer to JIT on
+    /// first call, and haven't been called yet. Their ops are still needed.
+    int llvm_lazy_layers_pending() const { return m_llvm_lazy_layers_pending; }
+
 #if OSL_USE_BATCHED
     // Hold onto wide versions of llvm functions side by side with scalar
     RunLLVMGroupFuncWide llvm_compiled_wide_version() const
@@ -1848,14 +2251,72 @@ public:
 #endif
     }
 
+    /// For tiered JIT: count one execution of the quickly compiled code,
+    /// returning true for the one that makes the group hot enough to be
+    /// recompiled with full optimization. Once that has happened (or if
+    /// the group was never compiled that way) it's just a relaxed load.
+    bool count_tierup_execution()
+    {
+        // Only the execution that takes it from 1 to 0 returns true, and
+        // it never goes below 0, however many threads get here at once.
+        long long n = m_tierup_countdown.load(std::memory_order_relaxed);
+        while (n > 0)
+            if (m_tierup_countdown.compare_exchange_weak(
+                    n, n - 1, std::memory_order_relaxed))
+                return n == 1;
+        return false;
+    }
+
     void name(ustring name) { m_name = name; }
     ustring name() const { return m_name; }
 
     // Generate and memoize the cache key so we don't calculate it twice
     void generate_optix_cache_key(string_view code);
     std::string optix_cache_key() const { return m_optix_cache_key; }
+    void generate_jit_cache_key(string_view code);
+    std::string jit_cache_key() const { return m_jit_cache_key; }
 
     std::string serialize() const;
+    // Serialize to out, for a group that is already locked.
+    void serialize(std::ostream& out) const;
+
+    /// Return a key that is the same for any two groups that will
+    /// optimize and JIT to the same code: the layers, their instance
+    /// values and connections, plus the group state that affects code
+    /// generation. Return "" for a group that can't share its code (one
+    /// with interactive params, whose values live with the group, or one
+    /// that ReParameter may respecialize). The group must be locked.
+    std::string dedup_key() const;
+
+    /// Take on the optimized layers of src, a group with the same
+    /// dedup_key (or the rebuilt declaration of this one), along with
+    /// everything optimizing and JITing it has produced so far. Both
+    /// groups must be locked.
+    void share_compiled_state(const ShaderGroup& src);
+
+    /// Number the ranges of ops, in each layer, that come from one source
+    /// line, so that their times can be profiled. Only does anything the
+    /// first time it is called.
+    void setup_profile_ranges();
+
+    /// Return the profiling range of op opnum of the given layer, or -1.
+    int profile_range(int layer, int opnum) const
+    {
+        if (layer >= int(m_profile_op_ranges.size())
+            || opnum >= int(m_profile_op_ranges[layer].size()))
+            return -1;
+        return m_profile_op_ranges[layer][opnum];
+    }
+
+    /// Number of profiling ranges numbered by setup_profile_ranges().
+    int profile_nranges() const { return int(m_profile.ranges.size()); }
+
+    /// Add the times and counts that one context measured to the group's.
+    void add_profile(const long long* layer_ticks, const long long* layer_calls,
+                     const long long* range_ticks);
+
+    /// Return a copy of the layer profile gathered so far.
+    pvt::LayerProfile layer_profile() const;
 
     void lock() const { m_mutex.lock(); }
     void unlock() const { m_mutex.unlock(); }
@@ -2020,9 +2481,11 @@ private:
         = 0;                     ///< Heap size needed for its wide groupdata
     int m_id;                    ///< Unique ID for the group
     int m_num_entry_layers = 0;  ///< Number of marked entry layers
-    RunLLVMGroupFunc m_llvm_compiled_version = nullptr;
-    RunLLVMGroupFunc m_llvm_compiled_init    = nullptr;
-    std::vector<RunLLVMGroupFunc> m_llvm_compiled_layers;
+    std::atomic<RunLLVMGroupFunc> m_llvm_compiled_version { nullptr };
+    std::atomic<RunLLVMGroupFunc> m_llvm_compiled_init { nullptr };
+    std::vector<std::atomic<RunLLVMGroupFunc>> m_llvm_compiled_layers;
+    std::vector<std::atomic<RunLLVMGroupFunc>> m_llvm_lazy_layers;
+    std::atomic<int> m_llvm_lazy_layers_pending { 0 };
 #if OSL_USE_BATCHED
     RunLLVMGroupFuncWide m_llvm_compiled_wide_version = nullptr;
     RunLLVMGroupFuncWide m_llvm_compiled_wide_init    = nullptr;
@@ -2056,9 +2519,16 @@ private:
     bool m_unknown_closures_needed;
     bool m_unknown_attributes_needed;
     atomic_ll m_executions { 0 };  ///< Number of times the group executed
+    atomic_ll m_tierup_countdown { 0 };  ///< Execs until full opt (tiered JIT)
+    ShaderGroupRef m_dedup_source;  ///< Identical group whose code we share
+    bool m_dedup_checked = false;   ///< Already looked for m_dedup_source?
     atomic_ll m_stat_total_shading_time_ticks { 0 };  // Shading time (ticks)
+    pvt::LayerProfile m_profile;  // See setup_profile_ranges, add_profile
+    std::vector<std::vector<int>> m_profile_op_ranges;  // [layer][op]
+    mutable spin_mutex m_profile_mutex;                 // Guards m_profile
 
     std::string m_optix_cache_key;
+    std::string m_jit_cache_key;
 
     // PTX assembly for compiled ShaderGroup
     std::string m_llvm_ptx_compiled_version;
@@ -2067,6 +2537,12 @@ private:
     std::vector<ParamHints> m_pending_hints;  // ParamHints of pending params
     ustring m_group_use;                      // "Usage" of group
     bool m_complete = false;                  // Successfully ShaderGroupEnd?
+    std::string m_declaration;                // As declared (to respecialize)
+    bool m_respecialized = false;             // Respecialized after compile?
+    bool m_rebuild = false;                   // Rebuilt, not app-declared?
+    bool m_async_queued = false;              // Given to compile_group_async?
+    std::vector<std::pair<int, ustring>> m_auto_interactive;  // Promoted
+    ShaderGroupRef m_demotion;  // Rebuild with those folded, compiling
 
     ShadingSystemImpl& m_shadingsys;  // Back-ptr to the shading system
 
@@ -2300,9 +2776,26 @@ public:
     const void* symbol_data(const Symbol& sym) const;
 
     /// Return a reference to a compiled regular expression for the
-    /// given string, being careful to cache already-created ones so we
-    /// aren't constantly compiling new ones.
-    const std::regex& find_regex(ustring r);
+    /// given string. The compiled patterns are owned by the ShadingSystem
+    /// and shared by all contexts; each context only remembers the ones it
+    /// has already looked up, so the common case needs no locking.
+    const CompiledRegex& find_regex(ustring r);
+
+    /// Return the point cloud this context most recently resolved, if it
+    /// was for the given filename (and for the same kind of access), so
+    /// that repeated queries of one file skip the shared registry.
+    PointCloud* cached_pointcloud(ustringhash filename, bool write) const
+    {
+        return (filename == m_pointcloud_name && write == m_pointcloud_write)
+                   ? m_pointcloud
+                   : nullptr;
+    }
+    void cache_pointcloud(ustringhash filename, bool write, PointCloud* pc)
+    {
+        m_pointcloud_name  = filename;
+        m_pointcloud_write = write;
+        m_pointcloud       = pc;
+    }
 
     /// Return a pointer to the shading group for this context.
     ///
@@ -2369,6 +2862,19 @@ public:
     bool ocio_transform(ustring fromspace, ustring tospace, const Color& C,
                         Color& Cout);
 
+    /// If the color config's transform from fromspace to tospace is
+    /// affine, store it in xform and return true.
+    bool ocio_affine_transform(ustring fromspace, ustring tospace,
+                               OCIOAffineTransform& xform)
+    {
+#ifndef __CUDACC__
+        return m_ocio_system.affine_transform(fromspace, tospace,
+                                              &shadingsys(), xform);
+#else
+        return false;
+#endif
+    }
+
     void incr_layers_executed() { ++m_stat_layers_executed; }
 
     void incr_get_userdata_calls() { ++m_stat_get_userdata_calls; }
@@ -2438,17 +2944,72 @@ public:
         record_error(ErrorHandler::EH_MESSAGE, fmtformat(fmt, args...));
     }
 
-    void reserve_heap(size_t size)
+    /// Make sure the heap has room for `size` bytes of groupdata, which
+    /// is wide (for batched execution) or not.
+    void reserve_heap(size_t size, bool wide = false)
     {
         if (size > m_heapsize) {
+            // Grow straight to the largest groupdata of the same kind of
+            // any group optimized so far, so that binding those groups
+            // later won't reallocate.
+            if (m_heapsize)
+                m_shadingsys.m_stat_context_heap_reallocs += 1;
+            size = std::max(size,
+                            wide ? m_shadingsys.m_max_groupdata_wide_size.load()
+                                 : m_shadingsys.m_max_groupdata_size.load());
             m_heap.reset(
                 (char*)OIIO::aligned_malloc(size, OIIO_CACHE_LINE_SIZE));
+            // Touch it now so the pages are local to this thread.
+            memset(m_heap.get(), 0, size);
             m_heapsize = size;
+            OIIO::atomic_max(m_shadingsys.m_stat_context_heap_highwater,
+                             (long long)size);
         }
     }
 
+    /// Fold this context's closure and scratch pool high-water marks into
+    /// the ShadingSystem stats (and the sizes new contexts preallocate).
+    void record_pool_high_water()
+    {
+        OIIO::atomic_max(m_shadingsys.m_stat_closure_highwater,
+                         (long long)m_closure_pool.high_water());
+        OIIO::atomic_max(m_shadingsys.m_stat_scratch_highwater,
+                         (long long)m_scratch_pool.high_water());
+    }
+
+    // Layer profiling (see the "profile_layers" option). The JITed code
+    // marks entry to and exit from each layer, and the start of each
+    // range of ops from one source line. The time between marks goes to
+    // the innermost running layer and its current range, accumulated here
+    // and only added to the group's totals by flush_layer_profile().
+    void profile_layer_begin(int layer);
+    void profile_range(int range)
+    {
+        profile_mark();
+        if (m_profile_stack.size())
+            m_profile_stack.back().second = range;
+    }
+    void profile_layer_end()
+    {
+        profile_mark();
+        if (m_profile_stack.size())
+            m_profile_stack.pop_back();
+    }
+    void flush_layer_profile();
+
 private:
-    void free_dict_resources();
+    // Charge the time since the last mark to the running layer and range
+    void profile_mark()
+    {
+        long long now = OIIO::Timer::now();
+        if (m_profile_stack.size()) {
+            long long ticks = now - m_profile_last_mark;
+            m_profile_layer_ticks[m_profile_stack.back().first] += ticks;
+            if (m_profile_stack.back().second >= 0)
+                m_profile_range_ticks[m_profile_stack.back().second] += ticks;
+        }
+        m_profile_last_mark = now;
+    }
 
     ShadingSystemImpl& m_shadingsys;  ///< Backpointer to shadingsys
     RendererServices* m_renderer;     ///< Ptr to renderer services
@@ -2461,8 +3022,8 @@ private:
         nullptr, &OIIO::aligned_free
     };
     size_t m_heapsize = 0;
-    using RegexMap = std::unordered_map<ustring, std::unique_ptr<std::regex>>;
-    RegexMap m_regex_map;    ///< Compiled regex's
+    using RegexMap = std::unordered_map<ustring, const CompiledRegex*>;
+    RegexMap m_regex_map;    ///< Compiled regex's already looked up
     MessageList m_messages;  ///< Message blackboard
 #if OSL_USE_BATCHED
     BatchedMessageBuffer
@@ -2473,11 +3034,22 @@ private:
     int m_stat_layers_executed;     ///< Number of layers executed
     long long m_ticks;              ///< Time executing the shader
 
+    // See profile_layer_begin()
+    ShaderGroupRef m_profile_group;  // Group the times below are for
+    std::vector<std::pair<int, int>> m_profile_stack;  // Running (layer,range)
+    long long m_profile_last_mark = 0;
+    std::vector<long long> m_profile_layer_ticks;
+    std::vector<long long> m_profile_layer_calls;
+    std::vector<long long> m_profile_range_ticks;
+
+    // See cached_pointcloud()
+    ustringhash m_pointcloud_name;
+    PointCloud* m_pointcloud = nullptr;
+    bool m_pointcloud_write  = false;
+
     SimplePool<20 * 1024> m_closure_pool;
     SimplePool<64 * 1024> m_scratch_pool;
 
-    Dictionary* m_dictionary;
-
     OCIOColorSystem m_ocio_system;
 
     // Buffering of error messages and printfs
@@ -0,0 +1,693 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#        define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#        define NOMINMAX
+#    endif
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+#include "oslexec_pvt.h"
+
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
+
+
+// Precompiled binary shaders (.osb files).
+//
+// An .osb holds the same ShaderMaster that parsing the .oso would make, in
+// a form that can be adopted with little more than a copy of each table.
+// All numbers are 32 bit ints (or floats), in the byte order of the machine
+// that wrote it, which the magic number checks. Every string (names,
+// opcodes, string constants) is stored just once, in a string table at the
+// front, and referred to everywhere else by its index. The layout is:
+//
+//    Header
+//    string table:  count, then for each: length, characters
+//    master:        shadertype, name, maincodebegin, maincodeend,
+//                   range_checking
+//    structs:       count, then for each: name, nfields, field names
+//    symbols:       count, SymRecord[count]
+//    ops:           count, OpRecord[count]
+//    args, int defaults, float defaults, string defaults, int constants,
+//    float constants, string constants:  each a count and the values
+//
+// The header records the size and a hash of the contents of the .oso it
+// was made from, so that an out of date .osb is ignored, and the lockgeom
+// default that was in effect, since that is baked into the symbols.
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {  // OSL::pvt
+
+
+namespace {
+
+constexpr uint32_t osb_magic   = 0x42534f4f;  // "OOSB" in little endian
+constexpr int32_t osb_version = 3;
+
+struct Header {
+    uint32_t magic;
+    int32_t version;
+    int32_t osl_version;
+    int32_t lockgeom_default;
+    int64_t oso_size;
+    int64_t oso_mtime;
+    uint64_t oso_hash;
+};
+
+// Symbol flag bits
+enum { SymClosure = 1, SymInterpolated = 2, SymInteractive = 4,
+       SymAllowConnect = 8 };
+
+struct SymRecord {
+    int32_t name, symtype, flags;
+    int32_t basetype, aggregate, vecsemantics, arraylen;
+    int32_t structure;  // index into the struct table, or -1
+    int32_t dataoffset, initializers, fieldid, initbegin, initend;
+    int32_t firstread, lastread, firstwrite, lastwrite;
+};
+
+struct OpRecord {
+    int32_t opname, method, sourcefile, sourceline;
+    int32_t firstarg, nargs;
+    int32_t jump[Opcode::max_jumps];
+    uint32_t argread, argwrite, argtakesderivs;
+};
+
+
+
+// Accumulates the contents of an .osb file.
+class BinaryWriter {
+public:
+    template<typename T> void put(const T& val)
+    {
+        m_out.append((const char*)&val, sizeof(T));
+    }
+
+    template<typename T> void put_array(const std::vector<T>& vals)
+    {
+        put(int32_t(vals.size()));
+        m_out.append((const char*)vals.data(), vals.size() * sizeof(T));
+    }
+
+    void put_strings(const std::vector<ustring>& vals)
+    {
+        put(int32_t(vals.size()));
+        for (ustring s : vals)
+            put(string_index(s));
+    }
+
+    /// Index of s in the string table, adding it if need be.
+    int32_t string_index(ustring s)
+    {
+        auto found = m_string_index.find(s);
+        if (found != m_string_index.end())
+            return found->second;
+        int32_t index = int32_t(m_strings.size());
+        m_strings.push_back(s);
+        m_string_index[s] = index;
+        return index;
+    }
+
+    /// The whole file: header, string table, then everything put so far.
+    std::string contents(const Header& header) const
+    {
+        std::string file((const char*)&header, sizeof(header));
+        int32_t nstrings = int32_t(m_strings.size());
+        file.append((const char*)&nstrings, sizeof(nstrings));
+        for (ustring s : m_strings) {
+            int32_t len = int32_t(s.size());
+            file.append((const char*)&len, sizeof(len));
+            file.append(s.c_str(), s.size());
+        }
+        return file + m_out;
+    }
+
+private:
+    std::string m_out;
+    std::vector<ustring> m_strings;
+    std::unordered_map<ustring, int32_t> m_string_index;
+};
+
+
+
+// Reads the pieces of an .osb file, checking that each is all there.
+class BinaryReader {
+public:
+    BinaryReader(const char* begin, const char* end) : m_pos(begin), m_end(end)
+    {
+    }
+
+    bool ok() const { return m_ok; }
+
+    template<typename T> bool get(T& val)
+    {
+        if (!m_ok || size_t(m_end - m_pos) < sizeof(T))
+            return m_ok = false;
+        memcpy(&val, m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return true;
+    }
+
+    /// Read a count, or fail if there can't be that many of something
+    /// that takes at least eltsize bytes.
+    bool get_count(size_t& count, size_t eltsize)
+    {
+        int32_t n = 0;
+        if (!get(n) || n < 0 || size_t(m_end - m_pos) / eltsize < size_t(n))
+            return m_ok = false;
+        count = size_t(n);
+        return true;
+    }
+
+    template<typename T> bool get_array(std::vector<T>& vals)
+    {
+        size_t n = 0;
+        if (!get_count(n, sizeof(T)))
+            return false;
+        vals.resize(n);
+        if (n)
+            memcpy(vals.data(), m_pos, n * sizeof(T));
+        m_pos += n * sizeof(T);
+        return true;
+    }
+
+    bool get_string_table()
+    {
+        size_t n = 0;
+        if (!get_count(n, sizeof(int32_t)))
+            return false;
+        m_strings.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            int32_t len = 0;
+            if (!get(len) || len < 0 || m_end - m_pos < len)
+                return m_ok = false;
+            m_strings.emplace_back(string_view(m_pos, size_t(len)));
+            m_pos += len;
+        }
+        return true;
+    }
+
+    /// Translate a string table index, failing if it's out of range.
+    ustring string(int32_t index)
+    {
+        if (index < 0 || size_t(index) >= m_strings.size()) {
+            m_ok = false;
+            return ustring();
+        }
+        return m_strings[index];
+    }
+
+    bool get_string(ustring& val)
+    {
+        int32_t index = -1;
+        if (!get(index))
+            return false;
+        val = string(index);
+        return m_ok;
+    }
+
+    bool get_strings(std::vector<ustring>& vals)
+    {
+        std::vector<int32_t> indices;
+        if (!get_array(indices))
+            return false;
+        vals.resize(indices.size());
+        for (size_t i = 0; i < indices.size(); ++i)
+            vals[i] = string(indices[i]);
+        return m_ok;
+    }
+
+private:
+    const char* m_pos;
+    const char* m_end;
+    bool m_ok = true;
+    std::vector<ustring> m_strings;
+};
+
+
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    MappedFile(const std::string& filename)
+    {
+#ifdef _WIN32
+        std::wstring wfilename = Strutil::utf8_to_utf16wstring(filename);
+        HANDLE file = CreateFileW(wfilename.c_str(), GENERIC_READ,
+                                  FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY,
+                                                0, 0, nullptr);
+            if (mapping) {
+                m_data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0,
+                                                    0, 0);
+                if (m_data)
+                    m_size = size_t(size.QuadPart);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE,
+                           fd, 0);
+            if (p != MAP_FAILED) {
+                m_data = (const char*)p;
+                m_size = size_t(st.st_size);
+            }
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+        if (!m_data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap((void*)m_data, m_size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size      = 0;
+};
+
+
+
+// Size and modification time of the .oso, which is how an .osb knows
+// it's up to date without reading the .oso.
+bool
+oso_stat(const std::string& osofilename, int64_t& size, int64_t& mtime)
+{
+    if (!OIIO::Filesystem::exists(osofilename))
+        return false;
+    size  = int64_t(OIIO::Filesystem::file_size(osofilename));
+    mtime = int64_t(OIIO::Filesystem::last_write_time(osofilename));
+    return true;
+}
+
+
+
+// Hash of the contents of the .oso, for when its time has changed (say,
+// it was copied) but it may be the same shader.
+bool
+oso_hash(const std::string& osofilename, uint64_t& hash)
+{
+    std::string contents;
+    if (!OIIO::Filesystem::read_text_file(osofilename, contents))
+        return false;
+    hash = Strutil::strhash(contents);
+    return true;
+}
+
+
+
+// Is this a type that a symbol of a master could have?
+bool
+valid_type(const SymRecord& r)
+{
+    return r.basetype >= 0 && r.basetype < TypeDesc::LASTBASE
+           && (r.aggregate == TypeDesc::SCALAR || r.aggregate == TypeDesc::VEC2
+               || r.aggregate == TypeDesc::VEC3 || r.aggregate == TypeDesc::VEC4
+               || r.aggregate == TypeDesc::MATRIX33
+               || r.aggregate == TypeDesc::MATRIX44)
+           && r.vecsemantics >= 0 && r.vecsemantics <= 255 && r.arraylen >= -1
+           && r.symtype >= 0 && r.symtype < SymTypeLast;
+}
+
+}  // namespace
+
+
+
+bool
+ShaderMaster::write_binary(const std::string& filename,
+                           const std::string& osofilename,
+                           std::string& err) const
+{
+    Header header;
+    header.magic            = osb_magic;
+    header.version          = osb_version;
+    header.osl_version      = OSL_LIBRARY_VERSION_CODE;
+    header.lockgeom_default = shadingsys().lockgeom_default();
+    if (!oso_stat(osofilename, header.oso_size, header.oso_mtime)
+        || !oso_hash(osofilename, header.oso_hash)) {
+        err = OIIO::Strutil::fmt::format("could not read \"{}\"",
+                                         osofilename);
+        return false;
+    }
+
+    BinaryWriter out;
+    out.put(int32_t(m_shadertype));
+    out.put(out.string_index(ustring(m_shadername)));
+    out.put(int32_t(m_maincodebegin));
+    out.put(int32_t(m_maincodeend));
+    out.put(int32_t(m_range_checking));
+
+    // Only the names of the struct fields are known at runtime
+    std::vector<int> structs;
+    for (auto&& s : m_symbols) {
+        int id = s.typespec().structure();
+        if (id > 0 && std::find(structs.begin(), structs.end(), id)
+                          == structs.end())
+            structs.push_back(id);
+    }
+    out.put(int32_t(structs.size()));
+    for (int id : structs) {
+        const StructSpec* spec = TypeSpec::structspec(id);
+        out.put(out.string_index(spec->name()));
+        out.put(int32_t(spec->numfields()));
+        for (int f = 0; f < spec->numfields(); ++f)
+            out.put(out.string_index(spec->field(f).name));
+    }
+
+    std::vector<SymRecord> syms(m_symbols.size());
+    for (size_t i = 0; i < m_symbols.size(); ++i) {
+        const Symbol& s(m_symbols[i]);
+        const TypeSpec& t(s.typespec());
+        SymRecord& r(syms[i]);
+        r.name    = out.string_index(s.name());
+        r.symtype = s.symtype();
+        r.flags   = (t.is_closure_based() ? SymClosure : 0)
+                  | (s.interpolated() ? SymInterpolated : 0)
+                  | (s.interactive() ? SymInteractive : 0)
+                  | (s.allowconnect() ? SymAllowConnect : 0);
+        r.basetype     = t.simpletype().basetype;
+        r.aggregate    = t.simpletype().aggregate;
+        r.vecsemantics = t.simpletype().vecsemantics;
+        r.arraylen     = t.simpletype().arraylen;
+        r.structure    = -1;
+        if (t.is_structure_based())
+            r.structure = int32_t(std::find(structs.begin(), structs.end(),
+                                            t.structure())
+                                  - structs.begin());
+        r.dataoffset   = s.dataoffset();
+        r.initializers = s.initializers();
+        r.fieldid      = s.fieldid();
+        r.initbegin    = s.initbegin();
+        r.initend      = s.initend();
+        r.firstread    = s.firstread();
+        r.lastread     = s.lastread();
+        r.firstwrite   = s.firstwrite();
+        r.lastwrite    = s.lastwrite();
+    }
+    out.put_array(syms);
+
+    std::vector<OpRecord> ops(m_ops.size());
+    for (size_t i = 0; i < m_ops.size(); ++i) {
+        const Opcode& op(m_ops[i]);
+        OpRecord& r(ops[i]);
+        r.opname     = out.string_index(op.opname());
+        r.method     = out.string_index(op.method());
+        r.sourcefile = out.string_index(op.sourcefile());
+        r.sourceline = op.sourceline();
+        r.firstarg   = op.firstarg();
+        r.nargs      = op.nargs();
+        for (int j = 0; j < (int)Opcode::max_jumps; ++j)
+            r.jump[j] = op.jump(j);
+        r.argread        = op.argread_bits();
+        r.argwrite       = op.argwrite_bits();
+        r.argtakesderivs = op.argtakesderivs_all();
+    }
+    out.put_array(ops);
+
+    out.put_array(m_args);
+    out.put_array(m_idefaults);
+    out.put_array(m_fdefaults);
+    out.put_strings(m_sdefaults);
+    out.put_array(m_iconsts);
+    out.put_array(m_fconsts);
+    out.put_strings(m_sconsts);
+
+    // Write to a temporary file and rename it into place, so that a
+    // process loading the .osb never sees it half written.
+    std::string contents = out.contents(header);
+    std::string tmpname  = OIIO::Strutil::fmt::format(
+        "{}.{}", filename, OIIO::Filesystem::unique_path());
+    OIIO::ofstream file;
+    OIIO::Filesystem::open(file, tmpname, std::ios::out | std::ios::binary);
+    if (file)
+        file.write(contents.data(), contents.size());
+    file.close();
+    if (!file) {
+        err = OIIO::Strutil::fmt::format("could not write \"{}\"", tmpname);
+        std::string rmerr;
+        OIIO::Filesystem::remove(tmpname, rmerr);
+        return false;
+    }
+    if (!OIIO::Filesystem::rename(tmpname, filename, err)) {
+        std::string rmerr;
+        OIIO::Filesystem::remove(tmpname, rmerr);
+        return false;
+    }
+    return true;
+}
+
+
+
+ShaderMaster::ref
+ShaderMaster::read_binary(ShadingSystemImpl& shadingsys,
+                          const std::string& filename,
+                          const std::string& osofilename, std::string& err)
+{
+    MappedFile file(filename);
+    if (!file.data()) {
+        err = "could not be mapped";
+        return nullptr;
+    }
+    BinaryReader in(file.data(), file.data() + file.size());
+    Header header;
+    if (!in.get(header) || header.magic != osb_magic
+        || header.version != osb_version) {
+        err = "is not a precompiled shader for this machine";
+        return nullptr;
+    }
+    if (header.osl_version != OSL_LIBRARY_VERSION_CODE
+        || header.lockgeom_default != int(shadingsys.lockgeom_default())) {
+        err = "was made by a different OSL version or with other options";
+        return nullptr;
+    }
+    if (osofilename.size()) {
+        // Only read the .oso if its time has changed but not its size
+        int64_t size = 0, mtime = 0;
+        uint64_t hash = 0;
+        if (!oso_stat(osofilename, size, mtime) || size != header.oso_size
+            || (mtime != header.oso_mtime
+                && (!oso_hash(osofilename, hash)
+                    || hash != header.oso_hash))) {
+            err = OIIO::Strutil::fmt::format("is out of date with \"{}\"",
+                                             osofilename);
+            return nullptr;
+        }
+    }
+
+    ref master(new ShaderMaster(shadingsys));
+    master->m_osofilename = osofilename.size() ? osofilename : filename;
+    int32_t shadertype = 0, maincodebegin = 0, maincodeend = 0;
+    int32_t range_checking = 1;
+    ustring shadername;
+    in.get_string_table();
+    in.get(shadertype);
+    in.get_string(shadername);
+    in.get(maincodebegin);
+    in.get(maincodeend);
+    in.get(range_checking);
+    master->m_shadertype     = ShaderType(shadertype);
+    master->m_shadername     = shadername.string();
+    master->m_maincodebegin  = maincodebegin;
+    master->m_maincodeend    = maincodeend;
+    master->m_range_checking = range_checking != 0;
+
+    size_t nstructs = 0;
+    std::vector<ustring> structnames;
+    in.get_count(nstructs, 2 * sizeof(int32_t));
+    for (size_t i = 0; i < nstructs && in.ok(); ++i) {
+        ustring name;
+        size_t nfields = 0;
+        in.get_string(name);
+        in.get_count(nfields, sizeof(int32_t));
+        // As when parsing the .oso, the struct is looked up (or added) by
+        // name, and gets its field names if it doesn't have them yet.
+        std::vector<ustring> fields(nfields);
+        for (size_t f = 0; f < nfields && in.ok(); ++f)
+            in.get_string(fields[f]);
+        if (in.ok())
+            TypeSpec::add_struct_fields(TypeSpec(name.c_str(), 0).structure(),
+                                        fields);
+        structnames.push_back(name);
+    }
+
+    std::vector<SymRecord> syms;
+    in.get_array(syms);
+    master->m_symbols.reserve(syms.size());
+    for (const SymRecord& r : syms) {
+        if (!in.ok())
+            break;
+        if (!valid_type(r)
+            || (r.structure >= 0
+                && size_t(r.structure) >= structnames.size())) {
+            err = "is corrupt";
+            return nullptr;
+        }
+        TypeSpec t;
+        if (r.structure >= 0 && size_t(r.structure) < structnames.size())
+            t = TypeSpec(structnames[r.structure].c_str(), 0);
+        else if (r.flags & SymClosure)
+            t = TypeSpec(TypeColor, true);
+        else
+            t = TypeDesc(TypeDesc::BASETYPE(r.basetype),
+                         TypeDesc::AGGREGATE(r.aggregate),
+                         TypeDesc::VECSEMANTICS(r.vecsemantics));
+        if (r.arraylen)
+            t.make_array(r.arraylen);
+        Symbol sym(in.string(r.name), t, SymType(r.symtype));
+        sym.dataoffset(r.dataoffset);
+        sym.initializers(r.initializers);
+        sym.fieldid(r.fieldid);
+        sym.initbegin(r.initbegin);
+        sym.initend(r.initend);
+        sym.set_read(r.firstread, r.lastread);
+        sym.set_write(r.firstwrite, r.lastwrite);
+        sym.interpolated(r.flags & SymInterpolated);
+        sym.interactive(r.flags & SymInteractive);
+        sym.allowconnect(r.flags & SymAllowConnect);
+        master->m_symbols.push_back(sym);
+    }
+
+    std::vector<OpRecord> ops;
+    in.get_array(ops);
+    master->m_ops.reserve(ops.size());
+    for (const OpRecord& r : ops) {
+        if (!in.ok())
+            break;
+        ustring opname = in.string(r.opname);
+        if (in.ok() && !shadingsys.op_descriptor(opname)) {
+            err = OIIO::Strutil::fmt::format("has unknown instruction \"{}\"",
+                                             opname);
+            return nullptr;
+        }
+        Opcode op(opname, in.string(r.method), r.firstarg, r.nargs);
+        op.set_jump(r.jump[0], r.jump[1], r.jump[2], r.jump[3]);
+        op.set_argbits(r.argread, r.argwrite, r.argtakesderivs);
+        op.source(in.string(r.sourcefile), r.sourceline);
+        master->m_ops.push_back(op);
+    }
+
+    in.get_array(master->m_args);
+    in.get_array(master->m_idefaults);
+    in.get_array(master->m_fdefaults);
+    in.get_strings(master->m_sdefaults);
+    in.get_array(master->m_iconsts);
+    in.get_array(master->m_fconsts);
+    in.get_strings(master->m_sconsts);
+    if (!in.ok()) {
+        err = "is truncated or corrupt";
+        return nullptr;
+    }
+
+    // Make sure that nothing refers outside of the tables, since the rest
+    // of the shading system trusts a master not to.
+    int nsyms = int(master->m_symbols.size());
+    int nops  = int(master->m_ops.size());
+    for (int a : master->m_args)
+        if (a < 0 || a >= nsyms) {
+            err = "is corrupt";
+            return nullptr;
+        }
+    auto valid_range = [nops](int begin, int end) {
+        return 0 <= begin && begin <= end && end <= nops;
+    };
+    if (!valid_range(master->m_maincodebegin, master->m_maincodeend)) {
+        err = "is corrupt";
+        return nullptr;
+    }
+    for (auto&& op : master->m_ops) {
+        bool ok = op.firstarg() >= 0 && op.nargs() >= 0
+                  && size_t(op.firstarg()) + size_t(op.nargs())
+                         <= master->m_args.size();
+        for (int j = 0; j < (int)Opcode::max_jumps; ++j)
+            ok &= op.jump(j) >= -1 && op.jump(j) <= nops;
+        if (!ok) {
+            err = "is corrupt";
+            return nullptr;
+        }
+    }
+    for (auto&& s : master->m_symbols) {
+        if (!valid_range(s.initbegin(), s.initend())) {
+            err = "is corrupt";
+            return nullptr;
+        }
+        // Each symbol with a table entry has as many values as the .oso
+        // reader gives it, and at least one for an unsized array.
+        size_t tablesize = 0;
+        TypeDesc t       = s.typespec().simpletype();
+        size_t nvals     = size_t(t.aggregate)
+                       * (t.is_unsized_array() ? 1 : t.numelements());
+        bool param = s.symtype() == SymTypeParam
+                     || s.symtype() == SymTypeOutputParam;
+        if (s.typespec().is_structure())
+            continue;
+        else if (param && s.typespec().is_closure_based())
+            tablesize = master->m_sdefaults.size();
+        else if (param && t.basetype == TypeDesc::INT)
+            tablesize = master->m_idefaults.size();
+        else if (param && t.basetype == TypeDesc::FLOAT)
+            tablesize = master->m_fdefaults.size();
+        else if (param && t.basetype == TypeDesc::STRING)
+            tablesize = master->m_sdefaults.size();
+        else if (s.symtype() == SymTypeConst && t.basetype == TypeDesc::INT)
+            tablesize = master->m_iconsts.size();
+        else if (s.symtype() == SymTypeConst && t.basetype == TypeDesc::FLOAT)
+            tablesize = master->m_fconsts.size();
+        else if (s.symtype() == SymTypeConst && t.basetype == TypeDesc::STRING)
+            tablesize = master->m_sconsts.size();
+        else
+            continue;
+        if (s.dataoffset() < 0 || size_t(s.dataoffset()) + nvals > tablesize) {
+            err = "is corrupt";
+            return nullptr;
+        }
+    }
+    return master;
+}
+
+
+};  // namespace pvt
+OSL_NAMESPACE_END
@@ -2,7 +2,13 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cstdarg>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <memory>
+#include <shared_mutex>
 #include <sstream>
 
 #include "pointcloud.h"
@@ -15,37 +21,75 @@ OSL_NAMESPACE_BEGIN
 namespace pvt {
 
 #ifdef USE_PARTIO
-using PointCloudMap
-    = std::unordered_map<ustringhash, std::unique_ptr<PointCloud>>;
+// The registry of point clouds, by filename. Each entry is a future for the
+// cloud, so that the thread that first asks for a file reads it without
+// holding the registry lock, while only the other threads that want that
+// same file wait for it. The shared futures also own the clouds.
+using PointCloudFuture = std::shared_future<std::shared_ptr<PointCloud>>;
+using PointCloudMap    = std::unordered_map<ustringhash, PointCloudFuture>;
 static PointCloudMap pointclouds;
-static OIIO::spin_mutex pointcloudmap_mutex;
+static std::shared_mutex pointcloudmap_mutex;
 
 PointCloud*
-PointCloud::get(ustringhash filename, bool write)
+PointCloud::get(ustringhash filename, bool write, ShadingContext* ctx)
 {
     if (filename.empty())
         return nullptr;
-    spin_lock lock(pointcloudmap_mutex);
-    PointCloudMap::const_iterator found = pointclouds.find(filename);
-    if (found != pointclouds.end())
-        return found->second.get();
-    // Not found. Create a new one.
-    Partio::ParticlesDataMutable* partio_cloud = nullptr;
-    if (!write) {
-        // Mute Partio error prints: by default Partio::read sends errors directly
-        // to std::err, but in most cases we want errors to go via errorfmt so the
-        // renderer can recognize the message as an error, as we do in
-        // pointcloud_search and pointcloud_get.
-        std::stringstream m_errorStream;
-
-        partio_cloud = Partio::read(filename.c_str(), false, m_errorStream);
-        if (!partio_cloud)
-            return nullptr;
-    } else {
-        partio_cloud = Partio::create();
+    if (ctx) {
+        if (PointCloud* pc = ctx->cached_pointcloud(filename, write))
+            return pc;
+    }
+
+    PointCloudFuture future;
+    std::promise<std::shared_ptr<PointCloud>> promise;
+    bool loader = false;
+    {
+        std::shared_lock<std::shared_mutex> lock(pointcloudmap_mutex);
+        PointCloudMap::const_iterator found = pointclouds.find(filename);
+        if (found != pointclouds.end())
+            future = found->second;
+    }
+    if (!future.valid()) {
+        std::unique_lock<std::shared_mutex> lock(pointcloudmap_mutex);
+        PointCloudFuture& entry = pointclouds[filename];
+        if (!entry.valid()) {
+            // Nobody else has asked for it yet, so it's up to us
+            entry  = promise.get_future().share();
+            loader = true;
+        }
+        future = entry;
     }
-    PointCloud* pc = new PointCloud(filename, partio_cloud, write);
-    pointclouds[filename].reset(pc);
+
+    if (loader) {
+        // Not found. Create a new one.
+        Partio::ParticlesDataMutable* partio_cloud = nullptr;
+        if (!write) {
+            // Mute Partio error prints: by default Partio::read sends errors
+            // directly to std::err, but in most cases we want errors to go
+            // via errorfmt so the renderer can recognize the message as an
+            // error, as we do in pointcloud_search and pointcloud_get.
+            std::stringstream m_errorStream;
+
+            partio_cloud = Partio::read(filename.c_str(), false,
+                                        m_errorStream);
+        } else {
+            partio_cloud = Partio::create();
+        }
+        std::shared_ptr<PointCloud> pc;
+        if (partio_cloud)
+            pc.reset(new PointCloud(filename, partio_cloud, write));
+        promise.set_value(pc);
+        if (!pc) {
+            // Forget the failure, so that a later request tries again,
+            // just as it would have if we had never seen this file.
+            std::unique_lock<std::shared_mutex> lock(pointcloudmap_mutex);
+            pointclouds.erase(filename);
+        }
+    }
+
+    PointCloud* pc = future.get().get();
+    if (ctx && pc)
+        ctx->cache_pointcloud(filename, write, pc);
     return pc;
 }
 
@@ -69,6 +113,23 @@ PointCloud::PointCloud(ustringhash filename,
             m_partio_cloud->attributeInfo(i, *a);
             m_attributes[ustringhash_from(ustring(a->name))].reset(a);
         }
+
+        // Build our own spatial index over the positions, which is what
+        // the searches use. If there are no usable positions, the index is
+        // left empty and searches fall back to Partio's kd-tree.
+        const Partio::ParticleAttribute* pos = attribute(u_position);
+        size_t n = size_t(m_partio_cloud->numParticles());
+        if (pos && pos->count == 3
+            && (pos->type == Partio::VECTOR || pos->type == Partio::FLOAT)) {
+            std::vector<float> positions(3 * n);
+            for (size_t i = 0; i < n; ++i) {
+                const float* p = m_partio_cloud->data<float>(*pos, i);
+                positions[3 * i + 0] = p[0];
+                positions[3 * i + 1] = p[1];
+                positions[3 * i + 2] = p[2];
+            }
+            m_index.build(positions.data(), n);
+        }
     }
 }
 
@@ -82,6 +143,257 @@ PointCloud::~PointCloud()
     if (m_partio_cloud)
         m_partio_cloud->release();
 }
+
+
+
+void
+PointCloudIndex::build(const float* positions, size_t n)
+{
+    m_nodes.clear();
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+    m_index.clear();
+    if (n == 0 || n > size_t(std::numeric_limits<uint32_t>::max()))
+        return;
+
+    // Build the tree over a permutation of the points, then lay out the
+    // positions in the order the leaves refer to them.
+    std::vector<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), uint32_t(0));
+    m_nodes.reserve(2 * (n / LeafSize + 1));
+    m_nodes.emplace_back();
+    build_node(0, positions, order.data(), 0, uint32_t(n));
+
+    m_x.resize(n);
+    m_y.resize(n);
+    m_z.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        const float* p = positions + 3 * size_t(order[i]);
+        m_x[i]         = p[0];
+        m_y[i]         = p[1];
+        m_z[i]         = p[2];
+    }
+    m_index = std::move(order);
+}
+
+
+
+void
+PointCloudIndex::build_node(uint32_t nodeindex, const float* positions,
+                            uint32_t* order, uint32_t begin, uint32_t end)
+{
+    Node node;
+    for (int a = 0; a < 3; ++a) {
+        node.bmin[a] = std::numeric_limits<float>::max();
+        node.bmax[a] = -std::numeric_limits<float>::max();
+    }
+    for (uint32_t i = begin; i < end; ++i) {
+        const float* p = positions + 3 * size_t(order[i]);
+        for (int a = 0; a < 3; ++a) {
+            node.bmin[a] = std::min(node.bmin[a], p[a]);
+            node.bmax[a] = std::max(node.bmax[a], p[a]);
+        }
+    }
+
+    if (end - begin <= uint32_t(LeafSize)) {
+        node.first         = begin;
+        node.count         = end - begin;
+        m_nodes[nodeindex] = node;
+        return;
+    }
+
+    // Split at the median along the longest axis of the bounds, which
+    // keeps the tree balanced no matter how the points are distributed.
+    int axis = 0;
+    for (int a = 1; a < 3; ++a)
+        if (node.bmax[a] - node.bmin[a] > node.bmax[axis] - node.bmin[axis])
+            axis = a;
+    uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(order + begin, order + mid, order + end,
+                     [=](uint32_t a, uint32_t b) {
+                         return positions[3 * size_t(a) + axis]
+                                < positions[3 * size_t(b) + axis];
+                     });
+
+    uint32_t child = uint32_t(m_nodes.size());
+    m_nodes.resize(m_nodes.size() + 2);
+    node.first         = child;
+    node.count         = 0;
+    m_nodes[nodeindex] = node;
+    build_node(child, positions, order, begin, mid);
+    build_node(child + 1, positions, order, mid, end);
+}
+
+
+
+namespace {
+
+// Squared distance from p to the nearest point of a node's bounds.
+template<typename Node>
+inline float
+box_dist2(const Node& node, const float* p)
+{
+    float d2 = 0.0f;
+    for (int a = 0; a < 3; ++a) {
+        float d = std::max(std::max(node.bmin[a] - p[a], p[a] - node.bmax[a]),
+                           0.0f);
+        d2 += d * d;
+    }
+    return d2;
+}
+
+// Offer a point to a bounded max-heap of the nearest points found so far,
+// and return the new search bound (the squared radius that any further
+// point must beat).
+inline float
+heap_insert(SortedPointRecord* heap, int& count, int max_points, float bound,
+            float d2, Partio::ParticleIndex index)
+{
+    if (count < max_points) {
+        heap[count++] = SortedPointRecord(d2, index);
+        std::push_heap(heap, heap + count, SortedPointCompare());
+        return count == max_points ? heap[0].first : bound;
+    }
+    std::pop_heap(heap, heap + count, SortedPointCompare());
+    heap[count - 1] = SortedPointRecord(d2, index);
+    std::push_heap(heap, heap + count, SortedPointCompare());
+    return heap[0].first;
+}
+
+}  // namespace
+
+
+
+int
+PointCloudIndex::find_nearest(const Vec3& center, float radius, int max_points,
+                              bool sort, SortedPointRecord* results) const
+{
+    if (m_nodes.empty() || max_points <= 0)
+        return 0;
+    const float p[3] = { center.x, center.y, center.z };
+    float bound      = radius * radius;
+    int count        = 0;
+
+    uint32_t stack[64];
+    int stacksize = 0;
+    uint32_t n    = 0;
+    for (;;) {
+        const Node& node = m_nodes[n];
+        if (node.count) {
+            float d2[LeafSize];
+            for (uint32_t i = 0; i < node.count; ++i) {
+                uint32_t j = node.first + i;
+                float dx   = m_x[j] - p[0];
+                float dy   = m_y[j] - p[1];
+                float dz   = m_z[j] - p[2];
+                d2[i]      = dx * dx + dy * dy + dz * dz;
+            }
+            for (uint32_t i = 0; i < node.count; ++i)
+                if (d2[i] < bound)
+                    bound = heap_insert(results, count, max_points, bound,
+                                        d2[i], m_index[node.first + i]);
+        } else {
+            // Descend into the nearer child first, so that the bound
+            // shrinks as quickly as possible.
+            uint32_t near = node.first, far = node.first + 1;
+            float dnear = box_dist2(m_nodes[near], p);
+            float dfar  = box_dist2(m_nodes[far], p);
+            if (dfar < dnear) {
+                std::swap(near, far);
+                std::swap(dnear, dfar);
+            }
+            if (dfar < bound)
+                stack[stacksize++] = far;
+            if (dnear < bound) {
+                n = near;
+                continue;
+            }
+        }
+        // Pop the next node that may still hold a closer point
+        for (;;) {
+            if (!stacksize)
+                goto done;
+            n = stack[--stacksize];
+            if (box_dist2(m_nodes[n], p) < bound)
+                break;
+        }
+    }
+done:
+    if (sort)
+        std::sort_heap(results, results + count, SortedPointCompare());
+    return count;
+}
+
+
+
+void
+PointCloudIndex::find_nearest(int nqueries, const Vec3* centers,
+                              const float* radii, int max_points, bool sort,
+                              SortedPointRecord* results, int* counts) const
+{
+    OSL_DASSERT(nqueries <= MaxBatch);
+    for (int q = 0; q < nqueries; ++q)
+        counts[q] = 0;
+    if (m_nodes.empty() || max_points <= 0 || nqueries <= 0)
+        return;
+
+    float bound[MaxBatch];
+    for (int q = 0; q < nqueries; ++q)
+        bound[q] = radii[q] * radii[q];
+
+    // The queries walk the tree together. A node is visited if any of the
+    // queries could still find a point in it, and within a leaf each point
+    // is loaded once and tested against every query.
+    uint32_t stack[64];
+    int stacksize      = 0;
+    stack[stacksize++] = 0;
+    while (stacksize) {
+        const Node& node = m_nodes[stack[--stacksize]];
+        bool wanted[MaxBatch];
+        bool any = false;
+        for (int q = 0; q < nqueries; ++q) {
+            wanted[q] = box_dist2(node, &centers[q].x) < bound[q];
+            any |= wanted[q];
+        }
+        if (!any)
+            continue;
+        if (node.count) {
+            for (uint32_t i = 0; i < node.count; ++i) {
+                uint32_t j = node.first + i;
+                float x = m_x[j], y = m_y[j], z = m_z[j];
+                for (int q = 0; q < nqueries; ++q) {
+                    float dx = x - centers[q].x;
+                    float dy = y - centers[q].y;
+                    float dz = z - centers[q].z;
+                    float d2 = dx * dx + dy * dy + dz * dz;
+                    if (wanted[q] && d2 < bound[q])
+                        bound[q] = heap_insert(results + q * max_points,
+                                               counts[q], max_points, bound[q],
+                                               d2, m_index[j]);
+                }
+            }
+        } else {
+            // Order the children by their distance to the first query that
+            // wants this node; the batch is usually spatially coherent.
+            int q = 0;
+            while (!wanted[q])
+                ++q;
+            uint32_t near = node.first, far = node.first + 1;
+            if (box_dist2(m_nodes[far], &centers[q].x)
+                < box_dist2(m_nodes[near], &centers[q].x))
+                std::swap(near, far);
+            stack[stacksize++] = far;
+            stack[stacksize++] = near;
+        }
+    }
+
+    if (sort)
+        for (int q = 0; q < nqueries; ++q)
+            std::sort_heap(results + q * max_points,
+                           results + q * max_points + counts[q],
+                           SortedPointCompare());
+}
 #endif
 
 }  // namespace pvt
@@ -97,7 +409,7 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
 #ifdef USE_PARTIO
     if (filename.empty())
         return 0;
-    PointCloud* pc = PointCloud::get(filename);
+    PointCloud* pc = PointCloud::get(filename, false, sg->context);
     if (pc == NULL) {  // The file failed to load
         sg->context->errorfmt("pointcloud_search: could not open \"{}\"",
                               filename);
@@ -119,7 +431,7 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
     // found point's positions.
     Partio::ParticleAttribute* pos_attr = NULL;
     if (derivs_offset) {
-        pos_attr = pc->m_attributes[u_position].get();
+        pos_attr = pc->attribute(u_position);
         if (!pos_attr)
             return 0;  // No "position" attribute -- fail
     }
@@ -141,13 +453,27 @@ RendererServices::pointcloud_search(ShaderGlobals* sg, ustringhash filename,
         dist2 = (float*)sg->context->alloc_scratch(max_points * sizeof(float),
                                                    sizeof(float));
 
-    float finalRadius;
-    int count = cloud->findNPoints(&center[0], max_points, radius, indices,
+    int count;
+    if (!pc->m_index.empty()) {
+        SortedPointRecord* found
+            = (SortedPointRecord*)sg->context->alloc_scratch(
+                max_points * sizeof(SortedPointRecord),
+                sizeof(SortedPointRecord));
+        count = pc->m_index.find_nearest(center, radius, max_points, sort,
+                                         found);
+        for (int i = 0; i < count; ++i) {
+            dist2[i]   = found[i].first;
+            indices[i] = found[i].second;
+        }
+    } else {
+        float finalRadius;
+        count = cloud->findNPoints(&center[0], max_points, radius, indices,
                                    dist2, &finalRadius);
+    }
 
     // If sorting, allocate some temp space and sort the distances and
-    // indices at the same time.
-    if (sort && count > 1) {
+    // indices at the same time (the index already returns them sorted).
+    if (sort && count > 1 && pc->m_index.empty()) {
         SortedPointRecord* sorted
             = (SortedPointRecord*)sg->context->alloc_scratch(
                 count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
@@ -222,7 +548,7 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
     if (!count)
         return 1;  // always succeed if not asking for any data
 
-    PointCloud* pc = PointCloud::get(filename);
+    PointCloud* pc = PointCloud::get(filename, false, sg->context);
     if (pc == NULL) {  // The file failed to load
         sg->context->errorfmt("pointcloud_get: could not open \"{}\"",
                               filename);
@@ -237,7 +563,7 @@ RendererServices::pointcloud_get(ShaderGlobals* sg, ustringhash filename,
     }
 
     // lookup the ParticleAttribute pointer needed for a query
-    Partio::ParticleAttribute* attr = pc->m_attributes[attr_name].get();
+    Partio::ParticleAttribute* attr = pc->attribute(attr_name);
     if (!attr) {
         sg->context->errorfmt(
             "Accessing unexisting attribute {} in pointcloud \"{}\"", attr_name,
@@ -4,17 +4,80 @@
 
 #ifdef USE_PARTIO
 #    include <Partio.h>
+#    include <cstdint>
 #    include <memory>
 #    include <unordered_map>
+#    include <utility>
+#    include <vector>
 #endif
 
 #include <OSL/oslconfig.h>
 
 OSL_NAMESPACE_BEGIN
+class ShadingContext;
+
 namespace pvt {
 
 #ifdef USE_PARTIO
 
+// some helper classes to make the sort easy
+typedef std::pair<float, Partio::ParticleIndex> SortedPointRecord;  // dist,index
+struct SortedPointCompare {
+    bool operator()(const SortedPointRecord& a, const SortedPointRecord& b)
+    {
+        return a.first < b.first;
+    }
+};
+
+
+
+/// Spatial index over the positions of a point cloud, built once when the
+/// cloud is read. It is a BVH with small leaves, and the positions are
+/// stored as separate x, y, z arrays in leaf order so that the distance
+/// tests within a leaf are a tight, vectorizable loop. The nearest points
+/// are selected with a bounded max-heap as the tree is searched, rather
+/// than gathering candidates and sorting them afterwards.
+class OSLEXECPUBLIC PointCloudIndex {
+public:
+    /// Build the index over n points, whose positions are xyz triples.
+    void build(const float* positions, size_t n);
+
+    bool empty() const { return m_nodes.empty(); }
+
+    /// Find up to max_points points within radius of center, storing
+    /// (squared distance, index) pairs in results[0..max_points-1] and
+    /// returning how many were found. If sort is true they are ordered
+    /// nearest first, otherwise in no particular order.
+    int find_nearest(const Vec3& center, float radius, int max_points,
+                     bool sort, SortedPointRecord* results) const;
+
+    /// Batched form of find_nearest, for up to MaxBatch queries at once.
+    /// The whole batch traverses the tree together, visiting each node
+    /// once for all the queries that need it. Query i stores its results
+    /// at results[i*max_points] and its count in counts[i].
+    static constexpr int MaxBatch = 16;
+    void find_nearest(int nqueries, const Vec3* centers, const float* radii,
+                      int max_points, bool sort, SortedPointRecord* results,
+                      int* counts) const;
+
+private:
+    struct Node {
+        float bmin[3], bmax[3];  // bounds of all points below
+        uint32_t first;          // first child (interior), or first point
+        uint32_t count;          // number of points if a leaf, else 0
+    };
+    static constexpr int LeafSize = 8;
+
+    void build_node(uint32_t nodeindex, const float* positions,
+                    uint32_t* order, uint32_t begin, uint32_t end);
+
+    std::vector<Node> m_nodes;
+    std::vector<float> m_x, m_y, m_z;  // positions, in leaf order
+    std::vector<uint32_t> m_index;     // original index of each point
+};
+
+
+
 class OSLEXECPUBLIC PointCloud {
 public:
     PointCloud(ustringhash filename, Partio::ParticlesDataMutable* partio_cloud,
@@ -26,7 +89,23 @@ public:
     PointCloud& operator=(const PointCloud&)  = delete;
     PointCloud& operator=(const PointCloud&&) = delete;
 
-    static PointCloud* get(ustringhash filename, bool write = false);
+    /// Return the point cloud for the file, reading it (or, if write is
+    /// true, creating it) the first time it is asked for. Returns nullptr
+    /// if the file could not be read. Any number of threads may call this
+    /// at once; only those that need a cloud that is still being read
+    /// wait for it. If ctx is supplied, its memo of the last cloud it
+    /// resolved is consulted and updated.
+    static PointCloud* get(ustringhash filename, bool write = false,
+                           ShadingContext* ctx = nullptr);
+
+    /// Look up an attribute without modifying the attribute map, so it is
+    /// safe for concurrent readers. Returns nullptr if there is no such
+    /// attribute.
+    Partio::ParticleAttribute* attribute(ustringhash name) const
+    {
+        auto found = m_attributes.find(name);
+        return found != m_attributes.end() ? found->second.get() : nullptr;
+    }
 
     typedef std::unordered_map<ustringhash,
                                std::unique_ptr<Partio::ParticleAttribute>>
@@ -54,21 +133,13 @@ public:
     bool m_write;
     Partio::ParticleAttribute m_position_attribute;
     OIIO::spin_mutex m_mutex;
+    PointCloudIndex m_index;  ///< Spatial index for reading (may be empty)
 };
 
 namespace {  // anon
 
 static ustring u_position("position");
 
-// some helper classes to make the sort easy
-typedef std::pair<float, Partio::ParticleIndex> SortedPointRecord;  // dist,index
-struct SortedPointCompare {
-    bool operator()(const SortedPointRecord& a, const SortedPointRecord& b)
-    {
-        return a.first < b.first;
-    }
-};
-
 inline Partio::ParticleAttributeType
 PartioType(TypeDesc t)
 {
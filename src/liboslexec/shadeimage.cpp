@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <vector>
+
 #include <OSL/oslconfig.h>
 
 #include <OpenImageIO/imagebuf.h>
@@ -9,6 +11,12 @@
 #include <OpenImageIO/thread.h>
 
 #include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+#if OSL_USE_BATCHED
+#    include <OSL/batched_shaderglobals.h>
+#endif
+
+#include "oslexec_pvt.h"
 
 using namespace OSL;
 using namespace OSL::pvt;
@@ -20,6 +28,248 @@ using namespace OSL::pvt;
 
 OSL_NAMESPACE_BEGIN
 
+namespace {
+
+// What we need to know about each requested output, gathered once rather
+// than for each pixel.
+struct ShadeImageOutput {
+    const ShaderSymbol* sym;
+    TypeDesc type;
+    int nchans;
+    bool uniform = false;  // Just one value in a batch (not wide)?
+};
+
+
+
+// Set up the shader globals that are the same for every point shaded.
+void
+init_shaderglobals(ShaderGlobals& sg, const ShaderGlobals* defaultsg,
+                   const OIIO::ROI& roi_full,
+                   ShadeImageLocations shadelocations, const Matrix44& Mshad,
+                   const Matrix44& Mobj)
+{
+    int xres = roi_full.width();
+    int yres = roi_full.height();
+    int zres = roi_full.depth();
+    // Note that because we are shading a single object that is a flat image
+    // plane, a lot of this is simplified. In a real 3D render, most of
+    // these fields would need to be reset for every shade.
+    if (defaultsg) {
+        // If the caller passed a default SG template, use it to initialize
+        // the sg and in particular to set all the constant fields.
+        memcpy((char*)&sg, (const char*)defaultsg, sizeof(ShaderGlobals));
+    } else {
+        // No SG template was passed, so set up reasonable defaults.
+        memset((char*)&sg, 0, sizeof(ShaderGlobals));
+        // Set "shader" space to be Mshad.  In a real renderer, this may be
+        // different for each shader group.
+        sg.shader2common = OSL::TransformationPtr(&Mshad);
+        // Set "object" space to be Mobj.  In a real renderer, this may be
+        // different for each object.
+        sg.object2common = OSL::TransformationPtr(&Mobj);
+        // Just make it look like all shades are the result of 'raytype' rays.
+        sg.raytype = 0;  // default ray type
+        // Set the surface area of the patch to 1 (which it is).  This is
+        // only used for light shaders that call the surfacearea() function.
+        sg.surfacearea = 1;
+        // Derivs are constant across the image
+        if (shadelocations == ShadePixelCenters) {
+            sg.dudx = 1.0f / xres;  // sg.dudy is already 0
+            sg.dvdy = 1.0f / yres;  // sg.dvdx is already 0
+        } else {
+            sg.dudx = 1.0f / std::max(1, (xres - 1));
+            sg.dvdy = 1.0f / std::max(1, (yres - 1));
+        }
+        // Derivatives with respect to x,y
+        sg.dPdx = Vec3(1.0f, 0.0f, 0.0f);
+        sg.dPdy = Vec3(0.0f, 1.0f, 0.0f);
+        sg.dPdz = Vec3(0.0f, 0.0f, 1.0f);
+        // Tangents of P with respect to surface u,v
+        sg.dPdu = Vec3(xres, 0.0f, 0.0f);
+        sg.dPdv = Vec3(0.0f, yres, 0.0f);
+        sg.dPdz = Vec3(0.0f, 0.0f, zres);
+        // That also implies that our normal points to (0,0,1)
+        sg.N  = Vec3(0, 0, 1);
+        sg.Ng = Vec3(0, 0, 1);
+        // In our SimpleRenderer, the "renderstate" itself just a pointer to
+        // the ShaderGlobals.
+        // sg.renderstate = &sg;
+    }
+}
+
+
+
+// Compute the u,v shading location of pixel (x,y).
+inline void
+pixel_uv(int x, int y, const OIIO::ROI& roi_full,
+         ShadeImageLocations shadelocations, float& u, float& v)
+{
+    int xres = roi_full.width();
+    int yres = roi_full.height();
+    if (shadelocations == ShadePixelCenters) {
+        u = float(x - roi_full.xbegin + 0.5f) / xres;
+        v = float(y - roi_full.ybegin + 0.5f) / yres;
+        // float w = float(p.z()-roi_full.zbegin+0.5f) / zres;
+    } else {
+        u = (xres == 1) ? 0.5f : float(x - roi_full.xbegin) / (xres - 1);
+        v = (yres == 1) ? 0.5f : float(y - roi_full.ybegin) / (yres - 1);
+        // float w = (zres == 1) ? 0.5f : float(p.z()-roi_full.zbegin) / (zres - 1);
+    }
+}
+
+
+
+// Save all the designated outputs of the most recent execution into the
+// pixel. Component c of each output is found at data[c * stride + lane],
+// which covers both the scalar layout (stride 1, lane 0) and the wide
+// layout used by batched execution (stride is the batch width). A uniform
+// output of a batch has the scalar layout, whatever the lane.
+inline void
+save_outputs(ShadingSystem& shadingsys, const ShadingContext& ctx,
+             cspan<ShadeImageOutput> outputs,
+             OIIO::ImageBuf::Iterator<float>& p, int nchannels, int stride,
+             int lane)
+{
+    int chan = 0;
+    for (const ShadeImageOutput& out : outputs) {
+        const void* data = shadingsys.symbol_address(ctx, out.sym);
+        if (!data)
+            continue;  // Skip if symbol isn't found
+        if (chan + out.nchans > nchannels)
+            break;
+        int s = out.uniform ? 1 : stride;
+        int l = out.uniform ? 0 : lane;
+        if (out.type.basetype == TypeDesc::FLOAT) {
+            for (int c = 0; c < out.nchans; ++c)
+                p[chan++] = ((const float*)data)[c * s + l];
+        } else if (out.type.basetype == TypeDesc::INT) {
+            for (int c = 0; c < out.nchans; ++c)
+                p[chan++] = ((const int*)data)[c * s + l];
+        }
+        // N.B. Drop any outputs that aren't float- or int-based
+    }
+}
+
+
+
+#if OSL_USE_BATCHED
+// Return the widest batch at which both the ShadingSystem and the renderer
+// are able to execute, or 0 if shade_image should shade one point at a
+// time. Batched execution also requires that the app has left
+// "opt_batched_analysis" enabled, and has already configured the JIT for
+// batches (see configure_batch_execution_at). Doing that here would change
+// the JIT options for everything else the app shades.
+int
+shade_image_batch_width(ShadingSystem& shadingsys)
+{
+    int batched_analysis = 0;
+    ustring jit_target;
+    shadingsys.getattribute("opt_batched_analysis", batched_analysis);
+    shadingsys.getattribute("llvm_jit_target", jit_target);
+    RendererServices* rs = shadingsys.renderer();
+    if (!batched_analysis || jit_target.empty() || !rs)
+        return 0;
+    if (rs->batched(WidthOf<16>())
+        && shadingsys.supports_batch_execution_at(16))
+        return 16;
+    if (rs->batched(WidthOf<8>()) && shadingsys.supports_batch_execution_at(8))
+        return 8;
+    if (rs->batched(WidthOf<4>()) && shadingsys.supports_batch_execution_at(4))
+        return 4;
+    return 0;
+}
+
+
+
+// Shade the roi in runs of up to WidthT pixels along each scanline. The
+// last run of a scanline may be a partial batch.
+template<int WidthT>
+void
+shade_image_batched(ShadingSystem& shadingsys, ShaderGroup& group,
+                    ShadingContext* ctx, const ShaderGlobals& sg,
+                    OIIO::ImageBuf& buf, cspan<ShadeImageOutput> outputs,
+                    ShadeImageLocations shadelocations, OIIO::ROI roi)
+{
+    auto executor = shadingsys.batched<WidthT>();
+    executor.jit_group(&group, ctx);
+
+    // Which outputs are uniform is only known once the group is JITed
+    std::vector<ShadeImageOutput> wide_outputs(outputs.begin(), outputs.end());
+    for (ShadeImageOutput& out : wide_outputs)
+        out.uniform = out.sym && ((const Symbol*)out.sym)->is_uniform();
+
+    // Broadcast the fields that are the same for every point.
+    BatchedShaderGlobals<WidthT> bsg;
+    memset(&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+    bsg.uniform.renderstate = sg.renderstate;
+    bsg.uniform.tracedata   = sg.tracedata;
+    bsg.uniform.objdata     = sg.objdata;
+    bsg.uniform.raytype     = sg.raytype;
+    auto& vsg               = bsg.varying;
+    assign_all(vsg.dPdx, sg.dPdx);
+    assign_all(vsg.dPdy, sg.dPdy);
+    assign_all(vsg.dPdz, sg.dPdz);
+    assign_all(vsg.I, sg.I);
+    assign_all(vsg.dIdx, sg.dIdx);
+    assign_all(vsg.dIdy, sg.dIdy);
+    assign_all(vsg.N, sg.N);
+    assign_all(vsg.Ng, sg.Ng);
+    assign_all(vsg.dudx, sg.dudx);
+    assign_all(vsg.dudy, sg.dudy);
+    assign_all(vsg.dvdx, sg.dvdx);
+    assign_all(vsg.dvdy, sg.dvdy);
+    assign_all(vsg.dPdu, sg.dPdu);
+    assign_all(vsg.dPdv, sg.dPdv);
+    assign_all(vsg.time, sg.time);
+    assign_all(vsg.dtime, sg.dtime);
+    assign_all(vsg.dPdtime, sg.dPdtime);
+    assign_all(vsg.Ps, sg.Ps);
+    assign_all(vsg.dPsdx, sg.dPsdx);
+    assign_all(vsg.dPsdy, sg.dPsdy);
+    assign_all(vsg.object2common, sg.object2common);
+    assign_all(vsg.shader2common, sg.shader2common);
+    assign_all(vsg.surfacearea, sg.surfacearea);
+    assign_all(vsg.flipHandedness, sg.flipHandedness);
+    assign_all(vsg.backfacing, sg.backfacing);
+
+    OIIO::ROI roi_full = buf.roi_full();
+    Block<int, WidthT> shadeindex;
+    for (int z = roi.zbegin; z < roi.zend; ++z) {
+        for (int y = roi.ybegin; y < roi.yend; ++y) {
+            for (int x = roi.xbegin; x < roi.xend; x += WidthT) {
+                // Set the shader globals that vary from pixel to pixel
+                int npoints = std::min(WidthT, roi.xend - x);
+                for (int lane = 0; lane < npoints; ++lane) {
+                    float u, v;
+                    pixel_uv(x + lane, y, roi_full, shadelocations, u, v);
+                    vsg.P[lane]      = Vec3(x + lane, y, z);
+                    vsg.u[lane]      = u;
+                    vsg.v[lane]      = v;
+                    shadeindex[lane] = ((z - roi_full.zbegin)
+                                            * roi_full.height()
+                                        + (y - roi_full.ybegin))
+                                           * roi_full.width()
+                                       + (x + lane - roi_full.xbegin);
+                }
+
+                // Actually run the shader for this batch of points
+                executor.execute(*ctx, group, npoints, shadeindex, bsg,
+                                 nullptr, nullptr);
+
+                // Scatter the wide results into the pixels
+                OIIO::ImageBuf::Iterator<float> p(buf, x, x + npoints, y,
+                                                  y + 1, z, z + 1);
+                for (int lane = 0; lane < npoints; ++lane, ++p)
+                    save_outputs(shadingsys, *ctx, wide_outputs, p,
+                                 buf.nchannels(), WidthT, lane);
+            }
+        }
+    }
+}
+#endif
+
+}  // namespace
+
 
 
 bool
@@ -39,6 +289,14 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         return false;
     }
 
+    // If both the ShadingSystem and the renderer support batched
+    // execution, shade whole runs of pixels at once. This is decided once
+    // up front, for all of the threads.
+    int batch_width = 0;
+#if OSL_USE_BATCHED
+    batch_width = shade_image_batch_width(shadingsys);
+#endif
+
     parallel_image(roi, popt, [&](OIIO::ROI roi) {
         // Request an OSL::PerThreadInfo for this thread.
         OSL::PerThreadInfo* thread_info = shadingsys.create_thread_info();
@@ -49,118 +307,60 @@ shade_image(ShadingSystem& shadingsys, ShaderGroup& group,
         // within a thread.
         ShadingContext* ctx = shadingsys.get_context(thread_info);
 
-        // Ensure the group has already been optimized
-        shadingsys.optimize_group(&group, ctx);
+        // Ensure the group has already been optimized. The batched path
+        // JITs its own code, so only JIT the scalar code if it's needed.
+        shadingsys.optimize_group(&group, ctx, batch_width == 0 /*do_jit*/);
 
         Matrix44 Mshad, Mobj;  // just let these be identity for now
         OIIO::ROI roi_full = buf.roi_full();
-        int xres           = roi_full.width();
-        int yres           = roi_full.height();
-        int zres           = roi_full.depth();
 
         // Gather some information about the outputs once, rather than for
         // each pixel.
-        const ShaderSymbol** output_sym = OSL_ALLOCA(const ShaderSymbol*,
-                                                     outputs.size());
-        TypeDesc* output_type           = OSL_ALLOCA(TypeDesc, outputs.size());
-        int* output_nchans              = OSL_ALLOCA(int, outputs.size());
+        ShadeImageOutput* output_info = OSL_ALLOCA(ShadeImageOutput,
+                                                   outputs.size());
         for (int i = 0; i < int(outputs.size()); ++i) {
-            output_sym[i]    = shadingsys.find_symbol(group, outputs[i]);
-            output_type[i]   = shadingsys.symbol_typedesc(output_sym[i]);
-            output_nchans[i] = output_type[i].numelements()
-                               * output_type[i].aggregate;
+            output_info[i].sym     = shadingsys.find_symbol(group, outputs[i]);
+            output_info[i].type    = shadingsys.symbol_typedesc(
+                output_info[i].sym);
+            output_info[i].nchans  = output_info[i].type.numelements()
+                                     * output_info[i].type.aggregate;
+            output_info[i].uniform = false;
         }
+        cspan<ShadeImageOutput> output_span(output_info, outputs.size());
 
-        // Set up shader globals and a little test grid of points to shade.
-        // Note that some of the fields can be set up once and used for all of
-        // the shades. Others need to be changed for every point shaded.
-        //
-        // Note that because we are shading a single object that is a flat image
-        // plane, a lot of this is simplified. In a real 3D render, most of
-        // these fields would need to be reset for every shade.
+        // Set up shader globals. Note that some of the fields can be set up
+        // once and used for all of the shades. Others need to be changed
+        // for every point shaded.
         ShaderGlobals sg;
-        if (defaultsg) {
-            // If the caller passed a default SG template, use it to initialize
-            // the sg and in particular to set all the constant fields.
-            memcpy((char*)&sg, (const char*)defaultsg, sizeof(ShaderGlobals));
-        } else {
-            // No SG template was passed, so set up reasonable defaults.
-            memset((char*)&sg, 0, sizeof(ShaderGlobals));
-            // Set "shader" space to be Mshad.  In a real renderer, this may be
-            // different for each shader group.
-            sg.shader2common = OSL::TransformationPtr(&Mshad);
-            // Set "object" space to be Mobj.  In a real renderer, this may be
-            // different for each object.
-            sg.object2common = OSL::TransformationPtr(&Mobj);
-            // Just make it look like all shades are the result of 'raytype' rays.
-            sg.raytype = 0;  // default ray type
-            // Set the surface area of the patch to 1 (which it is).  This is
-            // only used for light shaders that call the surfacearea() function.
-            sg.surfacearea = 1;
-            // Derivs are constant across the image
-            if (shadelocations == ShadePixelCenters) {
-                sg.dudx = 1.0f / xres;  // sg.dudy is already 0
-                sg.dvdy = 1.0f / yres;  // sg.dvdx is already 0
-            } else {
-                sg.dudx = 1.0f / std::max(1, (xres - 1));
-                sg.dvdy = 1.0f / std::max(1, (yres - 1));
-            }
-            // Derivatives with respect to x,y
-            sg.dPdx = Vec3(1.0f, 0.0f, 0.0f);
-            sg.dPdy = Vec3(0.0f, 1.0f, 0.0f);
-            sg.dPdz = Vec3(0.0f, 0.0f, 1.0f);
-            // Tangents of P with respect to surface u,v
-            sg.dPdu = Vec3(xres, 0.0f, 0.0f);
-            sg.dPdv = Vec3(0.0f, yres, 0.0f);
-            sg.dPdz = Vec3(0.0f, 0.0f, zres);
-            // That also implies that our normal points to (0,0,1)
-            sg.N  = Vec3(0, 0, 1);
-            sg.Ng = Vec3(0, 0, 1);
-            // In our SimpleRenderer, the "renderstate" itself just a pointer to
-            // the ShaderGlobals.
-            // sg.renderstate = &sg;
-        }
+        init_shaderglobals(sg, defaultsg, roi_full, shadelocations, Mshad,
+                           Mobj);
 
-        // Loop over all pixels in the image (in x and y)...
-        for (OIIO::ImageBuf::Iterator<float> p(buf, roi); !p.done(); ++p) {
-            // Set the shader globals that vary from point to pixel to pixel
-            sg.P = Vec3(p.x(), p.y(), p.z());
-            if (shadelocations == ShadePixelCenters) {
-                sg.u = float(p.x() - roi_full.xbegin + 0.5f) / xres;
-                sg.v = float(p.y() - roi_full.ybegin + 0.5f) / yres;
-                // float w = float(p.z()-roi_full.zbegin+0.5f) / zres;
-            } else {
-                sg.u = (xres == 1)
-                           ? 0.5f
-                           : float(p.x() - roi_full.xbegin) / (xres - 1);
-                sg.v = (yres == 1)
-                           ? 0.5f
-                           : float(p.y() - roi_full.ybegin) / (yres - 1);
-                // float w = (zres == 1) ? 0.5f : float(p.z()-roi_full.zbegin) / (zres - 1);
-            }
+#if OSL_USE_BATCHED
+        if (batch_width == 16)
+            shade_image_batched<16>(shadingsys, group, ctx, sg, buf,
+                                    output_span, shadelocations, roi);
+        else if (batch_width == 8)
+            shade_image_batched<8>(shadingsys, group, ctx, sg, buf,
+                                   output_span, shadelocations, roi);
+        else if (batch_width == 4)
+            shade_image_batched<4>(shadingsys, group, ctx, sg, buf,
+                                   output_span, shadelocations, roi);
+        else
+#endif
+        {
+            // Loop over all pixels in the image (in x and y)...
+            for (OIIO::ImageBuf::Iterator<float> p(buf, roi); !p.done(); ++p) {
+                // Set the shader globals that vary from point to pixel to
+                // pixel
+                sg.P = Vec3(p.x(), p.y(), p.z());
+                pixel_uv(p.x(), p.y(), roi_full, shadelocations, sg.u, sg.v);
 
-            // Actually run the shader for this point
-            shadingsys.execute(*ctx, group, sg);
-
-            // Save all the designated outputs.
-            int chan = 0;
-            for (int i = 0; i < int(outputs.size()); ++i) {
-                const void* data = shadingsys.symbol_address(*ctx,
-                                                             output_sym[i]);
-                if (!data)
-                    continue;  // Skip if symbol isn't found
-                TypeDesc t = output_type[i];
-                int tvals  = output_nchans[i];
-                if (chan + tvals > buf.nchannels())
-                    break;
-                if (t.basetype == TypeDesc::FLOAT) {
-                    for (int c = 0; c < tvals; ++c)
-                        p[chan++] = ((const float*)data)[c];
-                } else if (t.basetype == TypeDesc::INT) {
-                    for (int c = 0; c < int(t.numelements()) * t.aggregate; ++c)
-                        p[chan++] = ((const int*)data)[c];
-                }
-                // N.B. Drop any outputs that aren't float- or int-based
+                // Actually run the shader for this point
+                shadingsys.execute(*ctx, group, sg);
+
+                // Save all the designated outputs.
+                save_outputs(shadingsys, *ctx, output_span, p,
+                             buf.nchannels(), 1, 0);
             }
         }
 
@@ -2,11 +2,15 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <iterator>
+#include <map>
 #include <mutex>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include "oslexec_pvt.h"
@@ -125,6 +129,22 @@ ShadingSystem::LoadMemoryCompiledShader(string_view shadername,
 
 
 
+bool
+ShadingSystem::preload_shaders(cspan<ustring> shadernames, int nthreads)
+{
+    return m_impl->preload_shaders(shadernames, nthreads);
+}
+
+
+
+bool
+ShadingSystem::preload_shader_manifest(string_view filename, int nthreads)
+{
+    return m_impl->preload_shader_manifest(filename, nthreads);
+}
+
+
+
 ShaderGroupRef
 ShadingSystem::ShaderGroupBegin(string_view groupname)
 {
@@ -223,6 +243,14 @@ ShadingSystem::ReParameter(ShaderGroup& group, string_view layername,
 
 
 
+int
+ShadingSystem::settle_interactive_params()
+{
+    return m_impl->settle_interactive_params();
+}
+
+
+
 PerThreadInfo*
 ShadingSystem::create_thread_info()
 {
@@ -487,14 +515,23 @@ ShadingSystem::symbol_address(const ShadingContext& ctx,
 }
 
 #if OSL_USE_BATCHED
-bool
-ShadingSystem::configure_batch_execution_at(int width)
+// Can this machine execute batches of the given width, at the target the
+// app requested if any? If configure is true, and it can, set the options
+// to match: llvm_jit_target (unless requested) and llvm_jit_fma.
+static bool
+batch_execution_at(ShadingSystemImpl& impl, int width, bool configure)
 {
-    auto requestedISA = LLVM_Util::lookup_isa_by_name(
-        m_impl->llvm_jit_target());
+    auto requestedISA = LLVM_Util::lookup_isa_by_name(impl.llvm_jit_target());
     OSL_MAYBE_UNUSED bool target_requested = (requestedISA
                                               != TargetISA::UNKNOWN);
-    OSL_MAYBE_UNUSED bool jit_fma          = m_impl->llvm_jit_fma();
+    OSL_MAYBE_UNUSED bool jit_fma          = impl.llvm_jit_fma();
+    OSL_MAYBE_UNUSED auto use_isa = [&](TargetISA isa, bool has_fma) {
+        if (configure && !target_requested)
+            impl.attribute("llvm_jit_target", LLVM_Util::target_isa_name(isa));
+        if (configure && !has_fma)
+            impl.attribute("llvm_jit_fma", 0);
+        return true;
+    };
 
     // Build defines preprocessor MACROS to identify which
     // target specific ISA's it is building OSL library functions for.
@@ -508,13 +545,8 @@ ShadingSystem::configure_batch_execution_at(int width)
         case TargetISA::AVX512:
             if (jit_fma) {
 #    ifdef __OSL_SUPPORTS_b16_AVX512
-                if (LLVM_Util::supports_isa(TargetISA::AVX512)) {
-                    if (!target_requested)
-                        m_impl->attribute("llvm_jit_target",
-                                          LLVM_Util::target_isa_name(
-                                              TargetISA::AVX512));
-                    return true;
-                }
+                if (LLVM_Util::supports_isa(TargetISA::AVX512))
+                    return use_isa(TargetISA::AVX512, true);
 #    endif
                 if (target_requested) {
                     break;
@@ -523,15 +555,8 @@ ShadingSystem::configure_batch_execution_at(int width)
             // fallthrough
         case TargetISA::AVX512_noFMA:
 #    ifdef __OSL_SUPPORTS_b16_AVX512_noFMA
-            if (LLVM_Util::supports_isa(TargetISA::AVX512_noFMA)) {
-                if (!target_requested) {
-                    m_impl->attribute("llvm_jit_target",
-                                      LLVM_Util::target_isa_name(
-                                          TargetISA::AVX512_noFMA));
-                }
-                m_impl->attribute("llvm_jit_fma", 0);
-                return true;
-            }
+            if (LLVM_Util::supports_isa(TargetISA::AVX512_noFMA))
+                return use_isa(TargetISA::AVX512_noFMA, false);
 #    endif
             if (target_requested) {
                 break;
@@ -547,13 +572,8 @@ ShadingSystem::configure_batch_execution_at(int width)
         case TargetISA::AVX512:
             if (jit_fma) {
 #    ifdef __OSL_SUPPORTS_b8_AVX512
-                if (LLVM_Util::supports_isa(TargetISA::AVX512)) {
-                    if (!target_requested)
-                        m_impl->attribute("llvm_jit_target",
-                                          LLVM_Util::target_isa_name(
-                                              TargetISA::AVX512));
-                    return true;
-                }
+                if (LLVM_Util::supports_isa(TargetISA::AVX512))
+                    return use_isa(TargetISA::AVX512, true);
 #    endif
                 if (target_requested) {
                     break;
@@ -562,15 +582,8 @@ ShadingSystem::configure_batch_execution_at(int width)
             // fallthrough
         case TargetISA::AVX512_noFMA:
 #    ifdef __OSL_SUPPORTS_b8_AVX512_noFMA
-            if (LLVM_Util::supports_isa(TargetISA::AVX512_noFMA)) {
-                if (!target_requested) {
-                    m_impl->attribute("llvm_jit_target",
-                                      LLVM_Util::target_isa_name(
-                                          TargetISA::AVX512_noFMA));
-                }
-                m_impl->attribute("llvm_jit_fma", 0);
-                return true;
-            }
+            if (LLVM_Util::supports_isa(TargetISA::AVX512_noFMA))
+                return use_isa(TargetISA::AVX512_noFMA, false);
 #    endif
             if (target_requested) {
                 break;
@@ -579,13 +592,8 @@ ShadingSystem::configure_batch_execution_at(int width)
         case TargetISA::AVX2:
             if (jit_fma) {
 #    ifdef __OSL_SUPPORTS_b8_AVX2
-                if (LLVM_Util::supports_isa(TargetISA::AVX2)) {
-                    if (!target_requested)
-                        m_impl->attribute("llvm_jit_target",
-                                          LLVM_Util::target_isa_name(
-                                              TargetISA::AVX2));
-                    return true;
-                }
+                if (LLVM_Util::supports_isa(TargetISA::AVX2))
+                    return use_isa(TargetISA::AVX2, true);
 #    endif
                 if (target_requested) {
                     break;
@@ -594,14 +602,8 @@ ShadingSystem::configure_batch_execution_at(int width)
             // fallthrough
         case TargetISA::AVX2_noFMA:
 #    ifdef __OSL_SUPPORTS_b8_AVX2_noFMA
-            if (LLVM_Util::supports_isa(TargetISA::AVX2_noFMA)) {
-                if (!target_requested)
-                    m_impl->attribute("llvm_jit_target",
-                                      LLVM_Util::target_isa_name(
-                                          TargetISA::AVX2_noFMA));
-                m_impl->attribute("llvm_jit_fma", 0);
-                return true;
-            }
+            if (LLVM_Util::supports_isa(TargetISA::AVX2_noFMA))
+                return use_isa(TargetISA::AVX2_noFMA, false);
 #    endif
             if (target_requested) {
                 break;
@@ -609,15 +611,8 @@ ShadingSystem::configure_batch_execution_at(int width)
             // fallthrough
         case TargetISA::AVX:
 #    ifdef __OSL_SUPPORTS_b8_AVX
-            if (LLVM_Util::supports_isa(TargetISA::AVX)) {
-                if (!target_requested)
-                    m_impl->attribute("llvm_jit_target",
-                                      LLVM_Util::target_isa_name(
-                                          TargetISA::AVX));
-                // AVX doesn't support FMA
-                m_impl->attribute("llvm_jit_fma", 0);
-                return true;
-            }
+            if (LLVM_Util::supports_isa(TargetISA::AVX))
+                return use_isa(TargetISA::AVX, false);  // AVX has no FMA
 #    endif
             if (target_requested) {
                 break;
@@ -632,15 +627,8 @@ ShadingSystem::configure_batch_execution_at(int width)
             // fallthrough
         case TargetISA::x64:
 #    ifdef __OSL_SUPPORTS_b4_SSE2
-            if (LLVM_Util::supports_isa(TargetISA::x64)) {
-                if (!target_requested)
-                    m_impl->attribute("llvm_jit_target",
-                                      LLVM_Util::target_isa_name(
-                                          TargetISA::x64));
-                // SSE2 doesn't support FMA
-                m_impl->attribute("llvm_jit_fma", 0);
-                return true;
-            }
+            if (LLVM_Util::supports_isa(TargetISA::x64))
+                return use_isa(TargetISA::x64, false);  // SSE2 has no FMA
 #    endif
             if (target_requested) {
                 break;
@@ -652,6 +640,21 @@ ShadingSystem::configure_batch_execution_at(int width)
     default: return false;
     }
 }
+
+
+bool
+ShadingSystem::configure_batch_execution_at(int width)
+{
+    return batch_execution_at(*m_impl, width, true);
+}
+
+
+
+bool
+ShadingSystem::supports_batch_execution_at(int width)
+{
+    return batch_execution_at(*m_impl, width, false);
+}
 #endif
 
 std::string
@@ -742,8 +745,15 @@ ShadingSystem::raytype_bit(ustring name)
 void
 ShadingSystem::optimize_all_groups(int nthreads, bool do_jit)
 {
-    return m_impl->optimize_all_groups(nthreads, 0 /*mythread*/,
-                                       1 /*totalthreads*/, do_jit);
+    return m_impl->optimize_all_groups(nthreads, do_jit);
+}
+
+
+
+void
+ShadingSystem::start_async_compiles()
+{
+    m_impl->start_async_compiles();
 }
 
 
@@ -802,9 +812,10 @@ ShadingSystem::clear_symlocs()
 void
 ShadingSystem::clear_symlocs(ShaderGroup* group)
 {
-    if (group)
+    if (group) {
         group->clear_symlocs();
-    else
+        m_impl->recompile_group_async(*group);
+    } else
         clear_symlocs();  // no group specified, make it global
 }
 
@@ -821,9 +832,10 @@ ShadingSystem::add_symlocs(cspan<SymLocationDesc> symlocs)
 void
 ShadingSystem::add_symlocs(ShaderGroup* group, cspan<SymLocationDesc> symlocs)
 {
-    if (group)
+    if (group) {
         group->add_symlocs(symlocs);
-    else
+        m_impl->recompile_group_async(*group);
+    } else
         add_symlocs(symlocs);  // no group specified, make it global
 }
 
@@ -902,7 +914,7 @@ template<int WidthT>
 void
 ShadingSystem::BatchedExecutor<WidthT>::jit_all_groups(int nthreads)
 {
-    OSL_ASSERT(0 && "To Be Implemented");
+    m_shading_system.m_impl->batched<WidthT>().jit_all_groups(nthreads);
 }
 
 // Explicitly instantiate
@@ -1075,14 +1087,23 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_debugnan(false)
     , m_debug_uninit(false)
     , m_lockgeom_default(true)
+    , m_oso_binary(0)
     , m_strict_messages(true)
     , m_error_repeats(false)
     , m_range_checking(true)
     , m_connection_error(true)
     , m_greedyjit(false)
+    , m_async_jit(0)
+    , m_llvm_tiered_jit(0)
+    , m_llvm_lazy_layers(0)
+    , m_dedup_groups(false)
+    , m_reparam_respecialize(false)
+    , m_auto_interactive(0)
+    , m_auto_interactive_quiet(30.0f)
     , m_countlayerexecs(false)
     , m_relaxed_param_typecheck(false)
     , m_profile(0)
+    , m_profile_layers(0)
     , m_optimize(2)
     , m_opt_simplify_param(true)
     , m_opt_constant_fold(true)
@@ -1130,6 +1151,7 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_compile_report(0)
     , m_use_optix(renderer->supports("OptiX"))
     , m_use_optix_cache(m_use_optix && renderer->supports("optix_ptx_cache"))
+    , m_use_jit_cache(!m_use_optix && renderer->supports("llvm_jit_cache"))
     , m_max_optix_groupdata_alloc(0)
     , m_buffer_printf(true)
     , m_no_noise(false)
@@ -1161,7 +1183,9 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_shading_state_uniform.m_max_warnings_per_thread = 100;
 
     m_stat_shaders_loaded                    = 0;
+    m_stat_shaders_loaded_binary             = 0;
     m_stat_shaders_requested                 = 0;
+    m_stat_shaders_preloaded                 = 0;
     m_stat_groups                            = 0;
     m_stat_groupinstances                    = 0;
     m_stat_instances_compiled                = 0;
@@ -1181,6 +1205,15 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_global_connections                = 0;
     m_stat_tex_calls_codegened               = 0;
     m_stat_tex_calls_as_handles              = 0;
+    m_stat_jit_cache_hits                    = 0;
+    m_stat_groups_tiered_up                  = 0;
+    m_stat_async_compiles_pending            = 0;
+    m_stat_lazy_layers                       = 0;
+    m_stat_lazy_layers_jitted                = 0;
+    m_stat_groups_deduped                    = 0;
+    m_stat_groups_respecialized              = 0;
+    m_stat_params_promoted                   = 0;
+    m_stat_groups_demoted                    = 0;
     m_stat_useparam_ops                      = 0;
     m_stat_call_layers_inserted              = 0;
     m_stat_master_load_time                  = 0;
@@ -1202,6 +1235,10 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_reparam_bytes_total               = 0;
     m_stat_reparam_calls_changed             = 0;
     m_stat_reparam_bytes_changed             = 0;
+    m_stat_context_heap_highwater            = 0;
+    m_stat_closure_highwater                 = 0;
+    m_stat_scratch_highwater                 = 0;
+    m_stat_context_heap_reallocs             = 0;
 
     m_groups_to_compile_count     = 0;
     m_threads_currently_compiling = 0;
@@ -1410,8 +1447,8 @@ shading_system_setup_op_descriptors(
     OP (psnoise,     noise,               noise,         true,      0);
     OP (radians,     generic,             radians,       true,      0);
     OP (raytype,     raytype,             raytype,       true,      0);
-    OP (regex_match, regex,               none,          false,     STRCHARS);
-    OP (regex_search, regex,              regex_search,  false,     STRCHARS);
+    OP (regex_match, regex,               regex,         false,     STRCHARS);
+    OP (regex_search, regex,              regex,         false,     STRCHARS);
     OP (return,      return,              none,          false,     0);
     OP (round,       generic,             none,          true,      0);
     OP (select,      select,              select,        true,      0);
@@ -1522,6 +1559,12 @@ ShadingSystemImpl::query_closure(const char** name, int* id,
 
 ShadingSystemImpl::~ShadingSystemImpl()
 {
+    // Let any background compiles in progress finish, and skip the ones
+    // that haven't started, before we tear anything down.
+    m_stop_async_compiles = true;
+    m_compile_pool.reset();
+    free_dict_resources();
+
     size_t ngroups = m_all_shader_groups.size();
     for (size_t i = 0; i < ngroups; ++i) {
         if (ShaderGroupRef g = m_all_shader_groups[i].lock()) {
@@ -1535,6 +1578,8 @@ ShadingSystemImpl::~ShadingSystemImpl()
     }
 
     printstats();
+    if (m_profile_layers_file.size())
+        write_layer_profiles(m_profile_layers_file);
     // N.B. just let m_texsys go -- if we asked for one to be created,
     // we asked for a shared one.
 
@@ -1619,7 +1664,9 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("debugnan", int, m_debugnan);  // back-compatible alias
     ATTR_SET("debug_uninit", int, m_debug_uninit);
     ATTR_SET("lockgeom", int, m_lockgeom_default);
+    ATTR_SET("oso_binary", int, m_oso_binary);
     ATTR_SET("profile", int, m_profile);
+    ATTR_SET("profile_layers", int, m_profile_layers);
     ATTR_SET("optimize", int, m_optimize);
     ATTR_SET("opt_simplify_param", int, m_opt_simplify_param);
     ATTR_SET("opt_constant_fold", int, m_opt_constant_fold);
@@ -1667,6 +1714,13 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
              m_shading_state_uniform.m_unknown_coordsys_error);
     ATTR_SET("connection_error", int, m_connection_error);
     ATTR_SET("greedyjit", int, m_greedyjit);
+    ATTR_SET("async_jit", int, m_async_jit);
+    ATTR_SET("llvm_tiered_jit", int, m_llvm_tiered_jit);
+    ATTR_SET("llvm_lazy_layers", int, m_llvm_lazy_layers);
+    ATTR_SET("dedup_groups", int, m_dedup_groups);
+    ATTR_SET("reparam_respecialize", int, m_reparam_respecialize);
+    ATTR_SET("auto_interactive", int, m_auto_interactive);
+    ATTR_SET("auto_interactive_quiet", float, m_auto_interactive_quiet);
     ATTR_SET("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_SET("countlayerexecs", int, m_countlayerexecs);
     ATTR_SET("max_warnings_per_thread", int,
@@ -1695,12 +1749,16 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET_STRING("opt_layername", m_opt_layername);
     ATTR_SET_STRING("only_groupname", m_only_groupname);
     ATTR_SET_STRING("archive_groupname", m_archive_groupname);
+    ATTR_SET_STRING("profile_layers_file", m_profile_layers_file);
     ATTR_SET_STRING("archive_filename", m_archive_filename);
 
     // cases for special handling
     if (name == "searchpath:shader" && type == TypeDesc::STRING) {
+        lock_guard index_lock(m_searchpath_index_mutex);
         m_searchpath = std::string(*(const char**)val);
         OIIO::Filesystem::searchpath_split(m_searchpath, m_searchpath_dirs);
+        m_searchpath_index.clear();
+        m_searchpath_indexed = false;
         return true;
     }
     if (name == "searchpath:library" && type == TypeDesc::STRING) {
@@ -1809,7 +1867,9 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("debugnan", int, m_debugnan);  // back-compatible alias
     ATTR_DECODE("debug_uninit", int, m_debug_uninit);
     ATTR_DECODE("lockgeom", int, m_lockgeom_default);
+    ATTR_DECODE("oso_binary", int, m_oso_binary);
     ATTR_DECODE("profile", int, m_profile);
+    ATTR_DECODE("profile_layers", int, m_profile_layers);
     ATTR_DECODE("optimize", int, m_optimize);
     ATTR_DECODE("opt_simplify_param", int, m_opt_simplify_param);
     ATTR_DECODE("opt_constant_fold", int, m_opt_constant_fold);
@@ -1858,6 +1918,13 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
                 m_shading_state_uniform.m_unknown_coordsys_error);
     ATTR_DECODE("connection_error", int, m_connection_error);
     ATTR_DECODE("greedyjit", int, m_greedyjit);
+    ATTR_DECODE("async_jit", int, m_async_jit);
+    ATTR_DECODE("llvm_tiered_jit", int, m_llvm_tiered_jit);
+    ATTR_DECODE("llvm_lazy_layers", int, m_llvm_lazy_layers);
+    ATTR_DECODE("dedup_groups", int, m_dedup_groups);
+    ATTR_DECODE("reparam_respecialize", int, m_reparam_respecialize);
+    ATTR_DECODE("auto_interactive", int, m_auto_interactive);
+    ATTR_DECODE("auto_interactive_quiet", float, m_auto_interactive_quiet);
     ATTR_DECODE("countlayerexecs", int, m_countlayerexecs);
     ATTR_DECODE("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_DECODE("max_warnings_per_thread", int,
@@ -1871,6 +1938,7 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE_STRING("only_groupname", m_only_groupname);
     ATTR_DECODE_STRING("archive_groupname", m_archive_groupname);
     ATTR_DECODE_STRING("archive_filename", m_archive_filename);
+    ATTR_DECODE_STRING("profile_layers_file", m_profile_layers_file);
     ATTR_DECODE("max_local_mem_KB", int, m_max_local_mem_KB);
     ATTR_DECODE("compile_report", int, m_compile_report);
     ATTR_DECODE("max_optix_groupdata_alloc", int, m_max_optix_groupdata_alloc);
@@ -1891,6 +1959,8 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("optix_force_inline_thresh", int, m_optix_force_inline_thresh);
 
     ATTR_DECODE("stat:masters", int, m_stat_shaders_loaded);
+    ATTR_DECODE("stat:masters_binary", int, m_stat_shaders_loaded_binary);
+    ATTR_DECODE("stat:masters_preloaded", int, m_stat_shaders_preloaded);
     ATTR_DECODE("stat:groups", int, m_stat_groups);
     ATTR_DECODE("stat:instances_compiled", int, m_stat_instances_compiled);
     ATTR_DECODE("stat:groups_compiled", int, m_stat_groups_compiled);
@@ -1910,6 +1980,17 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:global_connections", int, m_stat_global_connections);
     ATTR_DECODE("stat:tex_calls_codegened", int, m_stat_tex_calls_codegened);
     ATTR_DECODE("stat:tex_calls_as_handles", int, m_stat_tex_calls_as_handles);
+    ATTR_DECODE("stat:jit_cache_hits", int, m_stat_jit_cache_hits);
+    ATTR_DECODE("stat:groups_tiered_up", int, m_stat_groups_tiered_up);
+    ATTR_DECODE("stat:async_compiles_pending", int,
+                m_stat_async_compiles_pending);
+    ATTR_DECODE("stat:lazy_layers", int, m_stat_lazy_layers);
+    ATTR_DECODE("stat:lazy_layers_jitted", int, m_stat_lazy_layers_jitted);
+    ATTR_DECODE("stat:groups_deduped", int, m_stat_groups_deduped);
+    ATTR_DECODE("stat:groups_respecialized", int,
+                m_stat_groups_respecialized);
+    ATTR_DECODE("stat:params_promoted", int, m_stat_params_promoted);
+    ATTR_DECODE("stat:groups_demoted", int, m_stat_groups_demoted);
     ATTR_DECODE("stat:useparam_ops", int, m_stat_useparam_ops);
     ATTR_DECODE("stat:call_layers_inserted", int, m_stat_call_layers_inserted);
     ATTR_DECODE("stat:master_load_time", float, m_stat_master_load_time);
@@ -1944,6 +2025,12 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
                 m_stat_reparam_calls_changed);
     ATTR_DECODE("stat:reparam_bytes_changed", long long,
                 m_stat_reparam_bytes_changed);
+    ATTR_DECODE("stat:context_heap_highwater", long long,
+                m_stat_context_heap_highwater);
+    ATTR_DECODE("stat:closure_highwater", long long, m_stat_closure_highwater);
+    ATTR_DECODE("stat:scratch_highwater", long long, m_stat_scratch_highwater);
+    ATTR_DECODE("stat:context_heap_reallocs", int,
+                m_stat_context_heap_reallocs);
     ATTR_DECODE("stat:memory_current", long long, m_stat_memory.current());
     ATTR_DECODE("stat:memory_peak", long long, m_stat_memory.peak());
     ATTR_DECODE("stat:mem_master_current", long long,
@@ -2060,19 +2147,27 @@ ShadingSystemImpl::attribute(ShaderGroup* group, string_view name,
     // No current group attributes to set
     if (!group)
         return attribute(name, type, val);
-    lock_guard lock(group->m_mutex);
     if (name == "renderer_outputs" && type.basetype == TypeDesc::STRING) {
-        group->m_renderer_outputs.clear();
-        for (size_t i = 0; i < type.numelements(); ++i)
-            group->m_renderer_outputs.emplace_back(((const char**)val)[i]);
+        {
+            lock_guard lock(group->m_mutex);
+            group->m_renderer_outputs.clear();
+            for (size_t i = 0; i < type.numelements(); ++i)
+                group->m_renderer_outputs.emplace_back(((const char**)val)[i]);
+        }
+        recompile_group_async(*group);
         return true;
     }
     if (name == "entry_layers" && type.basetype == TypeDesc::STRING) {
-        group->clear_entry_layers();
-        for (int i = 0; i < (int)type.numelements(); ++i)
-            group->mark_entry_layer(ustring(((const char**)val)[i]));
+        {
+            lock_guard lock(group->m_mutex);
+            group->clear_entry_layers();
+            for (int i = 0; i < (int)type.numelements(); ++i)
+                group->mark_entry_layer(ustring(((const char**)val)[i]));
+        }
+        recompile_group_async(*group);
         return true;
     }
+    lock_guard lock(group->m_mutex);
     if (name == "exec_repeat" && type == TypeInt) {
         group->m_exec_repeat = *(const int*)val;
         return true;
@@ -2411,6 +2506,7 @@ ShadingSystemImpl::getstats(int level) const
     opt += fmtformat(#name "=\"{}\" ", m_##name)
     INTOPT(optimize);
     INTOPT(llvm_optimize);
+    INTOPT(llvm_tiered_jit);
     INTOPT(debug);
     INTOPT(profile);
     INTOPT(llvm_debug);
@@ -2431,11 +2527,18 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(debugnan);
     BOOLOPT(debug_uninit);
     BOOLOPT(lockgeom_default);
+    INTOPT(oso_binary);
     BOOLOPT(strict_messages);
     BOOLOPT(error_repeats);
     BOOLOPT(range_checking);
     BOOLOPT(greedyjit);
+    BOOLOPT(llvm_lazy_layers);
+    INTOPT(async_jit);
+    BOOLOPT(dedup_groups);
+    BOOLOPT(reparam_respecialize);
+    INTOPT(auto_interactive);
     BOOLOPT(countlayerexecs);
+    INTOPT(profile_layers);
     BOOLOPT(opt_simplify_param);
     BOOLOPT(opt_constant_fold);
     BOOLOPT(opt_stale_assign);
@@ -2474,6 +2577,7 @@ ShadingSystemImpl::getstats(int level) const
     STROPT(debug_layername);
     STROPT(archive_groupname);
     STROPT(archive_filename);
+    STROPT(profile_layers_file);
 #undef BOOLOPT
 #undef INTOPT
 #undef STROPT
@@ -2512,6 +2616,11 @@ ShadingSystemImpl::getstats(int level) const
     out << "  Shaders:\n";
     out << "    Requested: " << m_stat_shaders_requested << "\n";
     out << "    Loaded:    " << m_stat_shaders_loaded << "\n";
+    if (m_oso_binary)
+        out << "      from precompiled .osb: " << m_stat_shaders_loaded_binary
+            << "\n";
+    if (m_stat_shaders_preloaded)
+        out << "      preloaded: " << m_stat_shaders_preloaded << "\n";
     out << "    Masters:   " << m_stat_shaders_loaded << "\n";
     out << "    Instances: " << m_stat_instances << "\n";
     out << "  Time loading masters: "
@@ -2606,9 +2715,29 @@ ShadingSystemImpl::getstats(int level) const
 
     out << "  Texture calls compiled: " << (int)m_stat_tex_calls_codegened
         << " (" << (int)m_stat_tex_calls_as_handles << " used handles)\n";
+    if (use_jit_cache())
+        out << "  JIT cache hits: " << m_stat_jit_cache_hits << " of "
+            << m_stat_groups_compiled << " groups\n";
+    if (m_dedup_groups)
+        out << "  Groups sharing the code of an identical group: "
+            << m_stat_groups_deduped << "\n";
+    if (m_llvm_tiered_jit)
+        out << "  Hot groups re-JITed with full optimization: "
+            << m_stat_groups_tiered_up << " of " << m_stat_groups_compiled
+            << "\n";
+    if (m_llvm_lazy_layers)
+        out << "  Lazy layers JITed on first call: "
+            << m_stat_lazy_layers_jitted << " of " << m_stat_lazy_layers
+            << "\n";
     out << "  Regex's compiled: " << m_stat_regexes << "\n";
     out << "  Largest generated function local memory size: "
         << m_stat_max_llvm_local_mem / 1024 << " KB\n";
+    out << "  Per-context memory high-water: heap "
+        << Strutil::memformat(m_stat_context_heap_highwater) << ", closures "
+        << Strutil::memformat(m_stat_closure_highwater) << ", scratch "
+        << Strutil::memformat(m_stat_scratch_highwater) << "\n";
+    out << "  Context heap reallocations: " << m_stat_context_heap_reallocs
+        << "\n";
     if (m_stat_getattribute_calls) {
         out << "  getattribute calls: " << m_stat_getattribute_calls << " ("
             << Strutil::timeintervalformat(m_stat_getattribute_time, 2)
@@ -2646,6 +2775,13 @@ ShadingSystemImpl::getstats(int level) const
               (long long)m_stat_reparam_calls_changed,
               OIIO::Strutil::memformat(m_stat_reparam_bytes_changed));
     }
+    if (m_reparam_respecialize)
+        out << "  Groups re-specialized for ReParameter: "
+            << m_stat_groups_respecialized << "\n";
+    if (m_auto_interactive)
+        out << "  Params made interactive automatically: "
+            << m_stat_params_promoted << " (groups folding them again: "
+            << m_stat_groups_demoted << ")\n";
     out << "  Memory total: " << m_stat_memory.memstat() << '\n';
     out << "    Master memory: " << m_stat_mem_master.memstat() << '\n';
     out << "        Master ops:            " << m_stat_mem_master_ops.memstat()
@@ -2715,6 +2851,47 @@ ShadingSystemImpl::getstats(int level) const
         }
     }
 
+    if (m_profile_layers) {
+        // Rank the layers, and the source lines, of all groups together
+        struct Entry {
+            double seconds;
+            std::string what;
+        };
+        std::vector<Entry> layers, lines;
+        for (auto&& p : layer_profiles()) {
+            std::string group = p.groupname.size() ? p.groupname.string()
+                                                   : "<unnamed group>";
+            for (size_t i = 0; i < p.layer_ticks.size(); ++i)
+                layers.push_back(
+                    { OIIO::Timer::seconds(p.layer_ticks[i]),
+                      fmtformat("{} / {} ({} calls)", group, p.layernames[i],
+                                p.layer_calls[i]) });
+            for (size_t i = 0; i < p.range_ticks.size(); ++i)
+                if (p.range_ticks[i])
+                    lines.push_back(
+                        { OIIO::Timer::seconds(p.range_ticks[i]),
+                          fmtformat("{}:{} ({} / {})", p.ranges[i].sourcefile,
+                                    p.ranges[i].sourceline, group,
+                                    p.layernames[p.ranges[i].layer]) });
+        }
+        auto print_top = [&](std::vector<Entry>& entries, string_view title) {
+            std::sort(entries.begin(), entries.end(),
+                      [](const Entry& a, const Entry& b) {
+                          return a.seconds > b.seconds;
+                      });
+            if (entries.size() > 10)
+                entries.resize(10);
+            if (entries.size())
+                out << "    " << title << ":\n";
+            for (auto&& e : entries)
+                out << "      " << Strutil::timeintervalformat(e.seconds, 2)
+                    << ' ' << e.what << "\n";
+        };
+        out << "  Layer profile:\n";
+        print_top(layers, "Most expensive layers");
+        print_top(lines, "Most expensive source lines");
+    }
+
     return out.str();
 }
 
@@ -2730,6 +2907,99 @@ ShadingSystemImpl::printstats() const
 
 
 
+void
+ShadingSystemImpl::retire_layer_profile(LayerProfile&& profile)
+{
+    spin_lock lock(m_stat_mutex);
+    m_retired_layer_profiles.push_back(std::move(profile));
+}
+
+
+
+std::vector<LayerProfile>
+ShadingSystemImpl::layer_profiles() const
+{
+    std::vector<LayerProfile> profiles;
+    {
+        spin_lock lock(m_stat_mutex);
+        profiles = m_retired_layer_profiles;
+    }
+    spin_lock lock(m_all_shader_groups_mutex);
+    for (auto&& grp : m_all_shader_groups) {
+        if (ShaderGroupRef g = grp.lock()) {
+            LayerProfile profile = g->layer_profile();
+            if (profile.layer_ticks.size())
+                profiles.push_back(std::move(profile));
+        }
+    }
+    return profiles;
+}
+
+
+
+static std::string
+json_string(string_view s)
+{
+    std::string r = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            r += '\\';
+            r += c;
+        } else if ((unsigned char)c < 0x20) {
+            r += fmtformat("\\u{:04x}", int(c));
+        } else {
+            r += c;
+        }
+    }
+    return r + "\"";
+}
+
+
+
+bool
+ShadingSystemImpl::write_layer_profiles(string_view filename) const
+{
+    std::ofstream out;
+    OIIO::Filesystem::open(out, filename);
+    if (!out) {
+        errorfmt("Could not open \"{}\" to write the layer profile",
+                 filename);
+        return false;
+    }
+    std::vector<LayerProfile> profiles = layer_profiles();
+    out << "{\n  \"groups\": [";
+    for (size_t g = 0; g < profiles.size(); ++g) {
+        const LayerProfile& p(profiles[g]);
+        out << (g ? ",\n" : "\n") << "    {\n      \"name\": "
+            << json_string(p.groupname) << ",\n      \"layers\": [";
+        for (size_t i = 0; i < p.layer_ticks.size(); ++i)
+            out << (i ? ",\n" : "\n")
+                << fmtformat("        {{ \"name\": {}, \"calls\": {}, "
+                             "\"seconds\": {:.6f} }}",
+                             json_string(p.layernames[i]), p.layer_calls[i],
+                             OIIO::Timer::seconds(p.layer_ticks[i]));
+        out << "\n      ],\n      \"lines\": [";
+        bool first = true;
+        for (size_t i = 0; i < p.range_ticks.size(); ++i) {
+            if (!p.range_ticks[i])
+                continue;  // never ran
+            const LayerProfile::Range& r(p.ranges[i]);
+            out << (first ? "\n" : ",\n")
+                << fmtformat("        {{ \"layer\": {}, \"file\": {}, "
+                             "\"line\": {}, \"seconds\": {:.6f} }}",
+                             json_string(p.layernames[r.layer]),
+                             json_string(r.sourcefile), r.sourceline,
+                             OIIO::Timer::seconds(p.range_ticks[i]));
+            first = false;
+        }
+        out << "\n      ]\n    }";
+    }
+    out << "\n  ]\n}\n";
+    return bool(out);
+}
+
+
+
 bool
 ShadingSystemImpl::Parameter(string_view name, TypeDesc t, const void* val,
                              ParamHints hints)
@@ -2834,6 +3104,24 @@ ShadingSystemImpl::ShaderGroupEnd(ShaderGroup& group)
     }
 
     group.m_complete = true;
+
+    // Remember the group as declared, before optimization transforms its
+    // layers, so that ReParameter can rebuild it with a different param,
+    // and an async compile can be redone if the group's outputs change.
+    std::string declaration;
+    if (m_reparam_respecialize || m_auto_interactive > 0 || m_async_jit)
+        declaration = group.serialize();
+    if (m_auto_interactive > 0)
+        promote_edited_params(group, declaration);
+    group.m_declaration = std::move(declaration);
+
+    // Get a head start compiling the group while the renderer carries on
+    // with its scene setup, once it has finished setting the group's
+    // attributes and calls start_async_compiles().
+    if (m_async_jit) {
+        std::lock_guard<std::mutex> lock(m_async_ended_mutex);
+        m_async_ended.push_back(group.weak_from_this());
+    }
     return true;
 }
 
@@ -3051,7 +3339,18 @@ ShadingSystemImpl::ShaderGroupBegin(string_view groupname, string_view usage,
                                     string_view groupspec)
 {
     ShaderGroupRef g = ShaderGroupBegin(groupname);
-    bool err         = false;
+    if (!parse_groupspec(*g, usage, groupspec))
+        return ShaderGroupRef();
+    return g;
+}
+
+
+
+bool
+ShadingSystemImpl::parse_groupspec(ShaderGroup& g, string_view usage,
+                                   string_view groupspec)
+{
+    bool err = false;
     std::string errdesc;
     string_view errstatement;
     std::vector<int> intvals;
@@ -3072,7 +3371,7 @@ ShadingSystemImpl::ShaderGroupBegin(string_view groupname, string_view usage,
             string_view shadername = Strutil::parse_identifier(p);
             Strutil::skip_whitespace(p);
             string_view layername = Strutil::parse_until(p, " \t\r\n,;");
-            bool ok               = Shader(*g, usage, shadername, layername);
+            bool ok               = Shader(g, usage, shadername, layername);
             if (!ok) {
                 errstatement = pstart;
                 err          = true;
@@ -3092,7 +3391,7 @@ ShadingSystemImpl::ShaderGroupBegin(string_view groupname, string_view usage,
             string_view lay2 = Strutil::parse_until(p, " \t\r\n.");
             Strutil::parse_char(p, '.');
             string_view param2 = Strutil::parse_until(p, " \t\r\n,;");
-            bool ok            = ConnectShaders(*g, lay1, param1, lay2, param2);
+            bool ok            = ConnectShaders(g, lay1, param1, lay2, param2);
             if (!ok) {
                 errstatement = pstart;
                 err          = true;
@@ -3300,11 +3599,11 @@ ShadingSystemImpl::ShaderGroupBegin(string_view groupname, string_view usage,
 
         bool ok = true;
         if (type.basetype == TypeDesc::INT) {
-            ok = Parameter(*g, paramname, type, &intvals[0], hints);
+            ok = Parameter(g, paramname, type, &intvals[0], hints);
         } else if (type.basetype == TypeDesc::FLOAT) {
-            ok = Parameter(*g, paramname, type, &floatvals[0], hints);
+            ok = Parameter(g, paramname, type, &floatvals[0], hints);
         } else if (type.basetype == TypeDesc::STRING) {
-            ok = Parameter(*g, paramname, type, &stringvals[0], hints);
+            ok = Parameter(g, paramname, type, &stringvals[0], hints);
         }
         if (!ok) {
             errstatement = pstart;
@@ -3330,7 +3629,7 @@ ShadingSystemImpl::ShaderGroupBegin(string_view groupname, string_view usage,
         std::string msg
             = fmtformat("ShaderGroupBegin: error parsing group description: {}\n"
                         "        group: {}",
-                        errdesc, g->name());
+                        errdesc, g.name());
         if (errstatement.empty()) {
             size_t offset     = p.data() - groupspec.data();
             size_t begin_stmt = std::min(groupspec.find_last_of(';', offset),
@@ -3345,10 +3644,10 @@ ShadingSystemImpl::ShaderGroupBegin(string_view groupname, string_view usage,
         error(msg);
         if (debug())
             infofmt("Broken group was:\n---{}\n---\n", groupspec);
-        return ShaderGroupRef();
+        return false;
     }
 
-    return g;
+    return true;
 }
 
 
@@ -3372,6 +3671,28 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
     if (!layer)
         return false;  // could not find the named layer
 
+    if (m_auto_interactive > 0) {
+        note_param_edit(group.name(), layername, ustring(paramname));
+        group.m_demotion.reset();  // It would lose this edit
+    }
+
+    // A param that isn't interactive in the compiled group may have been
+    // folded into its code, so the group must be rebuilt to change it.
+    // Until the group is compiled, an interactive param just takes the new
+    // instance value, which its compile (or any rebuild) will pick up.
+    if ((m_reparam_respecialize || m_auto_interactive > 0)
+        && group.m_declaration.size() && !use_optix()) {
+        if (!group.optimized() && !group.m_dedup_source
+            && set_instance_param(group, layerindex, ustring(paramname), type,
+                                  val))
+            return true;
+        if (!group.optimized()
+            || group.interactive_param_offset(layerindex, ustring(paramname))
+                   < 0)
+            return respecialize_group(group, layerindex, ustring(paramname),
+                                      type, val);
+    }
+
     // Find the named parameter within the layer
     int paramindex = layer->findparam(ustring(paramname),
                                       false /* don't go to master */);
@@ -3446,6 +3767,414 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
 
 
 
+bool
+ShadingSystemImpl::set_instance_param(ShaderGroup& group, int layerindex,
+                                      ustring paramname, TypeDesc type,
+                                      const void* val)
+{
+    // N.B. an async compile of the group holds its lock while it runs
+    lock_guard lock(group.m_mutex);
+    if (group.optimized())
+        return false;
+    ShaderInstance* layer = group[layerindex];
+    int p                 = layer->findparam(paramname, true);
+    if (p < 0 || !layer->instoverride(p)->interactive()
+        || !equivalent(layer->mastersymbol(p)->typespec().simpletype(), type))
+        return false;
+    memcpy(layer->param_storage(p), val, type.size());
+    layer->instoverride(p)->valuesource(Symbol::InstanceVal);
+    m_stat_reparam_calls_total += 1;
+    m_stat_reparam_bytes_total += type.size();
+    m_stat_reparam_calls_changed += 1;
+    m_stat_reparam_bytes_changed += type.size();
+    return true;
+}
+
+
+
+// The current value of an interactive param of the group: in its arena
+// once the group is compiled, and the instance value until then.
+static void
+current_interactive_value(ShaderGroup& group, int layerindex, int paramindex,
+                          ParamValueList& params)
+{
+    ShaderInstance* layer = group[layerindex];
+    const Symbol* msym    = layer->mastersymbol(paramindex);
+    TypeDesc type         = msym->typespec().simpletype();
+    int offset            = group.optimized()
+                                ? group.interactive_param_offset(layerindex,
+                                                                 msym->name())
+                                : -1;
+    if (offset < 0) {
+        params.emplace_back(msym->name(), type, 1,
+                            layer->param_storage(paramindex));
+    } else if (type.basetype == TypeDesc::STRING) {
+        // The arena holds ustringhashes instead of ustrings
+        std::vector<ustring> strings(type.numelements());
+        auto hashes = (const ustringhash*)(group.interactive_arena_ptr()
+                                           + offset);
+        for (size_t i = 0; i < strings.size(); ++i)
+            strings[i] = ustring_from(hashes[i]);
+        params.emplace_back(msym->name(), type, 1, strings.data());
+    } else {
+        params.emplace_back(msym->name(), type, 1,
+                            group.interactive_arena_ptr() + offset);
+    }
+}
+
+
+
+bool
+ShadingSystemImpl::respecialize_group(ShaderGroup& group, int layerindex,
+                                      ustring paramname, TypeDesc type,
+                                      const void* val)
+{
+    ShaderInstance* layer = group[layerindex];
+    int paramindex        = layer->findparam(paramname, true);
+    const Symbol* msym    = paramindex >= 0 ? layer->mastersymbol(paramindex)
+                                            : nullptr;
+    if (!msym || !relaxed_equivalent(msym->typespec(), type))
+        return false;  // no such parameter, or the wrong type
+
+    // Once the group has been compiled, make the param interactive in the
+    // rebuilt group, so that later edits just change its value in place.
+    // With auto_interactive, its edit history decides that instead.
+    bool interactive = (group.optimized() || group.m_respecialized)
+                       && m_auto_interactive <= 0;
+    ParamHints hints = interactive ? ParamHints::interactive
+                                   : ParamHints::none;
+    ParamValueList params;
+    params.emplace_back(paramname, type, 1, val);
+    ShaderGroupRef fresh = rebuild_group(group, cspan<int>(&layerindex, 1),
+                                         params, cspan<ParamHints>(&hints, 1));
+    if (!fresh)
+        return false;
+
+    bool respecialized = group.optimized() || group.m_respecialized;
+    adopt_rebuilt_group(group, fresh);
+    group.m_respecialized = respecialized;
+    m_stat_groups_respecialized += 1;
+    m_stat_reparam_calls_total += 1;
+    m_stat_reparam_bytes_total += type.size();
+    m_stat_reparam_calls_changed += 1;
+    m_stat_reparam_bytes_changed += type.size();
+    return true;
+}
+
+
+
+ShaderGroupRef
+ShadingSystemImpl::rebuild_group(ShaderGroup& group, cspan<int> layers,
+                                 const ParamValueList& params,
+                                 cspan<ParamHints> hints)
+{
+    ShaderGroupRef fresh(new ShaderGroup(group.name(), *this));
+    fresh->m_rebuild     = true;
+    fresh->m_exec_repeat = group.m_exec_repeat;
+    fresh->set_raytypes(group.raytypes_on(), group.raytypes_off());
+    fresh->add_symlocs(group.m_symlocs);
+    fresh->m_renderer_outputs = group.m_renderer_outputs;
+
+    // Each layer's params precede the statement that makes the layer, so
+    // the extra ones go just before it, following any declared values.
+    ustring usage    = group.m_group_use;
+    string_view decl = group.m_declaration;
+    size_t pos       = 0;
+    for (int i = 0, nl = group.nlayers(); i < nl; ++i) {
+        size_t end = (i == 0 && Strutil::starts_with(decl, "shader "))
+                         ? 0
+                         : decl.find("\nshader ", i ? pos + 1 : 0);
+        if (end == string_view::npos) {
+            errorfmt("Could not rebuild group {} from its declaration",
+                     group.name());
+            return {};
+        }
+        if (!parse_groupspec(*fresh, usage, decl.substr(pos, end - pos)))
+            return {};
+        for (size_t p = 0; p < params.size(); ++p)
+            if (layers[p] == i
+                && !Parameter(*fresh, params[p].name(), params[p].type(),
+                              params[p].data(), hints[p]))
+                return {};
+        // The declaration only has the values interactive params started
+        // with, so carry over any they've been edited to since.
+        ShaderInstance* layer = group[i];
+        ParamValueList current;
+        for (int p = layer->firstparam(), e = layer->lastparam(); p < e; ++p) {
+            const Symbol* msym = layer->mastersymbol(p);
+            if (!layer->instoverride(p)->interactive()
+                || msym->typespec().is_closure_based()
+                || msym->typespec().is_structure())
+                continue;
+            bool given = false;
+            for (size_t q = 0; q < params.size(); ++q)
+                given |= (layers[q] == i && params[q].name() == msym->name());
+            if (!given)
+                current_interactive_value(group, i, p, current);
+        }
+        for (auto&& pv : current)
+            if (!Parameter(*fresh, pv.name(), pv.type(), pv.data(),
+                           ParamHints::interactive))
+                return {};
+        pos = end;
+    }
+    if (!parse_groupspec(*fresh, usage, decl.substr(pos))
+        || fresh->nlayers() != group.nlayers())
+        return {};
+
+    for (int i = 0, nl = group.nlayers(); i < nl; ++i)
+        if (group[i]->entry_layer())
+            fresh->mark_entry_layer(i);
+    for (auto&& promoted : group.m_auto_interactive) {
+        ShaderInstance* inst = (*fresh)[promoted.first];
+        int p                = inst->findparam(promoted.second);
+        if (p >= 0 && inst->instoverride(p)->interactive())
+            fresh->m_auto_interactive.push_back(promoted);
+    }
+    ++m_groups_to_compile_count;
+    ShaderGroupEnd(*fresh);
+    return fresh;
+}
+
+
+
+void
+ShadingSystemImpl::adopt_rebuilt_group(ShaderGroup& group,
+                                       ShaderGroupRef fresh)
+{
+    // N.B. fresh may be compiling in the background, holding its lock
+    lock_guard lock(group.m_mutex);
+    if (group.optimized() && !fresh->jitted())
+        ++m_groups_to_compile_count;  // again, until it shares fresh's code
+    group.m_layers           = fresh->m_layers;
+    group.m_declaration      = fresh->m_declaration;
+    group.m_auto_interactive = fresh->m_auto_interactive;
+    group.m_dedup_source     = fresh;
+    group.m_dedup_checked    = true;
+    group.m_optimized        = false;
+    group.m_jitted           = false;
+    group.m_batch_jitted     = false;
+    group.m_does_nothing     = false;
+    group.m_tierup_countdown = 0;
+    if (fresh->jitted()) {
+        // Just as if the group were a duplicate of fresh
+        lock_guard fresh_lock(fresh->m_mutex);
+        group.share_compiled_state(*fresh);
+    }
+}
+
+
+
+static std::string
+param_edit_key(ustring layername, ustring paramname)
+{
+    return fmtformat("{}.{}", layername, paramname);
+}
+
+
+
+// Map "layer.param" to a hash of the value declared for it, given the
+// output of ShaderGroup::serialize().
+static std::unordered_map<std::string, uint64_t>
+declared_param_values(string_view decl)
+{
+    std::unordered_map<std::string, uint64_t> values;
+    std::vector<std::pair<string_view, string_view>> layerparams;
+    for (string_view line : Strutil::splitsv(decl, "\n")) {
+        if (Strutil::parse_prefix(line, "param ")) {
+            Strutil::parse_until(line, " ");  // type
+            Strutil::skip_whitespace(line);
+            string_view name = Strutil::parse_until(line, " ");
+            size_t hint      = line.rfind(" [[");
+            layerparams.emplace_back(name, line.substr(0, hint));
+        } else if (Strutil::parse_prefix(line, "shader ")) {
+            Strutil::parse_until(line, " ");  // shader name
+            Strutil::skip_whitespace(line);
+            string_view layername = Strutil::parse_until(line, " ");
+            for (auto&& lp : layerparams)
+                values[fmtformat("{}.{}", layername, lp.first)]
+                    = Strutil::strhash(lp.second);
+            layerparams.clear();
+        }
+    }
+    return values;
+}
+
+
+
+void
+ShadingSystemImpl::note_param_edit(ustring groupname, ustring layername,
+                                   ustring paramname)
+{
+    std::lock_guard<std::mutex> lock(m_param_edits_mutex);
+    ParamEdits& e(
+        m_param_edits[groupname].params[param_edit_key(layername, paramname)]);
+    e.edits += 1;
+    e.last = OIIO::Timer::now();
+}
+
+
+
+void
+ShadingSystemImpl::promote_edited_params(ShaderGroup& group,
+                                         string_view declaration)
+{
+    // Redeclaring a group with a different value for a param is an edit of
+    // it, just as a ReParameter is. Made-up names are never redeclared.
+    bool redeclared = !group.m_rebuild
+                      && !Strutil::starts_with(group.name(), "unnamed_group_");
+    std::unordered_map<std::string, uint64_t> declared;
+    if (redeclared)
+        declared = declared_param_values(declaration);
+
+    std::lock_guard<std::mutex> lock(m_param_edits_mutex);
+    GroupEdits& edits(m_param_edits[group.name()]);
+    if (redeclared) {
+        if (edits.declared.size()) {
+            for (auto&& v : declared) {
+                auto f = edits.declared.find(v.first);
+                if (f == edits.declared.end() || f->second != v.second) {
+                    ParamEdits& e(edits.params[v.first]);
+                    e.edits += 1;
+                    e.last = OIIO::Timer::now();
+                }
+            }
+        }
+        edits.declared = std::move(declared);
+    }
+
+    for (int i = 0, nl = group.nlayers(); i < nl; ++i) {
+        ShaderInstance* inst = group[i];
+        for (int p = inst->firstparam(); p < inst->lastparam(); ++p) {
+            const Symbol* sym   = inst->mastersymbol(p);
+            SymOverrideInfo* so = inst->instoverride(p);
+            if (sym->symtype() != SymTypeParam || so->interactive()
+                || so->connected() || sym->typespec().is_closure_based()
+                || sym->typespec().is_structure()
+                || sym->typespec().is_unsized_array()
+                || (so->valuesource() == Symbol::DefaultVal
+                    && sym->has_init_ops()))
+                continue;
+            auto f = edits.params.find(
+                param_edit_key(inst->layername(), sym->name()));
+            if (f == edits.params.end() || f->second.edits < m_auto_interactive)
+                continue;
+            // The instance's param storage already holds the default, so
+            // that can be its value.
+            so->valuesource(Symbol::InstanceVal);
+            so->interactive(true);
+            group.m_auto_interactive.emplace_back(i, sym->name());
+            m_stat_params_promoted += 1;
+        }
+    }
+}
+
+
+
+int
+ShadingSystemImpl::settle_interactive_params()
+{
+    if (m_auto_interactive <= 0 || use_optix())
+        return 0;
+    std::vector<ShaderGroupRef> groups;
+    std::unordered_set<ustring> live;
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        for (auto& weakgroup : m_all_shader_groups) {
+            ShaderGroupRef group = weakgroup.lock();
+            if (group)
+                live.insert(group->name());
+            if (group
+                && (group->m_auto_interactive.size() || group->m_demotion))
+                groups.push_back(std::move(group));
+        }
+    }
+    {
+        // Forget the edits of groups that no longer exist under any name.
+        // A renderer that redeclares a group does so before settling.
+        std::lock_guard<std::mutex> lock(m_param_edits_mutex);
+        for (auto e = m_param_edits.begin(); e != m_param_edits.end();)
+            e = live.count(e->first) ? std::next(e) : m_param_edits.erase(e);
+    }
+
+    int settled   = 0;
+    long long now = OIIO::Timer::now();
+    for (auto& group : groups) {
+        if (ShaderGroupRef fresh = group->m_demotion) {
+            // A rebuild started by an earlier call. Until it's compiled,
+            // the group carries on as it is.
+            if (fresh->jitted()) {
+                group->m_demotion.reset();
+                adopt_rebuilt_group(*group, fresh);
+                m_stat_groups_demoted += 1;
+                ++settled;
+            }
+            continue;
+        }
+        if (!group->jitted())
+            continue;  // its current values are only known once compiled
+
+        // Wait until all of the group's promoted params have been quiet
+        // long enough, then forget their edits.
+        std::vector<std::string> keys;
+        for (auto&& promoted : group->m_auto_interactive)
+            keys.push_back(param_edit_key((*group)[promoted.first]->layername(),
+                                          promoted.second));
+        {
+            std::lock_guard<std::mutex> lock(m_param_edits_mutex);
+            auto& edits(m_param_edits[group->name()].params);
+            bool quiet = std::none_of(keys.begin(), keys.end(), [&](auto& k) {
+                auto f = edits.find(k);
+                return f != edits.end()
+                       && OIIO::Timer::seconds(now - f->second.last)
+                              < m_auto_interactive_quiet;
+            });
+            if (!quiet)
+                continue;
+            for (auto&& k : keys)
+                edits.erase(k);
+        }
+
+        // Rebuild with the params no longer interactive, at the values
+        // they have been edited to, and compile that in the background.
+        // Any that were optimized away have nothing to fold, and are left
+        // as they are. The rebuild keeps the current values of the group's
+        // other interactive params, and any later ReParameter cancels it.
+        std::vector<std::pair<int, ustring>> folded;
+        std::vector<int> layers;
+        ParamValueList params;
+        std::vector<ParamHints> hints;
+        for (auto&& promoted : group->m_auto_interactive) {
+            int offset = group->interactive_param_offset(promoted.first,
+                                                         promoted.second);
+            if (offset < 0)
+                continue;
+            ShaderInstance* inst = (*group)[promoted.first];
+            current_interactive_value(*group, promoted.first,
+                                      inst->findparam(promoted.second),
+                                      params);
+            layers.push_back(promoted.first);
+            hints.push_back(ParamHints::none);
+            folded.push_back(promoted);
+        }
+        group->m_auto_interactive = folded;
+        if (folded.empty())
+            continue;
+        ShaderGroupRef fresh = rebuild_group(*group, layers, params, hints);
+        if (!fresh)
+            continue;
+        group->m_demotion = fresh;
+        std::weak_ptr<ShaderGroup> weakfresh = fresh;
+        push_async_compile(1, [this, weakfresh]() {
+            if (ShaderGroupRef fresh = weakfresh.lock())
+                optimize_group(*fresh, nullptr, true /*do_jit*/);
+        });
+    }
+    return settled;
+}
+
+
+
 PerThreadInfo*
 ShadingSystemImpl::create_thread_info()
 {
@@ -3485,6 +4214,8 @@ ShadingSystemImpl::release_context(ShadingContext* ctx)
     if (!ctx)
         return;
     ctx->process_errors();
+    ctx->record_pool_high_water();
+    ctx->flush_layer_profile();
     ctx->thread_info()->context_pool.push(ctx);
 }
 
@@ -3684,6 +4415,11 @@ ShadingSystemImpl::is_renderer_output(ustring layername, ustring paramname,
 void
 ShadingSystemImpl::group_post_jit_cleanup(ShaderGroup& group)
 {
+    if (group.m_dedup_source)
+        return;  // The layers belong to the group we share code with
+    if (group.llvm_lazy_layers_pending())
+        return;  // Still needed to JIT the lazy layers when they're called
+
     // Once we're generated the IR, we really don't need the ops and args,
     // and we only need the syms that include the params.
     off_t symmem         = 0;
@@ -3761,6 +4497,27 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
 
     double locking_time = timer();
 
+    if (m_dedup_groups && !group.m_dedup_checked) {
+        group.m_dedup_checked = true;
+        group.m_dedup_source  = find_dedup_source(group);
+    }
+    if (ShaderGroupRef source = group.m_dedup_source) {
+        // Identical to a group we've already seen: compile that one (if
+        // it isn't already) and use its code rather than making our own.
+        optimize_group(*source, ctx, do_jit);
+        if (ctx)
+            ctx->group(&group);
+        {
+            lock_guard source_lock(source->m_mutex);
+            group.share_compiled_state(*source);
+        }
+        spin_lock stat_lock(m_stat_mutex);
+        m_stat_opt_locking_time += locking_time;
+        m_stat_optimization_time += timer();
+        m_groups_to_compile_count -= 1;
+        return;
+    }
+
     bool ctx_allocated         = false;
     PerThreadInfo* thread_info = nullptr;
     if (!ctx) {
@@ -3809,6 +4566,8 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
 
         if (use_optix_cache())
             group.generate_optix_cache_key(rop.serialize());
+        else if (use_jit_cache())
+            group.generate_jit_cache_key(rop.serialize());
 
         spin_lock stat_lock(m_stat_mutex);
         if (!need_jit) {
@@ -3835,8 +4594,16 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
         }
 
         if (!cached) {
+            // With tiered JIT, start with minimal LLVM optimization. The
+            // group is JITed again with the full pipeline once it's been
+            // run enough to be worth it (see tier_up_group_async).
+            bool tiered = m_llvm_tiered_jit > 0 && !use_optix();
             BackendLLVM lljitter(*this, group, ctx);
+            if (tiered)
+                lljitter.llvm_optimize(0);
             lljitter.run();
+            if (tiered && !group.does_nothing())
+                group.m_tierup_countdown = m_llvm_tiered_jit;
 
             // NOTE: it is now possible to optimize and not JIT
             // which would leave the cleanup to happen
@@ -3845,10 +4612,12 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
             // Only cleanup when are not batching or if
             // the batch jit has already happened,
             // as it requires the ops so we can't delete them yet!
-            if (((renderer()->batched(WidthOf<16>()) == nullptr)
-                 && (renderer()->batched(WidthOf<8>()) == nullptr)
-                 && (renderer()->batched(WidthOf<4>()) == nullptr))
-                || group.batch_jitted()) {
+            // Tiered JIT still needs them for the second compile.
+            if ((((renderer()->batched(WidthOf<16>()) == nullptr)
+                  && (renderer()->batched(WidthOf<8>()) == nullptr)
+                  && (renderer()->batched(WidthOf<4>()) == nullptr))
+                 || group.batch_jitted())
+                && group.m_tierup_countdown == 0) {
                 group_post_jit_cleanup(group);
             }
 
@@ -3863,6 +4632,8 @@ ShadingSystemImpl::optimize_group(ShaderGroup& group, ShadingContext* ctx,
             m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
             m_stat_max_llvm_local_mem = std::max(m_stat_max_llvm_local_mem,
                                                  lljitter.m_llvm_local_mem);
+            if (group.llvm_groupdata_size() > m_max_groupdata_size)
+                m_max_groupdata_size = group.llvm_groupdata_size();
         }
     }
 
@@ -3896,6 +4667,21 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     if (!group.optimized())
         m_ssi.optimize_group(group, ctx, false /*do_jit*/);
 
+    if (ShaderGroupRef source = group.m_dedup_source) {
+        // Share the batched code of the identical group, too
+        jit_group(*source, ctx);
+        {
+            lock_guard lock(group.m_mutex);
+            lock_guard source_lock(source->m_mutex);
+            group.share_compiled_state(*source);
+        }
+        if (ctx_allocated) {
+            m_ssi.release_context(ctx);
+            m_ssi.destroy_thread_info(thread_info);
+        }
+        return;
+    }
+
     OIIO::Timer timer;
     // TODO: we could have separate mutexes for jit vs. batched_jit
     // choose to keep it simple to start with
@@ -3923,8 +4709,8 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     lljitter.run();
 
     // Keep OSL instructions around in case someone
-    // wants the scalar version jitted
-    if (group.jitted()) {
+    // wants the scalar version jitted (or re-jitted when tiering up)
+    if (group.jitted() && group.m_tierup_countdown == 0) {
         m_ssi.group_post_jit_cleanup(group);
     }
 
@@ -3944,6 +4730,8 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     m_ssi.m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
     m_ssi.m_stat_max_llvm_local_mem = std::max(m_ssi.m_stat_max_llvm_local_mem,
                                                lljitter.m_llvm_local_mem);
+    if (group.llvm_groupdata_wide_size() > m_ssi.m_max_groupdata_wide_size)
+        m_ssi.m_max_groupdata_wide_size = group.llvm_groupdata_wide_size();
 
     // TODO: not sure how to count these given batched vs. not
     m_ssi.m_stat_groups_compiled += 1;
@@ -3952,117 +4740,294 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
 }
 #endif
 
-static void
-optimize_all_groups_wrapper(ShadingSystemImpl* ss, int mythread,
-                            int totalthreads, bool do_jit)
-{
-    ss->optimize_all_groups(1, mythread, totalthreads, do_jit);
+void
+ShadingSystemImpl::compile_all_groups(
+    int nthreads, const std::function<bool(const ShaderGroup&)>& needs_compile,
+    const std::function<void(ShaderGroup&, ShadingContext*)>& compile)
+{
+    // Gather the groups needing work, most expensive first. Starting the
+    // big ones early keeps a late-starting ubershader from stretching the
+    // whole compile out long after the other threads have finished.
+    std::vector<std::pair<size_t, ShaderGroupRef>> work;
+    {
+        spin_lock lock(m_all_shader_groups_mutex);
+        work.reserve(m_all_shader_groups.size());
+        for (auto& weakgroup : m_all_shader_groups) {
+            ShaderGroupRef group = weakgroup.lock();
+            if (group && needs_compile(*group))
+                work.emplace_back(group->estimated_compile_cost(),
+                                  std::move(group));
+        }
+    }
+    if (work.empty())
+        return;
+    std::stable_sort(work.begin(), work.end(),
+                     [](const auto& a, const auto& b) {
+                         return a.first > b.first;
+                     });
+
+    if (nthreads < 1)  // threads <= 0 means use all hardware available
+        nthreads = (int)std::thread::hardware_concurrency();
+    nthreads = std::max(1, std::min(nthreads, (int)work.size()));
+
+    // Each thread grabs the next group off the shared list until it's
+    // exhausted, so a thread that drew an expensive group doesn't hold up
+    // the cheap ones behind it.
+    std::atomic<size_t> next(0);
+    auto worker = [&](int /*id*/) {
+        PerThreadInfo* threadinfo = create_thread_info();
+        ShadingContext* ctx       = get_context(threadinfo);
+        for (size_t i; (i = next++) < work.size();)
+            compile(*work[i].second, ctx);
+        release_context(ctx);
+        destroy_thread_info(threadinfo);
+    };
+
+    if (nthreads == 1) {
+        worker(-1);
+        return;
+    }
+
+    // Only one batch of compile threads at a time. If somebody else has
+    // already started them, never mind -- anything they miss will still be
+    // compiled on demand when it's first executed.
+    int none = 0;
+    if (!m_threads_currently_compiling.compare_exchange_strong(none, nthreads))
+        return;
+
+    // The calling thread does its share of the work, too.
+    OIIO::thread_pool* pool = compile_pool(nthreads - 1);
+    OIIO::task_set tasks(pool);
+    for (int t = 1; t < nthreads; ++t)
+        tasks.push(pool->push(worker));
+    worker(0);
+    tasks.wait();
+    m_threads_currently_compiling -= nthreads;
 }
 
 
-#if OSL_USE_BATCHED
-template<int WidthT>
-static void
-batched_jit_all_groups_wrapper(ShadingSystemImpl* ss, int mythread,
-                               int totalthreads)
+
+OIIO::thread_pool*
+ShadingSystemImpl::compile_pool(int nthreads)
 {
-    ss->batched<WidthT>().jit_all_groups(1, mythread, totalthreads);
+    // The pool persists between calls, so that compiling groups as they
+    // are declared doesn't pay for creating threads every time.
+    std::lock_guard<std::mutex> lock(m_compile_pool_mutex);
+    if (!m_compile_pool)
+        m_compile_pool.reset(new OIIO::thread_pool(nthreads));
+    else if (m_compile_pool->size() < nthreads)
+        m_compile_pool->resize(nthreads);
+    return m_compile_pool.get();
 }
-#endif
+
+
 
 void
-ShadingSystemImpl::optimize_all_groups(int nthreads, int mythread,
-                                       int totalthreads, bool do_jit)
+ShadingSystemImpl::compile_group_async(ShaderGroup& group)
 {
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
-    if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min((int)std::thread::hardware_concurrency(),
-                            (int)m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_threads_currently_compiling)
-            return;  // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
-        m_threads_currently_compiling += nthreads;
-        for (int t = 0; t < nthreads; ++t)
-            threads.add_thread(new std::thread(optimize_all_groups_wrapper,
-                                               this, t, nthreads, do_jit));
-        threads.join_all();
-        m_threads_currently_compiling -= nthreads;
-        return;
-    }
+    int nthreads = m_async_jit > 0 ? m_async_jit
+                                   : (int)std::thread::hardware_concurrency();
+    group.m_async_queued                 = true;
+    std::weak_ptr<ShaderGroup> weakgroup = group.weak_from_this();
+    push_async_compile(std::max(nthreads, 1), [this, weakgroup]() {
+        // By now the group may have been released, or already compiled by
+        // a shading thread that needed it first.
+        if (ShaderGroupRef group = weakgroup.lock())
+            optimize_group(*group, nullptr, true /*do_jit*/);
+    });
+}
+
 
-    // And here's the single thread case
-    size_t ngroups = 0;
+
+void
+ShadingSystemImpl::start_async_compiles()
+{
+    std::vector<std::weak_ptr<ShaderGroup>> ended;
     {
-        spin_lock lock(m_all_shader_groups_mutex);
-        ngroups = m_all_shader_groups.size();
+        std::lock_guard<std::mutex> lock(m_async_ended_mutex);
+        ended.swap(m_async_ended);
     }
-    PerThreadInfo* threadinfo = create_thread_info();
-    ShadingContext* ctx       = get_context(threadinfo);
-    for (size_t i = 0; i < ngroups; ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock(m_all_shader_groups_mutex);
-                group = m_all_shader_groups[i].lock();
-            }
-            if (group && group->m_complete)
-                optimize_group(*group, ctx, do_jit);
-        }
+    for (auto& weakgroup : ended) {
+        // A group already used for shading has been compiled, with the
+        // attributes it has now, by the thread that used it first.
+        ShaderGroupRef group = weakgroup.lock();
+        if (group && !group->optimized())
+            compile_group_async(*group);
     }
-    release_context(ctx);
-    destroy_thread_info(threadinfo);
 }
 
-#if OSL_USE_BATCHED
-template<int WidthT>
+
+
 void
-ShadingSystemImpl::Batched<WidthT>::jit_all_groups(int nthreads, int mythread,
-                                                   int totalthreads)
+ShadingSystemImpl::push_async_compile(int nthreads,
+                                      std::function<void()> task)
 {
-    // Spawn a bunch of threads to do this in parallel -- just call this
-    // routine again (with threads=1) for each thread.
-    if (nthreads < 1)  // threads <= 0 means use all hardware available
-        nthreads = std::min((int)std::thread::hardware_concurrency(),
-                            (int)m_ssi.m_groups_to_compile_count);
-    if (nthreads > 1) {
-        if (m_ssi.m_threads_currently_compiling)
-            return;  // never mind, somebody else spawned the JIT threads
-        OIIO::thread_group threads;
-        m_ssi.m_threads_currently_compiling += nthreads;
-        for (int t = 0; t < nthreads; ++t)
-            threads.add_thread(
-                new std::thread(batched_jit_all_groups_wrapper<WidthT>, &m_ssi,
-                                t, nthreads));
-        threads.join_all();
-        m_ssi.m_threads_currently_compiling -= nthreads;
-        return;
-    }
+    m_stat_async_compiles_pending += 1;
+    compile_pool(nthreads)->push([this, task](int) {
+        if (!m_stop_async_compiles)
+            task();
+        m_stat_async_compiles_pending -= 1;
+    });
+}
+
+
 
-    // And here's the single thread case
-    size_t ngroups = 0;
+void
+ShadingSystemImpl::recompile_group_async(ShaderGroup& group)
+{
+    // Until its compile starts, the queued task will see the new values.
+    // After, the optimizer has already dropped what they would now keep,
+    // so start over from the declaration (which the rebuild copies the
+    // group's outputs, entry layers and symbol locations into).
+    bool stale;
     {
-        spin_lock lock(m_ssi.m_all_shader_groups_mutex);
-        ngroups = m_ssi.m_all_shader_groups.size();
+        lock_guard lock(group.m_mutex);
+        stale = group.m_async_queued
+                && (group.optimized() || group.m_dedup_source);
     }
-    PerThreadInfo* threadinfo = m_ssi.create_thread_info();
-    ShadingContext* ctx       = m_ssi.get_context(threadinfo);
-    for (size_t i = 0; i < ngroups; ++i) {
-        // Assign to threads based on mod of totalthreads
-        if ((i % totalthreads) == (unsigned)mythread) {
-            ShaderGroupRef group;
-            {
-                spin_lock lock(m_ssi.m_all_shader_groups_mutex);
-                group = m_ssi.m_all_shader_groups[i].lock();
-            }
-            if (group)
-                jit_group(*group, ctx);
+    if (!stale || group.m_declaration.empty() || use_optix())
+        return;
+    if (ShaderGroupRef fresh = rebuild_group(group, {}, {}, {}))
+        adopt_rebuilt_group(group, fresh);
+}
+
+
+
+ShaderGroupRef
+ShadingSystemImpl::find_dedup_source(ShaderGroup& group)
+{
+    // OptiX identifies the compiled code by the group's name, so each
+    // group really does need its own.
+    if (use_optix())
+        return {};
+    std::string key = group.dedup_key();
+    if (key.empty())
+        return {};
+    spin_lock lock(m_dedup_mutex);
+    std::weak_ptr<ShaderGroup>& entry(m_dedup_map[key]);
+    ShaderGroupRef source = entry.lock();
+    if (source && source.get() != &group) {
+        m_stat_groups_deduped += 1;
+        return source;
+    }
+    entry = group.weak_from_this();
+    return {};
+}
+
+
+
+void
+ShadingSystemImpl::tier_up_group_async(ShaderGroup& group)
+{
+    std::weak_ptr<ShaderGroup> weakgroup = group.weak_from_this();
+    push_async_compile(1, [this, weakgroup]() {
+        ShaderGroupRef group = weakgroup.lock();
+        if (!group)
+            return;
+        OIIO::Timer timer;
+        lock_guard lock(group->m_mutex);
+        PerThreadInfo* thread_info = create_thread_info();
+        ShadingContext* ctx        = get_context(thread_info);
+
+        // Threads may keep running the old code while we build the new,
+        // and the group data layout doesn't change, so the new entry
+        // points can simply replace the old ones when run() sets them.
+        BackendLLVM lljitter(*this, *group, ctx);
+        lljitter.run();
+
+        if (((renderer()->batched(WidthOf<16>()) == nullptr)
+             && (renderer()->batched(WidthOf<8>()) == nullptr)
+             && (renderer()->batched(WidthOf<4>()) == nullptr))
+            || group->batch_jitted()) {
+            group_post_jit_cleanup(*group);
+        }
+        release_context(ctx);
+        destroy_thread_info(thread_info);
+
+        m_stat_groups_tiered_up += 1;
+        spin_lock stat_lock(m_stat_mutex);
+        m_stat_optimization_time += timer();
+        m_stat_total_llvm_time += lljitter.m_stat_total_llvm_time;
+        m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+        m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+        m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+        m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+    });
+}
+
+
+
+RunLLVMGroupFunc
+ShadingSystemImpl::jit_lazy_layer(ShaderGroup& group, int layer,
+                                  ShadingContext* ctx)
+{
+    std::atomic<RunLLVMGroupFunc>* slot = group.llvm_lazy_layer_slot(layer);
+    if (RunLLVMGroupFunc func = slot->load())
+        return func;  // Another thread JITed it since the caller looked
+
+    OIIO::Timer timer;
+    lock_guard lock(group.m_mutex);
+    if (RunLLVMGroupFunc func = slot->load())
+        return func;  // ...while we waited for the lock
+
+    BackendLLVM lljitter(*this, group, ctx);
+    RunLLVMGroupFunc func = lljitter.run_lazy_layer(layer);
+    OSL_ASSERT(func && "Could not JIT lazy layer");
+    slot->store(func);
+
+    if (lljitter.jit_layer_lazily(layer)) {
+        m_stat_lazy_layers_jitted += 1;
+        // Once the last one is JITed, the ops can go, as they would have
+        // after the group's JIT. A queued tiered JIT may still need them,
+        // though, and there's no telling whether it's done.
+        if (--group.m_llvm_lazy_layers_pending == 0 && !m_llvm_tiered_jit
+            && (((renderer()->batched(WidthOf<16>()) == nullptr)
+                 && (renderer()->batched(WidthOf<8>()) == nullptr)
+                 && (renderer()->batched(WidthOf<4>()) == nullptr))
+                || group.batch_jitted())) {
+            group_post_jit_cleanup(group);
         }
     }
-    m_ssi.release_context(ctx);
-    m_ssi.destroy_thread_info(threadinfo);
+
+    spin_lock stat_lock(m_stat_mutex);
+    m_stat_optimization_time += timer();
+    m_stat_total_llvm_time += lljitter.m_stat_total_llvm_time;
+    m_stat_llvm_setup_time += lljitter.m_stat_llvm_setup_time;
+    m_stat_llvm_irgen_time += lljitter.m_stat_llvm_irgen_time;
+    m_stat_llvm_opt_time += lljitter.m_stat_llvm_opt_time;
+    m_stat_llvm_jit_time += lljitter.m_stat_llvm_jit_time;
+    m_stat_max_llvm_local_mem = std::max(m_stat_max_llvm_local_mem,
+                                         lljitter.m_llvm_local_mem);
+    return func;
+}
+
+
+
+void
+ShadingSystemImpl::optimize_all_groups(int nthreads, bool do_jit)
+{
+    compile_all_groups(
+        nthreads,
+        [do_jit](const ShaderGroup& group) {
+            return group.m_complete
+                   && !(group.optimized() && (group.jitted() || !do_jit));
+        },
+        [this, do_jit](ShaderGroup& group, ShadingContext* ctx) {
+            optimize_group(group, ctx, do_jit);
+        });
+}
+
+#if OSL_USE_BATCHED
+template<int WidthT>
+void
+ShadingSystemImpl::Batched<WidthT>::jit_all_groups(int nthreads)
+{
+    m_ssi.compile_all_groups(
+        nthreads,
+        [](const ShaderGroup& group) { return !group.batch_jitted(); },
+        [this](ShaderGroup& group, ShadingContext* ctx) {
+            jit_group(group, ctx);
+        });
 }
 
 // Explicitly instantiate, although might need to specialize on target
@@ -4207,12 +5172,72 @@ OCIOColorSystem::load_transform(ustring fromspace, ustring tospace,
                                                                 tospace);
         m_last_colorproc_fromspace = fromspace;
         m_last_colorproc_tospace   = tospace;
+        if (!m_last_colorproc)
+            m_last_colorproc_affine = false;
+        else if (ss)
+            m_last_colorproc_affine
+                = ss->ocio_affine_transform(fromspace, tospace,
+                                            m_last_colorproc_xform);
+        else
+            m_last_colorproc_affine
+                = probe_affine_transform(*m_last_colorproc,
+                                         m_last_colorproc_xform);
     }
     return m_last_colorproc;
 }
 
 
 
+bool
+OCIOColorSystem::affine_transform(ustring fromspace, ustring tospace,
+                                  ShadingSystemImpl* ss,
+                                  OCIOAffineTransform& xform)
+{
+    if (!load_transform(fromspace, tospace, ss) || !m_last_colorproc_affine)
+        return false;
+    xform = m_last_colorproc_xform;
+    return true;
+}
+
+
+
+bool
+probe_affine_transform(const OIIO::ColorProcessor& cp,
+                       OCIOAffineTransform& xform)
+{
+    // Fit an affine transform to the results for black and the three
+    // primaries, then check that it reproduces a spread of other colors,
+    // including some outside [0,1] where LUTs and clamps would show up.
+    static const Color3 probes[] = {
+        Color3(0.0f, 0.0f, 0.0f),    Color3(1.0f, 0.0f, 0.0f),
+        Color3(0.0f, 1.0f, 0.0f),    Color3(0.0f, 0.0f, 1.0f),
+        Color3(0.18f, 0.18f, 0.18f), Color3(0.5f, 0.25f, 0.75f),
+        Color3(0.01f, 0.9f, 0.02f),  Color3(2.0f, 0.1f, 0.6f),
+        Color3(0.3f, 4.0f, 12.0f),   Color3(-0.2f, 0.5f, 1.5f)
+    };
+    constexpr int nprobes = int(std::size(probes));
+    Color3 out[nprobes];
+    std::copy(std::begin(probes), std::end(probes), out);
+    cp.apply((float*)out, nprobes, 1, 3, sizeof(float), sizeof(Color3),
+             nprobes * sizeof(Color3));
+
+    xform.offset = out[0];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c)
+            xform.linear[r][c] = out[r + 1][c] - out[0][c];
+    for (int i = 4; i < nprobes; ++i) {
+        Color3 expected = xform.apply(probes[i]);
+        for (int c = 0; c < 3; ++c) {
+            float tolerance = 1.0e-4f * std::max(1.0f, fabsf(expected[c]));
+            if (!(fabsf(out[i][c] - expected[c]) <= tolerance))
+                return false;
+        }
+    }
+    return true;
+}
+
+
+
 const OIIO::ColorConfig&
 OCIOColorSystem::colorconfig(ShadingSystemImpl* shadingsys)
 {
@@ -4240,6 +5265,34 @@ ShadingSystemImpl::colorconfig()
 
 
 
+bool
+ShadingSystemImpl::ocio_affine_transform(ustring fromspace, ustring tospace,
+                                         OCIOAffineTransform& xform)
+{
+    auto key = std::make_pair(fromspace, tospace);
+    {
+        std::shared_lock<std::shared_mutex> lock(m_ocio_affine_mutex);
+        auto found = m_ocio_affine.find(key);
+        if (found != m_ocio_affine.end()) {
+            xform = found->second.second;
+            return found->second.first;
+        }
+    }
+
+    // Probe outside the lock; if two threads race, they get the same answer
+    OCIOAffineTransform probed;
+    bool affine = false;
+    if (auto cp = colorconfig()->createColorProcessor(fromspace, tospace))
+        affine = probe_affine_transform(*cp, probed);
+
+    std::unique_lock<std::shared_mutex> lock(m_ocio_affine_mutex);
+    m_ocio_affine.emplace(key, std::make_pair(affine, probed));
+    xform = probed;
+    return affine;
+}
+
+
+
 bool
 ShadingSystemImpl::archive_shadergroup(ShaderGroup& group, string_view filename)
 {
@@ -4434,6 +5487,12 @@ ShadingContext::ocio_transform(ustring fromspace, ustring tospace,
                                const Color3& C, Color3& Cout)
 {
 #ifndef __CUDA_ARCH__
+    OCIOAffineTransform xform;
+    if (m_ocio_system.affine_transform(fromspace, tospace, &shadingsys(),
+                                       xform)) {
+        Cout = xform.apply(C);
+        return true;
+    }
     if (auto cp = m_ocio_system.load_transform(fromspace, tospace,
                                                &shadingsys())) {
         Cout = C;
@@ -4451,6 +5510,13 @@ ShadingContext::ocio_transform(ustring fromspace, ustring tospace,
                                const Dual2<Color3>& C, Dual2<Color3>& Cout)
 {
 #ifndef __CUDA_ARCH__
+    OCIOAffineTransform xform;
+    if (m_ocio_system.affine_transform(fromspace, tospace, &shadingsys(),
+                                       xform)) {
+        // Affine transforms have exact derivatives
+        Cout = xform.apply(C);
+        return true;
+    }
     if (auto cp = m_ocio_system.load_transform(fromspace, tospace,
                                                &shadingsys())) {
         // Use finite differencing to approximate the derivative. Make 3
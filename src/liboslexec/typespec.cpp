@@ -4,6 +4,7 @@
 
 #include <cstdio>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -86,9 +87,16 @@ TypeSpec::type_c_str() const
 }
 
 
+// Shaders may be loaded by several threads at once, each finding or
+// adding the structs they use.
+static std::mutex structs_mutex;
+
+
+
 int
 TypeSpec::structure_id(const char* name, bool add)
 {
+    std::lock_guard<std::mutex> lock(structs_mutex);
     std::vector<std::shared_ptr<StructSpec>>& m_structs(struct_list());
     ustring n(name);
     for (int i = (int)m_structs.size() - 1; i > 0; --i) {
@@ -108,6 +116,18 @@ TypeSpec::structure_id(const char* name, bool add)
 
 
 
+void
+TypeSpec::add_struct_fields(int id, cspan<ustring> fields)
+{
+    std::lock_guard<std::mutex> lock(structs_mutex);
+    StructSpec* spec = structspec(id);
+    if (spec && spec->numfields() == 0)
+        for (ustring field : fields)
+            spec->add_field(TypeSpec(), field);
+}
+
+
+
 int
 TypeSpec::new_struct(StructSpec* n)
 {
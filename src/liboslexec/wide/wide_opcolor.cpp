@@ -246,6 +246,19 @@ wide_prepend_color_from(ShadingContext* ctx, const ColorSystem& cs,
         return;
     }
 
+    OCIOAffineTransform xform;
+    if (ctx->ocio_affine_transform(fromspace, Strings::RGB, xform)) {
+        OSL_OMP_PRAGMA(omp simd simdlen(__OSL_WIDTH))
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            Color3 C = wR[lane];
+            if (wR.mask()[lane]) {
+                Color3 R             = xform.apply(C);
+                wR[ActiveLane(lane)] = R;
+            }
+        }
+        return;
+    }
+
     // Serialize calls to ocio
     wR.mask().foreach ([=, &cs](ActiveLane lane) -> void {
         Color3 C = wR[lane];
@@ -454,7 +467,20 @@ wide_transformc(const ColorSystem cs, ustring fromspace, ustring tospace,
         use_colorconfig = true;
     }
 
-    if (use_colorconfig) {
+    OCIOAffineTransform xform;
+    if (use_colorconfig
+        && context->ocio_affine_transform(fromspace, tospace, xform)) {
+        // An affine transform needs no calls to ocio, and its derivatives
+        // are exact
+        WIDE_TRANSFORMC_OMP_SIMD_LOOP(simdlen(__OSL_WIDTH))
+        for (int lane = 0; lane < __OSL_WIDTH; ++lane) {
+            COLOR C = wInput[lane];
+            if (wOutput.mask()[lane]) {
+                COLOR Cto                 = xform.apply(C);
+                wOutput[ActiveLane(lane)] = Cto;
+            }
+        }
+    } else if (use_colorconfig) {
         // Serialize calls to ocio
         wOutput.mask().foreach ([=, &cs](ActiveLane lane) -> void {
             COLOR C       = wInput[lane];
@@ -47,7 +47,7 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
         assign_all(results.wnum_points(), 0);
         return;
     }
-    PointCloud* pc = PointCloud::get(filename);
+    PointCloud* pc = PointCloud::get(filename, false, ctx);
     if (pc == NULL) {  // The file failed to load
         ctx->batched<__OSL_WIDTH>().errorfmt(
             results.mask(), "pointcloud_search: could not open \"{}\"",
@@ -75,7 +75,7 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
     // found point's positions.
     Partio::ParticleAttribute* pos_attr = NULL;
     if (results.distances_have_derivs()) {
-        pos_attr = pc->m_attributes[u_position].get();
+        pos_attr = pc->attribute(u_position);
         if (!pos_attr) {
             // No "position" attribute -- fail
             assign_all(results.wnum_points(), 0);
@@ -106,17 +106,59 @@ default_pointcloud_search(BatchedShaderGlobals* bsg, ustringhash filename,
     SortedPointRecord* sorted = OSL_ALLOCA(SortedPointRecord, max_points);
     auto windices             = results.windices();
     auto wnum_points          = results.wnum_points();
-    results.mask().foreach ([=](ActiveLane lane) -> void {
-        const OSL::Vec3 center = wcenter[lane];
 
-        const float radius = wradius[lane];
-        float finalRadius;
-        int count = cloud->findNPoints(&center[0], max_points, radius, indices,
+    // With a spatial index, search for all the active lanes at once so
+    // that they share the tree traversal, then hand out the results below.
+    const PointCloudIndex& index = pc->m_index;
+    static_assert(__OSL_WIDTH <= PointCloudIndex::MaxBatch,
+                  "PointCloudIndex::MaxBatch must cover the batch width");
+    SortedPointRecord* found = nullptr;
+    int nfound[__OSL_WIDTH]  = {};
+    int slot[__OSL_WIDTH]    = {};
+    if (!index.empty()) {
+        OSL::Vec3 centers[__OSL_WIDTH];
+        float radii[__OSL_WIDTH];
+        int nqueries = 0;
+        results.mask().foreach ([&](ActiveLane lane) -> void {
+            centers[nqueries] = wcenter[lane];
+            radii[nqueries]   = wradius[lane];
+            slot[lane]        = nqueries++;
+        });
+        // max_points comes from the shader, so only small result buffers
+        // go on the stack. Bigger ones come from the context's scratch
+        // memory, as the scalar pointcloud_search does.
+        const size_t nrecords = size_t(nqueries) * size_t(max_points);
+        if (nrecords * sizeof(SortedPointRecord) <= 4096)
+            found = OSL_ALLOCA(SortedPointRecord, nrecords);
+        else
+            found = (SortedPointRecord*)ctx->alloc_scratch(
+                nrecords * sizeof(SortedPointRecord),
+                sizeof(SortedPointRecord));
+        index.find_nearest(nqueries, centers, radii, max_points, sort, found,
+                           nfound);
+    }
+
+    results.mask().foreach ([=](ActiveLane lane) -> void {
+        int count;
+        if (found) {
+            const SortedPointRecord* lanefound = found
+                                                 + slot[lane] * max_points;
+            count = nfound[slot[lane]];
+            for (int i = 0; i < count; ++i) {
+                dist2[i]   = lanefound[i].first;
+                indices[i] = lanefound[i].second;
+            }
+        } else {
+            const OSL::Vec3 center = wcenter[lane];
+            const float radius     = wradius[lane];
+            float finalRadius;
+            count = cloud->findNPoints(&center[0], max_points, radius, indices,
                                        dist2, &finalRadius);
+        }
 
         // If sorting, allocate some temp space and sort the distances and
-        // indices at the same time.
-        if (sort && count > 1) {
+        // indices at the same time (the index already returns them sorted).
+        if (sort && count > 1 && !found) {
             //SortedPointRecord *sorted = (SortedPointRecord *) sg->context->alloc_scratch (count * sizeof(SortedPointRecord), sizeof(SortedPointRecord));
             //SortedPointRecord *sorted = OSL_ALLOCA(SortedPointRecord, count);
             for (int i = 0; i < count; ++i)
@@ -225,7 +267,7 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
     Mask success { false };
     ShadingContext* ctx = bsg->uniform.context;
 
-    PointCloud* pc = PointCloud::get(filename);
+    PointCloud* pc = PointCloud::get(filename, false, ctx);
     // defer reporting errors as only lanes with non zero num_points
     // should report errors
     const Partio::ParticlesData* cloud = nullptr;
@@ -234,7 +276,7 @@ default_pointcloud_get(BatchedShaderGlobals* bsg, ustringhash filename,
     }
     Partio::ParticleAttribute* attr = nullptr;
     if (cloud != nullptr) {
-        attr = pc->m_attributes[attr_name].get();
+        attr = pc->attribute(attr_name);
     }
 
     TypeDesc attr_type = wout_data.type();
@@ -296,33 +296,11 @@ __OSL_OP(regex_impl)(void* bsg_, const char* subject_, void* results,
     auto* bsg           = reinterpret_cast<BatchedShaderGlobals*>(bsg_);
     ShadingContext* ctx = bsg->uniform.context;
 
-    // TODO:  probably could share implementation from here with osl_regex_impl from opstring.cpp
     OSL_ASSERT(ustring::is_unique(subject_));
     OSL_ASSERT(ustring::is_unique(pattern));
 
-    const std::string& subject(ustring::from_unique(subject_).string());
-    std::match_results<std::string::const_iterator> mresults;
-    const std::regex& regex(ctx->find_regex(USTR(pattern)));
-    if (nresults > 0) {
-        std::string::const_iterator start = subject.begin();
-        int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                            : std::regex_search(subject, mresults, regex);
-        int* m  = (int*)results;
-        for (int r = 0; r < nresults; ++r) {
-            if (r / 2 < (int)mresults.size()) {
-                if ((r & 1) == 0)
-                    m[r] = mresults[r / 2].first - start;
-                else
-                    m[r] = mresults[r / 2].second - start;
-            } else {
-                m[r] = USTR(pattern).length();
-            }
-        }
-        return res;
-    } else {
-        return fullmatch ? regex_match(subject, regex)
-                         : regex_search(subject, regex);
-    }
+    const CompiledRegex& regex(ctx->find_regex(USTR(pattern)));
+    return regex.match(USTR(subject_), fullmatch, (int*)results, nresults);
 }
 
 
@@ -352,28 +330,11 @@ __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr, void* wsubject_ptr,
 
         auto results = wresults[lane];
 
-        const std::string& subject = usubject.string();
-        std::match_results<std::string::const_iterator> mresults;
-        const std::regex& regex(ctx->find_regex(pattern));
-        if (nresults > 0) {
-            std::string::const_iterator start = subject.begin();
-            int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                                : std::regex_search(subject, mresults, regex);
-            for (int r = 0; r < nresults; ++r) {
-                if (r / 2 < (int)mresults.size()) {
-                    if ((r & 1) == 0)
-                        results[r] = mresults[r / 2].first - start;
-                    else
-                        results[r] = mresults[r / 2].second - start;
-                } else {
-                    results[r] = pattern.length();
-                }
-            }
-            wsuccess[lane] = res;
-        } else {
-            wsuccess[lane] = fullmatch ? regex_match(subject, regex)
-                                       : regex_search(subject, regex);
-        }
+        const CompiledRegex& regex(ctx->find_regex(pattern));
+        int* m         = OSL_ALLOCA(int, nresults);
+        wsuccess[lane] = regex.match(usubject, fullmatch, m, nresults);
+        for (int r = 0; r < nresults; ++r)
+            results[r] = m[r];
     });
 }
 
@@ -0,0 +1,245 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <OSL/hashes.h>
+
+#include "batched_simpleraytracer.h"
+#include "simpleraytracer.h"
+
+namespace RS {
+namespace {
+namespace Hashes {
+#define RS_STRDECL(str, var_name) \
+    constexpr OSL::ustringhash var_name(OSL::strhash(str));
+#include "rs_strdecls.h"
+#undef RS_STRDECL
+};  //namespace Hashes
+}  // unnamed namespace
+};  //namespace RS
+
+OSL_NAMESPACE_BEGIN
+
+
+
+template<int WidthT>
+BatchedSimpleRaytracer<WidthT>::BatchedSimpleRaytracer(SimpleRaytracer& sr)
+    : BatchedRendererServices<WidthT>(sr.texturesys()), m_sr(sr)
+{
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           Wide<const TransformationPtr> xform,
+                                           Wide<const float> /*time*/)
+{
+    // SimpleRaytracer doesn't understand motion blur and transformations
+    // are just simple 4x4 matrices.
+    for (int lane = 0; lane < WidthT; ++lane) {
+        if (result.mask()[lane])
+            result[lane] = *reinterpret_cast<const Matrix44*>(xform[lane]);
+    }
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           ustringhash from,
+                                           Wide<const float> /*time*/)
+{
+    Matrix44 M;
+    if (!m_sr.get_matrix(nullptr, M, from))
+        return Mask(false);
+    for (int lane = 0; lane < WidthT; ++lane)
+        result[lane] = M;
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_matrix(BatchedShaderGlobals* /*bsg*/,
+                                           Masked<Matrix44> result,
+                                           Wide<const ustringhash> from,
+                                           Wide<const float> /*time*/)
+{
+    Mask succeeded(false);
+    result.mask().template foreach<1 /*MinOccupancyT*/>(
+        [&](ActiveLane lane) -> void {
+            Matrix44 M;
+            if (m_sr.get_matrix(nullptr, M, from[lane])) {
+                result[lane] = M;
+                succeeded.set_on(lane);
+            }
+        });
+    return succeeded;
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_inverse_matrix(
+    BatchedShaderGlobals* /*bsg*/, Masked<Matrix44> result, ustringhash to,
+    Wide<const float> /*time*/)
+{
+    Matrix44 M;
+    if (!m_sr.get_inverse_matrix(nullptr, M, to, 0.0f))
+        return Mask(false);
+    for (int lane = 0; lane < WidthT; ++lane)
+        result[lane] = M;
+    return result.mask();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_inverse_matrix(
+    BatchedShaderGlobals* /*bsg*/, Masked<Matrix44> result,
+    Wide<const ustringhash> to, Wide<const float> time)
+{
+    Mask succeeded(false);
+    result.mask().template foreach<1 /*MinOccupancyT*/>(
+        [&](ActiveLane lane) -> void {
+            Matrix44 M;
+            if (m_sr.get_inverse_matrix(nullptr, M, to[lane], time[lane])) {
+                result[lane] = M;
+                succeeded.set_on(lane);
+            }
+        });
+    return succeeded;
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::is_attribute_uniform(ustring object,
+                                                     ustring name)
+{
+    // The camera and version attributes are the same for every point
+    return object.empty()
+           && m_sr.m_attr_getters.find(name.uhash())
+                  != m_sr.m_attr_getters.end();
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_array_attribute(BatchedShaderGlobals* bsg,
+                                                    ustringhash object,
+                                                    ustringhash name,
+                                                    int index, MaskedData amd)
+{
+    // An attribute with a uniform answer can still be asked for from a
+    // varying name inside the shader, so broadcast it.
+    auto g = m_sr.m_attr_getters.find(name);
+    if (g != m_sr.m_attr_getters.end()) {
+        char* val = OIIO_ALLOCA(char, amd.type().size());
+        if (!(m_sr.*(g->second))(nullptr, false, object, amd.type(), name,
+                                 val))
+            return Mask(false);
+        amd.assign_all_from_scalar(val);
+        return amd.mask();
+    }
+
+    // If no named attribute was found, allow userdata to bind to the
+    // attribute request.
+    if (object.empty() && index == -1)
+        return get_userdata(name, bsg, amd);
+
+    return Mask(false);
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_attribute(BatchedShaderGlobals* bsg,
+                                              ustringhash object,
+                                              ustringhash name, MaskedData amd)
+{
+    return get_array_attribute(bsg, object, name, -1, amd);
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::get_array_attribute_uniform(
+    BatchedShaderGlobals* /*bsg*/, ustringhash object, ustringhash name,
+    int /*index*/, RefData val)
+{
+    auto g = m_sr.m_attr_getters.find(name);
+    if (g != m_sr.m_attr_getters.end())
+        return (m_sr.*(g->second))(nullptr, val.has_derivs(), object,
+                                   val.type(), name, val.ptr());
+    // Userdata is never uniform
+    return false;
+}
+
+
+
+template<int WidthT>
+bool
+BatchedSimpleRaytracer<WidthT>::get_attribute_uniform(BatchedShaderGlobals* bsg,
+                                                      ustringhash object,
+                                                      ustringhash name,
+                                                      RefData val)
+{
+    return get_array_attribute_uniform(bsg, object, name, -1, val);
+}
+
+
+
+template<int WidthT>
+typename BatchedSimpleRaytracer<WidthT>::Mask
+BatchedSimpleRaytracer<WidthT>::get_userdata(ustringhash name,
+                                             BatchedShaderGlobals* bsg,
+                                             MaskedData val)
+{
+    // Same as SimpleRaytracer::get_userdata: respect s and t userdata,
+    // filled in with the uv coordinates.
+    if ((name == RS::Hashes::s || name == RS::Hashes::t)
+        && Masked<float>::is(val)) {
+        const auto& vsg = bsg->varying;
+        const bool is_s = name == RS::Hashes::s;
+        const auto& x   = is_s ? vsg.u : vsg.v;
+        const auto& dx  = is_s ? vsg.dudx : vsg.dvdx;
+        const auto& dy  = is_s ? vsg.dudy : vsg.dvdy;
+        Masked<float> out(val);
+        for (int i = 0; i < WidthT; ++i)
+            out[i] = x[i];
+        if (val.has_derivs()) {
+            MaskedDx<float> out_dx(val);
+            MaskedDy<float> out_dy(val);
+            for (int i = 0; i < WidthT; ++i) {
+                out_dx[i] = dx[i];
+                out_dy[i] = dy[i];
+            }
+        }
+        return out.mask();
+    }
+    return Mask(false);
+}
+
+
+
+// Explicitly instantiate BatchedSimpleRaytracer template
+template class BatchedSimpleRaytracer<16>;
+template class BatchedSimpleRaytracer<8>;
+template class BatchedSimpleRaytracer<4>;
+
+
+OSL_NAMESPACE_END
@@ -0,0 +1,83 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <OSL/oslconfig.h>
+
+#include <OSL/batched_rendererservices.h>
+
+OSL_NAMESPACE_BEGIN
+
+class SimpleRaytracer;
+
+// Batched renderer services for the wavefront mode of testrender. Matrices
+// and the camera attributes answer exactly what SimpleRaytracer answers
+// for a single point, everything else is left to the defaults.
+template<int WidthT>
+class BatchedSimpleRaytracer : public BatchedRendererServices<WidthT> {
+public:
+    explicit BatchedSimpleRaytracer(SimpleRaytracer& sr);
+    virtual ~BatchedSimpleRaytracer() {}
+
+    OSL_USING_DATA_WIDTH(WidthT);
+
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    Wide<const TransformationPtr> xform,
+                    Wide<const float> time) override;
+    bool is_overridden_get_inverse_matrix_WmWxWf() const override
+    {
+        return false;
+    }
+
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    ustringhash from, Wide<const float> time) override;
+    Mask get_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                    Wide<const ustringhash> from,
+                    Wide<const float> time) override;
+    bool is_overridden_get_matrix_WmWsWf() const override { return true; }
+
+    Mask get_inverse_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                            ustringhash to, Wide<const float> time) override;
+    bool is_overridden_get_inverse_matrix_WmsWf() const override
+    {
+        return true;
+    }
+    Mask get_inverse_matrix(BatchedShaderGlobals* bsg, Masked<Matrix44> result,
+                            Wide<const ustringhash> to,
+                            Wide<const float> time) override;
+    bool is_overridden_get_inverse_matrix_WmWsWf() const override
+    {
+        return true;
+    }
+
+    bool is_attribute_uniform(ustring object, ustring name) override;
+
+    Mask get_array_attribute(BatchedShaderGlobals* bsg, ustringhash object,
+                             ustringhash name, int index,
+                             MaskedData amd) override;
+    Mask get_attribute(BatchedShaderGlobals* bsg, ustringhash object,
+                       ustringhash name, MaskedData amd) override;
+
+    bool get_array_attribute_uniform(BatchedShaderGlobals* bsg,
+                                     ustringhash object, ustringhash name,
+                                     int index, RefData val) override;
+    bool get_attribute_uniform(BatchedShaderGlobals* bsg, ustringhash object,
+                               ustringhash name, RefData val) override;
+
+    Mask get_userdata(ustringhash name, BatchedShaderGlobals* bsg,
+                      MaskedData val) override;
+
+    bool is_overridden_texture() const override { return false; }
+    bool is_overridden_texture3d() const override { return false; }
+    bool is_overridden_environment() const override { return false; }
+    bool is_overridden_pointcloud_search() const override { return false; }
+    bool is_overridden_pointcloud_get() const override { return false; }
+    bool is_overridden_pointcloud_write() const override { return false; }
+
+private:
+    SimpleRaytracer& m_sr;
+};
+
+OSL_NAMESPACE_END
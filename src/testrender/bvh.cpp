@@ -6,8 +6,13 @@
 #include "raytracer.h"
 
 #include <Imath/ImathBox.h>
+#include <OpenImageIO/parallel.h>
+#include <OpenImageIO/simd.h>
 #include <OpenImageIO/timer.h>
 
+#include <atomic>
+#include <limits>
+
 OSL_NAMESPACE_BEGIN
 
 using Box3 = Imath::Box3f;
@@ -39,48 +44,72 @@ comp(const Vec3& vec, int i)
 static constexpr int NumBins  = 16;
 static constexpr int MaxDepth = 64;
 
-static std::unique_ptr<BVH>
-build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
-          OIIO::ErrorHandler& errhandler)
-{
-    std::unique_ptr<BVH> bvh = std::make_unique<BVH>();
-    OIIO::Timer timer;
-    bvh->indices = std::make_unique<unsigned[]>(triangles.size());
+static constexpr float inf = std::numeric_limits<float>::infinity();
+// Bounds of an unused BVH4Node slot
+static constexpr float EmptyBounds[6] = { inf, -inf, inf, -inf, inf, -inf };
 
-    std::vector<BVHNode> buildnodes;
-    std::vector<Box3> triangle_bounds;
-    buildnodes.reserve(2 * triangles.size() + 1);
-    buildnodes.emplace_back();
-    triangle_bounds.reserve(triangles.size());
-    BuildNode current;
-    Box3 shape_bounds;
-    for (unsigned i = 0; i < triangles.size(); i++) {
-        bvh->indices[i] = i;
-        Vec3 va         = verts[triangles[i].a];
-        Vec3 vb         = verts[triangles[i].b];
-        Vec3 vc         = verts[triangles[i].c];
-        Box3 b(va);
-        b.extendBy(vb);
-        b.extendBy(vc);
-        triangle_bounds.emplace_back(b);
-        current.centroid.extendBy(b.center());
-        shape_bounds.extendBy(b);
+// Nodes with at least this many triangles are binned in parallel, and
+// build their subtrees as separate tasks.
+static constexpr unsigned ParallelBinMin     = 1 << 16;
+static constexpr unsigned ParallelSubtreeMin = 1 << 12;
+
+struct BinnedBounds {
+    Box3 bounds[3][NumBins];
+    unsigned n[3][NumBins] = {};
+
+    void merge(const BinnedBounds& other)
+    {
+        for (int axis = 0; axis < 3; axis++) {
+            for (int i = 0; i < NumBins; i++) {
+                bounds[axis][i].extendBy(other.bounds[axis][i]);
+                n[axis][i] += other.n[axis][i];
+            }
+        }
     }
-    buildnodes[0].set(shape_bounds.min, shape_bounds.max);
-    current.left      = 0;
-    current.right     = triangles.size();
-    current.depth     = 1;
-    current.nodeIndex = 0;
-    int stackPtr      = 0;
+};
+
+struct BVHBuilder {
+    OIIO::cspan<Box3> triangle_bounds;
+    unsigned* indices;  // permuted in place, each subtree within its range
+    std::unique_ptr<BVHNode[]> nodes;
+    std::atomic<unsigned> nnodes { 1 };
+    OIIO::thread_pool* pool = OIIO::default_thread_pool();
+
+    void bin(const BuildNode& current, const float binFactor[3],
+             unsigned begin, unsigned end, BinnedBounds& bins) const
+    {
+        // for each primitive, figure out in which bin it lands per axis
+        for (unsigned i = begin; i < end; i++) {
+            unsigned prim = indices[i];
+            Box3 bbox     = triangle_bounds[prim];
+            Vec3 center   = bbox.center();
+            for (int axis = 0; axis < 3; axis++) {
+                int binID = (int)((comp(center, axis)
+                                   - comp(current.centroid.min, axis))
+                                  * binFactor[axis]);
+                OSL_ASSERT(binID >= 0 && binID < NumBins);
+                bins.n[axis][binID]++;
+                bins.bounds[axis][binID].extendBy(bbox);
+            }
+        }
+    }
+
+    void build(BuildNode current);
+};
+
+
+
+void
+BVHBuilder::build(BuildNode current)
+{
+    // Subtrees handed off to other threads, to be waited for at the end
+    OIIO::task_set subtrees(pool);
+    int stackPtr = 0;
     BuildNode stack[MaxDepth];
     while (true) {
         const unsigned numPrims = current.right - current.left;
         if (numPrims > 1 && current.depth < MaxDepth) {
             // try to split this set of primitives
-            Box3 binBounds[3][NumBins];
-            unsigned binN[3][NumBins];
-            memset(binN, 0, sizeof(binN));
-
             float binFactor[3];
             for (int axis = 0; axis < 3; axis++) {
                 binFactor[axis] = comp(current.centroid.max, axis)
@@ -90,22 +119,27 @@ build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
                                             / binFactor[axis]
                                       : 0;
             }
-            // for each primitive, figure out in which bin it lands per axis
-            for (unsigned i = current.left; i < current.right; i++) {
-                unsigned prim = bvh->indices[i];
-                Box3 bbox     = triangle_bounds[prim];
-                Vec3 center   = bbox.center();
-                for (int axis = 0; axis < 3; axis++) {
-                    int binID = (int)((comp(center, axis)
-                                       - comp(current.centroid.min, axis))
-                                      * binFactor[axis]);
-                    OSL_ASSERT(binID >= 0 && binID < NumBins);
-                    binN[axis][binID]++;
-                    binBounds[axis][binID].extendBy(bbox);
-                }
+            BinnedBounds bins;
+            if (numPrims >= ParallelBinMin) {
+                // Bin chunks of the primitives in parallel, then merge
+                const unsigned chunk = ParallelBinMin / 4;
+                std::vector<BinnedBounds> chunkbins((numPrims + chunk - 1)
+                                                    / chunk);
+                OIIO::parallel_for(0, int64_t(chunkbins.size()),
+                                   [&](int64_t c) {
+                                       unsigned b = current.left + c * chunk;
+                                       unsigned e = std::min(b + chunk,
+                                                             current.right);
+                                       bin(current, binFactor, b, e,
+                                           chunkbins[c]);
+                                   });
+                for (auto& cb : chunkbins)
+                    bins.merge(cb);
+            } else {
+                bin(current, binFactor, current.left, current.right, bins);
             }
             // compute the SAH cost of partitioning at each bin
-            const float invArea = 1 / buildnodes[current.nodeIndex].half_area();
+            const float invArea = 1 / nodes[current.nodeIndex].half_area();
             float bestCost      = numPrims;
             int bestAxis        = -1;
             int bestBin         = -1;
@@ -120,13 +154,13 @@ build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
                 unsigned numL[NumBins];
                 float areaL[NumBins];
                 for (int i = 0; i < NumBins; i++) {
-                    countL += binN[axis][i];
+                    countL += bins.n[axis][i];
                     numL[i] = countL;
-                    bbox.extendBy(binBounds[axis][i]);
+                    bbox.extendBy(bins.bounds[axis][i]);
                     areaL[i] = half_area(bbox);
                 }
                 OSL_ASSERT(countL == numPrims);
-                bbox = binBounds[axis][NumBins - 1];
+                bbox = bins.bounds[axis][NumBins - 1];
                 for (int i = NumBins - 2; i >= 0; i--) {
                     if (numL[i] == 0 || numL[i] == numPrims)
                         continue;  // skip if this candidate split does not partition the prims
@@ -144,7 +178,7 @@ build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
                         bestNL   = numL[i];
                         bestNR   = numPrims - bestNL;
                     }
-                    bbox.extendBy(binBounds[axis][i]);
+                    bbox.extendBy(bins.bounds[axis][i]);
                 }
             }
             if (bestAxis != -1) {
@@ -154,7 +188,7 @@ build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
                 bn[0].depth = bn[1].depth = current.depth + 1;
                 unsigned rightOrig        = current.right;
                 for (unsigned i = current.left; i < current.right;) {
-                    unsigned prim = bvh->indices[i];
+                    unsigned prim = indices[i];
                     Box3 bbox     = triangle_bounds[prim];
                     float center  = comp(bbox.center(), bestAxis);
                     int binID
@@ -168,47 +202,180 @@ build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
                     } else {
                         boundsR.extendBy(bbox);
                         bn[1].centroid.extendBy(bbox.center());
-                        std::swap(bvh->indices[i],
-                                  bvh->indices[--current.right]);
+                        std::swap(indices[i], indices[--current.right]);
                     }
                 }
                 OSL_ASSERT(bestNL == (current.right - current.left));
                 OSL_ASSERT(bestNR == (rightOrig - current.right));
                 OSL_ASSERT(bestNL + bestNR == numPrims);
                 // allocate 2 child nodes
-                unsigned nextIndex = buildnodes.size();
-                buildnodes.emplace_back();
-                buildnodes.emplace_back();
+                unsigned nextIndex = nnodes.fetch_add(2);
                 // write to current node
-                buildnodes[current.nodeIndex].child  = nextIndex;
-                buildnodes[current.nodeIndex].nprims = 0;
-                bn[0].left                           = current.left;
-                bn[0].right                          = current.right;
-                bn[1].left                           = current.right;
-                bn[1].right                          = rightOrig;
-                bn[0].nodeIndex                      = nextIndex + 0;
-                bn[1].nodeIndex                      = nextIndex + 1;
-                buildnodes[nextIndex + 0].set(boundsL.min, boundsL.max);
-                buildnodes[nextIndex + 1].set(boundsR.min, boundsR.max);
-                current           = bn[0];
-                stack[stackPtr++] = bn[1];
+                nodes[current.nodeIndex].child  = nextIndex;
+                nodes[current.nodeIndex].nprims = 0;
+                bn[0].left                      = current.left;
+                bn[0].right                     = current.right;
+                bn[1].left                      = current.right;
+                bn[1].right                     = rightOrig;
+                bn[0].nodeIndex                 = nextIndex + 0;
+                bn[1].nodeIndex                 = nextIndex + 1;
+                nodes[nextIndex + 0].set(boundsL.min, boundsL.max);
+                nodes[nextIndex + 1].set(boundsR.min, boundsR.max);
+                current = bn[0];
+                if (bestNR >= ParallelSubtreeMin) {
+                    BuildNode right = bn[1];
+                    subtrees.push(
+                        pool->push([this, right](int) { build(right); }));
+                } else {
+                    stack[stackPtr++] = bn[1];
+                }
                 continue;  // keep building
             }
         }
         // nothing more to be done with this node - create a leaf
-        buildnodes[current.nodeIndex].child  = current.left;
-        buildnodes[current.nodeIndex].nprims = numPrims;
+        nodes[current.nodeIndex].child  = current.left;
+        nodes[current.nodeIndex].nprims = numPrims;
         // pop the stack
         if (stackPtr == 0)
             break;
         current = stack[--stackPtr];
     }
-    bvh->nodes = std::make_unique<BVHNode[]>(buildnodes.size());
-    memcpy(bvh->nodes.get(), buildnodes.data(),
-           buildnodes.size() * sizeof(BVHNode));
+    subtrees.wait();
+}
+
+
+
+static void
+set_child(BVH4Node& node, int i, const float* bounds, unsigned child,
+          unsigned nprims)
+{
+    for (int j = 0; j < 6; j++)
+        node.bounds[j][i] = bounds[j];
+    node.child[i]  = child;
+    node.nprims[i] = nprims;
+}
+
+
+
+static void
+set_empty_child(BVH4Node& node, int i)
+{
+    set_child(node, i, EmptyBounds, 0, 0);
+    node.mask &= ~(1 << i);
+}
+
+
+
+// Collapse the binary subtree under inner node b into four-wide nodes,
+// returning the index of the one made for b. Its children are found by
+// repeatedly opening the largest inner node among them.
+static unsigned
+collapse_bvh(const BVHNode* binary, unsigned b, std::vector<BVH4Node>& out)
+{
+    unsigned kids[4] = { binary[b].child, binary[b].child + 1 };
+    int nkids        = 2;
+    while (nkids < 4) {
+        int open        = -1;
+        float openArea  = -1;
+        for (int i = 0; i < nkids; i++) {
+            const BVHNode& kid = binary[kids[i]];
+            if (kid.nprims == 0 && kid.half_area() > openArea) {
+                open     = i;
+                openArea = kid.half_area();
+            }
+        }
+        if (open == -1)
+            break;  // all leaves
+        unsigned opened = kids[open];
+        kids[open]      = binary[opened].child;
+        kids[nkids++]   = binary[opened].child + 1;
+    }
+
+    unsigned index = out.size();
+    out.emplace_back();
+    out[index].mask = 0xf;
+    for (int i = 0; i < 4; i++) {
+        if (i >= nkids) {
+            set_empty_child(out[index], i);
+            continue;
+        }
+        const BVHNode& kid = binary[kids[i]];
+        unsigned nprims    = kid.nprims;
+        unsigned child     = nprims ? kid.child
+                                    : collapse_bvh(binary, kids[i], out);
+        // N.B. out may have grown, so only index it now
+        set_child(out[index], i, kid.bounds, child, nprims);
+    }
+    return index;
+}
+
+
+
+static std::unique_ptr<BVH>
+build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
+          OIIO::ErrorHandler& errhandler)
+{
+    std::unique_ptr<BVH> bvh = std::make_unique<BVH>();
+    OIIO::Timer timer;
+    bvh->indices = std::make_unique<unsigned[]>(triangles.size());
+
+    std::vector<Box3> triangle_bounds(triangles.size());
+    OIIO::parallel_for(0, int64_t(triangles.size()), [&](int64_t i) {
+        bvh->indices[i] = unsigned(i);
+        Box3 b(verts[triangles[i].a]);
+        b.extendBy(verts[triangles[i].b]);
+        b.extendBy(verts[triangles[i].c]);
+        triangle_bounds[i] = b;
+    });
+    BuildNode root;
+    Box3 shape_bounds;
+    for (const Box3& b : triangle_bounds) {
+        root.centroid.extendBy(b.center());
+        shape_bounds.extendBy(b);
+    }
+
+    BVHBuilder builder;
+    builder.triangle_bounds = triangle_bounds;
+    builder.indices         = bvh->indices.get();
+    builder.nodes = std::make_unique<BVHNode[]>(2 * triangles.size() + 1);
+    builder.nodes[0].set(shape_bounds.min, shape_bounds.max);
+    root.left      = 0;
+    root.right     = triangles.size();
+    root.depth     = 1;
+    root.nodeIndex = 0;
+    builder.build(root);
+    const BVHNode* binary = builder.nodes.get();
+
+    std::vector<BVH4Node> nodes;
+    nodes.reserve(builder.nnodes / 3 + 1);
+    if (binary[0].nprims || triangles.empty()) {
+        // A single leaf: make a root with just that one child, or none at
+        // all if there are no triangles
+        BVH4Node rootnode;
+        rootnode.mask = 0xf;
+        set_child(rootnode, 0, binary[0].bounds, binary[0].child,
+                  binary[0].nprims);
+        for (int i = triangles.empty() ? 0 : 1; i < 4; i++)
+            set_empty_child(rootnode, i);
+        nodes.push_back(rootnode);
+    } else {
+        collapse_bvh(binary, 0, nodes);
+    }
+    bvh->nodes = std::make_unique<BVH4Node[]>(nodes.size());
+    std::copy(nodes.begin(), nodes.end(), bvh->nodes.get());
+
+    bvh->leafverts = std::make_unique<Vec3[]>(3 * triangles.size());
+    OIIO::parallel_for(0, int64_t(triangles.size()), [&](int64_t i) {
+        const TriangleIndices& tri(triangles[bvh->indices[i]]);
+        bvh->leafverts[3 * i + 0] = verts[tri.a];
+        bvh->leafverts[3 * i + 1] = verts[tri.b];
+        bvh->leafverts[3 * i + 2] = verts[tri.c];
+    });
+
     double loadtime = timer();
-    errhandler.infofmt("BVH built {} nodes over {} triangles in {}",
-                       buildnodes.size(), triangles.size(),
+    errhandler.infofmt("BVH built {} nodes ({} binary) over {} triangles in {}",
+                       nodes.size(), unsigned(builder.nnodes),
+                       triangles.size(),
                        OIIO::Strutil::timeintervalformat(loadtime, 2));
     errhandler.infofmt("Root bounding box {}, {}, {} to {}, {}, {}",
                        shape_bounds.min.x, shape_bounds.min.y,
@@ -218,36 +385,40 @@ build_bvh(OIIO::cspan<Vec3> verts, OIIO::cspan<TriangleIndices> triangles,
 }
 
 // min and max, written such that any NaNs in 'b' get ignored
-static inline float
-minf(float a, float b)
+static inline OIIO::simd::vfloat4
+minf(const OIIO::simd::vfloat4& a, const OIIO::simd::vfloat4& b)
 {
-    return b < a ? b : a;
+    return OIIO::simd::blend(a, b, b < a);
 }
-static inline float
-maxf(float a, float b)
+static inline OIIO::simd::vfloat4
+maxf(const OIIO::simd::vfloat4& a, const OIIO::simd::vfloat4& b)
 {
-    return b > a ? b : a;
+    return OIIO::simd::blend(a, b, b > a);
 }
 
-static inline bool
-box_intersect(const Vec3& org, const Vec3& rdir, float tmax,
-              const float* bounds, float* dist)
+// Intersect the ray with all four children of a node at once, returning a
+// bitmask of the ones hit and the distance to the near plane of each.
+static inline int
+box_intersect(const OIIO::simd::vfloat4 org[3],
+              const OIIO::simd::vfloat4 rdir[3], float tmax,
+              const BVH4Node& node, OIIO::simd::vfloat4& dist)
 {
-    const float tx1 = (bounds[0] - org.x) * rdir.x;
-    const float tx2 = (bounds[1] - org.x) * rdir.x;
-    const float ty1 = (bounds[2] - org.y) * rdir.y;
-    const float ty2 = (bounds[3] - org.y) * rdir.y;
-    const float tz1 = (bounds[4] - org.z) * rdir.z;
-    const float tz2 = (bounds[5] - org.z) * rdir.z;
-    float tmin      = minf(tx1, tx2);
-    tmax            = minf(tmax, maxf(tx1, tx2));
-    tmin            = maxf(tmin, minf(ty1, ty2));
-    tmax            = minf(tmax, maxf(ty1, ty2));
-    tmin            = maxf(tmin, minf(tz1, tz2));
-    tmax            = minf(tmax, maxf(tz1, tz2));
-    *dist           = tmin;  // actual distance to near plane on the box
-    tmin            = maxf(0.0f, tmin);  // clip to valid portion of ray
-    return tmin <= tmax;
+    using OIIO::simd::vfloat4;
+    const vfloat4 tx1 = (vfloat4(node.bounds[0]) - org[0]) * rdir[0];
+    const vfloat4 tx2 = (vfloat4(node.bounds[1]) - org[0]) * rdir[0];
+    const vfloat4 ty1 = (vfloat4(node.bounds[2]) - org[1]) * rdir[1];
+    const vfloat4 ty2 = (vfloat4(node.bounds[3]) - org[1]) * rdir[1];
+    const vfloat4 tz1 = (vfloat4(node.bounds[4]) - org[2]) * rdir[2];
+    const vfloat4 tz2 = (vfloat4(node.bounds[5]) - org[2]) * rdir[2];
+    vfloat4 tmin      = minf(tx1, tx2);
+    vfloat4 tfar      = minf(vfloat4(tmax), maxf(tx1, tx2));
+    tmin              = maxf(tmin, minf(ty1, ty2));
+    tfar              = minf(tfar, maxf(ty1, ty2));
+    tmin              = maxf(tmin, minf(tz1, tz2));
+    tfar              = minf(tfar, maxf(tz1, tz2));
+    dist              = tmin;  // actual distance to near plane on the box
+    tmin = maxf(vfloat4::Zero(), tmin);  // clip to valid portion of ray
+    return (tmin <= tfar).bitmask() & node.mask;
 }
 
 static inline unsigned
@@ -265,17 +436,21 @@ Intersection
 Scene::intersect(const Ray& ray, const float tmax, unsigned skipID1,
                  unsigned skipID2) const
 {
+    // The stack can hold at most three children left over from each level
     struct StackItem {
-        BVHNode* node;
+        unsigned child;
+        unsigned nprims;
         float dist;
-    } stack[MaxDepth];
+    } stack[MaxDepth * 3 + 1];
     Intersection result;
     result.t       = tmax;
-    stack[0]       = { bvh->nodes.get(), result.t };
+    stack[0]       = { 0, 0, result.t };
     const Vec3 org = ray.origin;
     const Vec3 dir = ray.direction;
     const Vec3 rdir(1 / dir.x, 1 / dir.y, 1 / dir.z);
-    int kz = 0;
+    const OIIO::simd::vfloat4 org4[3]  = { org.x, org.y, org.z };
+    const OIIO::simd::vfloat4 rdir4[3] = { rdir.x, rdir.y, rdir.z };
+    int kz                             = 0;
     if (fabsf(dir.y) > fabsf(comp(dir, kz)))
         kz = 1;
     if (fabsf(dir.z) > fabsf(comp(dir, kz)))
@@ -287,15 +462,15 @@ Scene::intersect(const Ray& ray, const float tmax, unsigned skipID1,
     for (int stackPtr = 1; stackPtr != 0;) {
         if (result.t < stack[--stackPtr].dist)
             continue;
-        BVHNode* node = stack[stackPtr].node;
-        if (node->nprims) {
-            for (unsigned i = 0, nprims = node->nprims; i < nprims; i++) {
-                unsigned id = bvh->indices[node->child + i];
+        const StackItem item = stack[stackPtr];
+        if (item.nprims) {
+            for (unsigned i = item.child, e = i + item.nprims; i < e; i++) {
+                unsigned id = bvh->indices[i];
                 // Watertight Ray/Triangle Intersection - JCGT 2013
                 // https://jcgt.org/published/0002/01/05/
-                const Vec3 A   = verts[triangles[id].a] - org;
-                const Vec3 B   = verts[triangles[id].b] - org;
-                const Vec3 C   = verts[triangles[id].c] - org;
+                const Vec3 A   = bvh->leafverts[3 * i + 0] - org;
+                const Vec3 B   = bvh->leafverts[3 * i + 1] - org;
+                const Vec3 C   = bvh->leafverts[3 * i + 2] - org;
                 const float Ax = comp(A, kx) - shearDir.x * comp(A, kz);
                 const float Ay = comp(A, ky) - shearDir.y * comp(A, kz);
                 const float Bx = comp(B, kx) - shearDir.x * comp(B, kz);
@@ -333,23 +508,26 @@ Scene::intersect(const Ray& ray, const float tmax, unsigned skipID1,
                 result.id          = id;
             }
         } else {
-            BVHNode* child1 = bvh->nodes.get() + node->child;
-            BVHNode* child2 = child1 + 1;
-            float dist1     = 0;
-            bool hit1       = box_intersect(org, rdir, result.t, child1->bounds,
-                                            &dist1);
-            float dist2     = 0;
-            bool hit2       = box_intersect(org, rdir, result.t, child2->bounds,
-                                            &dist2);
-            if (dist1 > dist2) {
-                std::swap(hit1, hit2);
-                std::swap(dist1, dist2);
-                std::swap(child1, child2);
+            const BVH4Node& node = bvh->nodes[item.child];
+            OIIO::simd::vfloat4 dist4;
+            int hits = box_intersect(org4, rdir4, result.t, node, dist4);
+            // push the children that were hit, farthest first, so the
+            // nearest gets popped next
+            int order[4], n = 0;
+            float dist[4];
+            dist4.store(dist);
+            for (int i = 0; i < 4; i++) {
+                if (!(hits & (1 << i)))
+                    continue;
+                int j = n++;
+                for (; j > 0 && dist[order[j - 1]] < dist[i]; j--)
+                    order[j] = order[j - 1];
+                order[j] = i;
+            }
+            for (int j = 0; j < n; j++) {
+                const int i       = order[j];
+                stack[stackPtr++] = { node.child[i], node.nprims[i], dist[i] };
             }
-            stack[stackPtr] = { child2, dist2 };
-            stackPtr += hit2;
-            stack[stackPtr] = { child1, dist1 };
-            stackPtr += hit1;
         }
     }
     return result;
@@ -31,14 +31,30 @@ struct BVHNode {
         return vx * vy + vy * vz + vz * vx;
     }
 };
+
+// The binary tree is collapsed into one with four children per node, whose
+// bounds are stored component-wise so a ray can test them all at once.
+// Unused child slots have empty (inverted) bounds, and are left out of
+// the mask, since the box test doesn't reject inverted bounds.
+struct alignas(16) BVH4Node {
+    float bounds[6][4];  // lo x, hi x, lo y, hi y, lo z, hi z of each child
+    unsigned child[4];   // child node, or first leaf entry if nprims != 0
+    unsigned nprims[4];  // number of triangles in a leaf child
+    int mask;            // bit i is set if child i is in use
+};
+
 struct Intersection {
     float t, u, v;
     unsigned id;
 };
 
 struct BVH {
-    std::unique_ptr<BVHNode[]> nodes;
+    std::unique_ptr<BVH4Node[]> nodes;  // nodes[0] is the root
+    // Triangles in leaf order: the id of each, and its three vertices, so
+    // that a leaf's triangles are contiguous and intersecting them doesn't
+    // chase indices into the scene.
     std::unique_ptr<unsigned[]> indices;
+    std::unique_ptr<Vec3[]> leafverts;
 };
 
 OSL_NAMESPACE_END
@@ -37,6 +37,8 @@ struct Payload {
 
 OSL_NAMESPACE_BEGIN
 
+struct ShadingResult;
+
 struct SimpleRaytracer {
     using ShadingContext = ShadingContextCUDA;
 
@@ -63,8 +65,22 @@ struct SimpleRaytracer {
                                          int id, float u, float v);
     OSL_HOSTDEVICE Vec3 eval_background(const Dual2<Vec3>& dir,
                                         ShadingContext* ctx, int bounce = -1);
+    OSL_HOSTDEVICE void path_miss(PathState& path, ShadingContext* ctx);
+    OSL_HOSTDEVICE int path_hit(PathState& path, const Intersection& hit,
+                                OSL_CUDA::ShaderGlobals& sg);
+    OSL_HOSTDEVICE bool path_shaded(PathState& path, const Intersection& hit,
+                                    const OSL_CUDA::ShaderGlobals& sg,
+                                    int shaderID, Sampler& sampler,
+                                    ShadingContext* ctx);
+    OSL_HOSTDEVICE bool path_scatter(PathState& path, const Intersection& hit,
+                                     const OSL_CUDA::ShaderGlobals& sg,
+                                     ShadingResult& result, int shaderID,
+                                     Sampler& sampler, ShadingContext* ctx);
     OSL_HOSTDEVICE Color3 subpixel_radiance(float x, float y, Sampler& sampler,
                                             ShadingContext* ctx = nullptr);
+    OSL_HOSTDEVICE Vec2 pixel_jitter(int x, int y, Sampler& sampler) const;
+    OSL_HOSTDEVICE Color3 pixel_sample(int x, int y, int si,
+                                       ShadingContext* ctx = nullptr);
     OSL_HOSTDEVICE Color3 antialias_pixel(int x, int y,
                                           ShadingContext* ctx = nullptr);
 };
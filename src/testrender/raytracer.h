@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <limits>
 #include <vector>
 
 #include <OpenImageIO/fmath.h>
@@ -104,6 +105,22 @@ struct Ray {
 
 
 
+// What a path carries from one bounce to the next, so that it can be
+// suspended between tracing and shading.
+struct PathState {
+    OSL_HOSTDEVICE PathState(const Ray& r) : ray(r) {}
+
+    Ray ray;
+    Color3 weight { 1, 1, 1 };
+    Color3 radiance { 0, 0, 0 };
+    // camera ray has only one possible direction
+    float bsdf_pdf = std::numeric_limits<float>::infinity();
+    int prev_id    = -1;
+    int bounce     = 0;
+};
+
+
+
 struct Camera {
     OSL_HOSTDEVICE Camera() {}
 
@@ -408,6 +408,12 @@ struct BSDF : public AbstractBSDF {
 #endif
 };
 
+// The number of BSDF lobes a shading point can hold, set at build time with
+// the TESTRENDER_MAX_BSDFS CMake variable. Lobes past these are dropped.
+#ifndef TESTRENDER_MAX_BSDFS
+#    define TESTRENDER_MAX_BSDFS 8
+#endif
+
 /// Represents a weighted sum of BSDFS
 /// NOTE: no need to inherit from BSDF here because we use a "flattened" representation and therefore never nest these
 ///
@@ -521,8 +527,8 @@ private:
     OSL_HOSTDEVICE BSDF::Sample eval(const BSDF* bsdf, const Vec3& wo,
                                      const Vec3& wi) const;
 
-    enum { MaxEntries = 8 };
-    enum { MaxSize = 256 * sizeof(float) };
+    enum { MaxEntries = TESTRENDER_MAX_BSDFS };
+    enum { MaxSize = MaxEntries * 32 * sizeof(float) };
 
     Color3 weights[MaxEntries];
     float pdfs[MaxEntries];
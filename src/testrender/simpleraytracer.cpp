@@ -4,6 +4,9 @@
 
 
 #ifndef __CUDACC__
+#    include <algorithm>
+#    include <atomic>
+
 #    include <OpenImageIO/filesystem.h>
 #    include <OpenImageIO/parallel.h>
 #    include <OpenImageIO/timer.h>
@@ -83,6 +86,11 @@ private:
 
 
 SimpleRaytracer::SimpleRaytracer()
+#if OSL_USE_BATCHED
+    : m_batch_16_simple_raytracer(*this)
+    , m_batch_8_simple_raytracer(*this)
+    , m_batch_4_simple_raytracer(*this)
+#endif
 {
     m_errhandler.reset(new SimpleRaytracer::ErrorHandler(*this));
 
@@ -951,222 +959,280 @@ SimpleRaytracer::eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
     return process_background_closure((const ClosureColor*)sg.Ci);
 }
 
-Color3
-SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
-                                   ShadingContext* ctx)
+OSL_HOSTDEVICE void
+SimpleRaytracer::path_miss(PathState& path, ShadingContext* ctx)
+{
+    // we hit nothing? check background shader
+    if (backgroundShaderID >= 0) {
+        if (path.bounce > 0 && backgroundResolution > 0) {
+            float bg_pdf = 0;
+            Vec3 bg      = background.eval(path.ray.direction, bg_pdf);
+            path.radiance += path.weight * bg
+                             * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(
+                                 path.bsdf_pdf, bg_pdf);
+        } else {
+            // we aren't importance sampling the background - so just run it directly
+            path.radiance += path.weight
+                             * eval_background(path.ray.direction, ctx,
+                                               path.bounce);
+        }
+    }
+}
+
+OSL_HOSTDEVICE int
+SimpleRaytracer::path_hit(PathState& path, const Intersection& hit,
+                          ShaderGlobalsType& sg)
+{
+    // construct a shader globals for the hit point
+    globals_from_hit(sg, path.ray, hit.t, hit.id, hit.u, hit.v);
+
+    if (show_globals) {
+        // visualize the main fields of the shader globals
+        Vec3 v = sg.Ng;
+        if (show_globals == 2)
+            v = sg.N;
+        if (show_globals == 3)
+            v = sg.dPdu.normalize();
+        if (show_globals == 4)
+            v = sg.dPdv.normalize();
+        if (show_globals == 5)
+            v = Vec3(sg.u, sg.v, 0);
+        Color3 c(v.x, v.y, v.z);
+        if (show_globals != 5)
+            c = c * 0.5f + Color3(0.5f);
+        path.radiance += path.weight * c;
+        return -1;
+    }
+
+    int shaderID = scene.shaderid(hit.id);
+#ifndef __CUDACC__
+    if (shaderID >= 0 && !m_shaders[shaderID].surf)
+        return -1;  // no shader attached? done
+#endif
+    return shaderID;
+}
+
+OSL_HOSTDEVICE bool
+SimpleRaytracer::path_shaded(PathState& path, const Intersection& hit,
+                             const ShaderGlobalsType& sg, int shaderID,
+                             Sampler& sampler, ShadingContext* ctx)
+{
+    ShadingResult result;
+    process_closure(sg, path.ray.roughness, result, (const ClosureColor*)sg.Ci,
+                    path.bounce == max_bounces);
+    return path_scatter(path, hit, sg, result, shaderID, sampler, ctx);
+}
+
+OSL_HOSTDEVICE bool
+SimpleRaytracer::path_scatter(PathState& path, const Intersection& hit,
+                              const ShaderGlobalsType& sg,
+                              ShadingResult& result, int shaderID,
+                              Sampler& sampler, ShadingContext* ctx)
 {
 #ifdef __CUDACC__
     // Scratch space for the output closures
-    alignas(8) char closure_pool[256];
     alignas(8) char light_closure_pool[256];
 #endif
 
     constexpr float inf = std::numeric_limits<float>::infinity();
-    Ray r               = camera.get(x, y);
-    Color3 path_weight(1, 1, 1);
-    Color3 path_radiance(0, 0, 0);
-    int prev_id    = -1;
-    float bsdf_pdf = inf;  // camera ray has only one possible direction
-
-    for (int b = 0; b <= max_bounces; b++) {
-        ShaderGlobalsType sg;
-
-        // trace the ray against the scene
-        Intersection hit = scene.intersect(r, inf, prev_id);
-        if (hit.t == inf) {
-            // we hit nothing? check background shader
-            if (backgroundShaderID >= 0) {
-                if (b > 0 && backgroundResolution > 0) {
-                    float bg_pdf = 0;
-                    Vec3 bg      = background.eval(r.direction, bg_pdf);
-                    path_radiance
-                        += path_weight * bg
-                           * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bsdf_pdf,
-                                                                      bg_pdf);
-                } else {
-                    // we aren't importance sampling the background - so just run it directly
-                    path_radiance += path_weight
-                                     * eval_background(r.direction, ctx, b);
-                }
-            }
-            break;
-        }
-
-        // construct a shader globals for the hit point
-        globals_from_hit(sg, r, hit.t, hit.id, hit.u, hit.v);
-
-        if (show_globals) {
-            // visualize the main fields of the shader globals
-            Vec3 v = sg.Ng;
-            if (show_globals == 2)
-                v = sg.N;
-            if (show_globals == 3)
-                v = sg.dPdu.normalize();
-            if (show_globals == 4)
-                v = sg.dPdv.normalize();
-            if (show_globals == 5)
-                v = Vec3(sg.u, sg.v, 0);
-            Color3 c(v.x, v.y, v.z);
-            if (show_globals != 5)
-                c = c * 0.5f + Color3(0.5f);
-            path_radiance += path_weight * c;
-            break;
-        }
-
-        const float radius = r.radius + r.spread * hit.t;
-
-        int shaderID = scene.shaderid(hit.id);
+    Ray& r              = path.ray;
+    const int b         = path.bounce;
+    const float radius  = r.radius + r.spread * hit.t;
+    bool last_bounce    = b == max_bounces;
 
 #ifndef __CUDACC__
-        if (shaderID < 0 || !m_shaders[shaderID].surf)
-            break;  // no shader attached? done
-
-        // execute shader and process the resulting list of closures
-        shadingsys->execute(*ctx, *m_shaders[shaderID].surf, sg);
-#else
-        if (shaderID < 0)
-            break;  // no shader attached? done
-        execute_shader(sg, shaderID, closure_pool);
+    const size_t lightprims_size = m_lightprims.size();
 #endif
-        ShadingResult result;
-        bool last_bounce = b == max_bounces;
-        process_closure(sg, r.roughness, result, (const ClosureColor*)sg.Ci,
-                        last_bounce);
 
-#ifndef __CUDACC__
-        const size_t lightprims_size = m_lightprims.size();
-#endif
+    // add self-emission
+    float k = 1;
+    if (m_shader_is_light[shaderID] && lightprims_size > 0) {
+        const float light_pick_pdf = 1.0f / lightprims_size;
+        // figure out the probability of reaching this point
+        float light_pdf = light_pick_pdf
+                          * scene.shapepdf(hit.id, r.origin, sg.P);
+        k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(path.bsdf_pdf, light_pdf);
+    }
+    path.radiance += path.weight * k * result.Le;
 
-        // add self-emission
-        float k = 1;
-        if (m_shader_is_light[shaderID] && lightprims_size > 0) {
-            const float light_pick_pdf = 1.0f / lightprims_size;
-            // figure out the probability of reaching this point
-            float light_pdf = light_pick_pdf
-                              * scene.shapepdf(hit.id, r.origin, sg.P);
-            k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(bsdf_pdf, light_pdf);
-        }
-        path_radiance += path_weight * k * result.Le;
+    // last bounce? nothing left to do
+    if (last_bounce)
+        return false;
 
-        // last bounce? nothing left to do
-        if (last_bounce)
-            break;
+    // build internal pdf for sampling between bsdf closures
+    result.bsdf.prepare(-sg.I, path.weight, b >= rr_depth);
 
-        // build internal pdf for sampling between bsdf closures
-        result.bsdf.prepare(-sg.I, path_weight, b >= rr_depth);
+    if (show_albedo_scale > 0) {
+        // Instead of path tracing, just visualize the albedo
+        // of the bsdf. This can be used to validate the accuracy of
+        // the get_albedo method for a particular bsdf.
+        path.radiance += path.weight * result.bsdf.get_albedo(-sg.I)
+                         * show_albedo_scale;
+        return false;
+    }
 
-        if (show_albedo_scale > 0) {
-            // Instead of path tracing, just visualize the albedo
-            // of the bsdf. This can be used to validate the accuracy of
-            // the get_albedo method for a particular bsdf.
-            path_radiance += path_weight * result.bsdf.get_albedo(-sg.I)
-                             * show_albedo_scale;
-            break;
+    // get three random numbers
+    Vec3 s   = sampler.get();
+    float xi = s.x;
+    float yi = s.y;
+    float zi = s.z;
+
+    // trace one ray to the background
+    if (backgroundResolution > 0) {
+        Dual2<Vec3> bg_dir;
+        float bg_pdf   = 0;
+        Vec3 bg        = background.sample(xi, yi, bg_dir, bg_pdf);
+        BSDF::Sample b = result.bsdf.eval(-sg.I, bg_dir.val());
+        Color3 contrib = path.weight * b.weight * bg
+                         * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bg_pdf,
+                                                                    b.pdf);
+        if ((contrib.x + contrib.y + contrib.z) > 0) {
+            Ray shadow_ray = Ray(sg.P, bg_dir.val(), radius, 0, 0,
+                                 Ray::SHADOW);
+            Intersection shadow_hit = scene.intersect(shadow_ray, inf, hit.id);
+            if (shadow_hit.t == inf)  // ray reached the background?
+                path.radiance += contrib;
         }
+    }
 
-        // get three random numbers
-        Vec3 s   = sampler.get();
-        float xi = s.x;
-        float yi = s.y;
-        float zi = s.z;
-
-        // trace one ray to the background
-        if (backgroundResolution > 0) {
-            Dual2<Vec3> bg_dir;
-            float bg_pdf   = 0;
-            Vec3 bg        = background.sample(xi, yi, bg_dir, bg_pdf);
-            BSDF::Sample b = result.bsdf.eval(-sg.I, bg_dir.val());
-            Color3 contrib = path_weight * b.weight * bg
-                             * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(bg_pdf,
-                                                                        b.pdf);
+    // trace a shadow ray to one of the light emitting primitives
+    if (lightprims_size > 0) {
+        const float light_pick_pdf = 1.0f / lightprims_size;
+
+        // uniform probability for each light
+        float xl = xi * lightprims_size;
+        int ls   = floorf(xl);
+        xl -= ls;
+
+        uint32_t lid = m_lightprims[ls];
+        if (lid != hit.id) {
+            int shaderID = scene.shaderid(lid);
+
+            // sample a random direction towards the object
+            LightSample sample = scene.sample(lid, sg.P, xl, yi);
+            BSDF::Sample b     = result.bsdf.eval(-sg.I, sample.dir);
+            Color3 contrib     = path.weight * b.weight
+                             * MIS::power_heuristic<MIS::EVAL_WEIGHT>(
+                                 light_pick_pdf * sample.pdf, b.pdf);
             if ((contrib.x + contrib.y + contrib.z) > 0) {
-                ShaderGlobalsType shadow_sg;
-                Ray shadow_ray          = Ray(sg.P, bg_dir.val(), radius, 0, 0,
-                                              Ray::SHADOW);
-                Intersection shadow_hit = scene.intersect(shadow_ray, inf,
-                                                          hit.id);
-                if (shadow_hit.t == inf)  // ray reached the background?
-                    path_radiance += contrib;
-            }
-        }
-
-        // trace a shadow ray to one of the light emitting primitives
-        if (lightprims_size > 0) {
-            const float light_pick_pdf = 1.0f / lightprims_size;
-
-            // uniform probability for each light
-            float xl = xi * lightprims_size;
-            int ls   = floorf(xl);
-            xl -= ls;
-
-            uint32_t lid = m_lightprims[ls];
-            if (lid != hit.id) {
-                int shaderID = scene.shaderid(lid);
-
-                // sample a random direction towards the object
-                LightSample sample = scene.sample(lid, sg.P, xl, yi);
-                BSDF::Sample b     = result.bsdf.eval(-sg.I, sample.dir);
-                Color3 contrib     = path_weight * b.weight
-                                 * MIS::power_heuristic<MIS::EVAL_WEIGHT>(
-                                     light_pick_pdf * sample.pdf, b.pdf);
-                if ((contrib.x + contrib.y + contrib.z) > 0) {
-                    ShaderGlobalsType light_sg;
-                    Ray shadow_ray = Ray(sg.P, sample.dir, radius, 0, 0,
-                                         Ray::SHADOW);
-                    // trace a shadow ray and see if we actually hit the target
-                    // in this tiny renderer, tracing a ray is probably cheaper than evaluating the light shader
-                    Intersection shadow_hit
-                        = scene.intersect(shadow_ray, sample.dist, hit.id, lid);
+                ShaderGlobalsType light_sg;
+                Ray shadow_ray = Ray(sg.P, sample.dir, radius, 0, 0,
+                                     Ray::SHADOW);
+                // trace a shadow ray and see if we actually hit the target
+                // in this tiny renderer, tracing a ray is probably cheaper than evaluating the light shader
+                Intersection shadow_hit = scene.intersect(shadow_ray,
+                                                          sample.dist, hit.id,
+                                                          lid);
 
 #ifndef __CUDACC__
-                    const bool did_hit = shadow_hit.t == sample.dist;
+                const bool did_hit = shadow_hit.t == sample.dist;
 #else
-                    // The hit distance on the device is not as precise as on
-                    // the CPU, so we need to allow a little wiggle room. An
-                    // epsilon of 1e-3f empirically gives results that closely
-                    // match the CPU for the test scenes, so that's what we're
-                    // using.
-                    const bool did_hit = fabsf(shadow_hit.t - sample.dist)
-                                         < 1e-3f;
+                // The hit distance on the device is not as precise as on
+                // the CPU, so we need to allow a little wiggle room. An
+                // epsilon of 1e-3f empirically gives results that closely
+                // match the CPU for the test scenes, so that's what we're
+                // using.
+                const bool did_hit = fabsf(shadow_hit.t - sample.dist) < 1e-3f;
 #endif
-                    if (did_hit) {
-                        // setup a shader global for the point on the light
-                        globals_from_hit(light_sg, shadow_ray, sample.dist, lid,
-                                         sample.u, sample.v);
+                if (did_hit) {
+                    // setup a shader global for the point on the light
+                    globals_from_hit(light_sg, shadow_ray, sample.dist, lid,
+                                     sample.u, sample.v);
 #ifndef __CUDACC__
-                        // execute the light shader (for emissive closures only)
-                        shadingsys->execute(*ctx, *m_shaders[shaderID].surf,
-                                            light_sg);
+                    // execute the light shader (for emissive closures only)
+                    shadingsys->execute(*ctx, *m_shaders[shaderID].surf,
+                                        light_sg);
 #else
-                        execute_shader(light_sg, shaderID, light_closure_pool);
+                    execute_shader(light_sg, shaderID, light_closure_pool);
 #endif
-                        ShadingResult light_result;
-                        process_closure(light_sg, r.roughness, light_result,
-                                        (const ClosureColor*)light_sg.Ci, true);
-                        // accumulate contribution
-                        path_radiance += contrib * light_result.Le;
-                    }
+                    ShadingResult light_result;
+                    process_closure(light_sg, r.roughness, light_result,
+                                    (const ClosureColor*)light_sg.Ci, true);
+                    // accumulate contribution
+                    path.radiance += contrib * light_result.Le;
                 }
             }
         }
+    }
 
-        // trace indirect ray and continue
-        BSDF::Sample p = result.bsdf.sample(-sg.I, xi, yi, zi);
-        path_weight *= p.weight;
-        bsdf_pdf  = p.pdf;
-        r.raytype = Ray::DIFFUSE;  // FIXME? Use DIFFUSE for all indiirect rays
-        r.direction = p.wi;
-        r.radius    = radius;
-        // Just simply use roughness as spread slope
-        r.spread    = std::max(r.spread, p.roughness);
-        r.roughness = p.roughness;
-        if (!(path_weight.x > 0) && !(path_weight.y > 0)
-            && !(path_weight.z > 0))
-            break;  // filter out all 0's or NaNs
-        prev_id  = hit.id;
-        r.origin = sg.P;
+    // trace indirect ray and continue
+    BSDF::Sample p = result.bsdf.sample(-sg.I, xi, yi, zi);
+    path.weight *= p.weight;
+    path.bsdf_pdf = p.pdf;
+    r.raytype     = Ray::DIFFUSE;  // FIXME? Use DIFFUSE for all indiirect rays
+    r.direction   = p.wi;
+    r.radius      = radius;
+    // Just simply use roughness as spread slope
+    r.spread    = std::max(r.spread, p.roughness);
+    r.roughness = p.roughness;
+    if (!(path.weight.x > 0) && !(path.weight.y > 0) && !(path.weight.z > 0))
+        return false;  // filter out all 0's or NaNs
+    path.prev_id = hit.id;
+    r.origin     = sg.P;
+    return true;
+}
+
+Color3
+SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
+                                   ShadingContext* ctx)
+{
+#ifdef __CUDACC__
+    // Scratch space for the output closures
+    alignas(8) char closure_pool[256];
+#endif
+
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    PathState path(camera.get(x, y));
+
+    for (; path.bounce <= max_bounces; path.bounce++) {
+        ShaderGlobalsType sg;
+
+        // trace the ray against the scene
+        Intersection hit = scene.intersect(path.ray, inf, path.prev_id);
+        if (hit.t == inf) {
+            path_miss(path, ctx);
+            break;
+        }
+
+        int shaderID = path_hit(path, hit, sg);
+        if (shaderID < 0)
+            break;
+
+        // execute shader and process the resulting list of closures
+#ifndef __CUDACC__
+        shadingsys->execute(*ctx, *m_shaders[shaderID].surf, sg);
+#else
+        execute_shader(sg, shaderID, closure_pool);
+#endif
+        if (!path_shaded(path, hit, sg, shaderID, sampler, ctx))
+            break;
     }
-    return path_radiance;
+    return path.radiance;
+}
+
+
+OSL_HOSTDEVICE Vec2
+SimpleRaytracer::pixel_jitter(int x, int y, Sampler& sampler) const
+{
+    // jitter pixel coordinate [0,1)^2
+    Vec3 j = no_jitter ? Vec3(0.5f, 0.5f, 0) : sampler.get();
+    // warp distribution to approximate a tent filter [-1,+1)^2
+    j.x *= 2;
+    j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
+    j.y *= 2;
+    j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+    // apply jitter from center of the pixel
+    return Vec2(x + 0.5f + j.x, y + 0.5f + j.y);
+}
+
+
+OSL_HOSTDEVICE Color3
+SimpleRaytracer::pixel_sample(int x, int y, int si, ShadingContext* ctx)
+{
+    Sampler sampler(x, y, si);
+    // trace eye ray
+    Vec2 p = pixel_jitter(x, y, sampler);
+    return subpixel_radiance(p.x, p.y, sampler, ctx);
 }
 
 
@@ -1175,17 +1241,7 @@ SimpleRaytracer::antialias_pixel(int x, int y, ShadingContext* ctx)
 {
     Color3 result(0, 0, 0);
     for (int si = 0, n = aa * aa; si < n; si++) {
-        Sampler sampler(x, y, si);
-        // jitter pixel coordinate [0,1)^2
-        Vec3 j = no_jitter ? Vec3(0.5f, 0.5f, 0) : sampler.get();
-        // warp distribution to approximate a tent filter [-1,+1)^2
-        j.x *= 2;
-        j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
-        j.y *= 2;
-        j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
-        // trace eye ray (apply jitter from center of the pixel)
-        Color3 r = subpixel_radiance(x + 0.5f + j.x, y + 0.5f + j.y, sampler,
-                                     ctx);
+        Color3 r = pixel_sample(x, y, si, ctx);
         // mix in result via lerp for numerical stability
         result = OIIO::lerp(result, r, 1.0f / (si + 1));
     }
@@ -1198,12 +1254,18 @@ void
 SimpleRaytracer::prepare_render()
 {
     // Retrieve and validate options
-    aa                = std::max(1, options.get_int("aa"));
-    no_jitter         = options.get_int("no_jitter") != 0;
-    max_bounces       = options.get_int("max_bounces");
-    rr_depth          = options.get_int("rr_depth");
-    show_albedo_scale = options.get_float("show_albedo_scale");
-    show_globals      = options.get_int("show_globals");
+    aa                 = std::max(1, options.get_int("aa"));
+    no_jitter          = options.get_int("no_jitter") != 0;
+    max_bounces        = options.get_int("max_bounces");
+    rr_depth           = options.get_int("rr_depth");
+    show_albedo_scale  = options.get_float("show_albedo_scale");
+    show_globals       = options.get_int("show_globals");
+    batch_size         = options.get_int("batch_size");
+    sort_shading       = options.get_int("sort_shading") != 0;
+    adaptive_threshold = options.get_float("adaptive_threshold");
+    checkpoint_every   = options.get_float("checkpoint_interval");
+    progressive        = options.get_int("progressive") != 0
+                  || adaptive_threshold > 0 || checkpoint_every > 0;
 
     // prepare background importance table (if requested)
     if (backgroundResolution > 0 && backgroundShaderID >= 0) {
@@ -1401,6 +1463,19 @@ SimpleRaytracer::prepare_geometry()
 void
 SimpleRaytracer::render(int xres, int yres)
 {
+#    if OSL_USE_BATCHED
+    if (batch_size == 16)
+        return render_wavefront<16>(xres, yres);
+    if (batch_size == 8)
+        return render_wavefront<8>(xres, yres);
+    if (batch_size == 4)
+        return render_wavefront<4>(xres, yres);
+#    endif
+    if (sort_shading)
+        return render_sorted(xres, yres);
+    if (progressive)
+        return render_progressive(xres, yres);
+
     OIIO::Timer timer;
     ShadingSystem* shadingsys = this->shadingsys;
     OIIO::parallel_for_chunked(
@@ -1435,6 +1510,430 @@ SimpleRaytracer::render(int xres, int yres)
 
 
 
+void
+SimpleRaytracer::render_progressive(int xres, int yres)
+{
+    OIIO::Timer timer;
+    ShadingSystem* shadingsys = this->shadingsys;
+    constexpr int TileSize    = 16;
+    // Pixels aren't tested for convergence before they have this many
+    // samples, to have some confidence in their variance. Since each pass
+    // takes aa of them, no pixel can stop early unless aa*aa > MinSamples,
+    // that is with -aa 3 or more.
+    constexpr int MinSamples = 4;
+    const int xtiles         = (xres + TileSize - 1) / TileSize;
+    const int ytiles         = (yres + TileSize - 1) / TileSize;
+    const int64_t ntiles     = int64_t(xtiles) * ytiles;
+    const int nsamples       = aa * aa;
+    auto luminance = [](const Color3& c) { return (c.x + c.y + c.z) / 3; };
+
+    // The value of each pixel is accumulated exactly as antialias_pixel
+    // does, so a render that is never stopped early matches the regular
+    // one. The variance of its luminance is tracked alongside with
+    // Welford's algorithm.
+    struct PixelState {
+        Color3 value { 0, 0, 0 };
+        float m2  = 0;
+        int n     = 0;
+        bool done = false;
+    };
+    std::vector<PixelState> pixels(size_t(xres) * yres);
+    OIIO::ImageSpec aovspec(xres, yres, 2, OIIO::TypeDesc::FLOAT);
+    aovspec.channelnames = { "samples", "error" };
+    aovbuf.reset(aovspec);
+
+    std::atomic<long long> total_samples { 0 };
+    std::atomic<int> remaining { xres * yres };
+    double last_checkpoint = timer();
+    int passes             = 0;
+    // Each pass takes the next aa samples of every unfinished pixel
+    for (int first = 0; first < nsamples && remaining > 0; first += aa) {
+        const int last = std::min(first + aa, nsamples);
+        remaining      = 0;
+        OIIO::parallel_for(0, ntiles, [&, this](int64_t tile) {
+            OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+            ShadingContext* ctx = shadingsys->get_context(thread_info);
+
+            const OIIO::ROI roi(
+                int(tile % xtiles) * TileSize,
+                std::min(int(tile % xtiles + 1) * TileSize, xres),
+                int(tile / xtiles) * TileSize,
+                std::min(int(tile / xtiles + 1) * TileSize, yres));
+            OIIO::ImageBuf::Iterator<float> p(pixelbuf, roi);
+            OIIO::ImageBuf::Iterator<float> a(aovbuf, roi);
+            int unfinished = 0;
+            for (; !p.done(); ++p, ++a) {
+                PixelState& px = pixels[size_t(p.y()) * xres + p.x()];
+                if (px.done)
+                    continue;
+                for (int si = first; si < last; si++) {
+                    Color3 c    = pixel_sample(p.x(), p.y(), si, ctx);
+                    float delta = luminance(c) - luminance(px.value);
+                    px.value    = OIIO::lerp(px.value, c, 1.0f / (si + 1));
+                    px.m2 += delta * (luminance(c) - luminance(px.value));
+                    px.n++;
+                }
+                // standard error of the mean luminance
+                float mean  = luminance(px.value);
+                float error = px.n > 1 ? sqrtf(px.m2 / (px.n - 1) / px.n) : 0;
+                if (px.n == nsamples
+                    || (adaptive_threshold > 0 && px.n >= MinSamples
+                        && error <= adaptive_threshold * std::max(mean, 0.01f)))
+                    px.done = true;
+                else
+                    unfinished++;
+                p[0] = px.value.x;
+                p[1] = px.value.y;
+                p[2] = px.value.z;
+                a[0] = px.n;
+                a[1] = error;
+                total_samples += last - first;
+            }
+            remaining += unfinished;
+
+            shadingsys->release_context(ctx);
+            shadingsys->destroy_thread_info(thread_info);
+        });
+        passes++;
+        if (checkpoint && checkpoint_every > 0 && remaining > 0
+            && timer() - last_checkpoint >= checkpoint_every) {
+            checkpoint();
+            last_checkpoint = timer();
+        }
+    }
+    double rendertime = timer();
+    errhandler().infofmt(
+        "Rendered {}x{} image with up to {} samples in {} ({} passes, {:.1f} samples per pixel on average)",
+        xres, yres, nsamples, OIIO::Strutil::timeintervalformat(rendertime, 2),
+        passes, double(total_samples) / (double(xres) * yres));
+}
+
+
+
+void
+SimpleRaytracer::render_sorted(int xres, int yres)
+{
+    OIIO::Timer timer;
+    ShadingSystem* shadingsys = this->shadingsys;
+    constexpr float inf       = std::numeric_limits<float>::infinity();
+    constexpr int TileSize    = 16;
+    const int xtiles          = (xres + TileSize - 1) / TileSize;
+    const int ytiles          = (yres + TileSize - 1) / TileSize;
+    const int nsamples        = aa * aa;
+    std::atomic<long long> nshaded { 0 }, nruns { 0 };
+
+    // A path that hit something, waiting to be shaded
+    struct Hit {
+        unsigned path;
+        int shaderID;
+        Intersection hit;
+        ShaderGlobals sg;
+    };
+
+    OIIO::parallel_for(0, int64_t(xtiles) * ytiles, [&, this](int64_t tile) {
+        OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+        ShadingContext* ctx = shadingsys->get_context(thread_info);
+
+        const OIIO::ROI roi(int(tile % xtiles) * TileSize,
+                            std::min(int(tile % xtiles + 1) * TileSize, xres),
+                            int(tile / xtiles) * TileSize,
+                            std::min(int(tile / xtiles + 1) * TileSize, yres));
+
+        // Generate the camera rays of every sample of every pixel
+        std::vector<PathState> paths;
+        std::vector<Sampler> samplers;
+        paths.reserve(roi.npixels() * nsamples);
+        samplers.reserve(roi.npixels() * nsamples);
+        for (int y = roi.ybegin; y < roi.yend; y++) {
+            for (int x = roi.xbegin; x < roi.xend; x++) {
+                for (int si = 0; si < nsamples; si++) {
+                    Sampler sampler(x, y, si);
+                    Vec2 p = pixel_jitter(x, y, sampler);
+                    paths.emplace_back(camera.get(p.x, p.y));
+                    samplers.push_back(sampler);
+                }
+            }
+        }
+
+        std::vector<unsigned> live(paths.size());
+        for (unsigned i = 0; i < live.size(); i++)
+            live[i] = i;
+        std::vector<Hit> hits;
+        std::vector<unsigned> order;
+        while (!live.empty()) {
+            // Trace the whole wavefront, retiring the paths that escape
+            // N.B. no reallocation, so each sg.renderstate stays valid
+            hits.clear();
+            hits.reserve(live.size());
+            for (unsigned i : live) {
+                PathState& path  = paths[i];
+                Intersection hit = scene.intersect(path.ray, inf,
+                                                   path.prev_id);
+                if (hit.t == inf) {
+                    path_miss(path, ctx);
+                    continue;
+                }
+                hits.emplace_back();
+                Hit& h     = hits.back();
+                h.path     = i;
+                h.hit      = hit;
+                h.shaderID = path_hit(path, hit, h.sg);
+                if (h.shaderID < 0)
+                    hits.pop_back();
+            }
+
+            // Sort the hits so that points with the same shader and ray type
+            // are shaded back to back.
+            order.resize(hits.size());
+            for (unsigned i = 0; i < order.size(); i++)
+                order[i] = i;
+            std::stable_sort(order.begin(), order.end(),
+                             [&](unsigned a, unsigned b) {
+                                 const Hit& ha = hits[a];
+                                 const Hit& hb = hits[b];
+                                 return ha.shaderID != hb.shaderID
+                                            ? ha.shaderID < hb.shaderID
+                                            : ha.sg.raytype < hb.sg.raytype;
+                             });
+
+            // Run the surface shaders, one group after the other. The
+            // closures of each shade are turned into BSDFs right away, as
+            // the next shade reuses the context's closure memory.
+            std::unique_ptr<ShadingResult[]> results(
+                new ShadingResult[order.size()]);
+            for (size_t k = 0; k < order.size(); k++) {
+                Hit& h = hits[order[k]];
+                if (k == 0 || h.shaderID != hits[order[k - 1]].shaderID
+                    || h.sg.raytype != hits[order[k - 1]].sg.raytype)
+                    nruns += 1;
+                shadingsys->execute(*ctx, *m_shaders[h.shaderID].surf, h.sg);
+                process_closure(h.sg, paths[h.path].ray.roughness, results[k],
+                                (const ClosureColor*)h.sg.Ci,
+                                paths[h.path].bounce == max_bounces);
+            }
+            nshaded += order.size();
+
+            // Only then light the hits and continue their paths
+            live.clear();
+            for (size_t k = 0; k < order.size(); k++) {
+                Hit& h          = hits[order[k]];
+                PathState& path = paths[h.path];
+                if (path_scatter(path, h.hit, h.sg, results[k], h.shaderID,
+                                 samplers[h.path], ctx)
+                    && ++path.bounce <= max_bounces)
+                    live.push_back(h.path);
+            }
+        }
+
+        // Average the samples of each pixel in order, as antialias_pixel
+        OIIO::ImageBuf::Iterator<float> p(pixelbuf, roi);
+        for (size_t i = 0; !p.done(); ++p, i += nsamples) {
+            Color3 c(0, 0, 0);
+            for (int si = 0; si < nsamples; si++)
+                c = OIIO::lerp(c, paths[i + si].radiance, 1.0f / (si + 1));
+            p[0] = c.x;
+            p[1] = c.y;
+            p[2] = c.z;
+        }
+
+        shadingsys->release_context(ctx);
+        shadingsys->destroy_thread_info(thread_info);
+    });
+    double rendertime = timer();
+    errhandler().infofmt(
+        "Rendered {}x{} image with {} samples in {} (sorted, {:.1f} points per shader run)",
+        xres, yres, aa * aa, OIIO::Strutil::timeintervalformat(rendertime, 2),
+        nruns ? double(nshaded) / nruns : 0.0);
+}
+
+
+
+#    if OSL_USE_BATCHED
+template<int WidthT>
+void
+SimpleRaytracer::render_wavefront(int xres, int yres)
+{
+    OIIO::Timer timer;
+    ShadingSystem* shadingsys = this->shadingsys;
+    constexpr float inf       = std::numeric_limits<float>::infinity();
+    constexpr int TileSize    = 16;
+    const int xtiles          = (xres + TileSize - 1) / TileSize;
+    const int ytiles          = (yres + TileSize - 1) / TileSize;
+    const int nsamples        = aa * aa;
+    std::atomic<long long> nshaded { 0 }, nbatches { 0 };
+
+    // A path that hit something, waiting to be shaded
+    struct Hit {
+        unsigned path;
+        int shaderID;
+        Intersection hit;
+        ShaderGlobals sg;
+    };
+
+    OIIO::parallel_for(0, int64_t(xtiles) * ytiles, [&, this](int64_t tile) {
+        OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+        // Batches are shaded in their own context, because the closures of
+        // a batch must outlive the light and background shaders run while
+        // its lanes are processed one at a time.
+        ShadingContext* ctx       = shadingsys->get_context(thread_info);
+        ShadingContext* batch_ctx = shadingsys->get_context(thread_info);
+
+        const OIIO::ROI roi(int(tile % xtiles) * TileSize,
+                            std::min(int(tile % xtiles + 1) * TileSize, xres),
+                            int(tile / xtiles) * TileSize,
+                            std::min(int(tile / xtiles + 1) * TileSize, yres));
+
+        // Generate the camera rays of every sample of every pixel
+        std::vector<PathState> paths;
+        std::vector<Sampler> samplers;
+        paths.reserve(roi.npixels() * nsamples);
+        samplers.reserve(roi.npixels() * nsamples);
+        for (int y = roi.ybegin; y < roi.yend; y++) {
+            for (int x = roi.xbegin; x < roi.xend; x++) {
+                for (int si = 0; si < nsamples; si++) {
+                    Sampler sampler(x, y, si);
+                    Vec2 p = pixel_jitter(x, y, sampler);
+                    paths.emplace_back(camera.get(p.x, p.y));
+                    samplers.push_back(sampler);
+                }
+            }
+        }
+
+        std::vector<unsigned> live(paths.size());
+        for (unsigned i = 0; i < live.size(); i++)
+            live[i] = i;
+        std::vector<Hit> hits;
+        std::vector<unsigned> order;
+        BatchedShaderGlobals<WidthT> bsg;
+        while (!live.empty()) {
+            // Trace the whole wavefront, retiring the paths that escape
+            // N.B. no reallocation, so each sg.renderstate stays valid
+            hits.clear();
+            hits.reserve(live.size());
+            for (unsigned i : live) {
+                PathState& path  = paths[i];
+                Intersection hit = scene.intersect(path.ray, inf,
+                                                   path.prev_id);
+                if (hit.t == inf) {
+                    path_miss(path, ctx);
+                    continue;
+                }
+                hits.emplace_back();
+                Hit& h     = hits.back();
+                h.path     = i;
+                h.hit      = hit;
+                h.shaderID = path_hit(path, hit, h.sg);
+                if (h.shaderID < 0)
+                    hits.pop_back();
+            }
+
+            // Sort the hits so that points with the same shader, and ray
+            // type (which is uniform within a batch), are contiguous.
+            order.resize(hits.size());
+            for (unsigned i = 0; i < order.size(); i++)
+                order[i] = i;
+            std::stable_sort(order.begin(), order.end(),
+                             [&](unsigned a, unsigned b) {
+                                 const Hit& ha = hits[a];
+                                 const Hit& hb = hits[b];
+                                 return ha.shaderID != hb.shaderID
+                                            ? ha.shaderID < hb.shaderID
+                                            : ha.sg.raytype < hb.sg.raytype;
+                             });
+
+            // Shade each run of matching hits in batches
+            live.clear();
+            for (size_t begin = 0, end; begin < order.size(); begin = end) {
+                const Hit& first = hits[order[begin]];
+                end              = begin + 1;
+                while (end < order.size() && end - begin < WidthT
+                       && hits[order[end]].shaderID == first.shaderID
+                       && hits[order[end]].sg.raytype == first.sg.raytype)
+                    end++;
+                const int n = int(end - begin);
+
+                memset((char*)&bsg.uniform, 0, sizeof(UniformShaderGlobals));
+                bsg.uniform.renderstate = &bsg;
+                bsg.uniform.raytype     = first.sg.raytype;
+                auto& vsg               = bsg.varying;
+                OSL::Block<int, WidthT> shadeindex;
+                for (int lane = 0; lane < n; lane++) {
+                    const ShaderGlobals& sg  = hits[order[begin + lane]].sg;
+                    shadeindex[lane]         = lane;
+                    vsg.P[lane]              = sg.P;
+                    vsg.dPdx[lane]           = sg.dPdx;
+                    vsg.dPdy[lane]           = sg.dPdy;
+                    vsg.dPdz[lane]           = sg.dPdz;
+                    vsg.I[lane]              = sg.I;
+                    vsg.dIdx[lane]           = sg.dIdx;
+                    vsg.dIdy[lane]           = sg.dIdy;
+                    vsg.N[lane]              = sg.N;
+                    vsg.Ng[lane]             = sg.Ng;
+                    vsg.u[lane]              = sg.u;
+                    vsg.dudx[lane]           = sg.dudx;
+                    vsg.dudy[lane]           = sg.dudy;
+                    vsg.v[lane]              = sg.v;
+                    vsg.dvdx[lane]           = sg.dvdx;
+                    vsg.dvdy[lane]           = sg.dvdy;
+                    vsg.dPdu[lane]           = sg.dPdu;
+                    vsg.dPdv[lane]           = sg.dPdv;
+                    vsg.time[lane]           = sg.time;
+                    vsg.dtime[lane]          = sg.dtime;
+                    vsg.dPdtime[lane]        = sg.dPdtime;
+                    vsg.Ps[lane]             = sg.Ps;
+                    vsg.dPsdx[lane]          = sg.dPsdx;
+                    vsg.dPsdy[lane]          = sg.dPsdy;
+                    vsg.object2common[lane]  = sg.object2common;
+                    vsg.shader2common[lane]  = sg.shader2common;
+                    vsg.Ci[lane]             = nullptr;
+                    vsg.surfacearea[lane]    = sg.surfacearea;
+                    vsg.flipHandedness[lane] = sg.flipHandedness;
+                    vsg.backfacing[lane]     = sg.backfacing;
+                }
+                shadingsys->batched<WidthT>().execute(
+                    *batch_ctx, *m_shaders[first.shaderID].surf, n, shadeindex,
+                    bsg, nullptr, nullptr);
+                nshaded += n;
+                nbatches += 1;
+
+                // Hand each lane's closures back to its path
+                for (int lane = 0; lane < n; lane++) {
+                    Hit& h          = hits[order[begin + lane]];
+                    PathState& path = paths[h.path];
+                    h.sg.Ci         = vsg.Ci[lane];
+                    if (path_shaded(path, h.hit, h.sg, h.shaderID,
+                                    samplers[h.path], ctx)
+                        && ++path.bounce <= max_bounces)
+                        live.push_back(h.path);
+                }
+            }
+        }
+
+        // Average the samples of each pixel in order, as antialias_pixel
+        OIIO::ImageBuf::Iterator<float> p(pixelbuf, roi);
+        for (size_t i = 0; !p.done(); ++p, i += nsamples) {
+            Color3 c(0, 0, 0);
+            for (int si = 0; si < nsamples; si++)
+                c = OIIO::lerp(c, paths[i + si].radiance, 1.0f / (si + 1));
+            p[0] = c.x;
+            p[1] = c.y;
+            p[2] = c.z;
+        }
+
+        shadingsys->release_context(batch_ctx);
+        shadingsys->release_context(ctx);
+        shadingsys->destroy_thread_info(thread_info);
+    });
+    double rendertime = timer();
+    errhandler().infofmt(
+        "Rendered {}x{} image with {} samples in {} (wavefront, {:.1f} points per batch of {})",
+        xres, yres, aa * aa, OIIO::Strutil::timeintervalformat(rendertime, 2),
+        nbatches ? double(nshaded) / nbatches : 0.0, WidthT);
+}
+#    endif
+
+
+
 void
 SimpleRaytracer::clear()
 {
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <unordered_map>
@@ -12,6 +13,11 @@
 
 #include <OSL/oslexec.h>
 #include <OSL/rendererservices.h>
+
+#if OSL_USE_BATCHED
+#    include "batched_simpleraytracer.h"
+#endif
+
 #include "background.h"
 #include "raytracer.h"
 #include "sampling.h"
@@ -19,6 +25,8 @@
 
 OSL_NAMESPACE_BEGIN
 
+struct ShadingResult;
+
 struct Material {
     ShaderGroupRef surf;
     ShaderGroupRef disp;
@@ -27,6 +35,8 @@ struct Material {
 using MaterialVec = std::vector<Material>;
 
 class SimpleRaytracer : public RendererServices {
+    template<int> friend class BatchedSimpleRaytracer;
+
 public:
     // Just use 4x4 matrix for transformations
     typedef Matrix44 Transformation;
@@ -53,6 +63,21 @@ public:
     bool get_userdata(bool derivatives, ustringhash name, TypeDesc type,
                       ShaderGlobals* sg, void* val) override;
 
+#if OSL_USE_BATCHED
+    BatchedRendererServices<16>* batched(WidthOf<16>) override
+    {
+        return &m_batch_16_simple_raytracer;
+    }
+    BatchedRendererServices<8>* batched(WidthOf<8>) override
+    {
+        return &m_batch_8_simple_raytracer;
+    }
+    BatchedRendererServices<4>* batched(WidthOf<4>) override
+    {
+        return &m_batch_4_simple_raytracer;
+    }
+#endif
+
     void name_transform(const char* name, const Transformation& xform);
 
     // Set and get renderer attributes/options
@@ -109,11 +134,23 @@ public:
     ShadingSystem* shadingsys = nullptr;
     OIIO::ParamValueList options;
     OIIO::ImageBuf pixelbuf;
+    // Progressive renders only: the number of samples taken in each pixel
+    // and the estimated standard error of its value.
+    OIIO::ImageBuf aovbuf;
+    // Called (if set) between progressive passes, at most once every
+    // "checkpoint_interval" seconds, to save the image so far.
+    std::function<void()> checkpoint;
 
     int getBackgroundShaderID() const { return backgroundShaderID; }
     int getBackgroundResolution() const { return backgroundResolution; }
 
 private:
+#if OSL_USE_BATCHED
+    BatchedSimpleRaytracer<16> m_batch_16_simple_raytracer;
+    BatchedSimpleRaytracer<8> m_batch_8_simple_raytracer;
+    BatchedSimpleRaytracer<4> m_batch_4_simple_raytracer;
+#endif
+
     // Camera parameters
     Matrix44 m_world_to_camera;
     ustringhash m_projection;
@@ -129,6 +166,11 @@ private:
     int rr_depth             = 5;
     float show_albedo_scale  = 0.0f;
     int show_globals         = 0;
+    int batch_size           = 0;      // shade in batches of this width if > 0
+    bool sort_shading        = false;  // shade hits grouped by shader
+    bool progressive         = false;
+    float adaptive_threshold = 0.0f;  // relative error to stop sampling at
+    float checkpoint_every   = 0.0f;  // seconds between checkpoints
     MaterialVec m_shaders;
     std::vector<bool> m_shader_is_light;
     std::vector<float>
@@ -194,9 +236,38 @@ private:
                           const Dual2<float>& t, int id, float u, float v);
     Vec3 eval_background(const Dual2<Vec3>& dir, ShadingContext* ctx,
                          int bounce = -1);
+    // The stages of one bounce of a path, shared by subpixel_radiance and
+    // the wavefront renderers: path_hit returns the shader to run, or -1 if
+    // the path is done, and path_shaded returns false once it is.
+    // path_scatter is path_shaded for closures already processed.
+    void path_miss(PathState& path, ShadingContext* ctx);
+    int path_hit(PathState& path, const Intersection& hit, ShaderGlobals& sg);
+    bool path_shaded(PathState& path, const Intersection& hit,
+                     const ShaderGlobals& sg, int shaderID, Sampler& sampler,
+                     ShadingContext* ctx);
+    bool path_scatter(PathState& path, const Intersection& hit,
+                      const ShaderGlobals& sg, ShadingResult& result,
+                      int shaderID, Sampler& sampler, ShadingContext* ctx);
     Color3 subpixel_radiance(float x, float y, Sampler& sampler,
                              ShadingContext* ctx);
+    // Jittered position of a sample in pixel x,y
+    Vec2 pixel_jitter(int x, int y, Sampler& sampler) const;
+    Color3 pixel_sample(int x, int y, int si, ShadingContext* ctx);
     Color3 antialias_pixel(int x, int y, ShadingContext* ctx);
+    // Render in passes over tiles, each adding samples to the pixels that
+    // haven't converged yet, calling checkpoint between passes.
+    void render_progressive(int xres, int yres);
+    // Render one tile at a time as a wavefront, like render_wavefront, but
+    // running the scalar shaders: the hits of each bounce are sorted so
+    // that points with the same shader group and ray type are shaded back
+    // to back, before any of their paths continue.
+    void render_sorted(int xres, int yres);
+#if OSL_USE_BATCHED
+    // Render one tile at a time as a wavefront: all of its paths are traced
+    // together, and the hits sorted by shader so they can be shaded in
+    // batches of WidthT.
+    template<int WidthT> void render_wavefront(int xres, int yres);
+#endif
 
     friend class ErrorHandler;
 };
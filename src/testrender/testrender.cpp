@@ -54,8 +54,15 @@ static bool no_jitter          = false;
 static float show_albedo_scale = 0.0f;
 static int show_globals        = 0;
 static int num_threads         = 0;
+static bool batched            = false;
+static int batch_size          = -1;
+static bool sort_shading       = false;
+static bool progressive        = false;
+static float adaptive          = 0.0f;
+static float checkpoint        = 0.0f;
 static int iters               = 1;
-static std::string scenefile, imagefile;
+static std::string scenefile, imagefile, aovfile;
+static std::vector<std::string> printstats;
 static std::string shaderpath;
 static bool shadingsys_options_set = false;
 static bool use_optix              = OIIO::Strutil::stoi(
@@ -121,6 +128,41 @@ set_shadingsys_options()
     shadingsys->attribute("llvm_debugging_symbols", 1);
     shadingsys->attribute("llvm_profiling_events", 1);
 
+    // Let the testsuite's batched variants of the render tests run as
+    // wavefronts, just as it does for testshade.
+    if (const char* opt_env = getenv("TESTSHADE_BATCHED"))
+        batched = atoi(opt_env);
+    if (batched && !use_optix) {
+#if OSL_USE_BATCHED
+        // Use the widest batch the hardware supports, unless asked for one
+        bool batch_size_requested = (batch_size != -1);
+        if ((!batch_size_requested || batch_size == 16)
+            && shadingsys->configure_batch_execution_at(16)) {
+            batch_size = 16;
+        } else if ((!batch_size_requested || batch_size == 8)
+                   && shadingsys->configure_batch_execution_at(8)) {
+            batch_size = 8;
+        } else if ((!batch_size_requested || batch_size == 4)
+                   && shadingsys->configure_batch_execution_at(4)) {
+            batch_size = 4;
+        } else {
+            std::cerr << "testrender: batched execution is not supported"
+                      << " here, using the single point interface\n";
+            batched = false;
+        }
+#else
+        batched = false;
+#endif
+    } else {
+        batched = false;
+    }
+    if (!batched) {
+        // The analysis only pays off for batched execution, and keeps
+        // uniform and varying temps from coalescing.
+        shadingsys->attribute("opt_batched_analysis", 0);
+        batch_size = 0;
+    }
+
     // We rely on the default set of "raytypes" tags. To use a custom set,
     // this is where we would do:
     //      shadingsys->attribute("raytypes", TypeDesc(TypeDesc::STRING, num_raytypes),
@@ -164,6 +206,8 @@ getargs(int argc, const char* argv[])
       .hidden(); // DEPRECATED 1.7
     ap.arg("--profile", &profile)
       .help("Print profile information");
+    ap.arg("--printstat %L:NAME", &printstats)
+      .help("Print an integer stat (e.g. groups_deduped) after rendering, once background compiles are done");
     ap.arg("--saveptx", &saveptx)
       .help("Save the generated PTX (OptiX mode only)");
     ap.arg("--warmup", &warmup)
@@ -193,6 +237,20 @@ getargs(int argc, const char* argv[])
     ap.arg("-uvs")
       .help("Visualize the texture coordinates instead of path tracing")
       .action([&](cspan<const char*> argv) { show_globals = 5; });
+    ap.arg("--batched", &batched)
+      .help("Render as a wavefront, shading in batches with the batched ShadingSystem interface");
+    ap.arg("--batch_size %d:WIDTH", &batch_size)
+      .help("Batch width for --batched: 16, 8 or 4 (default: widest supported)");
+    ap.arg("--sort_shading", &sort_shading)
+      .help("Render as a wavefront, running each shader on all the points that need it back to back");
+    ap.arg("--progressive", &progressive)
+      .help("Render in passes over tiles, refining the whole image at once");
+    ap.arg("--adaptive %f:THRESHOLD", &adaptive)
+      .help("Stop sampling pixels whose relative error is below THRESHOLD (implies --progressive). Pixels take -aa samples per pass and may only stop once they have 4, so this needs -aa 3 or more");
+    ap.arg("--checkpoint %f:SECONDS", &checkpoint)
+      .help("Write the image so far every SECONDS between passes (implies --progressive)");
+    ap.arg("--aov %s:FILENAME", &aovfile)
+      .help("Also write the sample count and error of each pixel (progressive only)");
     ap.arg("--iters %d:N", &iters)
       .help("Number of iterations");
     ap.arg("-O0", &O0)
@@ -240,6 +298,34 @@ getargs(int argc, const char* argv[])
     }
 }
 
+// Write the image (and AOVs, if asked for) rendered so far
+static void
+write_images(SimpleRaytracer* rend)
+{
+    using namespace OIIO;
+    ImageBuf converted;
+    ImageBuf* out = &rend->pixelbuf;
+    if (Strutil::iends_with(imagefile, ".jpg")
+        || Strutil::iends_with(imagefile, ".jpeg")
+        || Strutil::iends_with(imagefile, ".gif")
+        || Strutil::iends_with(imagefile, ".png")) {
+        // JPEG, GIF, and PNG images should be automatically saved as sRGB
+        // because they are almost certainly supposed to be displayed on web
+        // pages. Convert a copy, as the render may not be done with it.
+        ImageBufAlgo::colorconvert(converted, rend->pixelbuf, "linear",
+                                   "sRGB", false, "", "");
+        out = &converted;
+    }
+    out->set_write_format(TypeDesc::HALF);
+    if (!out->write(imagefile))
+        rend->errhandler().errorfmt("Unable to write output image: {}",
+                                    out->geterror());
+    if (aovfile.size() && rend->aovbuf.initialized()
+        && !rend->aovbuf.write(aovfile))
+        rend->errhandler().errorfmt("Unable to write AOV image: {}",
+                                    rend->aovbuf.geterror());
+}
+
 }  // anonymous namespace
 
 
@@ -293,6 +379,14 @@ main(int argc, const char* argv[])
     rend->attribute("no_jitter", (int)no_jitter);
     rend->attribute("show_albedo_scale", show_albedo_scale);
     rend->attribute("show_globals", show_globals);
+    rend->attribute("sort_shading", (int)sort_shading);
+    rend->attribute("progressive", (int)progressive);
+    rend->attribute("adaptive_threshold", adaptive);
+    rend->attribute("checkpoint_interval", checkpoint);
+    rend->checkpoint = [rend]() {
+        write_images(rend);
+        rend->errhandler().infofmt("Wrote checkpoint {}", imagefile);
+    };
     OIIO::attribute("threads", num_threads);
 
 #if OSL_USE_OPTIX
@@ -315,6 +409,7 @@ main(int argc, const char* argv[])
 
     // Setup common attributes
     set_shadingsys_options();
+    rend->attribute("batch_size", batch_size);
 
 #if OSL_USE_OPTIX
     if (use_optix)
@@ -324,6 +419,7 @@ main(int argc, const char* argv[])
     // Loads a scene, creating camera, geometry and assigning shaders
     rend->camera.resolution(xres, yres);
     rend->parse_scene_xml(scenefile);
+    shadingsys->start_async_compiles();
 
     rend->prepare_render();
 
@@ -343,22 +439,23 @@ main(int argc, const char* argv[])
     rend->finalize_pixel_buffer();
 
     // Write image to disk
-    if (Strutil::iends_with(imagefile, ".jpg")
-        || Strutil::iends_with(imagefile, ".jpeg")
-        || Strutil::iends_with(imagefile, ".gif")
-        || Strutil::iends_with(imagefile, ".png")) {
-        // JPEG, GIF, and PNG images should be automatically saved as sRGB
-        // because they are almost certainly supposed to be displayed on web
-        // pages.
-        ImageBufAlgo::colorconvert(rend->pixelbuf, rend->pixelbuf, "linear",
-                                   "sRGB", false, "", "");
-    }
-    rend->pixelbuf.set_write_format(TypeDesc::HALF);
-    if (!rend->pixelbuf.write(imagefile))
-        rend->errhandler().errorfmt("Unable to write output image: {}",
-                                    rend->pixelbuf.geterror());
+    write_images(rend);
     double writetime = timer.lap();
 
+    // Print the requested stats, which may count compiles that rendering
+    // started in the background.
+    if (printstats.size()) {
+        int pending = 0;
+        while (shadingsys->getattribute("stat:async_compiles_pending", pending)
+               && pending > 0)
+            OIIO::Sysutil::usleep(1000);
+        for (auto&& name : printstats) {
+            int val = 0;
+            shadingsys->getattribute("stat:" + name, val);
+            std::cout << name << " = " << val << "\n";
+        }
+    }
+
     // Print some debugging info
     if (debug1 || runstats || profile) {
         std::cout << "\n";
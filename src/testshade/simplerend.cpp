@@ -3,6 +3,7 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <OpenImageIO/filesystem.h>
 #include <OpenImageIO/imagebufalgo.h>
 
 #include <OSL/encodedtypes.h>
@@ -262,11 +263,76 @@ SimpleRenderer::supports(string_view feature) const
         return true;
     else if (m_use_rs_bitcode && feature == "build_interpolated_getter")
         return true;
+    else if (feature == "llvm_jit_cache")
+        return !options.get_string("jit_cache_dir").empty();
     return false;
 }
 
 
 
+std::string
+SimpleRenderer::cache_filename(string_view cachename, string_view key) const
+{
+    // Keys may be long and contain arbitrary group and layer names, so
+    // name the file by a hash of the key instead. The file starts with the
+    // key itself, so that a hash collision can't be mistaken for a hit.
+    return fmtformat("{}/{}-{:016x}.bin", options.get_string("jit_cache_dir"),
+                     cachename, OIIO::Strutil::strhash(key));
+}
+
+
+
+void
+SimpleRenderer::cache_insert(string_view cachename, string_view key,
+                             string_view value) const
+{
+    if (options.get_string("jit_cache_dir").empty())
+        return;
+    // Write to a unique temporary and rename it into place, so that other
+    // threads or processes never see a partially written entry.
+    std::string filename = cache_filename(cachename, key);
+    std::string tmpname  = fmtformat("{}.{}", filename,
+                                     OIIO::Filesystem::unique_path());
+    OIIO::ofstream out;
+    OIIO::Filesystem::open(out, tmpname, std::ios::out | std::ios::binary);
+    if (!out)
+        return;
+    uint64_t keysize = key.size();
+    out.write((const char*)&keysize, sizeof(keysize));
+    out.write(key.data(), key.size());
+    out.write(value.data(), value.size());
+    out.close();
+    std::string err;
+    if (!out || !OIIO::Filesystem::rename(tmpname, filename, err))
+        OIIO::Filesystem::remove(tmpname, err);
+}
+
+
+
+bool
+SimpleRenderer::cache_get(string_view cachename, string_view key,
+                          std::string& value) const
+{
+    if (options.get_string("jit_cache_dir").empty())
+        return false;
+    std::string filename = cache_filename(cachename, key);
+    uint64_t size        = OIIO::Filesystem::file_size(filename);
+    uint64_t keysize     = 0;
+    if (size < sizeof(keysize) + key.size())
+        return false;
+    std::string contents(size, '\0');
+    if (OIIO::Filesystem::read_bytes(filename, &contents[0], size) != size)
+        return false;
+    memcpy(&keysize, contents.data(), sizeof(keysize));
+    if (keysize != key.size()
+        || string_view(contents).substr(sizeof(keysize), keysize) != key)
+        return false;  // Some other key with the same hash
+    value = contents.substr(sizeof(keysize) + keysize);
+    return true;
+}
+
+
+
 OIIO::ParamValue*
 SimpleRenderer::find_attribute(string_view name, TypeDesc searchtype,
                                bool casesensitive)
@@ -95,6 +95,13 @@ public:
                  const EncodedType* argTypes, uint32_t argValuesSize,
                  uint8_t* argValues) override;
 
+    // Store and retrieve cached JIT object code as files in the directory
+    // named by the "jit_cache_dir" option.
+    void cache_insert(string_view cachename, string_view key,
+                      string_view value) const override;
+    bool cache_get(string_view cachename, string_view key,
+                   std::string& value) const override;
+
     // Set and get renderer attributes/options
     void attribute(string_view name, TypeDesc type, const void* value);
     void attribute(string_view name, int value)
@@ -251,6 +258,9 @@ protected:
     bool get_camera_screen_window(ShaderGlobals* sg, bool derivs,
                                   ustringhash object, TypeDesc type,
                                   ustringhash name, void* val);
+
+    // Filename under "jit_cache_dir" for the cache entry with the given key
+    std::string cache_filename(string_view cachename, string_view key) const;
 };
 
 OSL_NAMESPACE_END
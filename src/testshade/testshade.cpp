@@ -57,6 +57,7 @@ static std::vector<TypeDesc> outputvartypes;
 static std::string dataformatname = "";
 static std::vector<std::string> entrylayers;
 static std::vector<std::string> entryoutputs;
+static std::vector<std::string> printstats;
 static std::vector<int> entrylayer_index;
 static std::vector<const ShaderSymbol*> entrylayer_symbols;
 static bool debug1        = false;
@@ -108,10 +109,12 @@ static ParamValueList reparams;
 static std::string reparam_layer;
 static ErrorHandler errhandler;
 static int iters                = 1;
+static int reparam_iters        = -1;
 static std::string raytype_name = "camera";
 static int raytype_bit          = 0;
 static bool raytype_opt         = false;
 static std::string extraoptions;
+static std::string preload_manifest;
 static std::string texoptions;
 static std::string colorspace;
 static OSL::Matrix44 Mshad;  // "shader" space to "common" space matrix
@@ -130,6 +133,8 @@ static char* output_base_ptr   = nullptr;
 static bool use_rs_bitcode
     = false;  // use free function bitcode version of renderer services
 static int jbufferMB = 16;
+static int jstream_pages = 0;
+static std::string jitcachedir;
 
 // Testshade thread tracking and assignment.
 // Not recommended for production renderer but fine for testshade
@@ -747,6 +752,8 @@ getargs(int argc, const char* argv[])
       .hidden();
     ap.arg("--options %s:LIST", &extraoptions)
       .help("Set extra OSL options");
+    ap.arg("--preload %s:MANIFEST", &preload_manifest)
+      .help("Load the shaders listed in a manifest file up front, in parallel");
     ap.arg("--texoptions %s:LIST", &texoptions)
       .help("Set extra TextureSystem options");
     ap.arg("--colorspace %s:NAME", &colorspace)
@@ -787,6 +794,9 @@ getargs(int argc, const char* argv[])
       .help("Specify ray type mask for optimization");
     ap.arg("--iters %d:ITERS", &iters)
       .help("Number of iterations");
+    ap.arg("--reparam_iters %d:N", &reparam_iters)
+      .help("Only apply --reparam after the first N iterations "
+            "(default: after every iteration)");
     ap.arg("-O0", &O0)
       .help("Do no runtime shader optimization");
     ap.arg("-O1", &O1)
@@ -815,6 +825,8 @@ getargs(int argc, const char* argv[])
       .help("Add layer to the list of entry points");
     ap.arg("--entryoutput %L:NAME", &entryoutputs)
       .help("Add output symbol to the list of entry points");
+    ap.arg("--printstat %L:NAME", &printstats)
+      .help("Print an integer stat (e.g. groups_tiered_up) after shading, once background compiles are done");
     ap.arg("--center", &pixelcenters)
       .help("Shade at output pixel 'centers' rather than corners");
     ap.arg("--debugnan", &debugnan)
@@ -859,6 +871,10 @@ getargs(int argc, const char* argv[])
       .help("Use free function bitcode Renderer services");
     ap.arg("--jbufferMB %d:JBUFFER",  &jbufferMB)
       .help("journal jbuffer size in MB");
+    ap.arg("--jstream %d:PAGES", &jstream_pages)
+      .help("Report journal output while shading, with a ring of PAGES pages per thread (instead of --jbufferMB)");
+    ap.arg("--jitcache %s:DIR", &jitcachedir)
+      .help("Cache JITed shader object code in DIR, reusing it across runs");
 
     // clang-format on
     ap.parse_args(argc, argv);
@@ -1957,6 +1973,18 @@ test_shade(int argc, const char* argv[])
     // Hand the userdata options from the command line over to the renderer
     rend->userdata.merge(userdata);
 
+    // The renderer must advertise the JIT cache before the ShadingSystem
+    // is created, since that is when it asks.
+    if (jitcachedir.size()) {
+        std::string err;
+        if (!OIIO::Filesystem::is_directory(jitcachedir)
+            && !OIIO::Filesystem::create_directory(jitcachedir, err))
+            std::cerr << "Could not create JIT cache directory \""
+                      << jitcachedir << "\": " << err << "\n";
+        else
+            rend->attribute("jit_cache_dir", jitcachedir);
+    }
+
     // Request a TextureSystem (by default it will be the global shared
     // one). This isn't strictly necessary, if you pass nullptr to
     // ShadingSystem ctr, it will ask for the shared one internally.
@@ -2010,6 +2038,11 @@ test_shade(int argc, const char* argv[])
     // line arguments, whereas the connections accumulate and have
     // to be processed at the end.  Bear with us.
 
+    // Load any shaders listed in a manifest all at once, before the group
+    // declaration asks for them one at a time.
+    if (preload_manifest.size())
+        shadingsys->preload_shader_manifest(preload_manifest);
+
     // Start the shader group and grab a reference to it.
     shadergroup = shadingsys->ShaderGroupBegin(groupname);
 
@@ -2121,6 +2154,10 @@ test_shade(int argc, const char* argv[])
     // Set up the image outputs requested on the command line
     setup_output_images(rend, shadingsys, shadergroup);
 
+    // The group's attributes are all set, so with async_jit it can start
+    // compiling in the background.
+    shadingsys->start_async_compiles();
+
     if (debug1)
         test_group_attributes(shadergroup.get());
 
@@ -2154,12 +2191,25 @@ test_shade(int argc, const char* argv[])
     }
 
     //Initialize a Journal Buffer for all threads to use for journaling fmt specification calls.
-    const size_t jbuffer_bytes = jbufferMB * 1024 * 1024;
-    std::unique_ptr<uint8_t[]> jbuffer(new uint8_t[jbuffer_bytes]);
     constexpr int jbuffer_pagesize = 1024;
+    size_t jbuffer_bytes           = jbufferMB * 1024 * 1024;
+    if (jstream_pages > 0) {
+        // Streaming only needs room for the rings of pages (at least 2 per
+        // thread), plus the bookkeeping.
+        jstream_pages = std::max(jstream_pages, 2);
+        jbuffer_bytes = 4096
+                        + size_t(jstream_pages * jbuffer_pagesize + 64)
+                              * num_threads;
+    }
+    std::unique_ptr<uint8_t[]> jbuffer(new uint8_t[jbuffer_bytes]);
     bool init_buffer_success
-        = OSL::journal::initialize_buffer(jbuffer.get(), jbuffer_bytes,
-                                          jbuffer_pagesize, num_threads);
+        = jstream_pages > 0
+              ? OSL::journal::initialize_streaming_buffer(jbuffer.get(),
+                                                          jbuffer_bytes,
+                                                          jbuffer_pagesize,
+                                                          num_threads)
+              : OSL::journal::initialize_buffer(jbuffer.get(), jbuffer_bytes,
+                                                jbuffer_pagesize, num_threads);
 
     if (!init_buffer_success) {
         std::cout << "Buffer allocation failed" << std::endl;
@@ -2169,6 +2219,25 @@ test_shade(int argc, const char* argv[])
     //Send the populated Journal Buffer to the renderer
     theRenderState.journal_buffer = jbuffer.get();
 
+    //Just to match existing behavior we extract the current error_repeats attribute but intent is for renderers to make
+    //their own decision about this.
+    int error_repeats;
+    shadingsys->getattribute("error_repeats", error_repeats);
+    bool limit_errors                  = !error_repeats;
+    bool limit_warnings                = !error_repeats;
+    const int error_history_capacity   = 25;
+    const int warning_history_capacity = 25;
+
+    journal::TrackRecentlyReported tracker_error_warnings(
+        limit_errors, error_history_capacity, limit_warnings,
+        warning_history_capacity);
+    TestshadeReporter reporter(&errhandler, tracker_error_warnings);
+
+    // When streaming, report journal output as it's made
+    std::unique_ptr<OSL::journal::Drainer> jdrainer;
+    if (jstream_pages > 0 && init_buffer_success)
+        jdrainer.reset(new OSL::journal::Drainer(jbuffer.get(), reporter));
+
 
     // Allow a settable number of iterations to "render" the whole image,
     // which is useful for time trials of things that would be too quick
@@ -2179,7 +2248,8 @@ test_shade(int argc, const char* argv[])
         if (use_optix) {
             rend->render(xres, yres);
         } else if (use_shade_image) {
-            // TODO: do we need a batched option/version of shade_image?
+            // N.B. shade_image will execute in batches on its own if
+            // batched was requested (which enables opt_batched_analysis).
             OSL::shade_image(*shadingsys, *shadergroup, NULL,
                              *rend->outputbuf(0), outputvarnames,
                              pixelcenters ? ShadePixelCenters : ShadePixelGrid,
@@ -2222,8 +2292,22 @@ test_shade(int argc, const char* argv[])
 #endif
         }
 
+        // Between iterations, like an IPR renderer between frames, let any
+        // automatically promoted interactive params settle. Wait for their
+        // background compiles first, so that the results don't depend on
+        // how long those take.
+        if (iter + 1 < iters) {
+            int pending = 0;
+            while (shadingsys->getattribute("stat:async_compiles_pending",
+                                            pending)
+                   && pending > 0)
+                OIIO::Sysutil::usleep(1000);
+            shadingsys->settle_interactive_params();
+        }
+
         // If any reparam was requested, do it now
-        if (reparams.size() && reparam_layer.size() && (iter + 1 < iters)) {
+        if (reparams.size() && reparam_layer.size() && (iter + 1 < iters)
+            && (reparam_iters < 0 || iter < reparam_iters)) {
             for (size_t p = 0; p < reparams.size(); ++p) {
                 const ParamValue& pv(reparams[p]);
                 shadingsys->ReParameter(*shadergroup, reparam_layer.c_str(),
@@ -2233,21 +2317,12 @@ test_shade(int argc, const char* argv[])
         }
     }
 
-    //Just to match existing behavior we extract the current error_repeats attribute but intent is for renderers to make
-    //their own decision about this.
-    int error_repeats;
-    shadingsys->getattribute("error_repeats", error_repeats);
-    bool limit_errors                  = !error_repeats;
-    bool limit_warnings                = !error_repeats;
-    const int error_history_capacity   = 25;
-    const int warning_history_capacity = 25;
-
-    journal::TrackRecentlyReported tracker_error_warnings(
-        limit_errors, error_history_capacity, limit_warnings,
-        warning_history_capacity);
-    TestshadeReporter reporter(&errhandler, tracker_error_warnings);
-    OSL::journal::Reader jreader(jbuffer.get(), reporter);
-    jreader.process();
+    if (jdrainer) {
+        jdrainer->finish();
+    } else {
+        OSL::journal::Reader jreader(jbuffer.get(), reporter);
+        jreader.process();
+    }
     // Need to call journal::initialize_buffer before re-using the jbuffer
 
     double runtime = timer.lap();
@@ -2289,6 +2364,20 @@ test_shade(int argc, const char* argv[])
         }
     }
 
+    // Print the requested stats, which may count compiles that shading
+    // started in the background.
+    if (printstats.size()) {
+        int pending = 0;
+        while (shadingsys->getattribute("stat:async_compiles_pending", pending)
+               && pending > 0)
+            OIIO::Sysutil::usleep(1000);
+        for (auto&& name : printstats) {
+            int val = 0;
+            shadingsys->getattribute("stat:" + name, val);
+            std::cout << name << " = " << val << "\n";
+        }
+    }
+
     // Print some debugging info
     if (debug1 || runstats || profile) {
         double writetime = timer.lap();
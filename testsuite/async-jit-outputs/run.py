@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# testshade names the group's outputs after ShaderGroupEnd, and only then
+# starts its background compile, so f_out must not be optimized away, and
+# the group must be compiled just once.
+command += testshade("--options async_jit=2 -t 1 -g 2 2 --no-output-placement --groupoutputs --layer alayer a -o f_out f_out.tif --print --printstat groups_compiled")
+command += testshade("--options async_jit=2 -t 1 -g 2 2 --layer alayer a -o f_out f_out.tif --print --printstat groups_compiled")
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compile the group on background threads once it's set up. The
+# results must not differ from compiling it on first use.
+command += testshade("--options async_jit=2 -g 2 2 -layer alayer a --layer blayer b --connect alayer f_out blayer f_in")
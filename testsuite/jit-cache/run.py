@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The first run JITs the group and stores its object code in the cache
+# directory, the second loads it from there. Both must give the same results.
+command += testshade("--jitcache jitcache -g 2 2 -param scale 2 test")
+command += testshade("--jitcache jitcache -g 2 2 -param scale 2 test "
+                     "--printstat jit_cache_hits")
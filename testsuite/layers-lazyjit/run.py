@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Layers A and D are only run on demand, so with llvm_lazy_layers they are
+# JITed when first called, A from C's code and D from A's.
+command += testshade("-g 2 2 --options llvm_lazy_layers=1 "
+                     "-layer dlayer d -layer alayer a -layer clayer c "
+                     "--connect dlayer out alayer scale "
+                     "--connect alayer f_out clayer f_in")
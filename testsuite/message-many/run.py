@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Many messages per shade, and several shades in a row, to exercise the
+# growth and per-shade reset of the message table.
+command += testshade ("-g 2 2 -layer alayer a --layer blayer b --connect alayer f_out blayer f_in")
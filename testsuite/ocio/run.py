@@ -5,7 +5,12 @@
 # https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
-# This test requires an OCIO config. We have one in testsuite/common.
-os.environ['OCIO'] = '../common/OpenColorIO/nuke-default/config.ocio'
+# This test requires an OCIO config. Ours borrows the LUTs of the one in
+# testsuite/common.
+os.environ['OCIO'] = 'config.ocio'
 
-command = testshade("test")
+# The shader's "graded" color must match what OIIO makes of the same color.
+command = testshade("-o Cgraded graded.exr test")
+command += oiiotool("--pattern constant:color=0.5,0.5,0.25 1x1 3 "
+                    "--colorconvert linear graded -d float -o oiio-graded.exr")
+command += oiiodiff("graded.exr", "oiio-graded.exr")
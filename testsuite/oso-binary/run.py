@@ -0,0 +1,15 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The first run parses test.oso and writes the precompiled test.osb beside
+# it. The second run finds only test.osb on the searchpath, so it must load
+# the shader from that.
+command += testshade("-g 2 2 --options oso_binary=2 "
+                     "-param scale 3 test")
+command += run_app("mkdir binonly", silent=True)
+command += run_app("mv test.osb binonly", silent=True)
+command += testshade("-g 2 2 --options oso_binary=1,searchpath:shader=binonly "
+                     "-param scale 3 test")
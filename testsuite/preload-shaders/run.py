@@ -0,0 +1,13 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Load both shaders from the manifest (which names one twice) before the
+# group is declared. The group must run just as if they were loaded by
+# the Shader() calls, which must find them already loaded.
+command += testshade("-g 2 2 --preload data/shaders.txt "
+                     "-param scale 10 -layer alayer a -layer blayer b "
+                     "--connect alayer f_out blayer f_in "
+                     "--printstat masters --printstat masters_preloaded")
@@ -0,0 +1,16 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Print the parts of the layer profile that don't depend on timing
+import json
+
+with open("profile.json") as f:
+    profile = json.load(f)
+for group in profile["groups"]:
+    for layer in group["layers"]:
+        timed = [l for l in group["lines"] if l["layer"] == layer["name"]]
+        print("layer {}: {} calls, source lines timed: {}".format(
+              layer["name"], layer["calls"], len(timed) > 0))
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+command = testshade("-g 2 2 -group test.oslgroup "
+                    "--options profile_layers=2,profile_layers_file=profile.json")
+command += pythonbin + " check.py >> out.txt"
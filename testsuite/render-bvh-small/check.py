@@ -0,0 +1,21 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Print whether each of a few pixels, well inside or outside of the
+# emitters, saw one, given the oiiotool --dumpdata output of an image.
+import sys
+
+pixels = {}
+with open(sys.argv[1]) as f:
+    for line in f:
+        line = line.strip()
+        if line.startswith("Pixel ("):
+            xy, values = line[len("Pixel ("):].split("):")
+            x, y = [int(c) for c in xy.split(",")]
+            pixels[(x, y)] = float(values.split()[0])
+for (x, y) in [(3, 12), (12, 3), (12, 12), (3, 3)]:
+    print("{} pixel {} {}: {}".format(sys.argv[1], x, y,
+          "lit" if pixels[(x, y)] > 0.5 else "dark"))
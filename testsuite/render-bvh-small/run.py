@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Scenes this small leave most of the BVH's four child slots unused, which
+# rays must never enter. Check which emitters each scene's pixels see.
+outputs = [ "pixels.txt" ]
+command = oslc("../render-cornell/emitter.osl")
+for scene in [ "one", "three" ] :
+    command += testrender("-r 16 16 -aa 1 " + scene + ".xml " + scene + ".exr")
+    command += oiio_app("oiiotool") + scene + ".exr --dumpdata > " + scene + ".txt ;\n"
+    command += pythonbin + " check.py " + scene + ".txt >> pixels.txt ;\n"
@@ -0,0 +1,16 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The back, bottom and top walls each have their own copy of the same
+# group, and the two later copies must share the first one's compiled
+# code. The image must be exactly like render-cornell's.
+failthresh = 0.01
+failpercent = 1
+outputs = [ "out.exr", "out.txt" ]
+command = oslc("../render-cornell/matte.osl")
+command += oslc("../render-cornell/metal.osl")
+command += oslc("../render-cornell/emitter.osl")
+command += testrender("-r 256 256 -aa 4 --llvm_opt 12 --options dedup_groups=1 --printstat groups_deduped cornell-dedup.xml out.exr")
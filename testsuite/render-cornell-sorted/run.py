@@ -0,0 +1,15 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Shading the hits sorted by shader only changes the order of the work, so
+# this must render exactly like render-cornell, whose reference image this is.
+failthresh = 0.01
+failpercent = 1
+outputs = [ "out.exr" ]
+command = oslc("../render-cornell/matte.osl")
+command += oslc("../render-cornell/metal.osl")
+command += oslc("../render-cornell/emitter.osl")
+command += testrender("-r 256 256 -aa 4 --llvm_opt 12 --sort_shading ../render-cornell/cornell.xml out.exr")
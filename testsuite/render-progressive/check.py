@@ -0,0 +1,23 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Summarize the per pixel sample counts of an adaptive render, as dumped by
+# oiiotool --dumpdata, in a way that doesn't depend on exactly which pixels
+# converged: given the most samples a pixel may take, check that some took
+# fewer and that none took more.
+import sys
+
+max_samples = int(sys.argv[1])
+counts = []
+with open("samples.txt") as f:
+    for line in f:
+        line = line.strip()
+        if line.startswith("Pixel"):
+            counts.append(int(round(float(line.split(":")[1]))))
+print("pixels: {}".format(len(counts)))
+print("some pixels stopped early: {}".format(min(counts) < max_samples))
+print("no pixel exceeded {} samples: {}".format(
+      max_samples, max(counts) <= max_samples))
@@ -0,0 +1,21 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Without --adaptive, every pixel still gets all of its samples, in the
+# same order, so the progressive render (checkpoints and all) must match
+# render-cornell, whose reference image this is.
+failthresh = 0.01
+failpercent = 1
+outputs = [ "out.exr", "adaptive.txt" ]
+command = oslc("../render-cornell/matte.osl")
+command += oslc("../render-cornell/metal.osl")
+command += oslc("../render-cornell/emitter.osl")
+command += testrender("-r 256 256 -aa 4 --llvm_opt 12 --progressive --checkpoint 0.001 --aov aov.exr ../render-cornell/cornell.xml out.exr")
+
+# With --adaptive, check the sample counts the AOV records for each pixel
+command += testrender("-r 256 256 -aa 4 --llvm_opt 12 --adaptive 0.05 --aov adaptive_aov.exr ../render-cornell/cornell.xml adaptive.exr")
+command += oiio_app("oiiotool") + "adaptive_aov.exr --ch samples --dumpdata > samples.txt ;\n"
+command += pythonbin + " check.py 16 > adaptive.txt ;\n"
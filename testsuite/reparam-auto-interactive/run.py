@@ -0,0 +1,18 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The params are made interactive on their second edit, and are folded
+# back in once they've been quiet, which with no quiet period is the next
+# time testshade settles them between iterations. Edits stop after the
+# second iteration, so both params are promoted and the group is demoted
+# once. Their values must come through all of that unchanged.
+command += testshade("--options auto_interactive=2,auto_interactive_quiet=0.0 "
+                     "--layer lay0 --param f 2 test "
+                     "--iters 5 --reparam_iters 2 "
+                     "--reparam lay0 f 10.0 --reparam lay0 msg bye "
+                     "--printstat params_promoted --printstat groups_demoted")
+
+outputs = [ "out.txt" ]
@@ -0,0 +1,26 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Neither param is declared interactive, so the first round of edits
+# rebuilds the group once for each, making them interactive, and the
+# second round just updates them.
+command += testshade("--options reparam_respecialize=1 "
+                     "--layer lay0 --param scale 3 src "
+                     "--layer lay1 --param f 2 test "
+                     "--connect lay0 val lay1 in "
+                     "--iters 3 --reparam lay1 f 10.0 --reparam lay1 msg bye "
+                     "--printstat groups_respecialized")
+
+# f is interactive from the start, so its edit goes to the compiled group's
+# arena. The rebuild for msg must keep that edit rather than the declared 2.
+command += testshade("--options reparam_respecialize=1 "
+                     "--layer lay0 --param scale 3 src "
+                     "--layer lay1 --param:interactive=1 f 2 test "
+                     "--connect lay0 val lay1 in "
+                     "--iters 3 --reparam lay1 f 10.0 --reparam lay1 msg bye "
+                     "--printstat groups_respecialized")
+
+outputs = [ "out.txt" ]
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Shade through OSL::shade_image. The width is not a multiple of any batch
+# size, so batched runs end each scanline with a partial batch.
+command = testshade("-t 1 -g 10 2 --shadeimage -o Cout out.tif test")
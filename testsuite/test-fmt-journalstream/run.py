@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Stream the journal through a ring much smaller than the total output:
+# nothing may be lost, and with one thread the order is preserved.
+command += testshade("-t 1 --jstream 2 -g 16 16 -od uint8 -o Cout test_jstream.tif test_jstream")
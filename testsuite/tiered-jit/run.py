@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# JIT with minimal optimization first and re-JIT after two executions. The
+# results must not depend on which version of the code shaded each point,
+# and the group must be tiered up exactly once.
+command += testshade("--options llvm_tiered_jit=2 -g 3 3 test --printstat groups_tiered_up")